@@ -0,0 +1,95 @@
+#pragma once
+#include <thread>
+#include "platform_define.hpp"
+
+#if TARGET_PLATFORM == PLATFORM_WINDOWS
+#include <windows.h>
+#elif TARGET_PLATFORM == PLATFORM_LINUX
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#endif
+
+namespace moon
+{
+    //pins a thread to one cpu. false when the cpu does not exist or the platform has no affinity api(macos)
+    inline bool bind_cpu(std::thread::native_handle_type handle, int cpu)
+    {
+        if (cpu < 0)
+        {
+            return false;
+        }
+#if TARGET_PLATFORM == PLATFORM_WINDOWS
+        if (cpu >= static_cast<int>(sizeof(DWORD_PTR) * 8))
+        {
+            return false;
+        }
+        return ::SetThreadAffinityMask(handle, DWORD_PTR{ 1 } << cpu) != 0;
+#elif TARGET_PLATFORM == PLATFORM_LINUX
+        if (cpu >= CPU_SETSIZE)
+        {
+            return false;
+        }
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        return ::pthread_setaffinity_np(handle, sizeof(set), &set) == 0;
+#else
+        (void)handle;
+        return false;
+#endif
+    }
+
+    inline bool bind_this_thread_cpu(int cpu)
+    {
+#if TARGET_PLATFORM == PLATFORM_WINDOWS
+        return bind_cpu(::GetCurrentThread(), cpu);
+#elif TARGET_PLATFORM == PLATFORM_LINUX
+        return bind_cpu(::pthread_self(), cpu);
+#else
+        return bind_cpu(std::thread::native_handle_type{}, cpu);
+#endif
+    }
+
+    //numa node of a cpu, -1 when unknown
+    inline int cpu_numa_node(int cpu)
+    {
+        if (cpu < 0)
+        {
+            return -1;
+        }
+#if TARGET_PLATFORM == PLATFORM_WINDOWS
+        UCHAR node = 0;
+        if (cpu > 0xFF || !::GetNumaProcessorNode(static_cast<UCHAR>(cpu), &node) || node == 0xFF)
+        {
+            return -1;
+        }
+        return node;
+#elif TARGET_PLATFORM == PLATFORM_LINUX
+        //the cpu directory links its node as "node<N>"
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+        DIR* dir = ::opendir(path);
+        if (nullptr == dir)
+        {
+            return -1;
+        }
+        int node = -1;
+        while (dirent* e = ::readdir(dir))
+        {
+            if (strncmp(e->d_name, "node", 4) == 0 && e->d_name[4] >= '0' && e->d_name[4] <= '9')
+            {
+                node = atoi(e->d_name + 4);
+                break;
+            }
+        }
+        ::closedir(dir);
+        return node;
+#else
+        return -1;
+#endif
+    }
+}
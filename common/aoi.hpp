@@ -1,7 +1,6 @@
 #pragma once
 #include <unordered_map>
-#include <forward_list>
-#include <unordered_set>
+#include <vector>
 #include <cassert>
 #include <functional>
 #include <iostream>
@@ -43,11 +42,38 @@ public:
         }
     };
 private:
+    //marker position is copied into the cell, so view checks scan one contiguous array
+    struct marker_slot
+    {
+        int x;
+        int y;
+        object_type* obj;
+    };
+
+    //per-cell flat arrays, removal swaps the last element into the hole
     struct tile
     {
-        std::forward_list<object_type*> markers;
-        std::unordered_set<object_type*> watchers;
+        std::vector<marker_slot> markers;
+        std::vector<object_type*> watchers;
     };
+
+    template<typename Container, typename Pred>
+    static bool swap_remove(Container& c, const Pred& pred)
+    {
+        for (size_t i = 0; i < c.size(); ++i)
+        {
+            if (pred(c[i]))
+            {
+                if (i + 1 != c.size())
+                {
+                    c[i] = c.back();
+                }
+                c.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
 public:
     aoi(int posx, int posy, int map_size, int tile_size)
         :rect_(posx, posy, map_size, map_size)
@@ -327,9 +353,9 @@ public:
                 {
                     for (auto& m : node.markers)
                     {
-                        if (m->inside(rc)&&m->check(std::forward<Args>(args)...))
+                        if (m.obj->inside(rc)&&m.obj->check(std::forward<Args>(args)...))
                         {
-                            out.push_back(m->handle);
+                            out.push_back(m.obj->handle);
                         }
                     }
                 }
@@ -337,9 +363,9 @@ public:
                 {
                     for (auto& m : node.markers)
                     {
-                        if (m->check(std::forward<Args>(args)...))
+                        if (m.obj->check(std::forward<Args>(args)...))
                         {
-                            out.push_back(m->handle);
+                            out.push_back(m.obj->handle);
                         }
                     }
                 }
@@ -393,7 +419,7 @@ public:
                     {
                         std::cout << iter->first << " unwatch (" << x << "," << y << ")" << std::endl;
                     }
-                    node.watchers.erase(&iter->second);
+                    remove_watcher(node, &iter->second);
                 });
             }
 
@@ -436,9 +462,9 @@ public:
                 tile& node = data_[y*count_ + x];
                 for (auto& m : node.markers)
                 {
-                    if (m->mode&filter)
+                    if (m.obj->mode&filter)
                     {
-                        hander(m->handle, m->x, m->y, x, y);
+                        hander(m.obj->handle, m.obj->x, m.obj->y, x, y);
                     }
                 }
 
@@ -466,7 +492,7 @@ private:
     void insert_marker(object_type* obj, int tile_x, int tile_y)
     {
         tile& node = data_[tile_y*count_ + tile_x];
-        node.markers.emplace_front(obj);
+        node.markers.push_back(marker_slot{ obj->x, obj->y, obj });
 
         for (const auto& w : node.watchers)
         {
@@ -485,7 +511,7 @@ private:
     void remove_marker(object_type* obj, int tile_x, int tile_y)
     {
         tile& node = data_[tile_y*count_ + tile_x];
-        node.markers.remove(obj);
+        swap_remove(node.markers, [obj](const marker_slot& m) { return m.obj == obj; });
 
         for (const auto& w : node.watchers)
         {
@@ -514,13 +540,25 @@ private:
 
         if (&old_node != &node)
         {
-            old_node.markers.remove(obj);
-            node.markers.emplace_front(obj);
+            swap_remove(old_node.markers, [obj](const marker_slot& m) { return m.obj == obj; });
+            node.markers.push_back(marker_slot{ obj->x, obj->y, obj });
             if (debug_)
             {
                 std::cout << obj->handle << " insert (" << new_tile_x << "," << new_tile_y << ")" << std::endl;
             }
         }
+        else
+        {
+            for (auto& m : node.markers)
+            {
+                if (m.obj == obj)
+                {
+                    m.x = obj->x;
+                    m.y = obj->y;
+                    break;
+                }
+            }
+        }
 
         if (enable_leave_event_)
         {
@@ -552,7 +590,7 @@ private:
 
     void marker_event(tile& node, object_type* obj, int eventid)
     {
-        assert(std::find(node.markers.begin(), node.markers.end(), obj) != node.markers.end());
+        assert(std::find_if(node.markers.begin(), node.markers.end(), [obj](const marker_slot& m) { return m.obj == obj; }) != node.markers.end());
         for (const auto& w : node.watchers)
         {
             //if (w->handle == obj->handle) continue;
@@ -569,14 +607,14 @@ private:
 
     void insert_watcher(tile& node, object_type* obj)
     {
-        [[maybe_unused]] bool ok = node.watchers.emplace(obj).second;
-        assert(ok);
+        assert(std::find(node.watchers.begin(), node.watchers.end(), obj) == node.watchers.end());
+        node.watchers.push_back(obj);
     }
 
     void remove_watcher(tile& node, object_type* obj)
     {
-        [[maybe_unused]] size_t count = node.watchers.erase(obj);
-        assert(1 == count);
+        [[maybe_unused]] bool ok = swap_remove(node.watchers, [obj](const object_type* w) { return w == obj; });
+        assert(ok);
     }
 
     void update_watcher(const tile& t,
@@ -586,18 +624,18 @@ private:
         bool check_enter = true,
         bool check_leave = true)
     {
-        for (auto& m : t.markers)
+        for (const auto& m : t.markers)
         {
-            if (obj->handle == m->handle) continue;
-            bool in_old_view = old_rect.contains(m->x, m->y);
-            bool in_new_view = new_rect.contains(m->x, m->y);
+            if (obj == m.obj) continue;
+            bool in_old_view = old_rect.contains(m.x, m.y);
+            bool in_new_view = new_rect.contains(m.x, m.y);
             if (in_old_view)
             {
                 if (enable_leave_event_)
                 {
                     if (!in_new_view&&check_leave)
                     {
-                        event_queue_.emplace_back(static_cast<int>(event_leave), obj->handle, m->handle);
+                        event_queue_.emplace_back(static_cast<int>(event_leave), obj->handle, m.obj->handle);
                     }
                 }
             }
@@ -605,7 +643,7 @@ private:
             {
                 if (in_new_view&&check_enter)
                 {
-                    event_queue_.emplace_back(static_cast<int>(event_enter), obj->handle, m->handle);
+                    event_queue_.emplace_back(static_cast<int>(event_enter), obj->handle, m.obj->handle);
                 }
             }
         }
@@ -69,6 +69,26 @@ namespace moon
             return false;
         }
 
+        template<typename Pred>
+        size_t erase_if(Pred&& pred)
+        {
+            std::unique_lock lck(lock_);
+            size_t n = 0;
+            for (auto iter = data_.begin(); iter != data_.end();)
+            {
+                if (pred(iter->second))
+                {
+                    iter = data_.erase(iter);
+                    ++n;
+                }
+                else
+                {
+                    ++iter;
+                }
+            }
+            return n;
+        }
+
         void clear()
         {
             std::unique_lock lck(lock_);
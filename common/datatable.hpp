@@ -0,0 +1,340 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace moon
+{
+    /*
+        read-only data table image, meant to be memory mapped and read in place.
+        little-endian, every record 8-byte aligned, offsets relative to the image start.
+
+        header | records...
+
+        table record:  table_head | value array[narr] | slot hash[nslots]
+        string record: bytes | '\0'
+
+        the hash part is open addressing with linear probing, nslots a power of two
+        and at most 7/8 full: the image is never written to, short probes matter less than size. integer keys 1..narr always live in the array part.
+    */
+    namespace datatable
+    {
+        constexpr uint32_t MAGIC = 0x3154444D;//"MDT1"
+        constexpr uint32_t VERSION = 1;
+
+        enum value_type : uint32_t
+        {
+            type_nil = 0,
+            type_false,
+            type_true,
+            type_integer,
+            type_number,
+            type_string,
+            type_table
+        };
+
+        struct value
+        {
+            uint32_t type;
+            uint32_t len;//string length
+            union
+            {
+                int64_t i;
+                double n;
+                uint64_t offset;//string and table records
+            };
+        };
+        static_assert(sizeof(value) == 16);
+
+        struct slot
+        {
+            value key;
+            value val;
+        };
+
+        struct table_head
+        {
+            uint32_t narr;
+            uint32_t nslots;
+            uint32_t nhash;
+            uint32_t reserved;
+        };
+
+        struct header
+        {
+            uint32_t magic;
+            uint32_t version;
+            uint64_t size;
+            uint64_t root;//offset of the root table
+            uint64_t reserved;
+        };
+
+        inline uint64_t hash_integer(int64_t v)
+        {
+            uint64_t x = static_cast<uint64_t>(v);
+            x ^= x >> 33;
+            x *= 0xff51afd7ed558ccdULL;
+            x ^= x >> 33;
+            x *= 0xc4ceb9fe1a85ec53ULL;
+            x ^= x >> 33;
+            return x;
+        }
+
+        inline uint64_t hash_string(const char* s, size_t len)
+        {
+            uint64_t h = 0xcbf29ce484222325ULL;
+            for (size_t i = 0; i < len; ++i)
+            {
+                h ^= static_cast<uint8_t>(s[i]);
+                h *= 0x100000001b3ULL;
+            }
+            return h;
+        }
+
+        inline uint64_t hash_key(const value& k, const char* base)
+        {
+            switch (k.type)
+            {
+            case type_integer:
+                return hash_integer(k.i);
+            case type_number:
+            {
+                int64_t bits;
+                memcpy(&bits, &k.n, sizeof(bits));
+                return hash_integer(bits) ^ 0x5bd1e995;
+            }
+            case type_string:
+                return hash_string(base + k.offset, k.len);
+            default:
+                return k.type;
+            }
+        }
+
+        //a mapped image, offsets are bounds checked on every access
+        class reader
+        {
+        public:
+            reader(const char* data, size_t size)
+                : data_(data), size_(size)
+            {
+            }
+
+            //false when the image is truncated or not a data table
+            bool valid() const
+            {
+                if (size_ < sizeof(header))
+                {
+                    return false;
+                }
+                auto h = reinterpret_cast<const header*>(data_);
+                return h->magic == MAGIC && h->version == VERSION && h->size == size_ && check_table(h->root);
+            }
+
+            uint64_t root() const
+            {
+                return reinterpret_cast<const header*>(data_)->root;
+            }
+
+            const char* data() const
+            {
+                return data_;
+            }
+
+            size_t size() const
+            {
+                return size_;
+            }
+
+            bool check_table(uint64_t offset) const
+            {
+                if (offset % 8 != 0 || offset > size_ || size_ - offset < sizeof(table_head))
+                {
+                    return false;
+                }
+                auto t = head(offset);
+                uint64_t need = sizeof(table_head) + uint64_t{ t->narr } * sizeof(value) + uint64_t{ t->nslots } * sizeof(slot);
+                return size_ - offset >= need && (t->nslots & (t->nslots - 1)) == 0;
+            }
+
+            bool check_string(const value& v) const
+            {
+                return v.offset <= size_ && size_ - v.offset > v.len;
+            }
+
+            const table_head* head(uint64_t offset) const
+            {
+                return reinterpret_cast<const table_head*>(data_ + offset);
+            }
+
+            const value* array(uint64_t offset) const
+            {
+                return reinterpret_cast<const value*>(data_ + offset + sizeof(table_head));
+            }
+
+            const slot* hash(uint64_t offset) const
+            {
+                return reinterpret_cast<const slot*>(array(offset) + head(offset)->narr);
+            }
+
+            std::string_view string(const value& v) const
+            {
+                return std::string_view{ data_ + v.offset, v.len };
+            }
+
+            //nullptr when absent
+            const value* find_integer(uint64_t offset, int64_t k) const
+            {
+                auto t = head(offset);
+                if (k >= 1 && static_cast<uint64_t>(k) <= t->narr)
+                {
+                    return &array(offset)[k - 1];
+                }
+                return find(offset, hash_integer(k), [k](const value& key) {
+                    return key.type == type_integer && key.i == k;
+                });
+            }
+
+            const value* find_string(uint64_t offset, const char* s, size_t len) const
+            {
+                //a damaged key never matches instead of reading out of the image
+                return find(offset, hash_string(s, len), [this, s, len](const value& key) {
+                    return key.type == type_string && key.len == len && check_string(key) && memcmp(data_ + key.offset, s, len) == 0;
+                });
+            }
+
+            const value* find_number(uint64_t offset, double n) const
+            {
+                value k{};
+                k.type = type_number;
+                k.n = n;
+                return find(offset, hash_key(k, data_), [n](const value& key) {
+                    return key.type == type_number && key.n == n;
+                });
+            }
+
+            const value* find_boolean(uint64_t offset, bool b) const
+            {
+                uint32_t type = b ? type_true : type_false;
+                return find(offset, type, [type](const value& key) {
+                    return key.type == type;
+                });
+            }
+        private:
+            template<typename Equal>
+            const value* find(uint64_t offset, uint64_t h, Equal&& equal) const
+            {
+                auto t = head(offset);
+                if (t->nslots == 0)
+                {
+                    return nullptr;
+                }
+                const slot* slots = hash(offset);
+                uint32_t mask = t->nslots - 1;
+                //bounded, a damaged image may have no empty slot
+                uint32_t i = static_cast<uint32_t>(h) & mask;
+                for (uint32_t n = 0; n < t->nslots; ++n, i = (i + 1) & mask)
+                {
+                    const slot& s = slots[i];
+                    if (s.key.type == type_nil)
+                    {
+                        return nullptr;
+                    }
+                    if (equal(s.key))
+                    {
+                        return &s.val;
+                    }
+                }
+                return nullptr;
+            }
+        private:
+            const char* data_;
+            size_t size_;
+        };
+
+        //appends records to an image, strings are stored once
+        class writer
+        {
+        public:
+            writer()
+            {
+                data_.resize(sizeof(header));
+            }
+
+            uint64_t add_string(std::string_view s)
+            {
+                auto [it, inserted] = strings_.try_emplace(std::string{ s }, 0);
+                if (!inserted)
+                {
+                    return it->second;
+                }
+                uint64_t offset = alloc(s.size() + 1);
+                memcpy(data_.data() + offset, s.data(), s.size());
+                it->second = offset;
+                return offset;
+            }
+
+            //reserves a table record, fill it with set_array and set_hash
+            uint64_t add_table(uint32_t narr, uint32_t nhash)
+            {
+                uint32_t nslots = 0;
+                if (nhash > 0)
+                {
+                    nslots = 1;
+                    while (nslots < nhash + nhash / 8 + 1)
+                    {
+                        nslots <<= 1;
+                    }
+                }
+                uint64_t offset = alloc(sizeof(table_head) + size_t{ narr } * sizeof(value) + size_t{ nslots } * sizeof(slot));
+                table_head t{ narr, nslots, nhash, 0 };
+                memcpy(data_.data() + offset, &t, sizeof(t));
+                return offset;
+            }
+
+            void set_array(uint64_t table, uint32_t index, const value& v)
+            {
+                memcpy(data_.data() + table + sizeof(table_head) + size_t{ index } * sizeof(value), &v, sizeof(v));
+            }
+
+            void set_hash(uint64_t table, const value& k, const value& v)
+            {
+                table_head t;
+                memcpy(&t, data_.data() + table, sizeof(t));
+                size_t slots = table + sizeof(table_head) + size_t{ t.narr } * sizeof(value);
+                uint32_t mask = t.nslots - 1;
+                for (uint32_t i = static_cast<uint32_t>(hash_key(k, data_.data())) & mask;; i = (i + 1) & mask)
+                {
+                    slot s;
+                    memcpy(&s, data_.data() + slots + size_t{ i } * sizeof(slot), sizeof(s));
+                    if (s.key.type == type_nil)
+                    {
+                        s.key = k;
+                        s.val = v;
+                        memcpy(data_.data() + slots + size_t{ i } * sizeof(slot), &s, sizeof(s));
+                        return;
+                    }
+                }
+            }
+
+            std::string finish(uint64_t root)
+            {
+                header h{ MAGIC, VERSION, data_.size(), root, 0 };
+                memcpy(data_.data(), &h, sizeof(h));
+                strings_.clear();
+                return std::move(data_);
+            }
+        private:
+            uint64_t alloc(size_t n)
+            {
+                uint64_t offset = data_.size();
+                data_.resize(offset + ((n + 7) & ~size_t{ 7 }), '\0');
+                return offset;
+            }
+        private:
+            std::string data_;
+            std::unordered_map<std::string, uint64_t> strings_;
+        };
+    }
+}
@@ -0,0 +1,120 @@
+#pragma once
+#include <cstdint>
+#include <cmath>
+#include <array>
+#include <algorithm>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace moon
+{
+    //log-linear histogram in the spirit of HdrHistogram. Values below 2^SUB_BITS are
+    //exact, larger ones land in buckets 1/32 of their magnitude wide (~3% error).
+    //Fixed size, recording is an index computation and an increment.
+    class histogram
+    {
+    public:
+        static constexpr int SUB_BITS = 6;
+        static constexpr int MAX_BITS = 36;
+        static constexpr uint64_t SUB = uint64_t{ 1 } << SUB_BITS;
+        static constexpr uint64_t HALF = SUB / 2;
+        static constexpr size_t BUCKETS = (MAX_BITS - SUB_BITS) * HALF + SUB;
+        static constexpr uint64_t MAX_VALUE = (uint64_t{ 1 } << MAX_BITS) - 1;
+
+        void record(int64_t value)
+        {
+            uint64_t v = value < 0 ? 0 : static_cast<uint64_t>(value);
+            v = std::min(v, MAX_VALUE);
+            ++counts_[index(v)];
+            ++count_;
+            sum_ += v;
+            max_ = std::max(max_, v);
+        }
+
+        uint64_t count() const
+        {
+            return count_;
+        }
+
+        uint64_t sum() const
+        {
+            return sum_;
+        }
+
+        uint64_t max() const
+        {
+            return max_;
+        }
+
+        double mean() const
+        {
+            return count_ == 0 ? 0.0 : static_cast<double>(sum_) / static_cast<double>(count_);
+        }
+
+        //highest value equivalent to the q(0..1) quantile
+        uint64_t percentile(double q) const
+        {
+            if (count_ == 0)
+            {
+                return 0;
+            }
+            uint64_t target = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * static_cast<double>(count_))));
+            uint64_t seen = 0;
+            for (size_t i = 0; i < BUCKETS; ++i)
+            {
+                seen += counts_[i];
+                if (seen >= target)
+                {
+                    return std::min(highest(i), max_);
+                }
+            }
+            return max_;
+        }
+
+        void clear()
+        {
+            counts_.fill(0);
+            count_ = 0;
+            sum_ = 0;
+            max_ = 0;
+        }
+    private:
+        static int msb(uint64_t v)
+        {
+#if defined(_MSC_VER)
+            unsigned long i = 0;
+            _BitScanReverse64(&i, v);
+            return static_cast<int>(i);
+#else
+            return 63 - __builtin_clzll(v);
+#endif
+        }
+
+        static size_t index(uint64_t v)
+        {
+            if (v < SUB)
+            {
+                return static_cast<size_t>(v);
+            }
+            int e = msb(v) - (SUB_BITS - 1);
+            return static_cast<size_t>(e * HALF + (v >> e));
+        }
+
+        static uint64_t highest(size_t idx)
+        {
+            if (idx < SUB)
+            {
+                return idx;
+            }
+            uint64_t e = idx / HALF - 1;
+            uint64_t mantissa = idx - e * HALF;
+            return ((mantissa + 1) << e) - 1;
+        }
+    private:
+        uint64_t count_ = 0;
+        uint64_t sum_ = 0;
+        uint64_t max_ = 0;
+        std::array<uint32_t, BUCKETS> counts_{};
+    };
+}
@@ -8,6 +8,7 @@
 #include "common/buffer.hpp"
 #include "common/spinlock.hpp"
 #include "common/string.hpp"
+#include "common/affinity.hpp"
 
 namespace moon
 {
@@ -137,6 +138,12 @@ namespace moon
             }
         }
 
+        //pins the writer thread
+        bool bind_cpu(int cpu)
+        {
+            return moon::bind_cpu(thread_.native_handle(), cpu);
+        }
+
         void wait()
         {
             if (state_.load() == state::stopped)
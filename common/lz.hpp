@@ -0,0 +1,281 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+namespace moon
+{
+    //LZ4 block format codec with an optional dictionary prefix.
+    //The dictionary is raw content both sides already hold, matches may reach
+    //back into it, so small similar messages compress well.
+    namespace lz
+    {
+        constexpr size_t MIN_MATCH = 4;
+        constexpr size_t LAST_LITERALS = 5;
+        constexpr size_t MFLIMIT = 12;
+        constexpr size_t MAX_OFFSET = 65535;
+        constexpr int HASH_LOG = 14;
+
+        inline size_t compress_bound(size_t n)
+        {
+            return n + n / 255 + 16;
+        }
+
+        namespace detail
+        {
+            inline uint32_t read32(const uint8_t* p)
+            {
+                uint32_t v;
+                memcpy(&v, p, sizeof(v));
+                return v;
+            }
+
+            inline uint32_t hash(uint32_t v)
+            {
+                return (v * 2654435761u) >> (32 - HASH_LOG);
+            }
+
+            inline uint8_t* write_length(uint8_t* op, size_t len)
+            {
+                while (len >= 255)
+                {
+                    *op++ = 255;
+                    len -= 255;
+                }
+                *op++ = static_cast<uint8_t>(len);
+                return op;
+            }
+
+            inline bool read_length(const uint8_t*& ip, const uint8_t* iend, size_t& len)
+            {
+                uint8_t b = 0;
+                do
+                {
+                    if (ip >= iend)
+                    {
+                        return false;
+                    }
+                    b = *ip++;
+                    len += b;
+                } while (b == 255);
+                return true;
+            }
+
+            //token, literals and, when match_len != 0, offset and match length
+            inline uint8_t* write_sequence(uint8_t* op, uint8_t* oend, const uint8_t* lit, size_t lit_len, size_t offset, size_t match_len)
+            {
+                if (static_cast<size_t>(oend - op) < 1 + lit_len + lit_len / 255 + 1 + 2 + match_len / 255 + 1)
+                {
+                    return nullptr;
+                }
+                uint8_t* token = op++;
+                *token = static_cast<uint8_t>((lit_len >= 15 ? 15 : lit_len) << 4);
+                if (lit_len >= 15)
+                {
+                    op = write_length(op, lit_len - 15);
+                }
+                memcpy(op, lit, lit_len);
+                op += lit_len;
+                if (match_len == 0)
+                {
+                    return op;
+                }
+                *op++ = static_cast<uint8_t>(offset);
+                *op++ = static_cast<uint8_t>(offset >> 8);
+                size_t ml = match_len - MIN_MATCH;
+                *token |= static_cast<uint8_t>(ml >= 15 ? 15 : ml);
+                if (ml >= 15)
+                {
+                    op = write_length(op, ml - 15);
+                }
+                return op;
+            }
+            //compresses window[begin, end), the bytes before begin are the dictionary,
+            //table holds position+1 of already hashed sequences, 0 means empty
+            inline size_t compress_window(const uint8_t* base, size_t begin, size_t end, uint32_t* table, char* dst, size_t cap)
+            {
+                uint8_t* op = reinterpret_cast<uint8_t*>(dst);
+                uint8_t* oend = op + cap;
+                size_t anchor = begin;
+                size_t ip = begin;
+                while (ip + MFLIMIT < end)
+                {
+                    uint32_t seq = read32(base + ip);
+                    uint32_t h = hash(seq);
+                    size_t ref = table[h];
+                    table[h] = static_cast<uint32_t>(ip + 1);
+                    if (ref == 0 || ip - (ref - 1) > MAX_OFFSET || read32(base + ref - 1) != seq)
+                    {
+                        //skip faster through data that does not compress
+                        ip += 1 + ((ip - anchor) >> 6);
+                        continue;
+                    }
+                    --ref;
+
+                    size_t match_len = MIN_MATCH;
+                    size_t limit = end - LAST_LITERALS;
+                    while (ip + match_len < limit && base[ref + match_len] == base[ip + match_len])
+                    {
+                        ++match_len;
+                    }
+                    while (ip > anchor && ref > 0 && base[ip - 1] == base[ref - 1])
+                    {
+                        --ip;
+                        --ref;
+                        ++match_len;
+                    }
+
+                    op = write_sequence(op, oend, base + anchor, ip - anchor, ip - ref, match_len);
+                    if (nullptr == op)
+                    {
+                        return 0;
+                    }
+                    ip += match_len;
+                    anchor = ip;
+                }
+
+                op = write_sequence(op, oend, base + anchor, end - anchor, 0, 0);
+                if (nullptr == op)
+                {
+                    return 0;
+                }
+                return op - reinterpret_cast<uint8_t*>(dst);
+            }
+        }
+
+        //a dictionary hashed once, for links that compress many batches against the same content
+        class dictionary
+        {
+        public:
+            void reset(std::string_view content)
+            {
+                using namespace detail;
+                if (content.size() > MAX_OFFSET)
+                {
+                    content = content.substr(content.size() - MAX_OFFSET);
+                }
+                size_ = content.size();
+                window_.assign(content.begin(), content.end());
+                table_.assign(size_t{ 1 } << HASH_LOG, 0);
+                for (size_t i = 0; i + MIN_MATCH <= size_; ++i)
+                {
+                    table_[hash(read32(window_.data() + i))] = static_cast<uint32_t>(i + 1);
+                }
+            }
+
+            bool empty() const
+            {
+                return size_ == 0;
+            }
+
+            std::string_view content() const
+            {
+                return std::string_view{ reinterpret_cast<const char*>(window_.data()), size_ };
+            }
+
+            //returns the compressed size, 0 when dst is too small
+            size_t compress(const char* src, size_t n, char* dst, size_t cap)
+            {
+                thread_local std::vector<uint32_t> table;
+                if (table_.empty())
+                {
+                    table.assign(size_t{ 1 } << HASH_LOG, 0);
+                }
+                else
+                {
+                    table = table_;
+                }
+                window_.resize(size_ + n);
+                if (n != 0)
+                {
+                    memcpy(window_.data() + size_, src, n);
+                }
+                return detail::compress_window(window_.data(), size_, size_ + n, table.data(), dst, cap);
+            }
+        private:
+            size_t size_ = 0;
+            std::vector<uint8_t> window_;
+            std::vector<uint32_t> table_;
+        };
+
+        //returns the compressed size, 0 when dst is too small
+        inline size_t compress(const char* src, size_t n, char* dst, size_t cap, std::string_view dict = std::string_view{})
+        {
+            thread_local dictionary d;
+            d.reset(dict);
+            return d.compress(src, n, dst, cap);
+        }
+
+        //dst must hold exactly rawsize bytes, dict must be the one used to compress
+        inline bool decompress(const char* src, size_t n, char* dst, size_t rawsize, std::string_view dict = std::string_view{})
+        {
+            using namespace detail;
+            if (dict.size() > MAX_OFFSET)
+            {
+                dict = dict.substr(dict.size() - MAX_OFFSET);
+            }
+
+            const uint8_t* ip = reinterpret_cast<const uint8_t*>(src);
+            const uint8_t* iend = ip + n;
+            uint8_t* const ostart = reinterpret_cast<uint8_t*>(dst);
+            uint8_t* op = ostart;
+            uint8_t* oend = op + rawsize;
+
+            while (ip < iend)
+            {
+                uint8_t token = *ip++;
+                size_t lit_len = token >> 4;
+                if (lit_len == 15 && !read_length(ip, iend, lit_len))
+                {
+                    return false;
+                }
+                if (lit_len > static_cast<size_t>(iend - ip) || lit_len > static_cast<size_t>(oend - op))
+                {
+                    return false;
+                }
+                memcpy(op, ip, lit_len);
+                op += lit_len;
+                ip += lit_len;
+                if (ip == iend)
+                {
+                    break;
+                }
+
+                if (iend - ip < 2)
+                {
+                    return false;
+                }
+                size_t offset = static_cast<size_t>(ip[0]) | (static_cast<size_t>(ip[1]) << 8);
+                ip += 2;
+                size_t match_len = token & 15;
+                if (match_len == 15 && !read_length(ip, iend, match_len))
+                {
+                    return false;
+                }
+                match_len += MIN_MATCH;
+
+                size_t produced = op - ostart;
+                if (offset == 0 || offset > produced + dict.size() || match_len > static_cast<size_t>(oend - op))
+                {
+                    return false;
+                }
+                if (offset > produced)
+                {
+                    size_t from_dict = offset - produced;
+                    size_t count = from_dict < match_len ? from_dict : match_len;
+                    memcpy(op, dict.data() + dict.size() - from_dict, count);
+                    op += count;
+                    match_len -= count;
+                }
+                //byte copy, the match may overlap its own output
+                const uint8_t* match = op - offset;
+                while (match_len-- > 0)
+                {
+                    *op++ = *match++;
+                }
+            }
+            return op == oend;
+        }
+    }
+}
@@ -0,0 +1,145 @@
+#pragma once
+#include <string>
+#include <cstddef>
+#include "platform_define.hpp"
+
+#if TARGET_PLATFORM != PLATFORM_WINDOWS
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#endif
+
+namespace moon
+{
+    //read-only memory mapped file
+    class mmap_file
+    {
+    public:
+        mmap_file() = default;
+
+        mmap_file(const mmap_file&) = delete;
+
+        mmap_file& operator=(const mmap_file&) = delete;
+
+        ~mmap_file()
+        {
+            close();
+        }
+
+        bool open(const std::string& path)
+        {
+            close();
+#if TARGET_PLATFORM == PLATFORM_WINDOWS
+            file_ = ::CreateFileA(path.data(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (file_ == INVALID_HANDLE_VALUE)
+            {
+                return false;
+            }
+            LARGE_INTEGER size;
+            if (!::GetFileSizeEx(file_, &size))
+            {
+                close();
+                return false;
+            }
+            size_ = static_cast<size_t>(size.QuadPart);
+            if (size_ == 0)
+            {
+                return true;
+            }
+            mapping_ = ::CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (mapping_ == NULL)
+            {
+                close();
+                return false;
+            }
+            data_ = static_cast<const char*>(::MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+            if (data_ == nullptr)
+            {
+                close();
+                return false;
+            }
+#else
+            int fd = ::open(path.data(), O_RDONLY);
+            if (fd < 0)
+            {
+                return false;
+            }
+            struct stat st;
+            if (::fstat(fd, &st) != 0)
+            {
+                ::close(fd);
+                return false;
+            }
+            size_ = static_cast<size_t>(st.st_size);
+            if (size_ > 0)
+            {
+                void* p = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+                if (p == MAP_FAILED)
+                {
+                    ::close(fd);
+                    size_ = 0;
+                    return false;
+                }
+                data_ = static_cast<const char*>(p);
+            }
+            ::close(fd);
+#endif
+            return true;
+        }
+
+        void close()
+        {
+#if TARGET_PLATFORM == PLATFORM_WINDOWS
+            if (data_ != nullptr)
+            {
+                ::UnmapViewOfFile(data_);
+            }
+            if (mapping_ != NULL)
+            {
+                ::CloseHandle(mapping_);
+                mapping_ = NULL;
+            }
+            if (file_ != INVALID_HANDLE_VALUE)
+            {
+                ::CloseHandle(file_);
+                file_ = INVALID_HANDLE_VALUE;
+            }
+#else
+            if (data_ != nullptr)
+            {
+                ::munmap(const_cast<char*>(data_), size_);
+            }
+#endif
+            data_ = nullptr;
+            size_ = 0;
+        }
+
+        //hint the kernel the mapping will be read front to back
+        void sequential() const
+        {
+#if TARGET_PLATFORM != PLATFORM_WINDOWS
+            if (data_ != nullptr)
+            {
+                ::madvise(const_cast<char*>(data_), size_, MADV_SEQUENTIAL);
+            }
+#endif
+        }
+
+        const char* data() const
+        {
+            return data_;
+        }
+
+        size_t size() const
+        {
+            return size_;
+        }
+    private:
+        const char* data_ = nullptr;
+        size_t size_ = 0;
+#if TARGET_PLATFORM == PLATFORM_WINDOWS
+        HANDLE file_ = INVALID_HANDLE_VALUE;
+        HANDLE mapping_ = NULL;
+#endif
+    };
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string_view>
+
+namespace moon
+{
+    //single producer single consumer ring of variable-length records.
+    //a record is an 8 byte header(uint32_t length) and the bytes, padded to 8. a record
+    //that does not fit before the end leaves a wrap marker and starts at the beginning.
+    class spsc_ring
+    {
+        static constexpr uint32_t WRAP = 0xFFFFFFFF;
+        static constexpr size_t HEADER = 8;
+        static constexpr size_t CACHE_LINE = 64;
+    public:
+        explicit spsc_ring(size_t capacity)
+            : capacity_(round_capacity(capacity))
+            , data_(new char[capacity_])
+        {
+        }
+
+        spsc_ring(const spsc_ring&) = delete;
+
+        spsc_ring& operator=(const spsc_ring&) = delete;
+
+        size_t capacity() const
+        {
+            return capacity_;
+        }
+
+        //largest record that can ever be written
+        size_t max_record() const
+        {
+            return capacity_ / 2 - HEADER;
+        }
+
+        //producer. false when there is no room
+        bool try_write(const char* data, size_t len)
+        {
+            if (len > max_record())
+            {
+                return false;
+            }
+            size_t need = record_size(len);
+            uint64_t tail = tail_.load(std::memory_order_relaxed);
+            size_t pos = static_cast<size_t>(tail & (capacity_ - 1));
+            size_t contiguous = capacity_ - pos;
+            size_t total = (need <= contiguous) ? need : contiguous + need;
+            if (tail + total - head_cache_ > capacity_)
+            {
+                head_cache_ = head_.load(std::memory_order_acquire);
+                if (tail + total - head_cache_ > capacity_)
+                {
+                    return false;
+                }
+            }
+            if (need > contiguous)
+            {
+                memcpy(data_.get() + pos, &WRAP, sizeof(WRAP));
+                tail += contiguous;
+                pos = 0;
+            }
+            uint32_t n = static_cast<uint32_t>(len);
+            memcpy(data_.get() + pos, &n, sizeof(n));
+            memcpy(data_.get() + pos + HEADER, data, len);
+            tail_.store(tail + need, std::memory_order_release);
+            return true;
+        }
+
+        //consumer. the next record, valid until pop
+        bool peek(std::string_view& record)
+        {
+            uint64_t head = head_.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                if (head == tail_cache_)
+                {
+                    tail_cache_ = tail_.load(std::memory_order_acquire);
+                    if (head == tail_cache_)
+                    {
+                        return false;
+                    }
+                }
+                size_t pos = static_cast<size_t>(head & (capacity_ - 1));
+                uint32_t n;
+                memcpy(&n, data_.get() + pos, sizeof(n));
+                if (n == WRAP)
+                {
+                    head += capacity_ - pos;
+                    head_.store(head, std::memory_order_release);
+                    continue;
+                }
+                record = std::string_view{ data_.get() + pos + HEADER, n };
+                return true;
+            }
+        }
+
+        //consumer. releases the record returned by peek
+        void pop(const std::string_view& record)
+        {
+            uint64_t head = head_.load(std::memory_order_relaxed);
+            head_.store(head + record_size(record.size()), std::memory_order_release);
+        }
+
+        //bytes in use, exact only on the producer or the consumer thread
+        size_t size() const
+        {
+            return static_cast<size_t>(tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire));
+        }
+    private:
+        static size_t record_size(size_t len)
+        {
+            return HEADER + ((len + 7) & ~size_t{ 7 });
+        }
+
+        static size_t round_capacity(size_t n)
+        {
+            size_t v = 4096;
+            while (v < n)
+            {
+                v <<= 1;
+            }
+            return v;
+        }
+    private:
+        const size_t capacity_;
+        std::unique_ptr<char[]> data_;
+        //the producer owns tail_ and head_cache_, the consumer head_ and tail_cache_
+        alignas(CACHE_LINE) std::atomic<uint64_t> tail_ = 0;
+        uint64_t head_cache_ = 0;
+        alignas(CACHE_LINE) std::atomic<uint64_t> head_ = 0;
+        uint64_t tail_cache_ = 0;
+    };
+}
@@ -18,6 +18,12 @@ namespace moon
             return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time_point_).count();
         }
 
+        //steady clock in microseconds, for latency measurement
+        static int64_t microsecond()
+        {
+            return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
         static bool offset(std::time_t v)
         {
             if (v <= 0)
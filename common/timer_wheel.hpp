@@ -0,0 +1,84 @@
+#pragma once
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <algorithm>
+
+namespace moon
+{
+    //hashed timing wheel. An entry sits in the slot of its expire tick and
+    //waits there for further revolutions until its time has come.
+    //Entries can not be removed, the expire handler skips the stale ones.
+    template<typename T, size_t Slots = 512, int64_t Tick = 10>
+    class timer_wheel
+    {
+        struct node
+        {
+            int64_t expire;
+            T value;
+        };
+    public:
+        static constexpr int64_t tick = Tick;
+
+        void add(int64_t expire, T value)
+        {
+            int64_t t = (expire + Tick - 1) / Tick;
+            if (t < current_)
+            {
+                t = current_;
+            }
+            slots_[static_cast<size_t>(t) % Slots].emplace_back(node{ expire, std::move(value) });
+            ++size_;
+        }
+
+        //calls handler(value) for every entry expired at now
+        template<typename Handler>
+        void update(int64_t now, Handler&& handler)
+        {
+            int64_t t = now / Tick;
+            if (size_ == 0)
+            {
+                current_ = t;
+                return;
+            }
+
+            int64_t n = std::min<int64_t>(t - current_ + 1, static_cast<int64_t>(Slots));
+            for (int64_t i = 0; i < n; ++i)
+            {
+                auto& slot = slots_[static_cast<size_t>(current_ + i) % Slots];
+                for (size_t k = 0; k < slot.size();)
+                {
+                    if (slot[k].expire <= now)
+                    {
+                        expired_.emplace_back(std::move(slot[k].value));
+                        slot[k] = std::move(slot.back());
+                        slot.pop_back();
+                        --size_;
+                    }
+                    else
+                    {
+                        ++k;
+                    }
+                }
+            }
+            current_ = t;
+
+            //handlers may add entries
+            for (auto& v : expired_)
+            {
+                handler(v);
+            }
+            expired_.clear();
+        }
+
+        size_t size() const
+        {
+            return size_;
+        }
+    private:
+        int64_t current_ = 0;
+        size_t size_ = 0;
+        std::array<std::vector<node>, Slots> slots_;
+        std::vector<T> expired_;
+    };
+}
@@ -1,12 +1,21 @@
 #pragma once
 #include <cstdint>
-#include <set>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <new>
 #include <unordered_map>
-#include <vector>
 #include <limits>
+#include <random>
+#include <vector>
+#include <algorithm>
 
 namespace moon
 {
+    /*
+        rank-augmented skiplist: every forward link records how many nodes it spans,
+        so update/erase/rank/start are all O(log n) and never need a full renumbering.
+    */
     class zset
     {
         struct context
@@ -14,38 +23,103 @@ namespace moon
             int64_t key = 0;
             int64_t score = 0;
             int64_t timestamp = 0;
-            uint32_t rank = 0;
         };
 
-        struct compare
+        struct node;
+
+        struct level
+        {
+            node* forward = nullptr;
+            uint32_t span = 0;
+        };
+
+        struct node
         {
-            bool operator()(context* a, context* b) const
+            context value;
+            node* backward = nullptr;
+            int height = 0;
+            level levels[1];
+        };
+
+        static bool less(const context& a, const context& b)
+        {
+            if (a.score == b.score)
             {
-                if (a->score == b->score)
+                if (a.timestamp == b.timestamp)
                 {
-                    if (a->timestamp == b->timestamp)
-                    {
-                        return a->key < b->key;
-                    }
-                    return a->timestamp < b->timestamp;
+                    return a.key < b.key;
                 }
-                return a->score > b->score;
+                return a.timestamp < b.timestamp;
             }
-        };
+            return a.score > b.score;
+        }
+
     public:
-        using container_type = std::set<context*, compare>;
-        using iterator = typename container_type::iterator;
-        using const_iterator = typename container_type::const_iterator;
-        using pointer = typename container_type::pointer;
-        using const_pointer = typename container_type::const_pointer;
+        static constexpr int MAX_LEVEL = 32;
+
+        //snapshot: magic, version, count, then count * {key, score, timestamp} in rank order
+        static constexpr uint32_t SNAPSHOT_MAGIC = 0x5445535A;//"ZSET"
+        static constexpr uint32_t SNAPSHOT_VERSION = 1;
+        static constexpr size_t SNAPSHOT_HEAD_SIZE = sizeof(uint32_t) * 2 + sizeof(uint64_t);
+        static constexpr size_t ENTRY_SIZE = sizeof(int64_t) * 3;
+
+        class const_iterator
+        {
+        public:
+            explicit const_iterator(const node* n = nullptr)
+                :node_(n)
+            {
+            }
+
+            const context* operator*() const
+            {
+                return &node_->value;
+            }
+
+            const_iterator& operator++()
+            {
+                node_ = node_->levels[0].forward;
+                return *this;
+            }
+
+            const_iterator operator++(int)
+            {
+                const_iterator tmp = *this;
+                ++*this;
+                return tmp;
+            }
 
-        static constexpr size_t JUMP_STEP = 100;
+            bool operator==(const const_iterator& other) const
+            {
+                return node_ == other.node_;
+            }
+
+            bool operator!=(const const_iterator& other) const
+            {
+                return node_ != other.node_;
+            }
+        private:
+            const node* node_;
+        };
+
+        using iterator = const_iterator;
 
         zset(size_t max_count = std::numeric_limits<size_t>::max())
             :max_count_(max_count)
+            , head_(make_node(MAX_LEVEL, context{}))
         {
         }
 
+        zset(const zset&) = delete;
+
+        zset& operator=(const zset&) = delete;
+
+        ~zset()
+        {
+            clear();
+            free_node(head_);
+        }
+
         void update(int64_t key, int64_t score, int64_t timestamp)
         {
             if (max_count_ == 0)
@@ -54,105 +128,117 @@ namespace moon
             }
 
             auto iter = index_.find(key);
-            if (index_.size() == max_count_ && iter == index_.end() && (*(order_.rbegin()))->score > score)
-            {
-                return;
-            }
-
             if (iter == index_.end())
             {
-                iter = index_.emplace(key, context{ key, score, timestamp }).first;
-            }
-            else
-            {
-                order_.erase(&iter->second);
-            }
+                if (index_.size() == max_count_ && tail_->value.score > score)
+                {
+                    return;
+                }
 
-            iter->second.score = score;
-            iter->second.timestamp = timestamp;
+                node* n = insert(context{ key, score, timestamp });
+                index_.emplace(key, n);
 
-            order_.emplace(&iter->second);
+                if (index_.size() > max_count_)
+                {
+                    node* last = tail_;
+                    index_.erase(last->value.key);
+                    remove(last);
+                }
+                return;
+            }
 
-            if (order_.size() > max_count_)
+            node* n = iter->second;
+            context v{ key, score, timestamp };
+            //position unchanged, update in place
+            if ((n->backward == nullptr || less(n->backward->value, v))
+                && (n->levels[0].forward == nullptr || less(v, n->levels[0].forward->value)))
             {
-                auto v = (*order_.rbegin());
-                order_.erase(v);
-                index_.erase(v->key);
+                n->value = v;
+                return;
             }
 
-            ordered_ = false;
+            remove(n);
+            iter->second = insert(v);
         }
 
-        uint32_t rank(int64_t key)
+        uint32_t rank(int64_t key) const
         {
-            prepare();
             auto iter = index_.find(key);
-            if (iter != index_.end())
+            if (iter == index_.end())
             {
-                return iter->second.rank;
+                return 0;
             }
-            return 0;
-        }
 
-        void prepare()
-        {
-            if (!ordered_)
+            const context& v = iter->second->value;
+            uint32_t rank = 0;
+            const node* x = head_;
+            for (int i = level_ - 1; i >= 0; --i)
             {
-                jump_.clear();
-                uint32_t n = 0;
-                for (auto iter = order_.begin(); iter != order_.end(); ++iter)
+                while (x->levels[i].forward && !less(v, x->levels[i].forward->value))
+                {
+                    rank += x->levels[i].span;
+                    x = x->levels[i].forward;
+                }
+                if (x->value.key == key && x != head_)
                 {
-                    if (n % JUMP_STEP == 0)
-                    {
-                        jump_.emplace_back(iter);
-                    }
-                    (*iter)->rank = ++n;
+                    return rank;
                 }
-                ordered_ = true;
             }
+            return 0;
+        }
+
+        //kept for compatibility, ranks are always up to date
+        void prepare()
+        {
         }
 
-        int64_t score(int64_t key)
+        int64_t score(int64_t key) const
         {
             auto iter = index_.find(key);
             if (iter != index_.end())
             {
-                return iter->second.score;
+                return iter->second->value.score;
             }
             return 0;
         }
 
         const_iterator start(uint32_t nrank) const
         {
-            size_t idx = nrank / JUMP_STEP;
-            if (idx >= jump_.size())
+            if (nrank == 0 || nrank > size_)
             {
-                return  order_.end();
+                return end();
             }
 
-            for (auto iter = jump_[idx]; iter != order_.end(); ++iter)
+            uint32_t traversed = 0;
+            const node* x = head_;
+            for (int i = level_ - 1; i >= 0; --i)
             {
-                if ((*iter)->rank == nrank)
+                while (x->levels[i].forward && (traversed + x->levels[i].span) <= nrank)
+                {
+                    traversed += x->levels[i].span;
+                    x = x->levels[i].forward;
+                }
+                if (traversed == nrank)
                 {
-                    return iter;
+                    return const_iterator{ x };
                 }
             }
-            return  order_.end();
+            return end();
         }
 
         const_iterator begin() const
         {
-            return order_.begin();
+            return const_iterator{ head_->levels[0].forward };
         }
 
         const_iterator end() const
         {
-            return  order_.end();
+            return const_iterator{ nullptr };
         }
 
         size_t size() const
         {
-            return order_.size();
+            return size_;
         }
 
         bool has(int64_t key) const
@@ -162,30 +248,330 @@ namespace moon
 
         void clear()
         {
-            jump_.clear();
-            order_.clear();
+            node* x = head_->levels[0].forward;
+            while (x)
+            {
+                node* next = x->levels[0].forward;
+                free_node(x);
+                x = next;
+            }
+            for (int i = 0; i < MAX_LEVEL; ++i)
+            {
+                head_->levels[i].forward = nullptr;
+                head_->levels[i].span = 0;
+            }
+            tail_ = nullptr;
+            level_ = 1;
+            size_ = 0;
             index_.clear();
         }
 
+        /*
+            data is count packed {key, score, timestamp} int64 triples.
+            when the zset is empty the entries are sorted (if needed) and linked in O(n),
+            otherwise every entry goes through update.
+        */
+        void update_many(const int64_t* data, size_t count)
+        {
+            if (size_ == 0 && count > 0 && count <= max_count_)
+            {
+                auto get = [data](size_t i) { return context{ data[i * 3], data[i * 3 + 1], data[i * 3 + 2] }; };
+                if (bulk_load(count, get))
+                {
+                    return;
+                }
+
+                std::vector<context> sorted(count);
+                for (size_t i = 0; i < count; ++i)
+                {
+                    sorted[i] = get(i);
+                }
+                std::sort(sorted.begin(), sorted.end(), less);
+                if (bulk_load(count, [&sorted](size_t i) { return sorted[i]; }))
+                {
+                    return;
+                }
+            }
+
+            for (size_t i = 0; i < count; ++i, data += 3)
+            {
+                update(data[0], data[1], data[2]);
+            }
+        }
+
+        std::string snapshot() const
+        {
+            std::string res;
+            res.resize(SNAPSHOT_HEAD_SIZE + size_ * ENTRY_SIZE);
+            char* p = res.data();
+            uint32_t magic = SNAPSHOT_MAGIC;
+            uint32_t version = SNAPSHOT_VERSION;
+            uint64_t count = size_;
+            std::memcpy(p, &magic, sizeof(magic));
+            std::memcpy(p + sizeof(magic), &version, sizeof(version));
+            std::memcpy(p + sizeof(magic) + sizeof(version), &count, sizeof(count));
+            p += SNAPSHOT_HEAD_SIZE;
+            for (const node* x = head_->levels[0].forward; x != nullptr; x = x->levels[0].forward)
+            {
+                int64_t v[3] = { x->value.key, x->value.score, x->value.timestamp };
+                std::memcpy(p, v, sizeof(v));
+                p += sizeof(v);
+            }
+            return res;
+        }
+
+        //replace content with a snapshot. data may point into a memory mapped file.
+        bool restore(const char* data, size_t size)
+        {
+            if (size < SNAPSHOT_HEAD_SIZE)
+            {
+                return false;
+            }
+            uint32_t magic = 0;
+            uint32_t version = 0;
+            uint64_t count = 0;
+            std::memcpy(&magic, data, sizeof(magic));
+            std::memcpy(&version, data + sizeof(magic), sizeof(version));
+            std::memcpy(&count, data + sizeof(magic) + sizeof(version), sizeof(count));
+            if (magic != SNAPSHOT_MAGIC || version != SNAPSHOT_VERSION || (size - SNAPSHOT_HEAD_SIZE) / ENTRY_SIZE < count)
+            {
+                return false;
+            }
+            clear();
+            const char* p = data + SNAPSHOT_HEAD_SIZE;
+            if ((reinterpret_cast<uintptr_t>(p) % alignof(int64_t)) == 0)
+            {
+                update_many(reinterpret_cast<const int64_t*>(p), static_cast<size_t>(count));
+            }
+            else
+            {
+                for (uint64_t i = 0; i < count; ++i, p += ENTRY_SIZE)
+                {
+                    int64_t v[3];
+                    std::memcpy(v, p, sizeof(v));
+                    update(v[0], v[1], v[2]);
+                }
+            }
+            return true;
+        }
+
         size_t erase(int64_t key)
         {
             auto iter = index_.find(key);
             if (iter != index_.end())
             {
-                order_.erase(&iter->second);
-                ordered_ = false;
+                remove(iter->second);
                 index_.erase(iter);
                 return 1;
             }
             return 0;
         }
     private:
-        bool ordered_ = true;
+        static node* make_node(int height, const context& v)
+        {
+            size_t bytes = sizeof(node) + (height - 1) * sizeof(level);
+            void* p = std::malloc(bytes);
+            if (nullptr == p)
+            {
+                throw std::bad_alloc{};
+            }
+            node* n = new (p) node{};
+            n->value = v;
+            n->height = height;
+            for (int i = 1; i < height; ++i)
+            {
+                new (&n->levels[i]) level{};
+            }
+            return n;
+        }
+
+        static void free_node(node* n)
+        {
+            std::free(n);
+        }
+
+        //append already ordered entries at the tail without searching. requires an empty zset.
+        template<typename Getter>
+        bool bulk_load(size_t count, Getter&& get)
+        {
+            if (count > max_count_)
+            {
+                return false;
+            }
+
+            for (size_t i = 1; i < count; ++i)
+            {
+                if (!less(get(i - 1), get(i)))
+                {
+                    return false;
+                }
+            }
+
+            index_.reserve(count);
+            node* update[MAX_LEVEL];
+            uint32_t rank[MAX_LEVEL];
+            for (int i = 0; i < MAX_LEVEL; ++i)
+            {
+                update[i] = head_;
+                rank[i] = 0;
+            }
+
+            for (size_t n = 0; n < count; ++n)
+            {
+                context v = get(n);
+                auto res = index_.emplace(v.key, nullptr);
+                if (!res.second)
+                {
+                    //duplicate key, rollback to the slow path
+                    clear();
+                    return false;
+                }
+
+                int lv = random_level();
+                if (lv > level_)
+                {
+                    level_ = lv;
+                }
+
+                node* x = make_node(lv, v);
+                uint32_t xrank = static_cast<uint32_t>(size_) + 1;
+                for (int i = 0; i < lv; ++i)
+                {
+                    update[i]->levels[i].forward = x;
+                    update[i]->levels[i].span = xrank - rank[i];
+                    update[i] = x;
+                    rank[i] = xrank;
+                }
+                x->backward = tail_;
+                tail_ = x;
+                ++size_;
+                res.first->second = x;
+            }
+
+            //links to the end span the remaining nodes
+            for (int i = 0; i < level_; ++i)
+            {
+                update[i]->levels[i].span = static_cast<uint32_t>(size_) - rank[i];
+            }
+            return true;
+        }
+
+        int random_level()
+        {
+            //p = 1/4
+            int lv = 1;
+            while (lv < MAX_LEVEL && (rng_() & 3) == 0)
+            {
+                ++lv;
+            }
+            return lv;
+        }
+
+        node* insert(const context& v)
+        {
+            node* update[MAX_LEVEL];
+            uint32_t rank[MAX_LEVEL];
+
+            node* x = head_;
+            for (int i = level_ - 1; i >= 0; --i)
+            {
+                rank[i] = (i == (level_ - 1)) ? 0 : rank[i + 1];
+                while (x->levels[i].forward && less(x->levels[i].forward->value, v))
+                {
+                    rank[i] += x->levels[i].span;
+                    x = x->levels[i].forward;
+                }
+                update[i] = x;
+            }
+
+            int lv = random_level();
+            if (lv > level_)
+            {
+                for (int i = level_; i < lv; ++i)
+                {
+                    rank[i] = 0;
+                    update[i] = head_;
+                    update[i]->levels[i].span = static_cast<uint32_t>(size_);
+                }
+                level_ = lv;
+            }
+
+            x = make_node(lv, v);
+            for (int i = 0; i < lv; ++i)
+            {
+                x->levels[i].forward = update[i]->levels[i].forward;
+                update[i]->levels[i].forward = x;
+                x->levels[i].span = update[i]->levels[i].span - (rank[0] - rank[i]);
+                update[i]->levels[i].span = (rank[0] - rank[i]) + 1;
+            }
+
+            for (int i = lv; i < level_; ++i)
+            {
+                update[i]->levels[i].span++;
+            }
+
+            x->backward = (update[0] == head_) ? nullptr : update[0];
+            if (x->levels[0].forward)
+            {
+                x->levels[0].forward->backward = x;
+            }
+            else
+            {
+                tail_ = x;
+            }
+            ++size_;
+            return x;
+        }
+
+        void remove(node* n)
+        {
+            node* update[MAX_LEVEL];
+            node* x = head_;
+            for (int i = level_ - 1; i >= 0; --i)
+            {
+                while (x->levels[i].forward && less(x->levels[i].forward->value, n->value))
+                {
+                    x = x->levels[i].forward;
+                }
+                update[i] = x;
+            }
+
+            for (int i = 0; i < level_; ++i)
+            {
+                if (update[i]->levels[i].forward == n)
+                {
+                    update[i]->levels[i].span += n->levels[i].span - 1;
+                    update[i]->levels[i].forward = n->levels[i].forward;
+                }
+                else
+                {
+                    update[i]->levels[i].span -= 1;
+                }
+            }
+
+            if (n->levels[0].forward)
+            {
+                n->levels[0].forward->backward = n->backward;
+            }
+            else
+            {
+                tail_ = n->backward;
+            }
+
+            while (level_ > 1 && head_->levels[level_ - 1].forward == nullptr)
+            {
+                --level_;
+            }
+            --size_;
+            free_node(n);
+        }
+    private:
+        int level_ = 1;
+        size_t size_ = 0;
         size_t max_count_;
-        std::vector<const_iterator> jump_;
-        std::set<context*, compare> order_;
-        std::unordered_map<int64_t, context> index_;
+        node* head_ = nullptr;
+        node* tail_ = nullptr;
+        std::minstd_rand rng_{ 0x5eed };
+        std::unordered_map<int64_t, node*> index_;
     };
 }
-
-
@@ -0,0 +1,70 @@
+---__init__
+if _G["__init__"] then
+    -- moon affinity_benchmark.lua [cpu of worker 1, 2, 3, timer, logger]
+    -- e.g. "moon affinity_benchmark.lua 2 3 4 0 1", no arguments leaves every thread unpinned
+    local arg = ...
+    local cpu = {}
+    for i, v in ipairs(arg) do
+        cpu[i] = math.tointeger(v)
+    end
+    return {
+        thread = 3,
+        enable_console = true,
+        worker_cpu = #cpu >= 3 and {cpu[1], cpu[2], cpu[3]} or nil,
+        timer_cpu = cpu[4],
+        logger_cpu = cpu[5],
+        -- worker 3 only runs services created with threadid = 3
+        dedicated = {3},
+    }
+end
+
+local moon = require("moon")
+
+local conf = ...
+
+local N = 200000
+
+if conf and conf.pong then
+    moon.dispatch("lua", function(msg)
+        local sender, sessionid = moon.decode(msg, "SE")
+        moon.response("lua", sender, sessionid, true)
+    end)
+    return
+end
+
+moon.async(function()
+    local general = {}
+    for i = 1, 8 do
+        general[i] = moon.new_service("lua", {name = "general" .. i, file = "affinity_benchmark.lua", pong = true})
+    end
+    for _, id in ipairs(general) do
+        assert((id >> 24) ~= 3, "general service placed on the dedicated worker")
+    end
+    local dedicated = moon.new_service("lua", {name = "dedicated", file = "affinity_benchmark.lua", pong = true, threadid = 3})
+    assert((dedicated >> 24) == 3)
+
+    -- round trips from worker 1 to a service on worker 2 and to the dedicated worker 3
+    local peer
+    for _, id in ipairs(general) do
+        if (id >> 24) == 2 then
+            peer = id
+            break
+        end
+    end
+    for _, target in ipairs({peer, dedicated}) do
+        local bt = moon.clock()
+        for _ = 1, N do
+            moon.co_call("lua", target, "ping")
+        end
+        local cost = moon.clock() - bt
+        print(string.format("worker 1 -> worker %d: %d round trips %.3fs, %.2f us each", target >> 24, N, cost, cost * 1e6 / N))
+    end
+
+    print(moon.server_info())
+
+    for _, id in ipairs(general) do
+        moon.remove_service(id, true)
+    end
+    moon.remove_service(dedicated, true)
+    moon.exit(-1)
+end)
@@ -0,0 +1,84 @@
+local moon = require("moon")
+local aoi = require("aoi")
+
+local AOI_WATCHER = 1
+local AOI_MARKER = 2
+
+-- scene: 5000 moving entities on a 4096x4096 map, 10 ticks per second
+local MAP_SIZE = 4096
+local TILE_SIZE = 64
+local N = 5000
+local VIEW = 200
+local TICKS = 100
+
+local clock = moon.clock
+local random = math.random
+
+local function make_scene()
+    local space = aoi.create(0, 0, MAP_SIZE, TILE_SIZE)
+    space:enable_leave_event(true)
+    local pos = {}
+    for id = 1, N do
+        local x, y = random(0, MAP_SIZE - 1), random(0, MAP_SIZE - 1)
+        pos[id] = { x, y }
+        space:insert(id, x, y, VIEW, VIEW, 0, AOI_WATCHER | AOI_MARKER)
+    end
+    return space, pos
+end
+
+local function step(p)
+    p[1] = math.max(0, math.min(MAP_SIZE - 1, p[1] + random(-8, 8)))
+    p[2] = math.max(0, math.min(MAP_SIZE - 1, p[2] + random(-8, 8)))
+end
+
+local event_cache = {}
+
+math.randomseed(1)
+local space, pos = make_scene()
+collectgarbage("collect")
+local nevent = 0
+local bt = clock()
+for _ = 1, TICKS do
+    for id = 1, N do
+        local p = pos[id]
+        step(p)
+        space:update(id, p[1], p[2], VIEW, VIEW, 0)
+        local count = space:update_event(event_cache)
+        for i = 1, count, 3 do
+            local watcher, marker, eventid = event_cache[i], event_cache[i + 1], event_cache[i + 2]
+        end
+        nevent = nevent + count // 3
+    end
+end
+local cost = clock() - bt
+print(string.format("update: %d ticks x %d entities cost %.3fs (%.2fms/tick), %d events", TICKS, N, cost, cost * 1000 / TICKS, nevent))
+
+math.randomseed(1)
+space, pos = make_scene()
+collectgarbage("collect")
+local moves = {}
+nevent = 0
+bt = clock()
+for _ = 1, TICKS do
+    local n = 0
+    for id = 1, N do
+        local p = pos[id]
+        step(p)
+        moves[n + 1] = id
+        moves[n + 2] = p[1]
+        moves[n + 3] = p[2]
+        moves[n + 4] = VIEW
+        moves[n + 5] = VIEW
+        moves[n + 6] = 0
+        n = n + 6
+    end
+    local count = space:update_many(moves, n, event_cache)
+    for i = 1, count, 3 do
+        local watcher, marker, eventid = event_cache[i], event_cache[i + 1], event_cache[i + 2]
+    end
+    nevent = nevent + count // 3
+end
+cost = clock() - bt
+print(string.format("update_many: %d ticks x %d entities cost %.3fs (%.2fms/tick), %d events", TICKS, N, cost, cost * 1000 / TICKS, nevent))
+
+moon.exit(-1)
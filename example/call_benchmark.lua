@@ -0,0 +1,174 @@
+local moon = require("moon")
+
+local conf = ...
+
+if conf and conf.callee then
+    local command = {}
+    local handled = 0
+
+    command.ECHO = function(...)
+        return ...
+    end
+
+    -- answers after ms milliseconds
+    command.SLOW = function(ms)
+        moon.sleep(ms)
+        return true
+    end
+
+    -- keeps the service busy, queued requests wait behind it
+    command.BUSY = function(ms)
+        local t = moon.clock() + ms / 1000
+        while moon.clock() < t do end
+        return true
+    end
+
+    command.HANDLED = function()
+        return handled
+    end
+
+    -- never answers
+    command.NEVER = function()
+        coroutine.yield()
+    end
+
+    command.EXIT = function()
+        moon.quit()
+    end
+
+    moon.dispatch("lua", function(msg, unpack)
+        local sender, sessionid, sz, len, deadline = moon.decode(msg, "SECD")
+        local function docmd(cmd, ...)
+            handled = handled + 1
+            if cmd == "LEFT" then
+                moon.response("lua", sender, sessionid, moon.remaining(deadline))
+                return
+            end
+            local fn = command[cmd]
+            if cmd == "SLOW" or cmd == "NEVER" or cmd == "EXIT" then
+                local args = {...}
+                moon.async(function()
+                    moon.response("lua", sender, sessionid, fn(table.unpack(args)))
+                end)
+                return
+            end
+            moon.response("lua", sender, sessionid, fn(...))
+        end
+        docmd(unpack(sz, len))
+    end)
+    return
+end
+
+local clock = moon.clock
+
+local function new_callee(name)
+    return moon.new_service("lua", {name = name, file = "call_benchmark.lua", callee = true})
+end
+
+local function check(callee)
+    assert(moon.co_call("lua", callee, "ECHO", 1, "a") == 1)
+
+    local ok, err = moon.co_call_timeout(50, "lua", callee, "SLOW", 200)
+    assert(ok == false and err == "timeout", err)
+    -- the late response is dropped quietly
+    moon.sleep(300)
+    assert(moon.co_call_timeout(500, "lua", callee, "SLOW", 10) == true)
+
+    -- the callee sees how long the caller still waits
+    local left = moon.co_call_timeout(1000, "lua", callee, "LEFT")
+    assert(left > 900 and left <= 1000, left)
+    assert(moon.co_call("lua", callee, "LEFT") == nil)
+
+    -- a request still queued when its deadline passes is never handled
+    local before = moon.co_call("lua", callee, "HANDLED")
+    moon.async(function()
+        moon.co_call("lua", callee, "BUSY", 100)
+    end)
+    ok, err = moon.co_call_timeout(20, "lua", callee, "ECHO", 1)
+    assert(ok == false and err == "timeout", err)
+    moon.sleep(100)
+    local handled = moon.co_call("lua", callee, "HANDLED")
+    assert(handled == before + 2, handled - before)
+    print("check ok")
+end
+
+local function run(callee, concurrency, count)
+    local bt = clock()
+    local done = 0
+    for _ = 1, concurrency do
+        moon.async(function()
+            for i = 1, count do
+                assert(moon.co_call("lua", callee, "ECHO", i) == i)
+            end
+            done = done + 1
+        end)
+    end
+    while done < concurrency do
+        moon.sleep(5)
+    end
+    local cost = clock() - bt
+    local n = concurrency * count
+    print(string.format("co_call %d x %d cost %.3fs (%.0f calls/s)", concurrency, count, cost, n / cost))
+end
+
+-- callees exit while many calls are pending, each exit fails only its own callers
+local function service_exit(ncallee, pending)
+    local callees = {}
+    for i = 1, ncallee do
+        callees[i] = new_callee("call_bench_exit" .. i)
+    end
+    local failed = 0
+    for i = 1, pending do
+        moon.async(function()
+            local ok = moon.co_call("lua", callees[i % ncallee + 1], "NEVER")
+            assert(ok == false)
+            failed = failed + 1
+        end)
+    end
+    moon.sleep(100)
+
+    local bt = clock()
+    for i = 1, ncallee do
+        moon.send("lua", callees[i], "EXIT")
+    end
+    while failed < pending do
+        moon.sleep(1)
+    end
+    print(string.format("%d services exit with %d pending calls cost %.3fs", ncallee, pending, clock() - bt))
+end
+
+local function deadline_timeouts(n)
+    local callee = new_callee("call_bench_deadline")
+    local bt = clock()
+    local timeouts = 0
+    for _ = 1, n do
+        moon.async(function()
+            local ok, err = moon.co_call_timeout(100, "lua", callee, "NEVER")
+            assert(ok == false and err == "timeout", err)
+            timeouts = timeouts + 1
+        end)
+    end
+    while timeouts < n do
+        moon.sleep(5)
+    end
+    print(string.format("%d calls timed out after %.3fs", n, clock() - bt))
+end
+
+if conf and conf.caller then
+    moon.async(function()
+        local callee = new_callee("call_bench_callee")
+        check(callee)
+        run(callee, 1, 200000)
+        run(callee, 100, 2000)
+        run(callee, 5000, 40)
+        service_exit(100, 100000)
+        deadline_timeouts(100000)
+        moon.exit(-1)
+    end)
+    return
+end
+
+-- _service_exit is only delivered to unique services
+moon.async(function()
+    moon.new_service("lua", {name = "call_bench_caller", file = "call_benchmark.lua", caller = true, unique = true})
+end)
@@ -0,0 +1,100 @@
+---__init__
+if _G["__init__"] then
+    return {
+        thread = 2,
+        enable_console = true,
+    }
+end
+
+local moon = require("moon")
+
+local conf = ...
+
+local N = 1000000
+local RECORD = string.rep("x", 64)
+
+if conf and conf.consumer then
+    local received = 0
+    local bytes = 0
+    local waiting
+
+    local function on_record(data)
+        received = received + 1
+        bytes = bytes + #data
+        if waiting and received >= waiting[1] then
+            local co = waiting[2]
+            waiting = nil
+            moon.wakeup(co)
+        end
+    end
+
+    moon.dispatch("text", function(msg)
+        on_record(moon.decode(msg, "Z"))
+    end)
+
+    moon.channel_dispatch(on_record)
+
+    local command = {}
+
+    command.WAIT = function(n)
+        if received < n then
+            waiting = {n, coroutine.running()}
+            coroutine.yield()
+        end
+        local r, b = received, bytes
+        received, bytes = 0, 0
+        return r, b
+    end
+
+    moon.dispatch("lua", function(msg, unpack)
+        local sender, sessionid, sz, len = moon.decode(msg, "SEC")
+        local args = {unpack(sz, len)}
+        moon.async(function()
+            moon.response("lua", sender, sessionid, command[args[1]](table.unpack(args, 2)))
+        end)
+    end)
+    return
+end
+
+local clock = moon.clock
+
+local function report(name, cost)
+    print(string.format("%-12s %d records of %d bytes: %.3fs, %.0f records/s", name, N, #RECORD, cost, N / cost))
+end
+
+moon.async(function()
+    -- bootstrap runs on worker 1, the consumer on worker 2
+    local consumer = moon.new_service("lua", {name = "channel_consumer", file = "channel_benchmark.lua", consumer = true, threadid = 2})
+
+    local bt = clock()
+    for i = 1, N do
+        moon.send("text", consumer, RECORD)
+        if i % 10000 == 0 then
+            moon.sleep(0)
+        end
+    end
+    assert(moon.co_call("lua", consumer, "WAIT", N) == N)
+    report("moon.send", clock() - bt)
+
+    local ch = moon.channel(consumer, 4 * 1024 * 1024)
+    local full = 0
+    bt = clock()
+    for i = 1, N do
+        while not ch:write(RECORD) do
+            full = full + 1
+            moon.sleep(0)
+        end
+        if i % 10000 == 0 then
+            moon.sleep(0)
+        end
+    end
+    local received, bytes = moon.co_call("lua", consumer, "WAIT", N)
+    assert(received == N and bytes == N * #RECORD)
+    report("moon.channel", clock() - bt)
+    local stats = ch:stats()
+    print(string.format("channel writes %d, full %d times, capacity %d", stats.writes, stats.full, stats.capacity))
+
+    ch:close()
+    assert(not ch:write(RECORD))
+    moon.exit(-1)
+end)
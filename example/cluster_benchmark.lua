@@ -0,0 +1,166 @@
+---__init__
+if _G["__init__"] then
+    return {
+        thread = 4,
+        enable_console = true,
+    }
+end
+
+local moon = require("moon")
+
+local conf = ...
+
+local HOST = "127.0.0.1"
+local PORT = 42400
+local NODE = 1
+-- same peer as NODE, through a batched and compressed link
+local NODE_LZ = 2
+-- batched without compression
+local NODE_BATCH = 3
+
+if conf and conf.receiver then
+    local count = 0
+
+    local command = {}
+
+    command.ACCUM = function(...)
+        local total = 0
+        for _, v in ipairs({...}) do
+            total = total + v
+        end
+        return total
+    end
+
+    command.ECHO = function(data)
+        return data
+    end
+
+    command.COUNTER = function()
+        count = count + 1
+    end
+
+    command.COUNT = function()
+        return count
+    end
+
+    moon.dispatch("lua", function(msg, unpack)
+        local sender, sessionid, sz, len = moon.decode(msg, "SEC")
+        local function docmd(cmd, ...)
+            local res = command[cmd](...)
+            if sessionid ~= 0 then
+                moon.response("lua", sender, sessionid, res)
+            end
+        end
+        docmd(unpack(sz, len))
+    end)
+    return
+end
+
+-------------------------------------------------------------------------------
+
+package.path = package.path .. ";../service/?.lua"
+
+local cluster = require("cluster")
+
+local clock = moon.clock
+
+-- the node calls itself: frames leave through the outbound connection of the
+-- router and come back through the connection it accepted
+local RECEIVER = "cluster_bench_receiver"
+
+local function check(NODE)
+    local args = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10}
+    assert(cluster.call(NODE, RECEIVER, "ACCUM", table.unpack(args)) == 55)
+
+    local big = string.rep("x", 1024 * 1024)
+    assert(cluster.call(NODE, RECEIVER, "ECHO", big) == big)
+
+    local ok, err = cluster.call(NODE, "no_such_service", "ACCUM", 1)
+    assert(not ok and err:find("service not found"), err)
+
+    ok, err = cluster.call(99, RECEIVER, "ACCUM", 1)
+    assert(not ok and err:find("resolve node 99 failed"), err)
+    print("check ok", NODE)
+end
+
+local function run_call(NODE, concurrency, count)
+    local bt = clock()
+    local done = 0
+    for _ = 1, concurrency do
+        moon.async(function()
+            for i = 1, count do
+                assert(cluster.call(NODE, RECEIVER, "ACCUM", i, 1) == i + 1)
+            end
+            done = done + 1
+        end)
+    end
+    while done < concurrency do
+        moon.sleep(10)
+    end
+    local cost = clock() - bt
+    local n = concurrency * count
+    print(string.format("node %d call %d x %d cost %.3fs (%.0f calls/s)", NODE, concurrency, count, cost, n / cost))
+end
+
+-- a typical game state update, field names and most values repeat
+local function make_update(i)
+    return {
+        uid = 100000 + i % 100,
+        name = "player_" .. (i % 100),
+        pos = {x = i % 512, y = 64, z = i % 256},
+        hp = 100, mp = 50,
+        buffs = {"speed", "shield", "regen"},
+    }
+end
+
+local function run_send(NODE, count, payload)
+    local before = cluster.call(NODE, RECEIVER, "COUNT")
+    local bt = clock()
+    for i = 1, count do
+        cluster.send(NODE, RECEIVER, "COUNTER", payload and payload(i))
+    end
+    -- frames of one connection arrive in order, the call returns after the sends
+    local after = cluster.call(NODE, RECEIVER, "COUNT")
+    local cost = clock() - bt
+    assert(after - before == count, after - before)
+    print(string.format("node %d send %d%s cost %.3fs (%.0f msgs/s)", NODE, count, payload and " updates" or "", cost, count / cost))
+end
+
+moon.async(function()
+    moon.new_service("lua", {
+        unique = true,
+        name = RECEIVER,
+        file = "cluster_benchmark.lua",
+        receiver = true,
+    })
+
+    local addr = moon.new_service("lua", {
+        unique = true,
+        name = "cluster",
+        file = "../service/cluster.lua",
+        host = HOST,
+        port = PORT,
+    })
+    assert(moon.co_call("lua", addr, "Start"))
+    cluster.set_node(NODE, HOST, PORT)
+    cluster.set_node(NODE_LZ, HOST, PORT, {batch_bytes = 16384, delay_us = 200, compress = true})
+    cluster.set_node(NODE_BATCH, HOST, PORT, {batch_bytes = 16384, delay_us = 200})
+
+    for _, node in ipairs({NODE, NODE_BATCH, NODE_LZ}) do
+        check(node)
+        run_call(node, 1, 20000)
+        run_call(node, 100, 2000)
+        run_send(node, 200000)
+        run_send(node, 200000, make_update)
+    end
+
+    local stats = moon.co_call("lua", addr, "Stats")
+    print(string.format("frames in %d out %d, bytes in %d out %d, call errors %d",
+        stats.frames_in, stats.frames_out, stats.bytes_in, stats.bytes_out, stats.call_errors))
+    for _, l in ipairs(stats.links) do
+        print(string.format("link fd %d node %d compress %s: %d frames in %d batches, out raw %d wire %d (%.1f%%), in raw %d wire %d, compress %.1fms decompress %.1fms",
+            l.fd, l.node, tostring(l.compress), l.frames, l.batches, l.raw_out, l.wire_out,
+            l.raw_out > 0 and 100 * l.wire_out / l.raw_out or 0, l.raw_in, l.wire_in, l.compress_ms, l.decompress_ms))
+    end
+    moon.exit(-1)
+end)
@@ -0,0 +1,107 @@
+local moon = require("moon")
+local datatable = require("datatable")
+
+local conf = ...
+
+local N = 100000
+local PATH = "datatable_benchmark.dt"
+
+local function make_data()
+    local items = {}
+    local quality = {"common", "rare", "epic", "legendary"}
+    for i = 1, N do
+        items[i] = {
+            id = 100000 + i,
+            name = "item_" .. i,
+            quality = quality[i % 4 + 1],
+            price = i * 1.5,
+            stack = i % 7 == 0,
+            attrs = {attack = i % 100, defense = i % 50, {1, 2, 3}},
+        }
+    end
+    return {items = items, version = 3, [2.5] = "float", [true] = "yes"}
+end
+
+local function sum(items)
+    local total = 0
+    for i = 1, #items do
+        local item = items[i]
+        total = total + item.attrs.attack + item.price
+    end
+    return total
+end
+
+if conf and conf.reader then
+    moon.dispatch("lua", function(msg, unpack)
+        local sender, sessionid, sz, len = moon.decode(msg, "SEC")
+        local cmd = unpack(sz, len)
+        collectgarbage("collect")
+        local before = collectgarbage("count")
+        local data
+        if cmd == "datatable" then
+            data = assert(datatable.open(PATH))
+        else
+            data = make_data()
+        end
+        collectgarbage("collect")
+        local kb = collectgarbage("count") - before
+        local bt = moon.clock()
+        local total = 0
+        for _ = 1, 10 do
+            total = total + sum(data.items)
+        end
+        moon.response("lua", sender, sessionid, kb, moon.clock() - bt, total)
+    end)
+    return
+end
+
+moon.async(function()
+    local bt = moon.clock()
+    assert(datatable.save(PATH, make_data()))
+    print(string.format("build and save %d items: %.3fs, %.2f MB on disk", N, moon.clock() - bt, #io.readfile(PATH) / 1024 / 1024))
+
+    -- semantics
+    local data = assert(datatable.open(PATH))
+    local items = data.items
+    assert(#items == N and data.version == 3 and data[2.5] == "float" and data[true] == "yes")
+    assert(items[7].stack == true and items[8].stack == false and items[N + 1] == nil)
+    assert(items[10].name == "item_10" and items[10].quality == "epic" and items[10].price == 15.0)
+    assert(items[10].attrs[1][3] == 3 and #items[10].attrs == 1)
+    assert(items[5] == data.items[5] and items[5] ~= items[6])
+    assert(not pcall(function() items[1] = 1 end))
+    local keys = {}
+    for k, v in pairs(items[3]) do
+        keys[#keys + 1] = k
+        assert(items[3][k] == v)
+    end
+    assert(#keys == 6)
+    local n = 0
+    for i, v in ipairs(items) do
+        n = n + 1
+        assert(v.id == 100000 + i)
+    end
+    assert(n == N)
+    assert(not datatable.open("not_exist.dt"))
+
+    local expect = sum(make_data().items)
+    local readers = {}
+    for i = 1, 4 do
+        readers[i] = moon.new_service("lua", {name = "reader" .. i, file = "datatable_benchmark.lua", reader = true})
+    end
+    for _, mode in ipairs({"lua table", "datatable"}) do
+        local kb, cost = 0, 0
+        for _, id in ipairs(readers) do
+            local k, c, total = moon.co_call("lua", id, mode)
+            assert(math.abs(total - expect * 10) < 1e-3)
+            kb, cost = kb + k, cost + c
+        end
+        print(string.format("%-9s %d services: lua heap %.2f MB total, 10 scans %.3fs per service",
+            mode, #readers, kb / 1024, cost / #readers))
+    end
+
+    for _, id in ipairs(readers) do
+        moon.remove_service(id, true)
+    end
+    os.remove(PATH)
+    moon.exit(-1)
+end)
@@ -0,0 +1,78 @@
+local moon = require("moon")
+
+local clock = moon.clock
+local co_running = coroutine.running
+local co_yield = coroutine.yield
+local co_resume = coroutine.resume
+
+local COUNT = 200000
+
+-- the old wakeup path: a PTYPE_TIMER message through the worker mailbox
+local function timer_wakeup(co)
+    moon.timeout(0, function()
+        assert(co_resume(co))
+    end)
+end
+
+-- two coroutines resume each other COUNT times
+local function ping_pong(name, wakeup)
+    local done = false
+    local a, b
+    local n = 0
+
+    a = moon.async(function()
+        a = co_running()
+        co_yield()
+        while n < COUNT do
+            n = n + 1
+            wakeup(b)
+            co_yield()
+        end
+        done = true
+        wakeup(b)
+    end)
+
+    local bt = clock()
+    b = moon.async(function()
+        b = co_running()
+        wakeup(a)
+        co_yield()
+        while not done do
+            wakeup(a)
+            co_yield()
+        end
+    end)
+
+    while not done do
+        moon.sleep(10)
+    end
+    local cost = clock() - bt
+    print(string.format("%s ping-pong %d cost %.3fs (%.0f switches/s)", name, COUNT, cost, COUNT / cost))
+end
+
+local function check()
+    local order = {}
+    moon.defer(function()
+        order[#order + 1] = 1
+        -- deferred from a deferred task: runs in the next turn
+        moon.defer(function()
+            order[#order + 1] = 3
+        end)
+    end)
+    moon.defer(function()
+        error("deferred task error is logged, later tasks still run")
+    end)
+    moon.defer(function()
+        order[#order + 1] = 2
+    end)
+    moon.sleep(10)
+    assert(#order == 3 and order[1] == 1 and order[2] == 2 and order[3] == 3)
+    print("check ok")
+end
+
+moon.async(function()
+    check()
+    ping_pong("timeout(0)", timer_wakeup)
+    ping_pong("defer", moon.wakeup)
+    moon.exit(-1)
+end)
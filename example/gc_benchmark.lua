@@ -0,0 +1,69 @@
+local moon = require("moon")
+
+local conf = ...
+
+if conf and conf.worker then
+    -- a live set that the collector has to traverse, plus garbage per message
+    local live = {}
+    for i = 1, 200000 do
+        live[i] = {id = i, name = "live" .. i}
+    end
+
+    local command = {}
+
+    command.WORK = function(n)
+        local t = {}
+        for i = 1, n do
+            t[i] = {id = i, name = "tmp" .. i}
+        end
+        live[math.random(1, #live)] = t[n]
+        return #t
+    end
+
+    moon.dispatch("lua", function(msg, unpack)
+        local sender, sessionid, sz, len = moon.decode(msg, "SEC")
+        local args = {unpack(sz, len)}
+        moon.response("lua", sender, sessionid, command[args[1]](table.unpack(args, 2)))
+    end)
+    return
+end
+
+local clock = moon.clock
+
+local function run(gcmode)
+    local target = moon.new_service("lua", {
+        name = "gc_" .. gcmode,
+        file = "gc_benchmark.lua",
+        worker = true,
+        gcmode = gcmode,
+    })
+
+    local costs = {}
+    local bt = clock()
+    for i = 1, 5000 do
+        local t = clock()
+        assert(moon.co_call("lua", target, "WORK", 200) == 200)
+        costs[i] = clock() - t
+        if i % 50 == 0 then
+            -- leave the worker some idle time, as a real gateway would have
+            moon.sleep(1)
+        end
+    end
+    local total = clock() - bt
+    table.sort(costs)
+
+    local stat = moon.co_call("debug", target, "gcstat")
+    print(string.format("%-8s total %.3fs call p50 %.1fus p99 %.1fus max %.1fus | gc steps %d total %.1fms p99 %dus max %dus%s",
+        gcmode, total, costs[#costs // 2] * 1e6, costs[#costs * 99 // 100] * 1e6, costs[#costs] * 1e6,
+        stat.steps, stat.total_us / 1000, stat.p99_us, stat.max_us,
+        stat.cycles and string.format(" cycles %d", stat.cycles) or ""))
+    assert(stat.mode == gcmode)
+    moon.remove_service(target, true)
+end
+
+moon.async(function()
+    run("gen")
+    run("inc")
+    run("adaptive")
+    moon.exit(-1)
+end)
@@ -0,0 +1,188 @@
+---__init__
+if _G["__init__"] then
+    return {
+        thread = 2,
+        enable_console = true,
+    }
+end
+
+local moon = require("moon")
+
+local conf = ...
+
+local HOST = "127.0.0.1"
+local PORT = 18001
+
+if conf and conf.server then
+    local http_server = require("moon.http.server")
+
+    -- clients closing keep-alive connections are expected here
+    http_server.error = function() end
+
+    http_server.on("/ping", function(_, response)
+        response:write_header("Content-Type", "text/plain")
+        response:write("pong")
+    end)
+
+    http_server.on("/echo", function(request, response)
+        response:write_header("Content-Type", "text/plain")
+        response:write(request.content)
+    end)
+
+    http_server.content_max_len = 1024 * 1024
+
+    http_server.listen(HOST, PORT)
+    return
+end
+
+-------------------------------------------------------------------------------
+
+local http = require("http")
+local socket = require("moon.socket")
+local httpc = require("moon.http.client")
+
+local clock = moon.clock
+local decode = moon.decode
+
+local ADDRESS = HOST .. ":" .. PORT
+
+-- chunked, interim 100 Continue and close delimited bodies from a raw socket server
+local function check_client()
+    local RAW_PORT = PORT + 1
+    local listenfd = socket.listen(HOST, RAW_PORT, moon.PTYPE_TEXT)
+    local replies = {
+        "HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5;ext=1\r\nhello\r\n6\r\n world\r\n0\r\nX-Trailer: 1\r\n\r\n",
+        "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\n\r\nuntil close",
+    }
+    moon.async(function()
+        for i = 1, #replies do
+            local fd = socket.accept(listenfd)
+            socket.readline(fd, "\r\n\r\n")
+            socket.write_then_close(fd, replies[i])
+        end
+        socket.close(listenfd)
+    end)
+    local res = httpc.get(HOST .. ":" .. RAW_PORT, { path = "/" })
+    assert(res.content == "hello world" and res.header["transfer-encoding"] == "chunked", res.content)
+    local err
+    res, err = httpc.get(HOST .. ":" .. RAW_PORT, { path = "/" })
+    assert(res and res.content == "until close", err)
+    assert(res.version == "1.0")
+
+    res = httpc.post(ADDRESS, "hello", { path = "/echo" })
+    assert(res.status_code == "200 OK" and res.content == "hello")
+    print("check ok")
+end
+
+local PING = "GET /ping HTTP/1.1\r\nHost: " .. ADDRESS .. "\r\n\r\n"
+
+local function read_response(fd)
+    local msg, err = socket.read_http(fd, 1)
+    assert(msg, err)
+    local ok, _, status_code, header, content = http.decode_response(decode(msg, "C"))
+    assert(ok)
+    return status_code, content, header
+end
+
+-- pipelined, chunked, 100-continue and oversized requests from a raw client
+local function check_server()
+    local fd = socket.connect(HOST, PORT, moon.PTYPE_SOCKET_HTTP)
+    socket.write(fd, PING .. "POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+        .. "3\r\nabc\r\n2;x=y\r\nde\r\n0\r\n\r\n" .. PING)
+    local status_code, content = read_response(fd)
+    assert(status_code == "200 OK" and content == "pong")
+    status_code, content = read_response(fd)
+    assert(status_code == "200 OK" and content == "abcde", content)
+    assert(select(2, read_response(fd)) == "pong")
+
+    socket.write(fd, "POST /echo HTTP/1.1\r\nContent-Length: 5\r\nExpect: 100-continue\r\n\r\n")
+    -- interim 100 Continue is skipped by the client side parser
+    moon.sleep(10)
+    socket.write(fd, "hello")
+    assert(select(2, read_response(fd)) == "hello")
+
+    socket.write(fd, "GET /ping HTTP/1.1\r\nConnection: close\r\n\r\n")
+    assert(select(2, read_response(fd)) == "pong")
+    local msg, err = socket.read_http(fd, 1)
+    assert(not msg and err == "EOF", err)
+
+    -- body over content_max_len closes the connection
+    fd = socket.connect(HOST, PORT, moon.PTYPE_SOCKET_HTTP)
+    socket.write(fd, "POST /echo HTTP/1.1\r\nContent-Length: 2000000\r\n\r\n")
+    msg, err = socket.read_http(fd, 1)
+    assert(not msg, err)
+    print("check server ok")
+end
+
+-- wrk style: persistent connections, each keeping `depth` requests in flight
+local function run_pipeline(name, connections, count, depth)
+    local batch = string.rep(PING, depth)
+    local bt = clock()
+    local done = 0
+    for _ = 1, connections do
+        moon.async(function()
+            local fd = socket.connect(HOST, PORT, moon.PTYPE_SOCKET_HTTP)
+            assert(fd)
+            socket.setnodelay(fd)
+            for _ = 1, count // depth do
+                socket.write(fd, batch)
+                for _ = 1, depth do
+                    local _, content = read_response(fd)
+                    assert(content == "pong")
+                end
+            end
+            socket.close(fd)
+            done = done + 1
+        end)
+    end
+    while done < connections do
+        moon.sleep(10)
+    end
+    local cost = clock() - bt
+    local n = connections * count
+    print(string.format("%-12s %d x %d requests cost %.3fs (%.0f requests/s)", name, connections, count, cost, n / cost))
+end
+
+local function run(name, concurrency, count, options)
+    local bt = clock()
+    local done = 0
+    for _ = 1, concurrency do
+        moon.async(function()
+            for _ = 1, count do
+                local res, err = httpc.get(ADDRESS, options)
+                assert(res and res.content == "pong", err)
+            end
+            done = done + 1
+        end)
+    end
+    while done < concurrency do
+        moon.sleep(10)
+    end
+    local cost = clock() - bt
+    local n = concurrency * count
+    print(string.format("%-12s %d x %d requests cost %.3fs (%.0f requests/s)", name, concurrency, count, cost, n / cost))
+end
+
+moon.async(function()
+    moon.new_service("lua", {
+        name = "http_server",
+        file = "http_benchmark.lua",
+        server = true,
+    })
+
+    check_client()
+    check_server()
+
+    run("new conn", 10, 200, { path = "/ping", keepalive = false })
+    run("keep-alive", 10, 2000, { path = "/ping" })
+    run_pipeline("pipeline(1)", 50, 2000, 1)
+    run_pipeline("pipeline(16)", 50, 8000, 16)
+
+    local stats = httpc.stats(ADDRESS)
+    print(string.format("requests %d errors %d connects %d reuses %d idle %d avg %.3fms",
+        stats.requests, stats.errors, stats.connects, stats.reuses, stats.idle, stats.avg_ms))
+    for _, v in ipairs(stats.latency_ms) do
+        print(string.format("  <= %s ms: %d", tostring(v[1]), v[2]))
+    end
+    moon.exit(-1)
+end)
@@ -0,0 +1,84 @@
+local moon = require("moon")
+
+local conf = ...
+
+if conf and conf.worker then
+    local leaked = {}
+
+    local function leak(n)
+        for i = 1, n do
+            leaked[#leaked + 1] = {id = i, name = "leak" .. i}
+        end
+    end
+
+    local function churn(n)
+        local t = {}
+        for i = 1, n do
+            t[i] = {id = i, name = "churn" .. i}
+        end
+        return #t
+    end
+
+    local command = {}
+
+    command.WORK = function(n)
+        for _ = 1, n do
+            leak(100)
+            churn(1000)
+        end
+        return n
+    end
+
+    moon.dispatch("lua", function(msg, unpack)
+        local sender, sessionid, sz, len = moon.decode(msg, "SEC")
+        local args = {unpack(sz, len)}
+        moon.async(function()
+            moon.response("lua", sender, sessionid, command[args[1]](table.unpack(args, 2)))
+        end)
+    end)
+    return
+end
+
+local clock = moon.clock
+
+local function work(target, rounds)
+    local bt = clock()
+    for _ = 1, rounds do
+        assert(moon.co_call("lua", target, "WORK", 100) == 100)
+    end
+    return clock() - bt
+end
+
+moon.async(function()
+    local target = moon.new_service("lua", {name = "memtrace_worker", file = "memtrace_benchmark.lua", worker = true})
+
+    print(string.format("memtrace off: %.3fs", work(target, 20)))
+
+    assert(moon.co_call("debug", target, "memtrace_start", 64 * 1024))
+    assert(not moon.co_call("debug", target, "memtrace_start"))
+    print(string.format("memtrace on: %.3fs", work(target, 20)))
+    moon.co_call("debug", target, "gc")
+
+    local top = moon.co_call("debug", target, "memtrace_report", 5)
+    local folded = moon.co_call("debug", target, "memtrace_stop")
+    print(string.format("memtrace off again: %.3fs", work(target, 20)))
+
+    local total = 0
+    for _, bytes in folded:gmatch("([^\n]+) (%d+)\n") do
+        total = total + tonumber(bytes)
+    end
+    -- the leaked tables outlive the gc, the churned ones do not
+    local first = top:match("^([^\n]+) %d+\n")
+    assert(first and first:find("memtrace_benchmark.lua:%d+;memtrace_benchmark.lua:10$"), first)
+    print(string.format("estimated live %.2f MB, top 5 sites:", total / 1024 / 1024))
+    for stack, bytes in top:gmatch("([^\n]+) (%d+)\n") do
+        if #stack > 150 then
+            stack = "..." .. stack:sub(-147)
+        end
+        print(string.format("%10d  %s", bytes, stack))
+    end
+
+    io.writefile("memtrace_benchmark.folded", folded)
+    print("live bytes per stack written to memtrace_benchmark.folded, render with flamegraph.pl")
+    moon.exit(-1)
+end)
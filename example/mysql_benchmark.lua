@@ -0,0 +1,394 @@
+---__init__
+if _G["__init__"] then
+    return {
+        thread = 2,
+        enable_console = true,
+    }
+end
+
+local moon = require("moon")
+local socket = require("moon.socket")
+local mysql = require("moon.db.mysql")
+
+local conf = ...
+
+local HOST = "127.0.0.1"
+local PORT = 13306
+
+local strpack = string.pack
+local strunpack = string.unpack
+local strbyte = string.byte
+local strsub = string.sub
+local tbconcat = table.concat
+
+if conf and conf.stub then
+    -- minimal mysql-compatible server: handshake, any credentials, and
+    -- "select N" answered by a generated result set of N rows, as text
+    -- query or as prepared statement
+    local core = require("mysql.core")
+
+    local function lenenc(n)
+        if n < 251 then
+            return string.char(n)
+        elseif n < (1 << 16) then
+            return strpack("<BI2", 0xfc, n)
+        end
+        return strpack("<BI3", 0xfd, n)
+    end
+
+    local function lenstr(s)
+        return lenenc(#s) .. s
+    end
+
+    local function packet(seq, payload)
+        return strpack("<I3B", #payload, seq & 0xff) .. payload
+    end
+
+    local function column(name, typ, flags)
+        return lenstr("def") .. lenstr("bench") .. lenstr("users") .. lenstr("users")
+            .. lenstr(name) .. lenstr(name)
+            .. strpack("<BI2I4BI2Bxx", 0x0c, 33, 64, typ, flags, 0)
+    end
+
+    local EOF = "\xfe\0\0\2\0"
+
+    local cache = {}
+
+    local function result_set(nrows)
+        local data = cache[nrows]
+        if data then
+            return data
+        end
+        local out = {}
+        local seq = 1
+        local function put(payload)
+            out[#out + 1] = packet(seq, payload)
+            seq = seq + 1
+        end
+        put(lenenc(5))
+        put(column("id", 0x08, 0))
+        put(column("name", 0xfd, 0))
+        put(column("score", 0x05, 0))
+        put(column("level", 0x03, 0))
+        put(column("created", 0x0c, 0))
+        put(EOF)
+        for i = 1, nrows do
+            put(lenstr(tostring(i)) .. lenstr("player_" .. i) .. lenstr(tostring(i * 1.5))
+                .. lenstr(tostring(i % 100)) .. lenstr("2024-01-01 00:00:00"))
+        end
+        put(EOF)
+        data = tbconcat(out)
+        cache[nrows] = data
+        return data
+    end
+
+    local binary_cache = {}
+
+    local function binary_result_set(nrows)
+        local data = binary_cache[nrows]
+        if data then
+            return data
+        end
+        local out = {}
+        local seq = 1
+        local function put(payload)
+            out[#out + 1] = packet(seq, payload)
+            seq = seq + 1
+        end
+        put(lenenc(5))
+        put(column("id", 0x08, 0))
+        put(column("name", 0xfd, 0))
+        put(column("score", 0x05, 0))
+        put(column("level", 0x03, 0))
+        put(column("created", 0x0c, 0))
+        put(EOF)
+        for i = 1, nrows do
+            put("\0\0" .. strpack("<i8", i) .. lenstr("player_" .. i) .. strpack("<d", i * 1.5)
+                .. strpack("<i4", i % 100) .. "\7" .. strpack("<I2BBBBB", 2024, 1, 1, 0, 0, 0))
+        end
+        put(EOF)
+        data = tbconcat(out)
+        binary_cache[nrows] = data
+        return data
+    end
+
+    -- prepare: "select N ..." with ? parameters, executing it returns N rows
+    local stmts = {}
+    local stmt_id = 0
+
+    local function prepare(sql)
+        stmt_id = stmt_id + 1
+        local nparams = select(2, string.gsub(sql, "%?", ""))
+        stmts[stmt_id] = tonumber(string.match(sql, "select (%d+)")) or 0
+        local out = { packet(1, strpack("<BI4I2I2BI2", 0, stmt_id, 5, nparams, 0, 0)) }
+        local seq = 2
+        local function put(payload)
+            out[#out + 1] = packet(seq, payload)
+            seq = seq + 1
+        end
+        for i = 1, nparams do
+            put(column("?", 0xfd, 0))
+        end
+        if nparams > 0 then
+            put(EOF)
+        end
+        for _, name in ipairs({ "id", "name", "score", "level", "created" }) do
+            put(column(name, 0xfd, 0))
+        end
+        put(EOF)
+        return tbconcat(out)
+    end
+
+    local OK = "\0\0\0\2\0\0\0"
+
+    local function serve(fd)
+        local handshake = "\10" .. "5.7.0-stub\0" .. strpack("<I4", 1) .. "12345678\0"
+            .. strpack("<I2BI2I2B", 0xf7ff, 33, 2, 0x8000, 21) .. string.rep("\0", 10) .. "123456789012\0"
+        socket.write(fd, packet(0, handshake))
+        while true do
+            local msg = socket.read_mysql(fd, 1)
+            if not msg then
+                socket.close(fd)
+                return
+            end
+            local payload, seq = core.packet(moon.decode(msg, "C"))
+            local cmd = strbyte(payload, 1)
+            if seq == 1 then
+                -- auth
+                socket.write(fd, packet(2, OK))
+            elseif cmd == 0x03 then
+                local n = tonumber(string.match(payload, "select (%d+)")) or 0
+                socket.write(fd, result_set(n))
+            elseif cmd == 0x16 then
+                socket.write(fd, prepare(strsub(payload, 2)))
+            elseif cmd == 0x17 then
+                local nrows = stmts[strunpack("<I4", payload, 2)]
+                socket.write(fd, binary_result_set(nrows))
+            elseif cmd == 0x19 then
+                stmts[strunpack("<I4", payload, 2)] = nil
+            elseif cmd == 0x01 then
+                socket.close(fd)
+                return
+            else
+                socket.write(fd, packet(1, OK))
+            end
+        end
+    end
+
+    local listenfd = socket.listen(HOST, PORT, moon.PTYPE_SOCKET_MYSQL)
+    moon.async(function()
+        while true do
+            local fd = socket.accept(listenfd)
+            if fd then
+                socket.setnodelay(fd)
+                moon.async(function()
+                    serve(fd)
+                end)
+            end
+        end
+    end)
+    return
+end
+
+-------------------------------------------------------------------------------
+-- Reference: the Lua parser moon.db.mysql used before the native decoder.
+-- Two socket reads per packet and string.unpack/string.sub per column.
+
+local lua_parser = {}
+
+do
+    local converters = {}
+    for i = 0x01, 0x05 do
+        converters[i] = tonumber
+    end
+    converters[0x08] = tonumber
+    converters[0x09] = tonumber
+    converters[0x0d] = tonumber
+    converters[0xf6] = tonumber
+
+    local function _from_length_coded_bin(data, pos)
+        local first = strbyte(data, pos)
+        if not first then
+            return nil, pos
+        end
+        if first >= 0 and first <= 250 then
+            return first, pos + 1
+        end
+        if first == 251 then
+            return nil, pos + 1
+        end
+        if first == 252 then
+            return strunpack("<I2", data, pos + 1)
+        end
+        if first == 253 then
+            return strunpack("<I3", data, pos + 1)
+        end
+        if first == 254 then
+            return strunpack("<I8", data, pos + 1)
+        end
+        return false, pos + 1
+    end
+
+    local function _from_length_coded_str(data, pos)
+        local len
+        len, pos = _from_length_coded_bin(data, pos)
+        if len == nil then
+            return nil, pos
+        end
+        return strsub(data, pos, pos + len - 1), pos + len
+    end
+
+    local function _recv_packet(fd)
+        local data = socket.read(fd, 4)
+        local len = strunpack("<I3", data, 1)
+        data = socket.read(fd, len)
+        local first = strbyte(data, 1)
+        local typ = "DATA"
+        if first == 0x00 then
+            typ = "OK"
+        elseif first == 0xff then
+            typ = "ERR"
+        elseif first == 0xfe then
+            typ = "EOF"
+        end
+        return data, typ
+    end
+
+    local function _parse_field_packet(data)
+        local col = {}
+        local _, pos = _from_length_coded_str(data, 1)
+        _, pos = _from_length_coded_str(data, pos)
+        _, pos = _from_length_coded_str(data, pos)
+        _, pos = _from_length_coded_str(data, pos)
+        col.name, pos = _from_length_coded_str(data, pos)
+        _, pos = _from_length_coded_str(data, pos)
+        pos = pos + 1
+        _, pos = strunpack("<I2", data, pos)
+        _, pos = strunpack("<I4", data, pos)
+        col.type = strbyte(data, pos)
+        return col
+    end
+
+    local function _parse_row_data_packet(data, cols)
+        local value, col, conv
+        local pos = 1
+        local row = {}
+        for i = 1, #cols do
+            value, pos = _from_length_coded_str(data, pos)
+            col = cols[i]
+            if value ~= nil then
+                conv = converters[col.type]
+                if conv then
+                    value = conv(value)
+                end
+            end
+            row[col.name] = value
+        end
+        return row
+    end
+
+    function lua_parser.connect()
+        local fd = socket.connect(HOST, PORT, moon.PTYPE_TEXT)
+        _recv_packet(fd)
+        socket.write(fd, strpack("<I3B", 33, 1) .. strpack("<I4I4B", 260047, 1024 * 1024, 33) .. string.rep("\0", 24))
+        _recv_packet(fd)
+        return fd
+    end
+
+    function lua_parser.query(fd, sql)
+        socket.write(fd, strpack("<I3B", #sql + 1, 0) .. "\3" .. sql)
+        local packet = _recv_packet(fd)
+        local field_count = _from_length_coded_bin(packet, 1)
+        local cols = {}
+        for i = 1, field_count do
+            cols[i] = _parse_field_packet((_recv_packet(fd)))
+        end
+        _recv_packet(fd)
+        local rows = {}
+        local i = 0
+        while true do
+            local typ
+            packet, typ = _recv_packet(fd)
+            if typ == "EOF" then
+                break
+            end
+            i = i + 1
+            rows[i] = _parse_row_data_packet(packet, cols)
+        end
+        return rows
+    end
+end
+
+-------------------------------------------------------------------------------
+
+local clock = moon.clock
+
+local function bench(name, rounds, nrows, fn)
+    collectgarbage("collect")
+    local mem = collectgarbage("count")
+    collectgarbage("stop")
+    local bt = clock()
+    local res
+    for _ = 1, rounds do
+        res = fn()
+    end
+    local cost = clock() - bt
+    local garbage = collectgarbage("count") - mem
+    collectgarbage("restart")
+    assert(#res == nrows and res[nrows].id == nrows and res[nrows].name == "player_" .. nrows)
+    print(string.format("%-8s %5d rows x %3d cost %.3fs (%.0f rows/s, %.1f KB allocated per query)",
+        name, nrows, rounds, cost, nrows * rounds / cost, garbage / rounds))
+end
+
+local function run()
+    local db, err = mysql.connect({ host = HOST, port = PORT, user = "root", database = "bench" })
+    if not db then
+        print("connect failed", err)
+        return
+    end
+    local fd = lua_parser.connect()
+
+    for _, v in ipairs({ { 10, 2000 }, { 10000, 20 } }) do
+        local nrows, rounds = v[1], v[2]
+        local sql = "select " .. nrows
+        bench("lua", rounds, nrows, function()
+            return lua_parser.query(fd, sql)
+        end)
+        bench("native", rounds, nrows, function()
+            return db:query(sql)
+        end)
+    end
+
+    -- hot single row lookup: formatted text query vs cached prepared statement
+    local N = 20000
+    collectgarbage("collect")
+    local bt = clock()
+    for i = 1, N do
+        local res = db:query(string.format("select 1 from users where id = %d and name = %s", i, mysql.quote_sql_str("player_" .. i)))
+        assert(res[1].id == 1)
+    end
+    local cost = clock() - bt
+    print(string.format("%-12s x %d cost %.3fs (%.0f queries/s)", "query", N, cost, N / cost))
+
+    collectgarbage("collect")
+    bt = clock()
+    for i = 1, N do
+        local res = db:query_stmt("select 1 from users where id = ? and name = ?", i, "player_" .. i)
+        assert(res[1].id == 1)
+    end
+    cost = clock() - bt
+    print(string.format("%-12s x %d cost %.3fs (%.0f queries/s)", "query_stmt", N, cost, N / cost))
+
+    socket.close(fd)
+    db:disconnect()
+end
+
+moon.async(function()
+    moon.new_service("lua", {
+        name = "mysql_stub",
+        file = "mysql_benchmark.lua",
+        stub = true,
+    })
+    run()
+    moon.exit(-1)
+end)
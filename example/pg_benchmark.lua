@@ -0,0 +1,323 @@
+---__init__
+if _G["__init__"] then
+    return {
+        thread = 2,
+        enable_console = true,
+    }
+end
+
+local moon = require("moon")
+local socket = require("moon.socket")
+local pg = require("moon.db.pg")
+
+local conf = ...
+
+local HOST = "127.0.0.1"
+local PORT = 15432
+
+local strpack = string.pack
+local strunpack = string.unpack
+local tbconcat = table.concat
+
+if conf and conf.stub then
+    -- minimal postgresql-compatible server: trust auth, simple and extended
+    -- query protocol, "select N" answered by N generated rows, inserts, COPY
+    -- FROM STDIN / TO STDOUT, and any sql containing "error" fails
+    local function msg(t, payload)
+        return t .. strpack(">I4", #payload + 4) .. payload
+    end
+
+    local READY = msg("Z", "I")
+
+    local function error_response(text)
+        return msg("E", "SERROR\0C42601\0M" .. text .. "\0\0")
+    end
+
+    local ROW_DESC = msg("T", strpack(">I2", 4)
+        .. "id\0" .. strpack(">I4I2I4I2I4I2", 0, 0, 23, 4, 0xffffffff, 0)
+        .. "name\0" .. strpack(">I4I2I4I2I4I2", 0, 0, 25, 0xffff, 0xffffffff, 0)
+        .. "score\0" .. strpack(">I4I2I4I2I4I2", 0, 0, 701, 8, 0xffffffff, 0)
+        .. "flag\0" .. strpack(">I4I2I4I2I4I2", 0, 0, 16, 1, 0xffffffff, 0))
+
+    local function col(v)
+        return strpack(">s4", v)
+    end
+
+    local cache = {}
+
+    local function rows(n)
+        local data = cache[n]
+        if data then
+            return data
+        end
+        local out = {}
+        for i = 1, n do
+            out[i] = msg("D", strpack(">I2", 4) .. col(tostring(i)) .. col("player_" .. i)
+                .. col(tostring(i * 1.5)) .. (i % 2 == 0 and col("t") or strpack(">i4", -1)))
+        end
+        out[#out + 1] = msg("C", "SELECT " .. n .. "\0")
+        data = tbconcat(out)
+        cache[n] = data
+        return data
+    end
+
+    -- describe + execute response of one statement
+    local function execute(sql)
+        if sql:find("error") then
+            return nil, error_response("syntax error at or near \"error\"")
+        end
+        local n = tonumber(sql:match("^select (%d+)"))
+        if n then
+            return ROW_DESC, rows(n)
+        end
+        if sql:match("^insert") then
+            return msg("n", ""), msg("C", "INSERT 0 1\0")
+        end
+        return msg("n", ""), msg("C", "UPDATE 0\0")
+    end
+
+    local function serve(fd)
+        local function read_message()
+            local header = socket.read(fd, 5)
+            if not header then
+                return
+            end
+            local len = strunpack(">I4", header, 2)
+            local body = len > 4 and socket.read(fd, len - 4) or ""
+            if not body then
+                return
+            end
+            return header:sub(1, 1), body
+        end
+
+        -- startup message has no type byte
+        local len = strunpack(">I4", socket.read(fd, 4))
+        socket.read(fd, len - 4)
+        socket.write(fd, msg("R", strpack(">I4", 0)) .. msg("S", "server_version\0" .. "14.0\0")
+            .. msg("K", strpack(">I4I4", 1, 2)) .. READY)
+
+        local stmts = {}
+        local portal
+        local out = {}
+        local failed = false
+        while true do
+            local t, body = read_message()
+            if not t or t == "X" then
+                socket.close(fd)
+                return
+            end
+            if t == "Q" then
+                local sql = body:sub(1, -2)
+                if sql:match("^COPY .* FROM STDIN") then
+                    socket.write(fd, msg("G", strpack(">BI2", 0, 0)))
+                    local nrows = 0
+                    local res
+                    while true do
+                        local ct, cbody = read_message()
+                        if ct == "d" then
+                            nrows = nrows + select(2, cbody:gsub("\n", ""))
+                        elseif ct == "c" then
+                            res = msg("C", "COPY " .. nrows .. "\0")
+                            break
+                        else
+                            res = error_response("COPY from stdin failed: " .. cbody:sub(1, -2))
+                            break
+                        end
+                    end
+                    socket.write(fd, res .. READY)
+                elseif sql:match("^COPY .* TO STDOUT") then
+                    local n = tonumber(sql:match("limit (%d+)")) or 10
+                    local data = { msg("H", strpack(">BI2", 0, 0)) }
+                    for i = 1, n do
+                        data[#data + 1] = msg("d", i .. "\tplayer_" .. i .. "\n")
+                    end
+                    data[#data + 1] = msg("c", "")
+                    data[#data + 1] = msg("C", "COPY " .. n .. "\0")
+                    data[#data + 1] = READY
+                    socket.write(fd, tbconcat(data))
+                else
+                    local desc, res = execute(sql)
+                    if desc == msg("n", "") then
+                        desc = nil
+                    end
+                    socket.write(fd, (desc or "") .. res .. READY)
+                end
+            elseif t == "S" then
+                out[#out + 1] = READY
+                socket.write(fd, tbconcat(out))
+                out = {}
+                failed = false
+            elseif failed then
+                -- skip until Sync after an error
+            elseif t == "P" then
+                local name, sql = strunpack("zz", body)
+                if sql:find("syntax error") then
+                    out[#out + 1] = error_response("syntax error")
+                    failed = true
+                else
+                    stmts[name] = sql
+                    out[#out + 1] = msg("1", "")
+                end
+            elseif t == "B" then
+                local _, name = strunpack("zz", body)
+                portal = stmts[name]
+                if not portal then
+                    out[#out + 1] = msg("E", "SERROR\0C26000\0Mprepared statement \"" .. name .. "\" does not exist\0\0")
+                    failed = true
+                else
+                    out[#out + 1] = msg("2", "")
+                end
+            elseif t == "D" then
+                local desc, res = execute(portal)
+                if desc then
+                    out[#out + 1] = desc
+                else
+                    out[#out + 1] = res
+                    failed = true
+                end
+            elseif t == "E" then
+                local _, res = execute(portal)
+                out[#out + 1] = res
+            elseif t == "C" then
+                stmts[body:sub(2, -2)] = nil
+                out[#out + 1] = msg("3", "")
+            end
+        end
+    end
+
+    local listenfd = socket.listen(HOST, PORT, moon.PTYPE_TEXT)
+    moon.async(function()
+        while true do
+            local fd = socket.accept(listenfd)
+            if fd then
+                socket.setnodelay(fd)
+                moon.async(function()
+                    serve(fd)
+                end)
+            end
+        end
+    end)
+    return
+end
+
+-------------------------------------------------------------------------------
+
+local clock = moon.clock
+
+local function check(db)
+    local res = db:query("select 3")
+    local rows = res.data
+    assert(#rows == 3 and rows[2].id == 2 and rows[2].name == "player_2" and rows[2].score == 3.0)
+    assert(rows[2].flag == true and rows[1].flag == "\0")
+
+    res = db:execute("select 2 from users where id = $1 and name = $2", 1, "player_1")
+    assert(#res.data == 2 and res.data[1].id == 1)
+
+    res = db:execute("insert into users values ($1, $2)", 7, nil)
+    assert(res.data.affected_rows == 1)
+
+    res = db:pipeline({
+        {"select 1 from users where id = $1", 1},
+        {"insert into users values ($1, $2)", 2, "b"},
+        "select 2",
+    })
+    assert(res.num_queries == 3 and #res.data[1] == 1 and res.data[2].affected_rows == 1 and #res.data[3] == 2)
+
+    -- an error aborts the rest of the pipeline, the failed Parse is not cached
+    res = db:pipeline({
+        {"select 1 from users where id = $1", 1},
+        "select syntax error",
+        "select 2",
+    })
+    assert(res.code == "42601" and res.num_queries == 1)
+    assert(not db._stmt_cache.map["select syntax error"])
+
+    res = db:copy_from("COPY users (id, name) FROM STDIN", {{1, "a\tb"}, {2, nil}, "3\tc"}, 2)
+    assert(res.data.affected_rows == 3, res.message)
+
+    local n = 0
+    res = db:copy_to("COPY (select * from users limit 5000) TO STDOUT", function(line)
+        n = n + 1
+        assert(line == n .. "\tplayer_" .. n .. "\n")
+    end)
+    assert(n == 5000 and res.data.affected_rows == 5000)
+
+    res = db:query("select error")
+    assert(res.code == "42601" and res.message)
+    print("check ok")
+end
+
+local function run()
+    local db = pg.connect({ host = HOST, port = PORT, user = "postgres", database = "bench" })
+    if db.code then
+        print("connect failed", db.message)
+        return
+    end
+
+    check(db)
+
+    for _, v in ipairs({ { 10, 2000 }, { 10000, 20 } }) do
+        local nrows, rounds = v[1], v[2]
+        local sql = "select " .. nrows
+        collectgarbage("collect")
+        local bt = clock()
+        for _ = 1, rounds do
+            local res = db:query(sql)
+            assert(#res.data == nrows)
+        end
+        local cost = clock() - bt
+        print(string.format("select %5d rows x %4d cost %.3fs (%.0f rows/s)", nrows, rounds, cost, nrows * rounds / cost))
+    end
+
+    local N = 20000
+    local bt = clock()
+    for i = 1, N do
+        local res = db:query(string.format("insert into users values (%d, 'player_%d')", i, i))
+        assert(res.data.affected_rows == 1)
+    end
+    local cost = clock() - bt
+    print(string.format("%-24s x %d cost %.3fs (%.0f inserts/s)", "query", N, cost, N / cost))
+
+    bt = clock()
+    for i = 1, N do
+        local res = db:execute("insert into users values ($1, $2)", i, "player_" .. i)
+        assert(res.data.affected_rows == 1)
+    end
+    cost = clock() - bt
+    print(string.format("%-24s x %d cost %.3fs (%.0f inserts/s)", "execute", N, cost, N / cost))
+
+    local BATCH = 100
+    bt = clock()
+    for i = 1, N, BATCH do
+        local queries = {}
+        for j = i, i + BATCH - 1 do
+            queries[#queries + 1] = {"insert into users values ($1, $2)", j, "player_" .. j}
+        end
+        local res = db:pipeline(queries)
+        assert(res.num_queries == BATCH)
+    end
+    cost = clock() - bt
+    print(string.format("%-24s x %d cost %.3fs (%.0f inserts/s)", "pipeline(" .. BATCH .. ")", N, cost, N / cost))
+
+    local rows = {}
+    for i = 1, N do
+        rows[i] = {i, "player_" .. i}
+    end
+    bt = clock()
+    local res = db:copy_from("COPY users (id, name) FROM STDIN", rows)
+    assert(res.data.affected_rows == N)
+    cost = clock() - bt
+    print(string.format("%-24s x %d cost %.3fs (%.0f inserts/s)", "copy_from", N, cost, N / cost))
+
+    db:disconnect()
+end
+
+moon.async(function()
+    moon.new_service("lua", {
+        name = "pg_stub",
+        file = "pg_benchmark.lua",
+        stub = true,
+    })
+    run()
+    moon.exit(-1)
+end)
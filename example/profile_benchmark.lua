@@ -0,0 +1,103 @@
+local moon = require("moon")
+
+local conf = ...
+
+if conf and conf.worker then
+    local function fib(n)
+        if n < 2 then
+            return n
+        end
+        return fib(n - 1) + fib(n - 2)
+    end
+
+    local function concat(n)
+        local t = {}
+        for i = 1, n do
+            t[#t + 1] = tostring(i)
+        end
+        return table.concat(t, ",")
+    end
+
+    local command = {}
+
+    -- the work runs in coroutines created by moon.async
+    command.WORK = function(n)
+        local done = 0
+        for _ = 1, n do
+            moon.async(function()
+                fib(18)
+                concat(500)
+                moon.sleep(0)
+                fib(16)
+                done = done + 1
+            end)
+        end
+        while done < n do
+            moon.sleep(1)
+        end
+        return done
+    end
+
+    moon.dispatch("lua", function(msg, unpack)
+        local sender, sessionid, sz, len = moon.decode(msg, "SEC")
+        local args = {unpack(sz, len)}
+        moon.async(function()
+            moon.response("lua", sender, sessionid, command[args[1]](table.unpack(args, 2)))
+        end)
+    end)
+    return
+end
+
+local clock = moon.clock
+
+local function work(target, rounds)
+    local bt = clock()
+    for _ = 1, rounds do
+        assert(moon.co_call("lua", target, "WORK", 100) == 100)
+    end
+    return clock() - bt
+end
+
+moon.async(function()
+    local target = moon.new_service("lua", {name = "profile_worker", file = "profile_benchmark.lua", worker = true})
+
+    local idle = work(target, 20)
+    print(string.format("profiler off: %.3fs", idle))
+
+    -- sample the whole run
+    local profiled
+    moon.async(function()
+        profiled = work(target, 20)
+    end)
+    local folded = moon.profile(target, math.floor(idle * 1000), 10000)
+    while not profiled do
+        moon.sleep(10)
+    end
+    print(string.format("profiler on: %.3fs", profiled))
+
+    assert(moon.co_call("debug", target, "profile_start"))
+    assert(not moon.co_call("debug", target, "profile_start"))
+    moon.co_call("debug", target, "profile_stop")
+    print(string.format("profiler off again: %.3fs", work(target, 20)))
+
+    local total, lines = 0, {}
+    for stack, count in folded:gmatch("([^\n]+) (%d+)\n") do
+        total = total + tonumber(count)
+        lines[#lines + 1] = {stack, tonumber(count)}
+    end
+    assert(total > 0)
+    -- the coroutines of moon.async are sampled
+    assert(folded:find("moon.lua:%d+;profile_benchmark.lua:%d+%(fn%);profile_benchmark.lua:%d+%(fib%)"))
+    print(string.format("%d samples in %d stacks, top 5:", total, #lines))
+    for i = 1, math.min(5, #lines) do
+        local stack = lines[i][1]
+        if #stack > 150 then
+            stack = stack:sub(1, 147) .. "..."
+        end
+        print(string.format("%6d  %s", lines[i][2], stack))
+    end
+
+    io.writefile("profile_benchmark.folded", folded)
+    print("folded stacks written to profile_benchmark.folded, render with flamegraph.pl")
+    moon.exit(-1)
+end)
@@ -0,0 +1,216 @@
+---__init__
+if _G["__init__"] then
+    return {
+        thread = 2,
+        enable_console = true,
+    }
+end
+
+local moon = require("moon")
+local socket = require("moon.socket")
+local redis = require("moon.db.redis")
+
+local conf = ...
+
+local HOST = "127.0.0.1"
+local PORT = 16379
+
+if conf and conf.stub then
+    -- minimal redis-compatible server: requests are framed by the
+    -- PTYPE_SOCKET_RESP connection too, one message per command
+    local db = {}
+
+    local function bulk(v)
+        if v == nil then
+            return "$-1\r\n"
+        end
+        return "$" .. #v .. "\r\n" .. v .. "\r\n"
+    end
+
+    local command = {}
+
+    command.PING = function()
+        return "+PONG\r\n"
+    end
+
+    command.SET = function(args)
+        db[args[2]] = args[3]
+        return "+OK\r\n"
+    end
+
+    command.GET = function(args)
+        return bulk(db[args[2]])
+    end
+
+    command.DEL = function(args)
+        local n = 0
+        for i = 2, #args do
+            if db[args[i]] ~= nil then
+                db[args[i]] = nil
+                n = n + 1
+            end
+        end
+        return ":" .. n .. "\r\n"
+    end
+
+    command.HSET = function(args)
+        local h = db[args[2]]
+        if not h then
+            h = {}
+            db[args[2]] = h
+        end
+        local n = 0
+        for i = 3, #args, 2 do
+            if h[args[i]] == nil then
+                n = n + 1
+            end
+            h[args[i]] = args[i + 1]
+        end
+        return ":" .. n .. "\r\n"
+    end
+
+    command.HGETALL = function(args)
+        local h = db[args[2]] or {}
+        local out = {}
+        local n = 0
+        for k, v in pairs(h) do
+            out[#out + 1] = bulk(k)
+            out[#out + 1] = bulk(v)
+            n = n + 2
+        end
+        return "*" .. n .. "\r\n" .. table.concat(out)
+    end
+
+    local function serve(fd)
+        while true do
+            local n, ok, args = socket.read_reply(fd, 1)
+            if not n or not ok then
+                socket.close(fd)
+                return
+            end
+            local f = command[string.upper(args[1])]
+            if f then
+                socket.write(fd, f(args))
+            else
+                socket.write(fd, "-ERR unknown command '" .. tostring(args[1]) .. "'\r\n")
+            end
+        end
+    end
+
+    local listenfd = socket.listen(HOST, PORT, moon.PTYPE_SOCKET_RESP)
+    moon.async(function()
+        while true do
+            local fd = socket.accept(listenfd)
+            if fd then
+                socket.setnodelay(fd)
+                moon.async(function()
+                    serve(fd)
+                end)
+            end
+        end
+    end)
+    return
+end
+
+local clock = moon.clock
+
+local function run()
+    local db, err = redis.connect({ host = HOST, port = PORT })
+    if not db then
+        print("connect failed", err)
+        return
+    end
+
+    local N = 20000
+    db:set("bench_key", "hello world")
+    local bt = clock()
+    for _ = 1, N do
+        assert(db:get("bench_key") == "hello world")
+    end
+    local cost = clock() - bt
+    print(string.format("GET x %d cost %.3fs (%.0f ops/s)", N, cost, N / cost))
+
+    local FIELDS = 1000
+    local args = { "bench_hash" }
+    for i = 1, FIELDS do
+        args[#args + 1] = "field" .. i
+        args[#args + 1] = i
+    end
+    db:hset(args)
+    local ROUNDS = 500
+    bt = clock()
+    for _ = 1, ROUNDS do
+        local t = db:hgetall("bench_hash")
+        assert(#t == FIELDS * 2)
+    end
+    cost = clock() - bt
+    print(string.format("HGETALL %d fields x %d cost %.3fs (%.0f ops/s)", FIELDS, ROUNDS, cost, ROUNDS / cost))
+
+    local BATCH = 1000
+    local ops = {}
+    for i = 1, BATCH do
+        ops[i] = { "set", "pipeline_key" .. i, i }
+    end
+    ROUNDS = 100
+    bt = clock()
+    for _ = 1, ROUNDS do
+        local resp = {}
+        db:pipeline(ops, resp)
+        assert(#resp == BATCH)
+    end
+    cost = clock() - bt
+    print(string.format("pipeline %d SET x %d cost %.3fs (%.0f cmds/s)", BATCH, ROUNDS, cost, BATCH * ROUNDS / cost))
+
+    db:disconnect()
+end
+
+local function run_redisd()
+    package.path = package.path .. ";../service/?.lua"
+    local redisd = require("redisd")
+    local db = moon.new_service("lua", {
+        unique = true,
+        name = "redisd_bench",
+        file = "../service/redisd.lua",
+        host = HOST,
+        port = PORT,
+        poolsize = 2,
+    })
+
+    -- many coroutines calling at once: requests of one tick share one write
+    local WORKERS = 100
+    local N = 200
+    local done = 0
+    local bt = clock()
+    for w = 1, WORKERS do
+        moon.async(function()
+            for i = 1, N do
+                assert(redisd.hash_call(w, db, "set", "redisd_key" .. w, i) == "OK")
+            end
+            done = done + 1
+        end)
+    end
+    while done < WORKERS do
+        moon.sleep(10)
+    end
+    local cost = clock() - bt
+    print(string.format("redisd %d coroutines x %d SET cost %.3fs (%.0f cmds/s)", WORKERS, N, cost, WORKERS * N / cost))
+
+    for i, v in ipairs(redisd.stats(db)) do
+        local buckets = {}
+        for _, b in ipairs(v.latency_ms) do
+            buckets[#buckets + 1] = string.format("<=%s:%d", b[1], b[2])
+        end
+        print(string.format("  conn %d inflight %d queued %d total %d  %s", i, v.inflight, v.queued, v.total, table.concat(buckets, " ")))
+    end
+end
+
+moon.async(function()
+    moon.new_service("lua", {
+        name = "redis_stub",
+        file = "redis_benchmark.lua",
+        stub = true,
+    })
+    run()
+    run_redisd()
+    moon.exit(-1)
+end)
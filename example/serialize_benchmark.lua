@@ -0,0 +1,74 @@
+local moon = require("moon")
+local seri = require("seri")
+local buffer = require("buffer")
+
+local N = 1000000
+
+local msg = {
+    id = 10086,
+    name = "player_name",
+    x = 123.5,
+    y = -45.25,
+    hp = 2000,
+    online = true,
+    items = {1001, 1002, 1003},
+}
+
+local schema = seri.schema{
+    {"id", "integer"},
+    {"name", "string"},
+    {"x", "number"},
+    {"y", "number"},
+    {"hp", "integer"},
+    {"online", "boolean"},
+    {"items", "any"},
+}
+
+local function bench(name, pack, unpack)
+    local clock = moon.clock
+
+    collectgarbage("collect")
+    local bt = clock()
+    for _ = 1, N do
+        buffer.delete(pack(msg))
+    end
+    local pack_cost = clock() - bt
+
+    local buf = pack(msg)
+    local sz, len = buffer.cstr(buf)
+    collectgarbage("collect")
+    bt = clock()
+    for _ = 1, N do
+        unpack(sz, len)
+    end
+    local unpack_cost = clock() - bt
+    buffer.delete(buf)
+
+    print(string.format("%-8s size %3d bytes, pack %.3fs (%.0f/s), unpack %.3fs (%.0f/s)",
+        name, len, pack_cost, N / pack_cost, unpack_cost, N / unpack_cost))
+end
+
+local t = schema:unpack(schema:packs(msg))
+assert(t.id == msg.id and t.name == msg.name and t.x == msg.x and t.online == msg.online)
+assert(#t.items == 3 and t.items[3] == 1003)
+
+
+bench("generic", function(v)
+    return seri.pack(v)
+end, function(sz, len)
+    return seri.unpack(sz, len)
+end)
+
+bench("intern", function(v)
+    return seri.pack(v)
+end, function(sz, len)
+    return seri.unpack_intern(sz, len)
+end)
+
+bench("schema", function(v)
+    return schema:pack(v)
+end, function(sz, len)
+    return schema:unpack(sz, len)
+end)
+
+moon.exit(-1)
@@ -0,0 +1,92 @@
+local moon = require("moon")
+
+package.path = package.path .. ";../service/?.lua"
+
+local sharetable = require("sharetable")
+
+local clock = moon.clock
+
+local ROWS = 200000
+local PATCH_ROWS = 100
+
+local file = "sharetable_bench_data.lua"
+local patch_file = "sharetable_bench_patch.lua"
+
+local function make_data()
+    local lines = {"return {"}
+    for i = 1, ROWS do
+        lines[#lines + 1] = string.format(
+            '[%d]={id=%d,name="item_%d",level=%d,price=%d,quality=%d,tags={"a%d","b%d"},attrs={hp=%d,atk=%d,def=%d}},',
+            i, i, i, i % 100, i * 3, i % 5, i % 7, i % 11, i * 10, i % 50, i % 30)
+    end
+    lines[#lines + 1] = "}"
+    io.writefile(file, table.concat(lines, "\n"))
+end
+
+local function make_patch()
+    local lines = {"return {"}
+    for i = 1, PATCH_ROWS do
+        local id = i * 1000
+        lines[#lines + 1] = string.format('{path={%d,"price"},value=%d},', id, -id)
+        lines[#lines + 1] = string.format('{path={%d,"attrs","hp"},value=%d},', id, -id)
+    end
+    -- new row and removed row
+    lines[#lines + 1] = string.format('{path=%d,value={id=%d,name="new"}},', ROWS + 1, ROWS + 1)
+    lines[#lines + 1] = '{path=1},'
+    lines[#lines + 1] = "}"
+    io.writefile(patch_file, table.concat(lines, "\n"))
+end
+
+local function mb(n)
+    return n / 1024 / 1024
+end
+
+moon.async(function()
+    make_data()
+    make_patch()
+
+    moon.new_service("lua", {
+        unique = true,
+        name = "sharetable",
+        file = "../service/sharetable.lua"
+    })
+
+    local bt = clock()
+    assert(sharetable.loadfile(file))
+    print(string.format("loadfile %d rows cost %.3fs, matrix %.1fMB", ROWS, clock() - bt, mb(sharetable.size(file))))
+
+    local data = sharetable.query(file)
+    assert(data[1000].price == 3000)
+
+    bt = clock()
+    assert(sharetable.loadfile(file))
+    local reload_cost = clock() - bt
+    bt = clock()
+    sharetable.update(file)
+    print(string.format("full reload cost %.3fs, client update %.3fs, matrix %.1fMB",
+        reload_cost, clock() - bt, mb(sharetable.size(file))))
+
+    bt = clock()
+    assert(sharetable.patchfile(file, patch_file))
+    local patch_cost = clock() - bt
+    bt = clock()
+    sharetable.update(file)
+    print(string.format("patch %d keys cost %.3fs, client update %.3fs, new version %.3fMB",
+        PATCH_ROWS * 2 + 2, patch_cost, clock() - bt, mb(sharetable.size(file))))
+
+    -- patched values are visible, untouched rows stay shared with the previous version
+    assert(data[1000].price == -1000 and data[1000].attrs.hp == -1000)
+    assert(data[1000].attrs.atk == 1000 % 50)
+    assert(data[ROWS + 1].name == "new")
+    assert(data[1] == nil)
+    assert(data[2].price == 6 and data[2].attrs.atk == 2)
+
+    local ok, err = sharetable.patchstring(file, "return {{path={2,'tags',1,'x'},value=1}}")
+    assert(not ok and err:find("Patch path"), err)
+    ok, err = sharetable.patchstring("no_such_file", "return {}")
+    assert(not ok and err:find("not loaded"), err)
+
+    os.remove(file)
+    os.remove(patch_file)
+    moon.exit(-1)
+end)
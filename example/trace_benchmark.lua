@@ -0,0 +1,86 @@
+---__init__
+if _G["__init__"] then
+    return {
+        thread = 2,
+    }
+end
+
+local moon = require("moon")
+
+local conf = ...
+
+local HOST = "127.0.0.1"
+local PORT = 18011
+
+if conf and conf.callee then
+    moon.dispatch("lua", function(msg, unpack)
+        local sender, sessionid, sz, len = moon.decode(msg, "SEC")
+        moon.response("lua", sender, sessionid, unpack(sz, len))
+    end)
+    return
+end
+
+local json = require("json")
+local httpc = require("moon.http.client")
+local http_server = require("moon.http.server")
+
+local clock = moon.clock
+
+-- the debug endpoint: Prometheus scrapes /metrics, /trace answers JSON
+http_server.error = function() end
+
+http_server.on("/metrics", function(_, response)
+    response:write_header("Content-Type", "text/plain; version=0.0.4")
+    response:write(moon.trace_report("prometheus"))
+end)
+
+http_server.on("/trace", function(_, response)
+    response:write_header("Content-Type", "application/json")
+    response:write(moon.trace_report("json"))
+end)
+
+local function run(name, callee, concurrency, count)
+    local bt = clock()
+    local done = 0
+    for _ = 1, concurrency do
+        moon.async(function()
+            for i = 1, count do
+                assert(moon.co_call("lua", callee, "ECHO", i) == "ECHO")
+            end
+            done = done + 1
+        end)
+    end
+    while done < concurrency do
+        moon.sleep(5)
+    end
+    local cost = clock() - bt
+    local n = concurrency * count
+    print(string.format("%s co_call %d x %d cost %.3fs (%.0f calls/s)", name, concurrency, count, cost, n / cost))
+end
+
+moon.async(function()
+    local callee = moon.new_service("lua", {name = "trace_bench_callee", file = "trace_benchmark.lua", callee = true, threadid = 2})
+    http_server.listen(HOST, PORT)
+
+    run("trace off", callee, 100, 2000)
+    moon.trace(true)
+    run("trace on ", callee, 100, 2000)
+    moon.trace(false)
+    run("trace off", callee, 100, 2000)
+
+    local res = httpc.get(HOST .. ":" .. PORT, { path = "/trace" })
+    for _, v in ipairs(json.decode(res.content)) do
+        if v.count >= 1000 then
+            print(string.format("%-20s ptype %2d count %7d wait p50 %4dus p99 %5dus max %6dus | dispatch p50 %3dus p99 %4dus max %5dus",
+                v.name, v.ptype, v.count,
+                v.queue_wait_us.p50, v.queue_wait_us.p99, v.queue_wait_us.max,
+                v.dispatch_us.p50, v.dispatch_us.p99, v.dispatch_us.max))
+        end
+    end
+
+    res = httpc.get(HOST .. ":" .. PORT, { path = "/metrics" })
+    assert(res.content:find("# TYPE moon_queue_wait_us summary", 1, true))
+    assert(res.content:find('moon_dispatch_us_count{service="trace_bench_callee"', 1, true))
+    print("metrics ok")
+    moon.exit(-1)
+end)
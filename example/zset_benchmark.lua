@@ -0,0 +1,38 @@
+local moon = require("moon")
+local zset = require("zset")
+
+local N = 1000000
+local ROUNDS = 200000
+
+local clock = moon.clock
+local random = math.random
+
+local z = zset.new(N)
+
+local bt = clock()
+for i = 1, N do
+    z:update(i, random(1, 100000000), i)
+end
+print(string.format("insert %d entries cost %.3fs", N, clock() - bt))
+
+-- every round: one score update, one rank query and one top-10 range query
+bt = clock()
+local ts = N
+for _ = 1, ROUNDS do
+    ts = ts + 1
+    z:update(random(1, N), random(1, 100000000), ts)
+    z:rank(random(1, N))
+    z:range(1, 10)
+end
+local cost = clock() - bt
+print(string.format("mixed update/rank/range %d rounds cost %.3fs (%.0f rounds/s)", ROUNDS, cost, ROUNDS / cost))
+
+bt = clock()
+for _ = 1, ROUNDS // 4 do
+    local r = random(1, N - 100)
+    z:range(r, r + 99)
+end
+cost = clock() - bt
+print(string.format("range 100 at random rank %d times cost %.3fs", ROUNDS // 4, cost))
+
+moon.exit(-1)
@@ -0,0 +1,59 @@
+local moon = require("moon")
+local zset = require("zset")
+
+local N = 5000000
+local FILE = "zset_snapshot.bin"
+
+local clock = moon.clock
+local random = math.random
+local spack = string.pack
+
+-- rows as they come from db: unordered {key, score, timestamp}
+local bt = clock()
+local chunks = {}
+local rows = {}
+for i = 1, N do
+    rows[#rows + 1] = spack("<jjj", i, random(1, 100000000), i)
+    if #rows == 4096 then
+        chunks[#chunks + 1] = table.concat(rows)
+        rows = {}
+    end
+end
+chunks[#chunks + 1] = table.concat(rows)
+local packed = table.concat(chunks)
+chunks, rows = nil, nil
+print(string.format("pack %d rows cost %.3fs", N, clock() - bt))
+
+local z = zset.new(N)
+bt = clock()
+z:update_many(packed)
+print(string.format("update_many %d rows cost %.3fs", z:size(), clock() - bt))
+packed = nil
+
+bt = clock()
+assert(z:save(FILE))
+print(string.format("save snapshot cost %.3fs", clock() - bt))
+
+local function check(z2)
+    assert(z2:size() == z:size())
+    for _ = 1, 1000 do
+        local k = random(1, N)
+        assert(z2:rank(k) == z:rank(k))
+        assert(z2:score(k) == z:score(k))
+    end
+end
+
+local z2 = zset.new(N)
+bt = clock()
+assert(z2:load(FILE))
+print(string.format("load snapshot cost %.3fs", clock() - bt))
+check(z2)
+z2:clear()
+
+bt = clock()
+assert(z2:load(FILE, true))
+print(string.format("load mmapped snapshot cost %.3fs", clock() - bt))
+check(z2)
+
+os.remove(FILE)
+moon.exit(-1)
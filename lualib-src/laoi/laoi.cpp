@@ -96,6 +96,64 @@ static int laoi_update(lua_State *L)
     return 1;
 }
 
+//update_many(moves, n, events): moves is a flat array of (id, x, y, w, h, layer) records.
+//The whole array is validated before the space is touched, then all moves are applied
+//and the events are written to the events table as flat (watcher, marker, eventid)
+//triples, as update_event does. Returns the events table size and the updated count.
+static int laoi_update_many(lua_State *L)
+{
+    aoi_space_box* ab = (aoi_space_box*)lua_touserdata(L, 1);
+    if (ab == NULL || ab->space == NULL)
+        return luaL_error(L, "Invalid aoi_space pointer");
+    luaL_checktype(L, 2, LUA_TTABLE);
+    lua_Integer n = luaL_checkinteger(L, 3);
+    luaL_checktype(L, 4, LUA_TTABLE);
+    if (n < 0 || n % 6 != 0 || n > (lua_Integer)lua_rawlen(L, 2))
+        return luaL_error(L, "update_many: moves size must be a multiple of 6 within the array, got %d", (int)n);
+
+    thread_local std::vector<int64_t> values;
+    values.resize((size_t)n);
+    for (lua_Integer i = 0; i < n; ++i)
+    {
+        lua_rawgeti(L, 2, i + 1);
+        int isnum = 0;
+        values[i] = (int64_t)lua_tointegerx(L, -1, &isnum);
+        if (!isnum)
+        {
+            if (lua_type(L, -1) != LUA_TNUMBER)
+                return luaL_error(L, "update_many: moves[%d] is not a number", (int)(i + 1));
+            values[i] = (int64_t)lua_tonumber(L, -1);
+        }
+        lua_pop(L, 1);
+    }
+
+    ab->space->clear_event();
+    int64_t updated = 0;
+    for (size_t i = 0; i < values.size(); i += 6)
+    {
+        const int64_t* v = &values[i];
+        if (ab->space->update(v[0], (int32_t)v[1], (int32_t)v[2], (int32_t)v[3], (int32_t)v[4], (int32_t)v[5]))
+        {
+            ++updated;
+        }
+    }
+
+    const auto& events = ab->space->get_event();
+    int idx = 1;
+    for (const auto& evt : events)
+    {
+        lua_pushinteger(L, evt.watcher);
+        lua_rawseti(L, 4, idx++);
+        lua_pushinteger(L, evt.marker);
+        lua_rawseti(L, 4, idx++);
+        lua_pushinteger(L, evt.eventid);
+        lua_rawseti(L, 4, idx++);
+    }
+    lua_pushinteger(L, static_cast<int64_t>(events.size() * 3));
+    lua_pushinteger(L, updated);
+    return 2;
+}
+
 static int laoi_query(lua_State *L)
 {
     aoi_space_box* ab = (aoi_space_box*)lua_touserdata(L, 1);
@@ -229,6 +287,7 @@ static int laoi_create(lua_State *L)
         luaL_Reg l[] = {
             { "insert",laoi_insert },
             { "update",laoi_update },
+            { "update_many",laoi_update_many },
             { "query", laoi_query},
             { "fire_event",laoi_fire_event },
             { "erase",laoi_erase },
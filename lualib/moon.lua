@@ -9,6 +9,7 @@ require("base.class")
 ---@type core
 local core = require("mooncore")
 local seri = require("seri")
+local resp = require("resp")
 
 local pairs = pairs
 local type = type
@@ -26,10 +27,15 @@ local _send = core.send
 local _now = core.now
 local _addr = core.id
 local _timeout = core.timeout
+local _defer = core.defer
+local _make_session = core.make_session
+local _take_session = core.take_session
+local _sessions = core.sessions
 local _newservice = core.new_service
 local _queryservice = core.queryservice
 local _decode = core.decode
 local _scan_services = core.scan_services
+local _trace_report = core.trace_report
 
 ---@class moon : core
 local moon = core
@@ -43,6 +49,12 @@ moon.PTYPE_SOCKET_WS = 6
 moon.PTYPE_DEBUG = 7
 moon.PTYPE_SHUTDOWN = 8
 moon.PTYPE_TIMER = 9
+moon.PTYPE_SOCKET_RESP = 10
+moon.PTYPE_SOCKET_MYSQL = 11
+moon.PTYPE_SOCKET_PG = 12
+moon.PTYPE_SOCKET_HTTP = 13
+moon.PTYPE_SOCKET_CLUSTER = 14 -- owned by the native cluster router
+moon.PTYPE_CHANNEL = 15
 
 --moon.codecache = require("codecache")
 
@@ -97,10 +109,7 @@ setmetatable(
     }
 )
 
-local uuid = 0
-local session_id_coroutine = {}
 local protocol = {}
-local session_watcher = {}
 
 local timer_routine = {}
 
@@ -114,28 +123,16 @@ local function coresume(co, ...)
     return ok, err
 end
 
----make map<coroutine,sessionid>
-local function make_response(receiver)
-    uuid = uuid + 1
-    if uuid == 0x7FFFFFFF then
-        uuid = 1
-    end
-
-    if nil ~= session_id_coroutine[uuid] then
-        error("sessionid is used!")
-    end
-
-    if receiver then
-        session_watcher[uuid] = receiver
-    end
-
-    session_id_coroutine[uuid] = co_running()
-    return uuid
+---park the running coroutine on a new sessionid, the session table lives in the service (C++)
+---@param receiver? integer @ the call fails if this service exits
+---@param deadline? integer @ server time(milliseconds), the call fails with "timeout" after it
+local function make_response(receiver, deadline)
+    return _make_session(receiver, deadline)
 end
 
 --- 取消等待session的回应
 function moon.cancel_session(sessionid)
-    session_id_coroutine[sessionid] = false
+    core.cancel_session(sessionid)
 end
 
 moon.make_response = make_response
@@ -150,10 +147,8 @@ local function _default_dispatch(msg, PTYPE)
 
     local sessionid = _decode(msg, "E")
     if sessionid > 0 and PTYPE ~= moon.PTYPE_ERROR then
-        session_watcher[sessionid] = nil
-        local co = session_id_coroutine[sessionid]
+        local co = _take_session(sessionid)
         if co then
-            session_id_coroutine[sessionid] = nil
             --print(coroutine.status(co))
             if p.unpack then
                 coresume(co, p.unpack(_decode(msg,"C")))
@@ -176,7 +171,35 @@ local function _default_dispatch(msg, PTYPE)
     end
 end
 
-core.callback(_default_dispatch)
+local deferred = {}
+local deferred_spare = {}
+
+---runs after the worker's current dispatch batch, tasks deferred meanwhile wait for the next one
+local function run_deferred()
+    local tasks = deferred
+    deferred, deferred_spare = deferred_spare, tasks
+    for i = 1, #tasks do
+        local fn = tasks[i]
+        tasks[i] = nil
+        local ok, err = xpcall(fn, traceback)
+        if not ok then
+            moon.error(err)
+        end
+    end
+end
+
+core.callback(_default_dispatch, run_deferred)
+
+---Queue fn to run once the messages of the current dispatch batch are handled.
+---Cheaper than moon.timeout(0, fn): no message, no mailbox round trip.
+---@param fn fun()
+function moon.defer(fn)
+    local n = #deferred + 1
+    deferred[n] = fn
+    if n == 1 then
+        _defer()
+    end
+end
 
 ---
 ---向指定服务发送消息,消息内容会根据协议类型进行打包
@@ -223,6 +246,9 @@ end
 ---@param config table @服务的启动配置，{name="a",file="file"}, 可以用来向服务传递额外参数
 ---                    unique 是否是唯一服务，唯一服务可以用moon.queryservice(name)查询服务id
 ---                    threadid 在指定工作者线程创建该服务，并绑定该线程。默认0,服务将轮询加入工作者线程。
+---                    gcmode GC模式 'gen'(默认), 'inc', 'adaptive'。adaptive 为增量模式, 处理消息时不运行GC, 由工作者线程在消息批次间隙和空闲时分步回收。
+---                    gcpause gcstepmul gcstepsize gcminormul gcmajormul 对应 collectgarbage 的参数, 0使用lua默认值。
+---                    gcbudget adaptive模式下, 工作者空闲时每次回收的时间片(微秒), 默认1000。
 ---@return integer @返回服务id
 function moon.new_service(stype, config)
     local sessionid = make_response()
@@ -247,11 +273,11 @@ end
 ---使当前服务退出
 function moon.quit()
     local running = co_running()
-    for k, co in pairs(session_id_coroutine) do
-		if type(co) == "thread" and co ~= running then
+    for _, sessionid in ipairs(_sessions()) do
+        local co = _take_session(sessionid)
+        if co and co ~= running then
             co_close(co)
-            session_id_coroutine[k] = false
-		end
+        end
     end
 
     for k, co in pairs(timer_routine) do
@@ -317,7 +343,7 @@ function moon.async(func)
 end
 
 function moon.wakeup(co)
-    moon.timeout(0, function()
+    moon.defer(function()
         local ok, err = co_resume(co)
         if not ok then
             err = traceback(co, tostring(err))
@@ -348,6 +374,15 @@ function moon.scan_services(workerid)
     return co_yield()
 end
 
+---latency histograms recorded while moon.trace(true) is on, in microseconds
+---@param format? string @ "json"(default) or "prometheus" text exposition
+---@return string
+function moon.trace_report(format)
+    local sessionid = make_response()
+    _trace_report(format or "json", sessionid)
+    return co_yield()
+end
+
 ---RPC形式调用，发送消息附带一个responseid，对方收到后把responseid发送回来，必须调用moon.response应答.
 ---@param PTYPE string @协议类型
 ---@param receiver integer @接收者服务id
@@ -367,6 +402,47 @@ function moon.co_call(PTYPE, receiver, ...)
     return co_yield()
 end
 
+---moon.co_call that gives up at deadline, returning false, "timeout". The deadline
+---travels with the message: the callee reads it with moon.decode(msg, "D"), a request
+---still queued when it passes is dropped, a response arriving later is ignored.
+---@param deadline integer @ server time(milliseconds), see moon.now. 0 waits forever
+---@param PTYPE string
+---@param receiver integer
+function moon.co_call_deadline(deadline, PTYPE, receiver, ...)
+    local p = protocol[PTYPE]
+    if not p then
+        error(string.format("moon call unknown PTYPE[%s] message", PTYPE))
+    end
+
+    if receiver == 0 then
+        error("moon co_call receiver == 0")
+    end
+
+    local sessionid = make_response(receiver, deadline)
+	_send(receiver, p.pack(...), "", sessionid, p.PTYPE, deadline)
+    return co_yield()
+end
+
+---moon.co_call that gives up after timeout milliseconds, see moon.co_call_deadline
+---@param timeout integer
+---@param PTYPE string
+---@param receiver integer
+function moon.co_call_timeout(timeout, PTYPE, receiver, ...)
+    return moon.co_call_deadline(_now() + timeout, PTYPE, receiver, ...)
+end
+
+---milliseconds left until a deadline received with a request, nil when there is none.
+---<= 0 means the caller has given up: drop the work, or pass the deadline on with
+---moon.co_call_deadline.
+---@param deadline integer @ moon.decode(msg, "D")
+---@return integer|nil
+function moon.remaining(deadline)
+    if deadline == 0 then
+        return nil
+    end
+    return deadline - _now()
+end
+
 ---回应moon.call
 ---@param PTYPE string @协议类型
 ---@param receiver integer  @接收者服务id
@@ -423,6 +499,13 @@ reg_protocol {
     end
 }
 
+---lua协议消息的短字符串key改用服务内的字符串缓存解码, 适合大量key重复的小消息。
+---Decode PTYPE_LUA messages and call results with seri.unpack_intern.
+---@param enable boolean
+function moon.intern_lua_keys(enable)
+    protocol[moon.PTYPE_LUA].unpack = enable and seri.unpack_intern or moon.unpack
+end
+
 reg_protocol {
     name = "text",
     PTYPE = moon.PTYPE_TEXT,
@@ -447,9 +530,8 @@ reg_protocol {
         if data and #data >0 then
             content = content..":"..data
         end
-        local co = session_id_coroutine[sessionid]
+        local co = _take_session(sessionid)
         if co then
-            session_id_coroutine[sessionid] = nil
             coresume(co, false, content)
             return
         end
@@ -460,14 +542,10 @@ local system_command = {}
 
 system_command._service_exit = function(sender, msg)
     local data = _decode(msg,"Z")
-    for k, v in pairs(session_watcher) do
-        if v == sender then
-            local co = session_id_coroutine[k]
-            if co then
-                session_id_coroutine[k] = nil
-                coresume(co, false, data)
-                return
-            end
+    for _, sessionid in ipairs(_sessions(sender)) do
+        local co = _take_session(sessionid)
+        if co then
+            coresume(co, false, data)
         end
     end
 end
@@ -510,6 +588,45 @@ reg_protocol{
     end
 }
 
+reg_protocol{
+    name = "resp",
+    PTYPE = moon.PTYPE_SOCKET_RESP,
+    pack = function(...) return ... end,
+    unpack = resp.decode,
+    dispatch = function(_)
+        error("PTYPE_SOCKET_RESP dispatch not implemented")
+    end
+}
+
+--- no unpack: the reader gets the message and decodes it with mysql.core
+--- before yielding again, rows are built straight from the message buffer
+reg_protocol{
+    name = "mysql",
+    PTYPE = moon.PTYPE_SOCKET_MYSQL,
+    pack = function(...) return ... end,
+    dispatch = function(_)
+        error("PTYPE_SOCKET_MYSQL dispatch not implemented")
+    end
+}
+
+reg_protocol{
+    name = "pg",
+    PTYPE = moon.PTYPE_SOCKET_PG,
+    pack = function(...) return ... end,
+    dispatch = function(_)
+        error("PTYPE_SOCKET_PG dispatch not implemented")
+    end
+}
+
+reg_protocol{
+    name = "http",
+    PTYPE = moon.PTYPE_SOCKET_HTTP,
+    pack = function(...) return ... end,
+    dispatch = function(_)
+        error("PTYPE_SOCKET_HTTP dispatch not implemented")
+    end
+}
+
 local cb_shutdown
 
 reg_protocol {
@@ -577,6 +694,56 @@ function moon.sleep(mills)
     return co_yield()
 end
 
+--------------------------CHANNEL----------------------------
+
+--- records handled per wake up, then the channel yields to the other messages
+local CHANNEL_BATCH = 4096
+
+local channels = {}
+local channel_handler
+
+---设置本服务收到通道记录的处理函数
+---@param fn fun(data:string, channelid:integer)
+function moon.channel_dispatch(fn)
+    channel_handler = fn
+end
+
+reg_protocol {
+    name = "channel",
+    PTYPE = moon.PTYPE_CHANNEL,
+    dispatch = function(msg)
+        local id = string.unpack("<I4", _decode(msg, "Z"))
+        local ch = channels[id]
+        if not ch then
+            ch = core.channel_attach(id)
+            if not ch then
+                return
+            end
+            channels[id] = ch
+        end
+        ch:rearm()
+        local handler = channel_handler
+        for _ = 1, CHANNEL_BATCH do
+            local data = ch:read()
+            if not data then
+                if ch:closed() then
+                    -- records written between the empty read and the close
+                    data = ch:read()
+                    while data do
+                        handler(data, id)
+                        data = ch:read()
+                    end
+                    channels[id] = nil
+                    ch:detach()
+                end
+                return
+            end
+            handler(data, id)
+        end
+        ch:notify()
+    end
+}
+
 --------------------------DEBUG----------------------------
 
 local debug_command = {}
@@ -600,6 +767,46 @@ debug_command.state = function(sender, sessionid)
     moon.response("debug",sender,sessionid, s)
 end
 
+debug_command.gcstat = function(sender, sessionid)
+    moon.response("debug",sender,sessionid, moon.gcstat())
+end
+
+debug_command.profile_start = function(sender, sessionid, period)
+    moon.response("debug",sender,sessionid, moon.profile_start(period))
+end
+
+debug_command.profile_stop = function(sender, sessionid)
+    moon.response("debug",sender,sessionid, moon.profile_stop())
+end
+
+debug_command.memtrace_start = function(sender, sessionid, rate)
+    moon.response("debug",sender,sessionid, moon.memtrace_start(rate))
+end
+
+debug_command.memtrace_report = function(sender, sessionid, top)
+    moon.response("debug",sender,sessionid, moon.memtrace_report(top))
+end
+
+debug_command.memtrace_stop = function(sender, sessionid)
+    moon.response("debug",sender,sessionid, moon.memtrace_stop())
+end
+
+---async
+---sample the Lua stacks of a service for mills milliseconds, through the debug protocol.
+---Returns folded stacks, one "frame;frame;frame count" line per stack, for flamegraph.pl.
+---@param serviceid integer
+---@param mills integer
+---@param period? integer @ VM instructions between samples, default 10000
+---@return string|boolean, string
+function moon.profile(serviceid, mills, period)
+    local ok, err = moon.co_call("debug", serviceid, "profile_start", period)
+    if not ok then
+        return false, err or "profiler already running or a debug hook is installed"
+    end
+    moon.sleep(mills)
+    return moon.co_call("debug", serviceid, "profile_stop")
+end
+
 reg_protocol {
     name = "debug",
     PTYPE = moon.PTYPE_DEBUG,
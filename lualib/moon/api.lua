@@ -97,8 +97,10 @@ end
 ---@param data string|userdata
 ---@param header string
 ---@param sessionid integer
-function core.send(sender, receiver, data, header, sessionid)
-    ignore_param(sender, receiver, data, header, sessionid)
+---@param type integer
+---@param deadline? integer @server time(milliseconds) the caller waits until, message:deadline()
+function core.send(sender, receiver, data, header, sessionid, type, deadline)
+    ignore_param(sender, receiver, data, header, sessionid, type, deadline)
 end
 
 --- remove a service
@@ -162,6 +164,103 @@ function core.callback(fn)
     ignore_param(fn)
 end
 
+--- park the running coroutine on a new sessionid
+---@param watcher? integer @the call fails when this service exits
+---@param deadline? integer @server time(milliseconds), the call fails with "timeout" after it
+---@return integer
+function core.make_session(watcher, deadline)
+    ignore_param(watcher, deadline)
+end
+
+--- the coroutine parked on sessionid, false when the session was cancelled, nil when unknown
+---@param sessionid integer
+---@return thread|boolean|nil
+function core.take_session(sessionid)
+    ignore_param(sessionid)
+end
+
+--- stop waiting, a late response is dropped
+---@param sessionid integer
+function core.cancel_session(sessionid)
+    ignore_param(sessionid)
+end
+
+--- sessions waiting on watcher, all waiting sessions when watcher is nil
+---@param watcher? integer
+---@return integer[]
+function core.sessions(watcher)
+    ignore_param(watcher)
+end
+
+--- record queue wait and dispatch time of every message, per service and PTYPE.
+--- Server wide, off by default. Enabling clears the previous records.
+---@param enable boolean
+function core.trace(enable)
+    ignore_param(enable)
+end
+
+--- responds to sessionid with the recorded latency histograms
+---@param format string @"json" or "prometheus"
+---@param sessionid integer
+function core.trace_report(format, sessionid)
+    ignore_param(format, sessionid)
+end
+
+--- start sampling the Lua stacks of this service, all coroutines included
+---@param period? integer @VM instructions between samples, default 10000
+---@return boolean @false when already running or when a debug hook(debug.sethook) is installed
+function core.profile_start(period)
+    ignore_param(period)
+end
+
+--- stop sampling
+---@return string @folded stacks, "frame;frame;frame count" per line
+function core.profile_stop()
+end
+
+--- start sampling the Lua allocations of this service by call stack.
+--- only blocks allocated after the start are tracked.
+---@param rate? integer @average bytes allocated between samples, default 512KB
+---@return boolean @false when already running
+function core.memtrace_start(rate)
+    ignore_param(rate)
+end
+
+--- estimated live bytes per call stack, "frame;frame;frame bytes" per line
+---@param top? integer @only the top stacks, default all
+---@return string
+function core.memtrace_report(top)
+    ignore_param(top)
+end
+
+--- stop sampling
+---@return string @the final report
+function core.memtrace_stop()
+end
+
+--- gc mode and collector pause times(microseconds) of this service.
+--- a pause is one collector step inside the service, or one worker slice in adaptive mode.
+---@return table @{mode, mem, steps, total_us, mean_us, p50_us, p99_us, max_us, cycles?, threshold?, backstops?}
+function core.gcstat()
+end
+
+---打开一个到 consumer 服务的专用单生产者单消费者环形通道, 适合固定的高频率生产者/消费者服务对。
+---ch:write(data) 写入一条记录(string 或 moon.pack 的 buffer), 通道满或已关闭(包括 consumer 服务已退出)时返回 false。
+---consumer 的多条记录只会被唤醒一次, 用 moon.channel_dispatch 处理。ch:close() 或 ch 被回收时关闭通道。
+---@param consumer integer
+---@param capacity? integer @字节数, 默认1MB, 范围 4KB ~ 1GB
+---@return userdata
+function core.channel(consumer, capacity)
+    ignore_param(consumer, capacity)
+end
+
+---consumer 端按 id 取得通道, 由 channel 协议的 dispatch 调用
+---@param id integer
+---@return userdata?
+function core.channel_attach(id)
+    ignore_param(id)
+end
+
 --- get server time(milliseconds)
 ---@return integer
 function core.now()
@@ -184,6 +283,8 @@ end
 ---'B' message:buffer()
 ---
 ---'C' message:buffer():data() message:buffer():size()
+---
+---'D' message:deadline(), 0 when the sender does not wait for a deadline
 ---@param msg userdata @message* lightuserdata
 ---@param pattern string
 function core.decode(msg, pattern)
@@ -334,6 +435,14 @@ function asio.set_enable_chunked(fd, flag)
     ignore_param(fd,flag)
 end
 
+---@param fd integer
+---@param limit integer
+---PTYPE_SOCKET_HTTP 连接: 请求行加头部的最大字节数, 0 或超过 65536 时为 65536
+---@return boolean
+function asio.set_http_head_limit(fd, limit)
+    ignore_param(fd, limit)
+end
+
 ---@param fd integer
 function asio.close(fd)
     ignore_param(fd)
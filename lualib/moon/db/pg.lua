@@ -2,6 +2,7 @@ local moon = require("moon")
 local seri = require ("seri")
 local cbuffer = require("buffer")
 local socket = require("moon.socket")
+local core = require("pg.core")
 
 local concat = seri.concat
 local bsize = cbuffer.size
@@ -14,19 +15,29 @@ local md5 = moon.md5
 
 local NULL = "\000"
 
-local insert = table.insert
-
 local strpack = string.pack
 local strunpack = string.unpack
-local strsub = string.sub
 
-local type = type
-local assert = assert
+local read_pg = socket.read_pg
+local decode = moon.decode
+local decode_message = core.message
+local decode_result = core.result
+local decode_copy_data = core.copy_data
+local compose_execute = core.execute
+local compose_copy_rows = core.copy_rows
+
+-- socket.read_pg modes
+local READ_MESSAGE = 1
+local READ_UNTIL_READY = 2
+local READ_AVAILABLE = 3
 
-local tointeger = math.tointeger
-local tonumber = tonumber
+local SYNC = "S\0\0\0\4"
+local COPY_DONE = "c\0\0\0\4"
 
-local convert_null = true
+local ERRCODE_INVALID_SQL_STATEMENT_NAME = "26000"
+
+local type = type
+local assert = assert
 
 local flipped
 flipped = function(t)
@@ -79,48 +90,16 @@ local ERROR_TYPES =
     }
 )
 
-local PG_TYPES = {
-    ---"boolean"
-    [16] =  function(value)
-        return value == "t"
-    end,
-    -- [17] = "bytea",
-    [20] = tointeger,
-    [21] = tointeger,
-    [23] = tointeger,
-    [700] = tonumber,
-    [701] = tonumber,
-    [1700] = tonumber,
-    -- [114] = "json",
-    -- [3802] = "json",
-    -- [1000] = "array_boolean",
-    -- [1005] = "array_number",
-    -- [1007] = "array_number",
-    -- [1016] = "array_number",
-    -- [1021] = "array_number",
-    -- [1022] = "array_number",
-    -- [1231] = "array_number",
-    -- [1009] = "array_string",
-    -- [1015] = "array_string",
-    -- [1002] = "array_string",
-    -- [1014] = "array_string",
-    -- [2951] = "array_string",
-    -- [199] = "array_json",
-    -- [3807] = "array_json"
-}
+-- column values are converted by pg.core: bool, int2/int4/int8, float4/float8
+-- and numeric to lua values, NULL to "\000", anything else stays a string
 
 local function encode_int(n)
     return strpack(">i", n)
 end
 
-local function decode_int(s)
-    return strunpack(">i", s)
-end
-
-local function decode_short(s)
-    return strunpack(">H", s)
-end
-
+--- socket errors are handled in the receive functions only: they close the
+--- connection, every request then returns {code = pg.socket_errcode} and the
+--- caller reconnects
 local function disconnect(self)
     if self.sock then
         socket.close(self.sock)
@@ -132,21 +111,45 @@ local function receive_message(self)
     if not self.sock then
         return socket_error,"not connect"
     end
-    local header, err, content
-    ---header: 1byte type + 4byte len
-    header, err = socket.read(self.sock, 5)
-    if not header then
+    local msg, err = read_pg(self.sock, READ_MESSAGE)
+    if not msg then
         disconnect(self)
-        return socket_error, "receive_message: failed to get header: " .. tostring(err)
+        return socket_error, "receive_message: " .. tostring(err)
+    end
+    return decode_message(decode(msg, "C"))
+end
+
+--- reads the whole response up to ReadyForQuery(or CopyInResponse) and decodes it natively
+local function receive_result(self)
+    if not self.sock then
+        return socket_error, "not connect"
     end
-    local t = strsub(header, 1, 1)
-    local len = strunpack(">i", header, 2) - 4
-    content, err = socket.read(self.sock, len)
-    if not content then
+    local msg, err = read_pg(self.sock, READ_UNTIL_READY)
+    if not msg then
         disconnect(self)
         return socket_error, err
     end
-    return t, content
+    return decode_result(decode(msg, "C"))
+end
+
+--- complete messages buffered so far, for streamed responses(COPY TO)
+local function receive_available(self)
+    if not self.sock then
+        return socket_error, "not connect"
+    end
+    local msg, err = read_pg(self.sock, READ_AVAILABLE)
+    if not msg then
+        disconnect(self)
+        return socket_error, err
+    end
+    return decode_copy_data(decode(msg, "C"))
+end
+
+--- writes on a closed connection are dropped, the following receive reports it
+local function send_data(self, data)
+    if self.sock then
+        socket.write(self.sock, data)
+    end
 end
 
 local function send_message(self, t, data)
@@ -154,7 +157,7 @@ local function send_message(self, t, data)
     local len = bsize(buf)
     bwritefront(buf, strpack(">I", len+4))
     bwritefront(buf, t)
-    socket.write(self.sock, buf)
+    send_data(self, buf)
 end
 
 local function send_startup_message(self)
@@ -303,13 +306,22 @@ pg.socket_errcode = -1
 ---@param opts table @{database = "", user = "", password = ""}
 ---@return pg
 function pg.connect(opts)
-    local sock, err = socket.connect(opts.host, opts.port, moon.PTYPE_TEXT, opts.connect_timeout)
+    local sock, err = socket.connect(opts.host, opts.port, moon.PTYPE_SOCKET_PG, opts.connect_timeout)
     if not sock then
         return {code= pg.socket_errcode, message = err}
     end
 
     local obj = table.deepcopy(opts)
     obj.sock = sock
+    obj._stmt_id = 0
+    obj._stmt_cache = {
+        capacity = opts.stmt_cache_size or 64,
+        size = 0,
+        map = {},
+        head = {}
+    }
+    obj._stmt_cache.head.next = obj._stmt_cache.head
+    obj._stmt_cache.head.prev = obj._stmt_cache.head
 
     send_startup_message(obj)
 
@@ -373,100 +385,27 @@ end
 --     end
 -- }
 
-local function parse_row_desc(row_desc)
-    local num_fields = decode_short(row_desc:sub(1, 2))
-    local offset = 3
-    local fields = {}
-    for _ = 1, num_fields do
-        local name = row_desc:match("[^%z]+", offset)
-        offset = offset + #name + 1
-        local data_type = decode_int(row_desc:sub(offset + 6, offset + 9))
-        --data_type = PG_TYPES[data_type] or "string"
-        local format = decode_short(row_desc:sub(offset + 16, offset + 17))
-        assert(0 == format, "don't know how to handle format")
-        offset = offset + 18
-        local info = {
-            name,
-            data_type
-        }
-        table.insert(fields, info)
-    end
-    return fields
-end
-
-
-
-local function parse_row_data(data_row, fields)
-    local tupnfields = decode_short(data_row:sub(1, 2))
-    assert(tupnfields == #fields, 'unexpected field count in \"D\" message')
-    local out = {}
-    local offset = 3
-    for i = 1, tupnfields do
-        local field = fields[i]
-        local field_name, field_type = field[1], field[2]
-        local len = decode_int(data_row:sub(offset, offset + 3))
-        offset = offset + 4
-        if len < 0 then
-            if convert_null then
-                out[field_name] = NULL
-            end
-        else
-            local value = data_row:sub(offset, offset + len - 1)
-            offset = offset + len
-            local fn = PG_TYPES[field_type]
-            if fn then
-                value = fn(value)
-            end
-            out[field_name] = value
-        end
+local function query_result(results, err, notifications)
+    local num_queries = #results
+    local data
+    if num_queries == 1 then
+        data = results[1]
+    elseif num_queries > 1 then
+        data = results
     end
-    return out
-end
-
-local function parse_notification(msg)
-    local pid = decode_int(msg:sub(1, 4))
-    local offset = 4
-    local channel, payload = msg:match("^([^%z]+)%z([^%z]*)%z$", offset + 1)
-    if not (channel) then
-        error("parse_notification: failed to parse notification")
+    if err then
+        err.data = data
+        err.num_queries = num_queries
+        err.notifications = notifications
+        return err
     end
     return {
-        operation = "notification",
-        pid = pid,
-        channel = channel,
-        payload = payload
+        data = data,
+        num_queries = num_queries,
+        notifications = notifications
     }
 end
 
-local function format_query_result(row_desc, data_rows, command_complete)
-    local command, affected_rows
-    if command_complete then
-        command = command_complete:match("^%w+")
-        affected_rows = tointeger(command_complete:match("(%d+)%z$"))
-    end
-    if row_desc then
-        if not (data_rows) then
-            return {}
-        end
-        local fields = parse_row_desc(row_desc)
-        local num_rows = #data_rows
-        for i = 1, num_rows do
-            data_rows[i] = parse_row_data(data_rows[i], fields)
-        end
-        if affected_rows and command ~= "SELECT" then
-            data_rows.affected_rows = affected_rows
-        end
-        return data_rows
-    end
-    if affected_rows then
-        return {
-            affected_rows = affected_rows
-        }
-    else
-        return true
-    end
-end
-
 function pg.pack_query_buffer(buf)
     bwrite(buf, "\0")
     local len = bsize(buf)
@@ -490,60 +429,222 @@ function pg.query(self, sql)
     else
         socket.write_message(self.sock, sql)
     end
-    local row_desc, data_rows, err_msg
-    local result, notifications
-    local num_queries = 0
+    local results, err, notifications, status = receive_result(self)
+    if results == socket_error then
+        return {code= pg.socket_errcode, message = err}
+    end
+    if status == "G" then
+        -- COPY FROM STDIN needs pg.copy_from
+        send_message(self, "f", {"use pg.copy_from", NULL})
+        results, err = receive_result(self)
+        if results == socket_error then
+            return {code= pg.socket_errcode, message = err}
+        end
+    end
+    return query_result(results, err, notifications)
+end
+
+-------------------------------------------------------------------------------
+--- Extended query protocol. Statements are prepared once per connection and
+--- cached by sql text(opts.stmt_cache_size, default 64, least recently used
+--- statements are closed). Parameters use $1, $2 ... placeholders and are sent
+--- in text format, nil as NULL.
+
+local function lru_unlink(node)
+    node.prev.next = node.next
+    node.next.prev = node.prev
+end
+
+local function lru_push_front(cache, node)
+    local head = cache.head
+    node.next = head.next
+    node.prev = head
+    head.next.prev = node
+    head.next = node
+end
+
+local function lru_remove(cache, node)
+    lru_unlink(node)
+    cache.map[node.sql] = nil
+    cache.size = cache.size - 1
+end
+
+local function clear_stmt_cache(self)
+    local cache = self._stmt_cache
+    cache.map = {}
+    cache.size = 0
+    cache.head.next = cache.head
+    cache.head.prev = cache.head
+end
+
+--- appends the messages executing sql to out, a Parse first when the statement is not cached.
+--- newly parsed nodes are appended to parsed, in the order the server sees them.
+local function compose_stmt(self, out, parsed, sql, ...)
+    local cache = self._stmt_cache
+    local node = cache.map[sql]
+    if node then
+        if cache.head.next ~= node then
+            lru_unlink(node)
+            lru_push_front(cache, node)
+        end
+    else
+        self._stmt_id = self._stmt_id + 1
+        node = {sql = sql, name = "moon_s" .. self._stmt_id}
+        cache.map[sql] = node
+        cache.size = cache.size + 1
+        lru_push_front(cache, node)
+        out[#out + 1] = strpack(">c1I4zzI2", "P", #node.name + #sql + 8, node.name, sql, 0)
+        parsed[#parsed + 1] = node
+        if cache.size > cache.capacity then
+            local last = cache.head.prev
+            lru_remove(cache, last)
+            out[#out + 1] = strpack(">c1I4c1z", "C", #last.name + 6, "S", last.name)
+        end
+    end
+    out[#out + 1] = compose_execute(node.name, ...)
+end
+
+--- statements whose ParseComplete did not arrive(the pipeline failed before them) are not on the server
+local function drop_unparsed(self, parsed, nparsed)
+    local cache = self._stmt_cache
+    for i = nparsed + 1, #parsed do
+        local node = parsed[i]
+        if cache.map[node.sql] == node then
+            lru_remove(cache, node)
+        end
+    end
+end
+
+local function run_pipeline(self, queries)
+    local out, parsed = {}, {}
+    for i = 1, #queries do
+        local q = queries[i]
+        if type(q) == "string" then
+            compose_stmt(self, out, parsed, q)
+        else
+            compose_stmt(self, out, parsed, table.unpack(q, 1, q.n or #q))
+        end
+    end
+    out[#out + 1] = SYNC
+    send_data(self, table.concat(out))
+    local results, err, notifications, _, nparsed = receive_result(self)
+    if results == socket_error then
+        clear_stmt_cache(self)
+        return socket_error, err
+    end
+    drop_unparsed(self, parsed, nparsed)
+    return results, err, notifications
+end
+
+--- Sends every query with a single Sync and reads all responses in one go.
+--- queries: { {sql, param1, param2, ...}, "sql without params", ... }
+--- data is an array with one result per query. On error the following queries
+--- are skipped by the server, data holds the results completed before it.
+---@param queries table
+---@return pg_result
+function pg.pipeline(self, queries)
+    local results, err, notifications = run_pipeline(self, queries)
+    if results == socket_error then
+        return {code= pg.socket_errcode, message = err}
+    end
+    local res = query_result(results, err, notifications)
+    res.data = results
+    return res
+end
+
+--- Executes sql as a cached prepared statement, result shape is the same as pg.query.
+---@param sql string
+---@return pg_result
+function pg.execute(self, sql, ...)
+    local query = table.pack(sql, ...)
+    local results, err, notifications = run_pipeline(self, {query})
+    if results == socket_error then
+        return {code= pg.socket_errcode, message = err}
+    end
+    if err and err.code == ERRCODE_INVALID_SQL_STATEMENT_NAME then
+        -- server side statements are gone(DISCARD ALL etc.), prepare again once
+        clear_stmt_cache(self)
+        results, err, notifications = run_pipeline(self, {query})
+        if results == socket_error then
+            return {code= pg.socket_errcode, message = err}
+        end
+    end
+    return query_result(results, err, notifications)
+end
+
+--- COPY ... FROM STDIN. rows is an array of rows(each an array of column values,
+--- nil as NULL, or a preformatted text line), or an iterator returning such arrays
+--- until nil. Rows are streamed in CopyData batches of opts.batch_size(default 1000).
+---@param sql string
+---@param rows table|function
+---@param ncols? integer @ column count, needed when rows contain nil values
+---@return pg_result
+function pg.copy_from(self, sql, rows, ncols)
+    send_message(self, MSG_TYPE.query, {sql, NULL})
+    local results, err, notifications, status = receive_result(self)
+    if results == socket_error then
+        return {code= pg.socket_errcode, message = err}
+    end
+    if status ~= "G" then
+        return query_result(results, err or {message = "not a COPY FROM STDIN statement"}, notifications)
+    end
+
+    local batch = self.batch_size or 1000
+    if type(rows) == "function" then
+        for chunk in rows do
+            if #chunk > 0 then
+                send_data(self, compose_copy_rows(chunk, ncols))
+            end
+        end
+    else
+        for i = 1, #rows, batch do
+            send_data(self, compose_copy_rows(rows, ncols, i, math.min(i + batch - 1, #rows)))
+        end
+    end
+    send_data(self, COPY_DONE)
+
+    results, err, notifications = receive_result(self)
+    if results == socket_error then
+        return {code= pg.socket_errcode, message = err}
+    end
+    return query_result(results, err, notifications)
+end
+
+--- COPY ... TO STDOUT. Each text line(with its trailing newline) is passed to
+--- callback as it arrives, without callback the lines are returned as data.
+---@param sql string
+---@param callback? fun(line:string)
+---@return pg_result
+function pg.copy_to(self, sql, callback)
+    send_message(self, MSG_TYPE.query, {sql, NULL})
+    local data = {}
+    local n = 0
+    local db_error
     while true do
-        local t, msg = receive_message(self)
-        if t == socket_error then
-            return {code= pg.socket_errcode, message = msg}
+        local lines, status, e, affected_rows = receive_available(self)
+        if lines == socket_error then
+            return {code= pg.socket_errcode, message = status}
         end
-        local _exp_0 = t
-        if MSG_TYPE.data_row == _exp_0 then
-            data_rows = data_rows or {}
-            insert(data_rows, msg)
-        elseif MSG_TYPE.row_description == _exp_0 then
-            row_desc = msg
-        elseif MSG_TYPE.error == _exp_0 then
-            err_msg = msg
-        elseif MSG_TYPE.command_complete == _exp_0 then
-
-            local next_result = format_query_result(row_desc, data_rows, msg)
-            num_queries = num_queries + 1
-            if num_queries == 1 then
-                result = next_result
-            elseif num_queries == 2 then
-                result = {
-                    result,
-                    next_result
-                }
+        db_error = db_error or e
+        for i = 1, #lines do
+            if callback then
+                callback(lines[i])
             else
-                insert(result, next_result)
+                n = n + 1
+                data[n] = lines[i]
             end
-            row_desc = nil
-            data_rows = nil
-        elseif MSG_TYPE.ready_for_query == _exp_0 then
+        end
+        if affected_rows then
+            data.affected_rows = affected_rows
+        end
+        if status then
             break
-        elseif MSG_TYPE.notification == _exp_0 then
-            if not (notifications) then
-                notifications = {}
-            end
-            insert(notifications, parse_notification(msg))
         end
     end
-    if err_msg then
-        local db_error = parse_error(err_msg)
-        db_error.data = result
-        db_error.num_queries = num_queries
-        db_error.notifications = notifications
-        return db_error
+    if db_error then
+        return query_result({}, db_error)
     end
-
-    return {
-        data = result,
-        num_queries = num_queries,
-        notifications = notifications
-    }
+    return query_result({data})
 end
 
 return pg
\ No newline at end of file
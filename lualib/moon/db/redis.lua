@@ -5,7 +5,6 @@ local seri = require("seri")
 local socket = require "moon.socket"
 
 local tostring = tostring
-local tonumber = tonumber
 local table = table
 local string = string
 local assert = assert
@@ -15,8 +14,7 @@ local type = type
 local select = select
 local pairs = pairs
 
-local readline = socket.readline
-local read = socket.read
+local read_reply = socket.read_reply
 
 local redis = {}
 local command = {}
@@ -30,59 +28,42 @@ local socket_error = setmetatable({}, {__tostring = function() return "[Error: s
 redis.socket_error = socket_error
 
 ---------- redis response
-local redcmd = {}
-
-redcmd[36] = function(fd, data) -- '$'
-	local bytes = tonumber(data)
-	if bytes < 0 then
-		return true,nil
-	end
-	local firstline, err = read(fd, bytes+2)
-	if firstline then
-		return true, string.sub(firstline,1,-3)
-	else
-		return socket_error, err
-	end
-end
-
-redcmd[43] = function(_, data) -- '+'
-	return true, data
-end
-
-redcmd[45] = function(_, data) -- '-'
-	return false, data
-end
-
-redcmd[58] = function(_, data) -- ':'
-	-- todo: return string later
-	return true, tonumber(data)
-end
+-- replies are framed by the PTYPE_SOCKET_RESP connection and decoded natively,
+-- one scheduler round trip per reply (or per batch of pipelined replies)
 
 local function read_response(fd)
-	local result, err = readline(fd, "\r\n")
-	if not result then
-		return socket_error, err
+	local n, ok, data = read_reply(fd, 1)
+	if not n then
+		return socket_error, ok
 	end
-	local firstchar = string.byte(result)
-	local data = string.sub(result,2)
-	return redcmd[firstchar](fd,data)
+	return ok, data
 end
 
-redcmd[42] = function(fd, data)	-- '*'
-	local n = tonumber(data)
-	if n < 0 then
-		return true, nil
-	end
-	local bulk = {}
-	local noerr = true
-	for i = 1,n do
-		local ok, v = read_response(fd)
-		if not ok then
-			noerr = false
+-- max replies delivered by one message when reading pipeline results
+local PIPELINE_BATCH = 1024
+
+local function read_pipeline(fd, count, resp)
+	local ok, out
+	local remain = count
+	while remain > 0 do
+		local n = remain < PIPELINE_BATCH and remain or PIPELINE_BATCH
+		local res = table.pack(read_reply(fd, n))
+		if not res[1] then
+			return socket_error, res[2]
+		end
+		for i = 2, res.n, 2 do
+			ok, out = res[i], res[i+1]
+			if resp then
+				resp[#resp+1] = {ok = ok, out = out}
+			end
 		end
-		bulk[i] = v
+		remain = remain - n
 	end
-	return noerr, bulk
+	if resp then
+		return true, resp
+	end
+	-- return last response
+	return ok, out
 end
 
 -------------------
@@ -194,7 +175,7 @@ local function redis_login(auth, db)
 end
 
 function redis.connect(db_conf)
-	local fd, err = socket.connect(db_conf.host, db_conf.port or 6379, moon.PTYPE_TEXT, db_conf.timeout)
+	local fd, err = socket.connect(db_conf.host, db_conf.port or 6379, moon.PTYPE_SOCKET_RESP, db_conf.timeout)
 	if not fd then
 		return false, err
 	end
@@ -258,24 +239,9 @@ function command:pipeline(ops,resp)
 		compose_table(cmds, cmd)
 	end
 
-	if resp then
-		return request(self[1], cmds, function(fd)
-			for _=1, #ops do
-				local ok, out = read_response(fd)
-				table.insert(resp, {ok = ok, out = out})
-			end
-			return true, resp
-		end)
-	else
-		return request(self[1], cmds, function(fd)
-			local ok, out
-			for _=1, #ops do
-				ok, out = read_response(fd)
-			end
-			-- return last response
-			return ok,out
-		end)
-	end
+	return request(self[1], cmds, function(fd)
+		return read_pipeline(fd, #ops, resp)
+	end)
 end
 
 --- watch mode
@@ -309,7 +275,7 @@ function redis.watch(db_conf)
 		__psubscribe = {},
 	}
 
-	local fd, err = socket.connect(db_conf.host, db_conf.port or 6379, moon.PTYPE_TEXT, db_conf.timeout)
+	local fd, err = socket.connect(db_conf.host, db_conf.port or 6379, moon.PTYPE_SOCKET_RESP, db_conf.timeout)
 	if not fd then
 		return false, err
 	end
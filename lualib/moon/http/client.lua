@@ -4,193 +4,199 @@ local moon = require("moon")
 local socket = require("moon.socket")
 
 local tbinsert = table.insert
-local tbconcat = table.concat
+local tbremove = table.remove
 
 local tostring = tostring
 local tonumber = tonumber
 local pairs = pairs
-local assert = assert
-local error = error
 
-local parse_response = http.parse_response
+local decode = moon.decode
+local clock = moon.clock
+local read_http = socket.read_http
+local decode_response = http.decode_response
 local create_query_string = http.create_query_string
 
------------------------------------------------------------------
-
-local function read_chunked(fd)
-
-    local chunkdata = {}
+-- socket.read_http modes
+local READ_RESPONSE = 1
+local READ_HEAD_RESPONSE = 2
 
-    while true do
-        local data, err = socket.readline(fd, "\r\n")
-        if not data then
-            return {socket_error = err}
-        end
-        local length = tonumber(data,"16")
-        if not length then
-            error("Invalid response body")
-        end
+-- methods a reused connection may send again after any read failure, RFC 7230 6.3.1
+local IDEMPOTENT = {GET = true, HEAD = true, PUT = true, DELETE = true, OPTIONS = true, TRACE = true}
 
-        if length==0 then
-            break
-        end
+-- latency histogram bucket upper bounds, milliseconds
+local LATENCY_BOUNDS = {1, 2, 5, 10, 20, 50, 100, 200, 500, 1000}
 
-        if length >0 then
-            data, err = socket.read(fd, length)
-            if not data then
-                return {socket_error = err}
-            end
-            tbinsert( chunkdata, data )
-            data, err = socket.readline(fd, "\r\n")
-            if not data then
-                return {socket_error = err}
-            end
-        elseif length <0 then
-            error("Invalid response body")
-        end
-    end
+-----------------------------------------------------------------
 
-    local  data, err = socket.readline(fd, "\r\n")
-    if not data then
-        return {socket_error = err}
+local function parse_host(host, defaultport)
+    local host_, port = host:match("([^:]+):?(%d*)$")
+    if port == "" then
+        port = defaultport
+    else
+        port = tonumber(port)
     end
-
-    return chunkdata
+    return host_, port
 end
 
-local function response_handler(fd)
-    local data, err = socket.readline(fd, "\r\n\r\n")
-    if not data then
-        return {socket_error = err}
-    end
+local M = {}
 
-    --print("raw data",data)
-    local ok, version, status_code, header = parse_response(data)
-    assert(ok,"Invalid HTTP response header")
+local default_connect_timeout = 1000
 
-    local response = {
-        version = version,
-        status_code = status_code,
-        header = header
-    }
+local default_read_timeout = 10000
 
-    response.header = {}
-    for k,v in pairs(header) do
-        response.header[k:lower()]=v
-    end
+--- idle keep-alive connections kept per host
+M.max_idle_per_host = 16
 
-    header = response.header
+--- seconds an idle connection stays in the pool
+M.idle_timeout = 60
 
-    local content_length = header["content-length"]
-    if content_length then
-        content_length = tonumber(content_length)
-        if not content_length then
-            moon.warn("content-length is not number")
-            return response
-        end
+---per host: idle connections(stack, most recently used on top) and counters
+local pools = {}
 
-        if content_length >0 then
-            --print("Content-Length",content_length)
-            data, err = socket.read(fd, content_length)
-            if not data then
-                return {socket_error = err}
-            end
-            response.content = data
+local function get_pool(baseaddress)
+    local pool = pools[baseaddress]
+    if not pool then
+        local histogram = {}
+        for i = 1, #LATENCY_BOUNDS + 1 do
+            histogram[i] = 0
         end
-    elseif header["transfer-encoding"] == 'chunked' then
-        local chunkdata = read_chunked(fd)
-        if chunkdata.socket_error then
-            return chunkdata
+        pool = {
+            idle = {},
+            idle_since = {},
+            requests = 0,
+            errors = 0,
+            connects = 0,
+            reuses = 0,
+            histogram = histogram,
+            total_ms = 0
+        }
+        pools[baseaddress] = pool
+    end
+    return pool
+end
+
+local function take_idle(pool)
+    local idle, idle_since = pool.idle, pool.idle_since
+    local now = clock()
+    while #idle > 0 do
+        local fd = tbremove(idle)
+        local since = tbremove(idle_since)
+        if now - since < M.idle_timeout then
+            return fd
         end
-        response.content = tbconcat( chunkdata )
-    else
-        moon.warn("Unsupport transfer-encoding:"..tostring(header["transfer-encoding"]))
+        socket.close(fd)
     end
-    return response
 end
 
-local function parse_host(host, defaultport)
-    local host_, port = host:match("([^:]+):?(%d*)$")
-    if port == "" then
-        port = defaultport
+local function give_back(pool, fd)
+    local idle = pool.idle
+    if #idle < M.max_idle_per_host then
+        idle[#idle + 1] = fd
+        pool.idle_since[#pool.idle_since + 1] = clock()
     else
-        port = tonumber(port)
+        socket.close(fd)
     end
-    return host_, port
 end
 
-local M = {}
-
-local default_connect_timeout = 1000
-
-local default_read_timeout = 10000
-
-local keep_alive_host = {}
+local function record(pool, bt, ok)
+    local ms = (clock() - bt) * 1000
+    local histogram = pool.histogram
+    local i = 1
+    while i <= #LATENCY_BOUNDS and ms > LATENCY_BOUNDS[i] do
+        i = i + 1
+    end
+    histogram[i] = histogram[i] + 1
+    pool.requests = pool.requests + 1
+    pool.total_ms = pool.total_ms + ms
+    if not ok then
+        pool.errors = pool.errors + 1
+    end
+end
 
-local max_pool_num = 10
+local function keep_alive(options, response)
+    if options.keepalive == false then
+        return false
+    end
+    local connection = response.header["connection"]
+    if connection then
+        connection = connection:lower()
+        if connection == "close" then
+            return false
+        end
+    end
+    -- HTTP/1.0 closes by default
+    return response.version ~= "1.0" or connection == "keep-alive"
+end
 
 ---@param options HttpOptions
-local function do_request(baseaddress, options, req)
-    options.connect_timeout = options.connect_timeout or default_connect_timeout
-    options.read_timeout = options.read_timeout or default_read_timeout
+local function do_request(baseaddress, options, req, method)
+    local connect_timeout = options.connect_timeout or default_connect_timeout
+    local read_timeout = options.read_timeout or default_read_timeout
+    local mode = (method == "HEAD") and READ_HEAD_RESPONSE or READ_RESPONSE
 
-::TRY_AGAIN::
-    local fd, err
-    local pool = keep_alive_host[baseaddress]
-    if not pool then
-        pool = {}
-        keep_alive_host[baseaddress] = pool
-    elseif #pool >0 then
-        fd = table.remove(pool)
-    end
+    local pool = get_pool(baseaddress)
+    local bt = clock()
 
-    local newconn = false
-    if not fd then
+::TRY_AGAIN::
+    local fd = take_idle(pool)
+    local reused = (fd ~= nil)
+    if reused then
+        pool.reuses = pool.reuses + 1
+    else
         local host, port = parse_host(baseaddress, 80)
-        fd, err = socket.connect(host, port,  moon.PTYPE_TEXT, options.connect_timeout)
+        local err
+        fd, err = socket.connect(host, port, moon.PTYPE_SOCKET_HTTP, connect_timeout)
         if not fd then
-            return false ,err
+            record(pool, bt, false)
+            return false, err
         end
-        local read_timeout = options.read_timeout or 0
+        pool.connects = pool.connects + 1
         socket.settimeout(fd, read_timeout//1000)
-        newconn = true
+        socket.setnodelay(fd)
     end
 
     if not socket.write(fd, seri.concat(req)) then
-        goto TRY_AGAIN
-    end
-
-    local ok , response = pcall(response_handler, fd)
-    if not ok then
         socket.close(fd)
-        return false, response
+        if reused then
+            goto TRY_AGAIN
+        end
+        record(pool, bt, false)
+        return false, "write failed"
     end
 
-    if response.socket_error then
+    local msg, err = read_http(fd, mode)
+    if not msg then
         socket.close(fd)
-        if response.socket_error == "TIMEOUT" then
-            return false, response.socket_error
-        end
-        if newconn and response.socket_error == "EOF" then
-            return false, response.socket_error
+        -- the server closed the idle connection before answering. a non-idempotent
+        -- request may have run, retry only when nothing of the response arrived
+        if reused and (err == "EOF" or (IDEMPOTENT[method] and err ~= "TIMEOUT")) then
+            goto TRY_AGAIN
         end
-        goto TRY_AGAIN
+        record(pool, bt, false)
+        return false, err
     end
 
-    if not options.keepalive then
+    local ok, version, status_code, header, content = decode_response(decode(msg, "C"))
+    if not ok then
         socket.close(fd)
+        record(pool, bt, false)
+        return false, "Invalid HTTP response header"
+    end
+
+    local response = {
+        version = version,
+        status_code = status_code,
+        header = header,
+        content = content
+    }
+
+    if keep_alive(options, response) then
+        give_back(pool, fd)
     else
-        if response.header["connection"] == "close" then
-            socket.close(fd)
-        else
-            if #pool < max_pool_num then
-                table.insert(pool, fd)
-            else
-                socket.close(fd)
-            end
-        end
+        socket.close(fd)
     end
-    return ok, response
+    record(pool, bt, true)
+    return true, response
 end
 
 ---@param method string
@@ -240,7 +246,10 @@ local function request( method, baseaddress, options, content)
         end
     end
 
-    if options.keepalive then
+    if options.keepalive == false then
+        tbinsert( cache, "Connection: close")
+        tbinsert( cache, "\r\n")
+    elseif options.keepalive then
         tbinsert( cache, "Connection: keep-alive")
         tbinsert( cache, "\r\n")
         tbinsert( cache, "Keep-Alive: "..tostring(options.keepalive))
@@ -254,7 +263,7 @@ local function request( method, baseaddress, options, content)
         baseaddress = options.proxy
     end
 
-    local ok, response = do_request(baseaddress, options, cache)
+    local ok, response = do_request(baseaddress, options, cache, method)
 
     if ok then
         return response
@@ -268,11 +277,41 @@ M.create_query_string = create_query_string
 ---@class HttpOptions
 ---@field public path string
 ---@field public header table<string,string>
----@field public keepalive integer @ seconds
+---@field public keepalive integer|boolean @ seconds, connections are reused unless false
 ---@field public connect_timeout integer @ ms
 ---@field public read_timeout integer @ ms
 ---@field public proxy string @ host:port
 
+--- per host counters: requests, errors, connects(new connections), reuses(keep-alive hits),
+--- idle(pooled connections), avg_ms and latency_ms = { {bound_ms, count}, ... }, the last bound is math.huge
+---@param host? string @host:port, all hosts when nil
+function M.stats(host)
+    local function one(pool)
+        local latency = {}
+        for i, count in ipairs(pool.histogram) do
+            latency[i] = {LATENCY_BOUNDS[i] or math.huge, count}
+        end
+        return {
+            requests = pool.requests,
+            errors = pool.errors,
+            connects = pool.connects,
+            reuses = pool.reuses,
+            idle = #pool.idle,
+            avg_ms = pool.requests > 0 and pool.total_ms / pool.requests or 0,
+            latency_ms = latency
+        }
+    end
+    if host then
+        local pool = pools[host]
+        return pool and one(pool)
+    end
+    local res = {}
+    for k, pool in pairs(pools) do
+        res[k] = one(pool)
+    end
+    return res
+end
+
 ---@param host string @host:port
 ---@param options HttpOptions
 function M.get(host, options)
@@ -5,20 +5,19 @@ local seri = require("seri")
 local fs = require("fs")
 local socket = require("moon.socket")
 
-local parse_request = http.parse_request
+local decode_request = http.decode_request
 local parse_query_string = http.parse_query_string
 
 local tbinsert = table.insert
-local tbconcat = table.concat
-
-local strfmt = string.format
 
 local tostring = tostring
-local tonumber = tonumber
 local setmetatable = setmetatable
 local pairs = pairs
 local assert = assert
 
+local decode = moon.decode
+local read_http = socket.read_http
+
 local http_status_msg = {
 
 	[100] = "Continue",
@@ -167,50 +166,16 @@ local M = {}
 
 local routers = {}
 
-local function read_chunked(fd)
-
-    local chunkdata = {}
-    local content_length = 0
-
-    while true do
-        local data, err = socket.readline(fd, "\r\n", 64)
-        assert(data,err)
-        local length = tonumber(data,"16")
-        if not length then
-            error("Invalid response body")
-        end
-
-        if length==0 then
-            break
-        end
-
-        content_length = content_length + length
-
-        if M.content_max_len and content_length > M.content_max_len then
-            error(strfmt( "content length %d, limit %d", content_length, M.content_max_len ))
-        end
-
-        if length >0 then
-            data, err = socket.read(fd, length)
-            assert(data,err)
-            tbinsert( chunkdata, data )
-            data, err = socket.readline(fd, "\r\n", 2)
-            assert(data,err)
-        elseif length <0 then
-            error("Invalid response body")
-        end
-    end
+local traceback = debug.traceback
 
-    local  data, err = socket.readline(fd, "\r\n", 2)
-    if not data then
-        return false,err
+local function send_response(fd, request, response)
+    if request.close then
+        socket.write_then_close(fd, seri.concat(response:tb()))
+    else
+        socket.write(fd, seri.concat(response:tb()))
     end
-
-    return chunkdata
 end
 
-local traceback = debug.traceback
-
 local function request_handler(fd, request)
     local response = http_response.new()
 
@@ -220,11 +185,7 @@ local function request_handler(fd, request)
         if static_src then
             response:write_header("Content-Type", static_src.mime)
             response:write(static_src.bin)
-            if request.header["Connection"] == "close" then
-                socket.write_then_close(fd, seri.concat(response:tb()))
-            else
-                socket.write(fd, seri.concat(response:tb()))
-            end
+            send_response(fd, request, response)
             return
         end
     end
@@ -246,64 +207,42 @@ local function request_handler(fd, request)
         response:write(string.format("Cannot %s %s", request.method, request.path))
     end
 
-    if request.header["Connection"] == "close" then
-        socket.write_then_close(fd, seri.concat(response:tb()))
-    else
-        socket.write(fd, seri.concat(response:tb()))
-    end
+    send_response(fd, request, response)
 end
 
+-- the connection parses and de-chunks the whole request natively,
+-- pipelined requests are served one by one in arrival order
 local function session_handler(fd)
-    local data, err = socket.readline(fd, "\r\n\r\n", M.header_max_len)
-    assert(data,err)
+    local msg, err = read_http(fd, M.content_max_len or 0)
+    if not msg then
+        return false, err
+    end
 
-    --print("raw data",data)
-    local ok,method,path,query_string,version,header = parse_request(data)
-    assert(ok,"Invalid HTTP response header")
+    local ok, method, path, query_string, version, header, content = decode_request(decode(msg, "C"))
+    assert(ok, "Invalid HTTP request header")
 
     local request = {
         method = method,
         path = path,
         query_string = query_string,
-        version = version
+        version = version,
+        header = header,
+        content = content,
     }
 
-    request.header = {}
-    for k,v in pairs(header) do
-        request.header[k:lower()]=v
+    local connection = header["connection"]
+    if version == "1.0" then
+        request.close = not connection or connection:lower() ~= "keep-alive"
+    else
+        request.close = connection ~= nil and connection:lower() == "close"
     end
 
-    header = request.header
-
     request.parse_query = function() return parse_query_string(request.query_string) end
 
     request.parse_form = function() return parse_query_string(request.content) end
 
-    local content_length = header["content-length"]
-    if content_length then
-        content_length = tonumber(content_length)
-        if not content_length then
-            error("content-length is not number")
-        end
-
-        if M.content_max_len and content_length> M.content_max_len then
-            error(strfmt( "content length %d, limit %d",content_length,M.content_max_len ))
-        end
-
-        data, err = socket.read(fd, content_length)
-        assert(data,err)
-        --print("Content-Length",content_length)
-        request.content = data
-    elseif header["transfer-encoding"] == 'chunked' then
-        local chunkdata = read_chunked(fd)
-        if not chunkdata then
-            error("Invalid response body")
-        end
-        request.content = tbconcat( chunkdata )
-    elseif method:upper()~="GET" then
-        moon.warn("Unsupport transfer-encoding: "..tostring(header["transfer-encoding"]))
-    end
     request_handler(fd, request)
+    return not request.close
 end
 
 -----------------------------------------------------------------
@@ -312,15 +251,23 @@ local listenfd
 
 function M.start(fd, timeout)
     socket.settimeout(fd, timeout)
+    -- pipelined responses are written one by one, do not let Nagle hold them back
+    socket.setnodelay(fd)
+    socket.set_http_head_limit(fd, M.header_max_len or 0)
     moon.async(function()
         while true do
-            local ok,errmsg = pcall(session_handler,fd)
-            if not ok then
-                socket.close(fd)
-                if M.error then
-                    M.error(fd, errmsg)
-                else
-                    print("httpserver session error",errmsg)
+            local ok, continue, errmsg = pcall(session_handler, fd)
+            if not ok or not continue then
+                if not ok then
+                    errmsg = continue
+                end
+                if errmsg then
+                    socket.close(fd)
+                    if M.error then
+                        M.error(fd, errmsg)
+                    else
+                        print("httpserver session error",errmsg)
+                    end
                 end
                 return
             end
@@ -330,7 +277,7 @@ end
 
 function M.listen(host,port,timeout)
     assert(not listenfd,"http server can only listen port once.")
-    listenfd = socket.listen(host, port, moon.PTYPE_TEXT)
+    listenfd = socket.listen(host, port, moon.PTYPE_SOCKET_HTTP)
     timeout = timeout or 0
     moon.async(function()
         while true do
@@ -21,7 +21,11 @@ local flag_ws_pong = 64
 local supported_protocol = {
     [moon.PTYPE_TEXT] = true,
     [moon.PTYPE_SOCKET] = true,
-    [moon.PTYPE_SOCKET_WS] = true
+    [moon.PTYPE_SOCKET_WS] = true,
+    [moon.PTYPE_SOCKET_RESP] = true,
+    [moon.PTYPE_SOCKET_MYSQL] = true,
+    [moon.PTYPE_SOCKET_PG] = true,
+    [moon.PTYPE_SOCKET_HTTP] = true
 }
 
 ---@class socket : asio
@@ -44,7 +48,7 @@ function socket.start(listenfd)
 end
 
 --- async
---- param protocol moon.PTYPE_TEXT、moon.PTYPE_SOCKET、moon.PTYPE_SOCKET_WS、
+--- param protocol moon.PTYPE_TEXT、moon.PTYPE_SOCKET、moon.PTYPE_SOCKET_WS、moon.PTYPE_SOCKET_RESP、moon.PTYPE_SOCKET_MYSQL、moon.PTYPE_SOCKET_PG、moon.PTYPE_SOCKET_HTTP、
 --- timeout millseconds
 ---@param host string
 ---@param port integer
@@ -86,6 +90,46 @@ function socket.readline(fd, delim, limit)
     return yield()
 end
 
+--- async, only for moon.PTYPE_SOCKET_RESP
+--- read n complete replies, returns count, ok1, value1, ok2, value2 ...
+--- or false, errmsg when the socket fails
+function socket.read_reply(fd, n)
+    local sessionid = make_response()
+    read(fd, id, n or 1, "", sessionid)
+    return yield()
+end
+
+--- async, only for moon.PTYPE_SOCKET_MYSQL
+--- mode 1: one packet, 2: command response, 3: prepare response.
+--- returns the message holding the raw packets, decode it before the next yield.
+--- or false, errmsg when the socket fails
+function socket.read_mysql(fd, mode)
+    local sessionid = make_response()
+    read(fd, id, mode, "", sessionid)
+    return yield()
+end
+
+--- async, only for moon.PTYPE_SOCKET_PG
+--- mode 1: one message, 2: until ReadyForQuery or CopyInResponse, 3: what is buffered.
+--- returns the message holding the raw backend messages, decode it before the next yield.
+--- or false, errmsg when the socket fails
+function socket.read_pg(fd, mode)
+    local sessionid = make_response()
+    read(fd, id, mode, "", sessionid)
+    return yield()
+end
+
+--- async, only for moon.PTYPE_SOCKET_HTTP
+--- connected fd, mode 1: a complete response, 2: a complete response to HEAD(no body).
+--- accepted fd, mode is the request body size limit(0 unlimited): a complete request.
+--- returns the message holding head and decoded body, decode it before the next yield.
+--- or false, errmsg when the socket fails
+function socket.read_http(fd, mode)
+    local sessionid = make_response()
+    read(fd, id, mode, "", sessionid)
+    return yield()
+end
+
 function socket.write_then_close(fd, data)
     write(fd ,data, flag_close)
 end
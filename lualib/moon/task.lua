@@ -20,7 +20,7 @@ function _M.wait_all(fnlist)
         return res
     end
     local co = corunning()
-    moon.timeout(0, function()
+    moon.defer(function()
         for i,fn in ipairs(fnlist) do
             moon.async(function ()
                 local one = {xpcall(fn, traceback)}
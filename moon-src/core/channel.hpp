@@ -0,0 +1,33 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include "common/spsc_ring.hpp"
+
+namespace moon
+{
+    //opt-in ring between two services. only the producer service writes and only the
+    //consumer service reads; a service never leaves its worker, so each side is one thread.
+    //the consumer is woken by one PTYPE_CHANNEL message per drained batch, not per record.
+    struct channel
+    {
+        channel(uint32_t id_, uint32_t producer_, uint32_t consumer_, size_t capacity)
+            : id(id_), producer(producer_), consumer(consumer_), ring(capacity)
+        {
+        }
+
+        const uint32_t id;
+        const uint32_t producer;
+        const uint32_t consumer;
+        spsc_ring ring;
+        //a wake up message is on its way, set by the producer, cleared by the consumer
+        std::atomic_bool notified = false;
+        std::atomic_bool closed = false;
+        //producer side
+        uint64_t writes = 0;
+        uint64_t full = 0;
+        //consumer side
+        uint64_t reads = 0;
+    };
+
+    using channel_ptr_t = std::shared_ptr<channel>;
+}
@@ -24,6 +24,12 @@ namespace moon
     constexpr uint8_t PTYPE_DEBUG = 7;//
     constexpr uint8_t PTYPE_SHUTDOWN = 8;//
     constexpr uint8_t PTYPE_TIMER = 9;//
+    constexpr uint8_t PTYPE_SOCKET_RESP = 10; //redis serialization protocol
+    constexpr uint8_t PTYPE_SOCKET_MYSQL = 11; //mysql client/server protocol
+    constexpr uint8_t PTYPE_SOCKET_PG = 12; //postgresql frontend/backend protocol
+    constexpr uint8_t PTYPE_SOCKET_HTTP = 13; //http/1.1
+    constexpr uint8_t PTYPE_SOCKET_CLUSTER = 14; //cluster router frames
+    constexpr uint8_t PTYPE_CHANNEL = 15; //records are waiting on a channel, see channel.hpp
 
     //network
     using message_size_t = uint16_t;
@@ -69,11 +75,33 @@ namespace moon
         bool unique = false;
         uint32_t threadid = 0;
         size_t memlimit = 0;
+        //lua gc mode: "gen"(default), "inc", or "adaptive": incremental, stopped while
+        //handling messages and stepped by the worker between batches.
+        std::string gcmode;
+        //lua_gc parameters, 0 keeps the lua default
+        int gcpause = 0;
+        int gcstepmul = 0;
+        int gcstepsize = 0;
+        int gcminormul = 0;
+        int gcmajormul = 0;
+        //adaptive: microseconds of collector work per step when the worker is idle
+        int64_t gcbudget = 0;
         std::string name;
         std::string source;
         std::string params;
     };
 
+    //thread placement, a cpu of -1 leaves the thread unpinned.
+    //a pinned worker allocates its services on the numa node of its cpu(first touch).
+    struct placement_conf
+    {
+        std::vector<int> worker_cpu;//index is worker id - 1
+        int timer_cpu = -1;
+        int logger_cpu = -1;
+        //worker ids never chosen for services created without threadid
+        std::vector<uint32_t> dedicated;
+    };
+
     constexpr uint32_t BOOTSTRAP_ADDR = 0x01000001;
 }
 
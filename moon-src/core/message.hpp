@@ -111,6 +111,28 @@ namespace moon
             return type_;
         }
 
+        //server time(milliseconds) after which the caller no longer waits, 0 means none
+        void set_deadline(int64_t v)
+        {
+            deadline_ = v;
+        }
+
+        int64_t deadline() const
+        {
+            return deadline_;
+        }
+
+        //time::microsecond() when the message entered the worker queue, 0 when not traced
+        void set_enqueue_time(int64_t v)
+        {
+            enqueue_time_ = v;
+        }
+
+        int64_t enqueue_time() const
+        {
+            return enqueue_time_;
+        }
+
         std::string_view bytes() const
         {
             if (!data_)
@@ -176,6 +198,8 @@ namespace moon
             sender_ = 0;
             receiver_ = 0;
             sessionid_ = 0;
+            deadline_ = 0;
+            enqueue_time_ = 0;
 
             if (header_)
             {
@@ -192,6 +216,8 @@ namespace moon
         uint32_t sender_ = 0;
         uint32_t receiver_ = 0;
         int32_t sessionid_ = 0;
+        int64_t deadline_ = 0;
+        int64_t enqueue_time_ = 0;
         std::unique_ptr<std::string> header_;
         buffer_ptr_t data_;
     };
@@ -146,6 +146,12 @@ namespace moon
             wq_error_size_ = errorsize;
         }
 
+        //buffers not yet completed by the writer, 0 when the connection is idle
+        size_t send_queue_size() const
+        {
+            return queue_.size();
+        }
+
         static time_t now()
         {
             return std::time(nullptr);
@@ -0,0 +1,153 @@
+#pragma once
+#include "base_connection.hpp"
+#include "common/byte_convert.hpp"
+
+namespace moon
+{
+    //fixed binary header of a cluster frame, integers in network byte order.
+    //followed by name_len bytes of name and the payload.
+    struct cluster_frame
+    {
+        enum kind_t : uint8_t
+        {
+            send = 1,//to service `name`, no response
+            call,//to service `name`, addr and session of the caller
+            response,//to caller addr and session
+            error,//to caller addr and session, name is the error header
+            ping,
+            pong,
+            batch,//frames packed together, ptype flags, addr raw size, session frame count
+            dict,//payload is the dictionary of the following compressed batches
+            link,//link options: addr batch_bytes, session delay_us, ptype compress
+        };
+
+        uint32_t len;//frame size after this field
+        uint8_t kind;
+        uint8_t ptype;//payload protocol type
+        uint16_t name_len;
+        uint32_t addr;
+        int32_t session;
+    };
+
+    static_assert(sizeof(cluster_frame) == 16, "cluster_frame must be packed");
+
+    //connection of the native cluster router.
+    //reads are buffered, every complete frame is delivered to the owner as one
+    //socket_recv message holding the whole frame. When a read holds exactly one
+    //frame the read buffer itself is handed over. Sends are not framed here, the
+    //router queues header and payload buffers and they leave in one gathered write.
+    class cluster_connection : public base_connection
+    {
+    public:
+        static constexpr size_t READ_BUFFER_SIZE = 65536;
+
+        static constexpr size_t MAX_FRAME_SIZE = 64 * 1024 * 1024;
+
+        using base_connection_t = base_connection;
+
+        template <typename... Args>
+        explicit cluster_connection(Args&&... args)
+            :base_connection_t(std::forward<Args>(args)...)
+        {
+        }
+
+        void start(bool accepted) override
+        {
+            base_connection_t::start(accepted);
+            set_no_delay();
+            buf_ = message::create_buffer(READ_BUFFER_SIZE, 0);
+
+            auto m = message::create();
+            m->write_data(address());
+            m->set_receiver(static_cast<uint8_t>(accepted ?
+                socket_data_type::socket_accept : socket_data_type::socket_connect));
+            handle_message(std::move(m));
+            read_some();
+        }
+
+    protected:
+        void read_some()
+        {
+            if (!is_open())
+            {
+                return;
+            }
+
+            size_t n = READ_BUFFER_SIZE;
+            if (need_ > buf_->size() + n)
+            {
+                n = need_ - buf_->size();
+            }
+            buf_->prepare(n);
+            socket_.async_read_some(asio::buffer(buf_->data() + buf_->size(), buf_->writeablesize()),
+                [this, self = shared_from_this()](const asio::error_code& e, std::size_t bytes_transferred)
+            {
+                if (e)
+                {
+                    error(e);
+                    return;
+                }
+
+                recvtime_ = now();
+                buf_->commit(bytes_transferred);
+
+                if (!parse())
+                {
+                    error(make_error_code(moon::error::read_message_too_big));
+                    return;
+                }
+                read_some();
+            });
+        }
+
+        bool parse()
+        {
+            while (nullptr != parent_)
+            {
+                size_t size = buf_->size();
+                if (size < sizeof(cluster_frame))
+                {
+                    need_ = sizeof(cluster_frame);
+                    return true;
+                }
+
+                uint32_t len = 0;
+                memcpy(&len, buf_->data(), sizeof(len));
+                net2host(len);
+                size_t total = sizeof(len) + static_cast<size_t>(len);
+                if (total < sizeof(cluster_frame) || total > MAX_FRAME_SIZE)
+                {
+                    return false;
+                }
+
+                if (size < total)
+                {
+                    need_ = total;
+                    return true;
+                }
+                need_ = 0;
+
+                buffer_ptr_t data;
+                if (size == total)
+                {
+                    data = std::move(buf_);
+                    buf_ = message::create_buffer(READ_BUFFER_SIZE, 0);
+                }
+                else
+                {
+                    data = message::create_buffer(total);
+                    data->write_back(buf_->data(), total);
+                    buf_->consume(total);
+                }
+
+                auto m = message::create(std::move(data));
+                m->set_receiver(static_cast<uint8_t>(socket_data_type::socket_recv));
+                handle_message(std::move(m));
+            }
+            return true;
+        }
+    protected:
+        size_t need_ = 0;
+        buffer_ptr_t buf_;
+    };
+}
@@ -56,6 +56,10 @@ namespace moon
         ws_bad_size,//The WebSocket frame size was not canonical
         bad_frame_payload,//The WebSocket frame payload was not valid utf8
         ws_closed,//The WebSocket receive close frame
+        resp_bad_reply,//The RESP reply was malformed
+        mysql_bad_packet,//The MySQL packet was malformed
+        pg_bad_message,//The PostgreSQL message was malformed
+        http_bad_message,//The HTTP message was malformed
     };
 
     /// Error conditions corresponding to sets of error codes.
@@ -124,6 +128,10 @@ namespace moon
                 case error::ws_bad_size: return "The WebSocket frame size was not canonical";
                 case error::bad_frame_payload: return "The WebSocket frame payload was not valid utf8";
                 case error::ws_closed: return "The WebSocket receive close frame";
+                case error::resp_bad_reply: return "The RESP reply was malformed";
+                case error::mysql_bad_packet: return "The MySQL packet was malformed";
+                case error::pg_bad_message: return "The PostgreSQL message was malformed";
+                case error::http_bad_message: return "The HTTP message was malformed";
                 }
             }
 
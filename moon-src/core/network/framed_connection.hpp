@@ -0,0 +1,216 @@
+#pragma once
+#include "base_connection.hpp"
+
+namespace moon
+{
+    //Client/server connection of a request-response protocol.
+    //read(n) waits until one complete response is buffered, then delivers it
+    //in one message of type ptype. The protocol only supplies the framing:
+    //  prepare_read: accept the read argument n and reset its parse state
+    //  parse: scan the buffered bytes, returns fail(code) on protocol error
+    //  ready: the first n bytes are the response and used bytes are consumed
+    //  consumed: the first used bytes were handed over
+    //A failed read delivers PTYPE_ERROR with header TIMEOUT, EOF or SOCKET_ERROR.
+    class framed_connection : public base_connection
+    {
+    public:
+        using base_connection_t = base_connection;
+
+        template <typename... Args>
+        explicit framed_connection(uint8_t ptype, size_t read_buffer_size, Args&&... args)
+            :base_connection_t(std::forward<Args>(args)...)
+            , ptype_(ptype)
+            , read_buffer_size_(read_buffer_size)
+        {
+        }
+
+        void start(bool accepted) override
+        {
+            base_connection_t::start(accepted);
+            buf_ = message::create_buffer(read_buffer_size_, 0);
+        }
+
+        void read(size_t n, std::string_view, int32_t sessionid) override
+        {
+            if (!is_open() || sessionid_ != 0 || !prepare_read(n))
+            {
+                //Undefined behavior
+                CONSOLE_ERROR(logger(), "invalid read operation. %u", fd_);
+                asio::post(socket_.get_executor(), [this, self = shared_from_this()]() {
+                    error(make_error_code(error::invalid_read_operation));
+                });
+                return;
+            }
+
+            sessionid_ = sessionid;
+
+            if (!parse())
+            {
+                asio::post(socket_.get_executor(), [this, self = shared_from_this()]() {
+                    error(make_error_code(parse_error_));
+                });
+                return;
+            }
+
+            size_t size = 0;
+            size_t used = 0;
+            if (ready(size, used))
+            {
+                //already buffered, never dispatch from inside the caller's read
+                asio::post(socket_.get_executor(), [this, self = shared_from_this()]() {
+                    try_response();
+                });
+                return;
+            }
+            read_some();
+        }
+
+    protected:
+        virtual bool prepare_read(size_t n) = 0;
+
+        virtual bool parse() = 0;
+
+        virtual bool ready(size_t& n, size_t& used) const = 0;
+
+        virtual void consumed(size_t used) = 0;
+
+        bool fail(moon::error e)
+        {
+            parse_error_ = e;
+            return false;
+        }
+
+        void read_some()
+        {
+            if (reading_)
+            {
+                return;
+            }
+            reading_ = true;
+            buf_->prepare(read_buffer_size_);
+            socket_.async_read_some(asio::buffer(buf_->data() + buf_->size(), buf_->writeablesize()),
+                [this, self = shared_from_this()](const asio::error_code& e, std::size_t bytes_transferred)
+            {
+                reading_ = false;
+                if (e)
+                {
+                    error(e);
+                    return;
+                }
+
+                recvtime_ = now();
+                buf_->commit(bytes_transferred);
+
+                if (sessionid_ == 0)
+                {
+                    return;
+                }
+
+                if (!parse())
+                {
+                    error(make_error_code(parse_error_));
+                    return;
+                }
+
+                if (!try_response())
+                {
+                    read_some();
+                }
+            });
+        }
+
+        bool try_response()
+        {
+            size_t n = 0;
+            size_t used = 0;
+            if (sessionid_ == 0 || !ready(n, used))
+            {
+                return false;
+            }
+            response(n, used);
+            return true;
+        }
+
+        //the first n bytes of buf_ are the response, used bytes are consumed
+        void response(size_t n, size_t used)
+        {
+            buffer_ptr_t data;
+            if (n == used && n == buf_->size())
+            {
+                //hand the whole read buffer over, no copy
+                data = std::move(buf_);
+                buf_ = message::create_buffer(read_buffer_size_, 0);
+            }
+            else
+            {
+                data = message::create_buffer(n, 0);
+                data->write_back(buf_->data(), n);
+                buf_->consume(used);
+            }
+            consumed(used);
+
+            auto m = message::create(std::move(data));
+            m->set_type(ptype_);
+            m->set_sender(fd());
+            m->set_sessionid(sessionid_);
+            sessionid_ = 0;
+            handle_message(std::move(m));
+        }
+
+        void response_error(std::string_view header, std::string_view content = std::string_view{})
+        {
+            auto m = message::create();
+            m->set_header(header);
+            if (!content.empty())
+            {
+                m->write_data(content);
+            }
+            m->set_type(PTYPE_ERROR);
+            m->set_sender(fd());
+            m->set_sessionid(sessionid_);
+            sessionid_ = 0;
+            handle_message(std::move(m));
+        }
+
+        //the pending read failed
+        virtual void read_error(const asio::error_code& e)
+        {
+            if (e == moon::error::read_timeout)
+            {
+                response_error("TIMEOUT");
+            }
+            else if (e == asio::error::eof)
+            {
+                response_error("EOF");
+            }
+            else
+            {
+                response_error("SOCKET_ERROR", moon::format("%s.(%d)", e.message().data(), e.value()));
+            }
+        }
+
+        void error(const asio::error_code& e, const std::string& additional = "") override
+        {
+            (void)additional;
+
+            if (nullptr == parent_)
+            {
+                return;
+            }
+
+            if (sessionid_ != 0)
+            {
+                read_error(e);
+            }
+            parent_->close(fd_);
+            parent_ = nullptr;
+        }
+    protected:
+        bool reading_ = false;
+        uint8_t ptype_;
+        moon::error parse_error_ = moon::error::invalid_read_operation;
+        int32_t sessionid_ = 0;
+        size_t read_buffer_size_;
+        buffer_ptr_t buf_;
+    };
+}
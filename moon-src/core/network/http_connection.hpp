@@ -0,0 +1,444 @@
+#pragma once
+#include "framed_connection.hpp"
+
+namespace moon
+{
+    //HTTP/1.1 connection, client side when connected, server side when accepted.
+    //read(n) waits until a complete message is buffered, then delivers the
+    //start line, headers and body in one PTYPE_SOCKET_HTTP message. Chunked
+    //bodies are decoded in place, so the message is always head + plain body.
+    //Client: n is the mode, Lua side decodes it with http.decode_response.
+    //  mode 1: response to a request with body semantics, interim 1xx responses are skipped
+    //  mode 2: response to a HEAD request, never has a body
+    //Server: n is the body size limit(0 unlimited), Lua side decodes it with
+    //  http.decode_request. Pipelined requests stay buffered for the following reads,
+    //  "Expect: 100-continue" is answered before the body is read.
+    class http_connection : public framed_connection
+    {
+        enum class state
+        {
+            head,
+            body_length,
+            chunk_size,
+            chunk_data,
+            chunk_trailer,
+            body_until_eof,
+            done,
+        };
+    public:
+        static constexpr size_t READ_BUFFER_SIZE = 16384;
+
+        static constexpr size_t MAX_HEAD_SIZE = 65536;
+
+        static constexpr size_t READ_RESPONSE = 1;
+
+        static constexpr size_t READ_HEAD_RESPONSE = 2;
+
+        using framed_connection_t = framed_connection;
+
+        template <typename... Args>
+        explicit http_connection(Args&&... args)
+            :framed_connection_t(PTYPE_SOCKET_HTTP, READ_BUFFER_SIZE, std::forward<Args>(args)...)
+        {
+        }
+
+        //largest start line plus header fields, 0 or above MAX_HEAD_SIZE means MAX_HEAD_SIZE
+        void set_head_limit(size_t n)
+        {
+            head_limit_ = (n == 0 || n > MAX_HEAD_SIZE) ? MAX_HEAD_SIZE : n;
+        }
+
+        void start(bool accepted) override
+        {
+            framed_connection_t::start(accepted);
+            server_ = accepted;
+        }
+
+    protected:
+        bool prepare_read(size_t mode) override
+        {
+            if (server_)
+            {
+                limit_ = mode;
+            }
+            else if (mode < READ_RESPONSE || mode > READ_HEAD_RESPONSE)
+            {
+                return false;
+            }
+            else
+            {
+                mode_ = mode;
+            }
+            reset();
+            return true;
+        }
+
+        //[0, wpos_) is head + decoded body, pos_ bytes are consumed
+        bool ready(size_t& n, size_t& used) const override
+        {
+            if (state_ != state::done)
+            {
+                return false;
+            }
+            n = wpos_;
+            used = pos_;
+            return true;
+        }
+
+        void consumed(size_t) override
+        {
+            reset();
+        }
+
+        void reset()
+        {
+            state_ = state::head;
+            head_len_ = 0;
+            search_ = 0;
+            pos_ = 0;
+            wpos_ = 0;
+            remain_ = 0;
+        }
+
+        static bool iequal(std::string_view a, std::string_view b)
+        {
+            if (a.size() != b.size())
+            {
+                return false;
+            }
+            for (size_t i = 0; i < a.size(); ++i)
+            {
+                if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i])))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        static std::string_view trim(std::string_view s)
+        {
+            while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+            {
+                s.remove_prefix(1);
+            }
+            while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+            {
+                s.remove_suffix(1);
+            }
+            return s;
+        }
+
+        //response status code, false if the status line is malformed
+        static bool status_line(std::string_view line, int& status)
+        {
+            size_t sp = line.find(' ');
+            if (sp == std::string_view::npos || line.size() < sp + 4 || line.compare(0, 5, "HTTP/") != 0)
+            {
+                return false;
+            }
+            status = 0;
+            for (size_t i = sp + 1; i < sp + 4; ++i)
+            {
+                if (line[i] < '0' || line[i] > '9')
+                {
+                    return false;
+                }
+                status = status * 10 + (line[i] - '0');
+            }
+            return true;
+        }
+
+        //METHOD SP request-target SP HTTP/x.y
+        static bool request_line(std::string_view line)
+        {
+            size_t sp1 = line.find(' ');
+            if (sp1 == std::string_view::npos || sp1 == 0)
+            {
+                return false;
+            }
+            size_t sp2 = line.find(' ', sp1 + 1);
+            if (sp2 == std::string_view::npos || sp2 == sp1 + 1)
+            {
+                return false;
+            }
+            return line.compare(sp2 + 1, 5, "HTTP/") == 0;
+        }
+
+        //body framing from the header fields. returns false on protocol error.
+        bool head_complete(std::string_view head)
+        {
+            size_t eol = head.find("\r\n");
+            int status = 0;
+            if (server_ ? !request_line(head.substr(0, eol)) : !status_line(head.substr(0, eol), status))
+            {
+                return fail(error::http_bad_message);
+            }
+
+            bool chunked = false;
+            bool has_encoding = false;
+            bool has_length = false;
+            bool expect_continue = false;
+            size_t content_length = 0;
+            while (eol != std::string_view::npos)
+            {
+                size_t start = eol + 2;
+                eol = head.find("\r\n", start);
+                std::string_view line = head.substr(start, eol == std::string_view::npos ? std::string_view::npos : eol - start);
+                size_t colon = line.find(':');
+                if (colon == std::string_view::npos)
+                {
+                    continue;
+                }
+                std::string_view name = line.substr(0, colon);
+                std::string_view value = trim(line.substr(colon + 1));
+                if (iequal(name, "content-length"))
+                {
+                    //repeated lengths are a request smuggling vector, never pick one
+                    if (has_length || value.empty() || value.size() > 18)
+                    {
+                        return fail(error::http_bad_message);
+                    }
+                    content_length = 0;
+                    for (char c : value)
+                    {
+                        if (c < '0' || c > '9')
+                        {
+                            return fail(error::http_bad_message);
+                        }
+                        content_length = content_length * 10 + static_cast<size_t>(c - '0');
+                    }
+                    has_length = true;
+                }
+                else if (iequal(name, "transfer-encoding"))
+                {
+                    //a request body is only ever plain chunked
+                    if (server_ && (has_encoding || !iequal(value, "chunked")))
+                    {
+                        return fail(error::http_bad_message);
+                    }
+                    has_encoding = true;
+                    chunked = (value.size() >= 7 && iequal(value.substr(value.size() - 7), "chunked"));
+                }
+                else if (server_ && iequal(name, "expect"))
+                {
+                    expect_continue = iequal(value, "100-continue");
+                }
+            }
+
+            if (!server_ && status >= 100 && status < 200 && status != 101)
+            {
+                //interim response, the final one follows
+                buf_->consume(head_len_);
+                reset();
+                return true;
+            }
+
+            pos_ = wpos_ = head_len_;
+            if (server_)
+            {
+                //both framings: a proxy in front may have used the other one
+                if (has_encoding && has_length)
+                {
+                    return fail(error::http_bad_message);
+                }
+                if (has_length && limit_ != 0 && content_length > limit_)
+                {
+                    return fail(error::read_message_too_big);
+                }
+                if (chunked)
+                {
+                    state_ = state::chunk_size;
+                }
+                else if (has_length && content_length > 0)
+                {
+                    remain_ = content_length;
+                    state_ = state::body_length;
+                }
+                else
+                {
+                    state_ = state::done;
+                }
+                if (expect_continue && state_ != state::done && buf_->size() == head_len_)
+                {
+                    send_continue();
+                }
+            }
+            else if (mode_ == READ_HEAD_RESPONSE || status == 204 || status == 304 || status == 101)
+            {
+                state_ = state::done;
+            }
+            else if (chunked)
+            {
+                state_ = state::chunk_size;
+            }
+            else if (has_length)
+            {
+                remain_ = content_length;
+                state_ = state::body_length;
+            }
+            else
+            {
+                state_ = state::body_until_eof;
+            }
+            return true;
+        }
+
+        void send_continue()
+        {
+            static constexpr std::string_view CONTINUE = "HTTP/1.1 100 Continue\r\n\r\n";
+            auto data = message::create_buffer(CONTINUE.size(), 0);
+            data->write_back(CONTINUE.data(), CONTINUE.size());
+            send(std::move(data));
+        }
+
+        //pos_ is the parsed position and wpos_ the end of head + body. chunk data
+        //is moved down to wpos_, so [0, wpos_) is always head + decoded body.
+        bool parse() override
+        {
+            while (true)
+            {
+                const char* data = buf_->data();
+                size_t size = buf_->size();
+                switch (state_)
+                {
+                case state::head:
+                {
+                    std::string_view sv{ data, size };
+                    size_t n = sv.find("\r\n\r\n", search_);
+                    if (n == std::string_view::npos)
+                    {
+                        search_ = size > 3 ? size - 3 : 0;
+                        return size <= head_limit_ || fail(error::read_message_too_big);
+                    }
+                    head_len_ = n + 4;
+                    if (head_len_ > head_limit_)
+                    {
+                        return fail(error::read_message_too_big);
+                    }
+                    if (!head_complete(std::string_view{ data, head_len_ }))
+                    {
+                        return false;
+                    }
+                    break;
+                }
+                case state::body_length:
+                {
+                    if (size - pos_ < remain_)
+                    {
+                        return true;
+                    }
+                    pos_ += remain_;
+                    wpos_ = pos_;
+                    remain_ = 0;
+                    state_ = state::done;
+                    break;
+                }
+                case state::chunk_size:
+                {
+                    std::string_view sv{ data + pos_, size - pos_ };
+                    size_t eol = sv.find("\r\n");
+                    if (eol == std::string_view::npos)
+                    {
+                        return sv.size() < 1024 || fail(error::http_bad_message);
+                    }
+                    size_t len = 0;
+                    size_t digits = 0;
+                    for (char c : sv.substr(0, eol))
+                    {
+                        int v = 0;
+                        if (c >= '0' && c <= '9') v = c - '0';
+                        else if (c >= 'a' && c <= 'f') v = c - 'a' + 10;
+                        else if (c >= 'A' && c <= 'F') v = c - 'A' + 10;
+                        else break;
+                        if (++digits > 15)
+                        {
+                            return fail(error::http_bad_message);
+                        }
+                        len = (len << 4) | static_cast<size_t>(v);
+                    }
+                    if (digits == 0)
+                    {
+                        return fail(error::http_bad_message);
+                    }
+                    if (server_ && limit_ != 0 && (wpos_ - head_len_) + len > limit_)
+                    {
+                        return fail(error::read_message_too_big);
+                    }
+                    pos_ += eol + 2;
+                    remain_ = len;
+                    state_ = (len == 0) ? state::chunk_trailer : state::chunk_data;
+                    break;
+                }
+                case state::chunk_data:
+                {
+                    if (size - pos_ < remain_ + 2)
+                    {
+                        return true;
+                    }
+                    if (data[pos_ + remain_] != '\r' || data[pos_ + remain_ + 1] != '\n')
+                    {
+                        return fail(error::http_bad_message);
+                    }
+                    if (wpos_ != pos_)
+                    {
+                        memmove(buf_->data() + wpos_, data + pos_, remain_);
+                    }
+                    wpos_ += remain_;
+                    pos_ += remain_ + 2;
+                    remain_ = 0;
+                    state_ = state::chunk_size;
+                    break;
+                }
+                case state::chunk_trailer:
+                {
+                    std::string_view sv{ data + pos_, size - pos_ };
+                    size_t eol = sv.find("\r\n");
+                    if (eol == std::string_view::npos)
+                    {
+                        return sv.size() < head_limit_ || fail(error::read_message_too_big);
+                    }
+                    pos_ += eol + 2;
+                    if (eol == 0)
+                    {
+                        state_ = state::done;
+                    }
+                    break;
+                }
+                case state::body_until_eof:
+                case state::done:
+                    return true;
+                }
+            }
+        }
+
+        void read_error(const asio::error_code& e) override
+        {
+            if (e == asio::error::eof && state_ == state::body_until_eof)
+            {
+                //body delimited by connection close
+                response(buf_->size(), buf_->size());
+            }
+            else if (e == asio::error::eof && buf_->size() != 0)
+            {
+                //only a close before any byte of the message is safe to retry on a new connection
+                response_error("SOCKET_ERROR", "eof inside a message");
+            }
+            else
+            {
+                framed_connection_t::read_error(e);
+            }
+        }
+    protected:
+        bool server_ = false;
+        state state_ = state::head;
+        size_t mode_ = READ_RESPONSE;
+        size_t limit_ = 0;
+        size_t head_limit_ = MAX_HEAD_SIZE;
+        size_t head_len_ = 0;
+        size_t search_ = 0;
+        size_t pos_ = 0;
+        size_t wpos_ = 0;
+        size_t remain_ = 0;
+    };
+}
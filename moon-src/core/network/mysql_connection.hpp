@@ -0,0 +1,295 @@
+#pragma once
+#include "framed_connection.hpp"
+
+namespace moon
+{
+    //MySQL client/server protocol client connection.
+    //read(mode) waits until a complete server response is buffered, then
+    //delivers the raw packets (headers included) in one PTYPE_SOCKET_MYSQL
+    //message. Lua side decodes it with mysql.core.
+    //  mode 1: one packet (handshake, authentication)
+    //  mode 2: command response, OK/ERR or whole result sets(text or binary rows),
+    //          including the following result sets while SERVER_MORE_RESULTS_EXISTS
+    //  mode 3: COM_STMT_PREPARE response, OK plus parameter and column definitions
+    class mysql_connection : public framed_connection
+    {
+        enum class state
+        {
+            packet,
+            result_head,
+            columns,
+            columns_eof,
+            rows,
+            prepare_head,
+            prepare_defs,
+        };
+    public:
+        static constexpr size_t READ_BUFFER_SIZE = 16384;
+
+        static constexpr size_t MAX_PACKET_SIZE = 0xFFFFFF;
+
+        static constexpr uint16_t SERVER_MORE_RESULTS_EXISTS = 8;
+
+        static constexpr size_t READ_PACKET = 1;
+
+        static constexpr size_t READ_RESULT = 2;
+
+        static constexpr size_t READ_PREPARE = 3;
+
+        using framed_connection_t = framed_connection;
+
+        template <typename... Args>
+        explicit mysql_connection(Args&&... args)
+            :framed_connection_t(PTYPE_SOCKET_MYSQL, READ_BUFFER_SIZE, std::forward<Args>(args)...)
+        {
+        }
+
+    protected:
+        bool prepare_read(size_t mode) override
+        {
+            switch (mode)
+            {
+            case READ_PACKET:
+                state_ = state::packet;
+                break;
+            case READ_RESULT:
+                state_ = state::result_head;
+                break;
+            case READ_PREPARE:
+                state_ = state::prepare_head;
+                break;
+            default:
+                return false;
+            }
+            scan_ = 0;
+            remain_ = 0;
+            done_ = false;
+            pending_done_ = false;
+            continuation_ = false;
+            return true;
+        }
+
+        bool ready(size_t& n, size_t& used) const override
+        {
+            if (!done_)
+            {
+                return false;
+            }
+            n = used = scan_;
+            return true;
+        }
+
+        void consumed(size_t) override
+        {
+            scan_ = 0;
+            done_ = false;
+        }
+
+        static bool lenenc(const uint8_t*& p, const uint8_t* end, uint64_t& v)
+        {
+            if (p >= end)
+            {
+                return false;
+            }
+            uint8_t c = *p++;
+            size_t n = 0;
+            switch (c)
+            {
+            case 0xFC: n = 2; break;
+            case 0xFD: n = 3; break;
+            case 0xFE: n = 8; break;
+            case 0xFB:
+            case 0xFF:
+                return false;
+            default:
+                v = c;
+                return true;
+            }
+            if (static_cast<size_t>(end - p) < n)
+            {
+                return false;
+            }
+            v = 0;
+            for (size_t i = 0; i < n; ++i)
+            {
+                v |= static_cast<uint64_t>(p[i]) << (8 * i);
+            }
+            p += n;
+            return true;
+        }
+
+        //server status of an OK packet
+        static bool ok_status(const uint8_t* p, const uint8_t* end, uint16_t& status)
+        {
+            uint64_t v = 0;
+            ++p;
+            if (!lenenc(p, end, v) || !lenenc(p, end, v) || end - p < 2)
+            {
+                return false;
+            }
+            status = static_cast<uint16_t>(p[0] | (p[1] << 8));
+            return true;
+        }
+
+        //first fragment of one logical packet. returns false on protocol error.
+        bool step(const uint8_t* p, size_t len)
+        {
+            const uint8_t* end = p + len;
+            if (len == 0)
+            {
+                done_ = (state_ == state::packet);
+                return done_;
+            }
+
+            switch (state_)
+            {
+            case state::packet:
+            {
+                done_ = true;
+                return true;
+            }
+            case state::result_head:
+            {
+                if (p[0] == 0x00)
+                {
+                    uint16_t status = 0;
+                    if (!ok_status(p, end, status))
+                    {
+                        return false;
+                    }
+                    done_ = ((status & SERVER_MORE_RESULTS_EXISTS) == 0);
+                    return true;
+                }
+                if (p[0] == 0xFF || p[0] == 0xFB)
+                {
+                    //ERR, or LOCAL INFILE request which the decoder reports as unsupported
+                    done_ = true;
+                    return true;
+                }
+                uint64_t count = 0;
+                if (!lenenc(p, end, count) || count == 0)
+                {
+                    return false;
+                }
+                remain_ = count;
+                state_ = state::columns;
+                return true;
+            }
+            case state::columns:
+            {
+                if (--remain_ == 0)
+                {
+                    state_ = state::columns_eof;
+                }
+                return true;
+            }
+            case state::columns_eof:
+            {
+                if (p[0] != 0xFE || len >= 9)
+                {
+                    return false;
+                }
+                state_ = state::rows;
+                return true;
+            }
+            case state::rows:
+            {
+                if (p[0] == 0xFE && len < 9)
+                {
+                    if (len < 5)
+                    {
+                        return false;
+                    }
+                    uint16_t status = static_cast<uint16_t>(p[3] | (p[4] << 8));
+                    if (status & SERVER_MORE_RESULTS_EXISTS)
+                    {
+                        state_ = state::result_head;
+                    }
+                    else
+                    {
+                        done_ = true;
+                    }
+                }
+                else if (p[0] == 0xFF)
+                {
+                    done_ = true;
+                }
+                return true;
+            }
+            case state::prepare_head:
+            {
+                if (p[0] != 0x00)
+                {
+                    done_ = true;
+                    return true;
+                }
+                if (len < 12)
+                {
+                    return false;
+                }
+                uint64_t columns = static_cast<uint64_t>(p[5] | (p[6] << 8));
+                uint64_t params = static_cast<uint64_t>(p[7] | (p[8] << 8));
+                remain_ = columns + (columns > 0 ? 1 : 0) + params + (params > 0 ? 1 : 0);
+                if (remain_ == 0)
+                {
+                    done_ = true;
+                }
+                state_ = state::prepare_defs;
+                return true;
+            }
+            case state::prepare_defs:
+            {
+                if (--remain_ == 0)
+                {
+                    done_ = true;
+                }
+                return true;
+            }
+            }
+            return false;
+        }
+
+        //scan buffered packets from scan_ until the response is complete
+        bool parse() override
+        {
+            const uint8_t* begin = reinterpret_cast<const uint8_t*>(buf_->data());
+            const uint8_t* end = begin + buf_->size();
+            while (!done_)
+            {
+                const uint8_t* p = begin + scan_;
+                if (end - p < 4)
+                {
+                    return true;
+                }
+                size_t len = static_cast<size_t>(p[0]) | (static_cast<size_t>(p[1]) << 8) | (static_cast<size_t>(p[2]) << 16);
+                if (static_cast<size_t>(end - p) < len + 4)
+                {
+                    return true;
+                }
+
+                bool first = !continuation_;
+                continuation_ = (len == MAX_PACKET_SIZE);
+                if (first)
+                {
+                    if (!step(p + 4, len))
+                    {
+                        return fail(error::mysql_bad_packet);
+                    }
+                    //a packet larger than 16MB completes the response with its last fragment
+                    pending_done_ = done_;
+                    done_ = false;
+                }
+                scan_ += len + 4;
+                done_ = pending_done_ && !continuation_;
+            }
+            return true;
+        }
+    protected:
+        bool done_ = false;
+        bool pending_done_ = false;
+        bool continuation_ = false;
+        state state_ = state::packet;
+        size_t scan_ = 0;
+        uint64_t remain_ = 0;
+    };
+}
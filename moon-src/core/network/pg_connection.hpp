@@ -0,0 +1,92 @@
+#pragma once
+#include "framed_connection.hpp"
+
+namespace moon
+{
+    //PostgreSQL frontend/backend protocol client connection.
+    //read(mode) delivers complete backend messages (type and length included)
+    //in one PTYPE_SOCKET_PG message. Lua side decodes it with pg.core.
+    //  mode 1: one message (authentication)
+    //  mode 2: every message up to and including ReadyForQuery('Z') or CopyInResponse('G')
+    //  mode 3: the complete messages buffered so far(at least one), stops after 'Z' or 'G'.
+    //          used to stream large responses such as COPY TO
+    class pg_connection : public framed_connection
+    {
+    public:
+        static constexpr size_t READ_BUFFER_SIZE = 16384;
+
+        static constexpr size_t READ_MESSAGE = 1;
+
+        static constexpr size_t READ_UNTIL_READY = 2;
+
+        static constexpr size_t READ_AVAILABLE = 3;
+
+        using framed_connection_t = framed_connection;
+
+        template <typename... Args>
+        explicit pg_connection(Args&&... args)
+            :framed_connection_t(PTYPE_SOCKET_PG, READ_BUFFER_SIZE, std::forward<Args>(args)...)
+        {
+        }
+
+    protected:
+        bool prepare_read(size_t mode) override
+        {
+            if (mode < READ_MESSAGE || mode > READ_AVAILABLE)
+            {
+                return false;
+            }
+            mode_ = mode;
+            scan_ = 0;
+            done_ = false;
+            return true;
+        }
+
+        bool ready(size_t& n, size_t& used) const override
+        {
+            if (scan_ == 0 || (!done_ && mode_ != READ_AVAILABLE))
+            {
+                return false;
+            }
+            n = used = scan_;
+            return true;
+        }
+
+        void consumed(size_t) override
+        {
+            scan_ = 0;
+            done_ = false;
+        }
+
+        //scan complete messages from scan_
+        bool parse() override
+        {
+            const uint8_t* begin = reinterpret_cast<const uint8_t*>(buf_->data());
+            const uint8_t* end = begin + buf_->size();
+            while (!done_)
+            {
+                const uint8_t* p = begin + scan_;
+                if (end - p < 5)
+                {
+                    return true;
+                }
+                uint32_t len = (static_cast<uint32_t>(p[1]) << 24) | (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 8) | static_cast<uint32_t>(p[4]);
+                if (len < 4)
+                {
+                    return fail(error::pg_bad_message);
+                }
+                if (static_cast<size_t>(end - p) < static_cast<size_t>(len) + 1)
+                {
+                    return true;
+                }
+                scan_ += static_cast<size_t>(len) + 1;
+                done_ = (mode_ == READ_MESSAGE) || p[0] == 'Z' || p[0] == 'G';
+            }
+            return true;
+        }
+    protected:
+        bool done_ = false;
+        size_t mode_ = READ_MESSAGE;
+        size_t scan_ = 0;
+    };
+}
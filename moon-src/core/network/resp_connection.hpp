@@ -0,0 +1,232 @@
+#pragma once
+#include "framed_connection.hpp"
+
+namespace moon
+{
+    //Redis serialization protocol(RESP2/RESP3) client connection.
+    //read(n) waits until n complete replies are buffered, then delivers them
+    //in one PTYPE_SOCKET_RESP message. The payload is the raw reply bytes,
+    //Lua side decodes it with one call to resp.decode.
+    class resp_connection : public framed_connection
+    {
+        struct aggregate
+        {
+            int64_t remain;
+            bool attribute;
+        };
+    public:
+        static constexpr size_t MAX_DEPTH = 64;
+
+        //same as redis proto-max-bulk-len
+        static constexpr int64_t MAX_BULK_SIZE = 512 * 1024 * 1024;
+
+        static constexpr int64_t MAX_DIGITS = 18;
+
+        static constexpr size_t READ_BUFFER_SIZE = 8192;
+
+        using framed_connection_t = framed_connection;
+
+        template <typename... Args>
+        explicit resp_connection(Args&&... args)
+            :framed_connection_t(PTYPE_SOCKET_RESP, READ_BUFFER_SIZE, std::forward<Args>(args)...)
+        {
+        }
+
+    protected:
+        bool prepare_read(size_t n) override
+        {
+            want_ = (n > 0 ? n : 1);
+            return true;
+        }
+
+        //the first want_ replies when they are all buffered
+        bool ready(size_t& n, size_t& used) const override
+        {
+            if (ends_.size() < want_)
+            {
+                return false;
+            }
+            n = used = ends_[want_ - 1];
+            return true;
+        }
+
+        void consumed(size_t used) override
+        {
+            ends_.erase(ends_.begin(), ends_.begin() + want_);
+            for (auto& end : ends_)
+            {
+                end -= used;
+            }
+            scan_ -= used;
+            want_ = 0;
+        }
+
+        static const char* find_crlf(const char* p, const char* end)
+        {
+            while (p + 1 < end)
+            {
+                auto q = static_cast<const char*>(memchr(p, '\r', end - p - 1));
+                if (nullptr == q)
+                {
+                    return nullptr;
+                }
+                if (q[1] == '\n')
+                {
+                    return q;
+                }
+                p = q + 1;
+            }
+            return nullptr;
+        }
+
+        //at most MAX_DIGITS digits, v can not overflow
+        static bool parse_integer(const char* p, const char* end, int64_t& v)
+        {
+            bool negative = false;
+            if (p < end && *p == '-')
+            {
+                negative = true;
+                ++p;
+            }
+            if (p == end || end - p > MAX_DIGITS)
+            {
+                return false;
+            }
+            v = 0;
+            for (; p < end; ++p)
+            {
+                if (*p < '0' || *p > '9')
+                {
+                    return false;
+                }
+                v = v * 10 + (*p - '0');
+            }
+            if (negative)
+            {
+                v = -v;
+            }
+            return true;
+        }
+
+        //one element finished, returns true when it completed a top level reply
+        bool element_done()
+        {
+            while (!stack_.empty())
+            {
+                auto& top = stack_.back();
+                if (--top.remain > 0)
+                {
+                    return false;
+                }
+                bool attribute = top.attribute;
+                stack_.pop_back();
+                if (attribute)
+                {
+                    //attribute precedes the real reply, it is not an element itself
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        //scan buffered bytes from scan_, recording the end offset of each complete reply
+        bool parse() override
+        {
+            const char* begin = buf_->data();
+            const char* end = begin + buf_->size();
+            while (true)
+            {
+                const char* p = begin + scan_;
+                const char* crlf = find_crlf(p, end);
+                if (nullptr == crlf)
+                {
+                    return true;
+                }
+
+                const char* next = crlf + 2;
+                bool done = false;
+                switch (*p)
+                {
+                case '+':
+                case '-':
+                case ':':
+                case '_':
+                case '#':
+                case ',':
+                case '(':
+                {
+                    done = true;
+                    break;
+                }
+                case '$':
+                case '!':
+                case '=':
+                {
+                    int64_t len = 0;
+                    if (!parse_integer(p + 1, crlf, len) || len < -1 || len > MAX_BULK_SIZE)
+                    {
+                        return fail(error::resp_bad_reply);
+                    }
+                    if (len >= 0)
+                    {
+                        if (end - next < len + 2)
+                        {
+                            //wait the whole bulk string
+                            return true;
+                        }
+                        if (next[len] != '\r' || next[len + 1] != '\n')
+                        {
+                            return fail(error::resp_bad_reply);
+                        }
+                        next += len + 2;
+                    }
+                    done = true;
+                    break;
+                }
+                case '*':
+                case '~':
+                case '>':
+                case '%':
+                case '|':
+                {
+                    int64_t count = 0;
+                    if (!parse_integer(p + 1, crlf, count) || count < -1)
+                    {
+                        return fail(error::resp_bad_reply);
+                    }
+                    if (*p == '%' || *p == '|')
+                    {
+                        count *= 2;
+                    }
+                    if (count > 0)
+                    {
+                        if (stack_.size() >= MAX_DEPTH)
+                        {
+                            return fail(error::resp_bad_reply);
+                        }
+                        stack_.push_back(aggregate{ count, *p == '|' });
+                    }
+                    else
+                    {
+                        done = (*p != '|');
+                    }
+                    break;
+                }
+                default:
+                    return fail(error::resp_bad_reply);
+                }
+
+                scan_ = static_cast<size_t>(next - begin);
+                if (done && element_done())
+                {
+                    ends_.push_back(scan_);
+                }
+            }
+        }
+    protected:
+        size_t want_ = 0;
+        size_t scan_ = 0;
+        std::vector<size_t> ends_;
+        std::vector<aggregate> stack_;
+    };
+}
@@ -8,6 +8,11 @@
 #include "network/moon_connection.hpp"
 #include "network/stream_connection.hpp"
 #include "network/ws_connection.hpp"
+#include "network/resp_connection.hpp"
+#include "network/mysql_connection.hpp"
+#include "network/pg_connection.hpp"
+#include "network/http_connection.hpp"
+#include "network/cluster_connection.hpp"
 
 using namespace moon;
 
@@ -329,6 +334,28 @@ bool moon::socket::set_send_queue_limit(uint32_t fd, uint32_t warnsize, uint32_t
     return false;
 }
 
+bool moon::socket::set_http_head_limit(uint32_t fd, size_t limit)
+{
+    if (auto iter = connections_.find(fd); iter != connections_.end())
+    {
+        if (auto c = std::dynamic_pointer_cast<http_connection>(iter->second))
+        {
+            c->set_head_limit(limit);
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t moon::socket::send_queue_size(uint32_t fd)
+{
+    if (auto iter = connections_.find(fd); iter != connections_.end())
+    {
+        return iter->second->send_queue_size();
+    }
+    return 0;
+}
+
 std::string moon::socket::getaddress(uint32_t fd)
 {
 	if (auto iter = connections_.find(fd); iter != connections_.end())
@@ -358,6 +385,31 @@ connection_ptr_t socket::make_connection(uint32_t serviceid, uint8_t type)
         connection = std::make_shared<ws_connection>(serviceid, type, this, ioc_);
         break;
     }
+    case PTYPE_SOCKET_RESP:
+    {
+        connection = std::make_shared<resp_connection>(serviceid, type, this, ioc_);
+        break;
+    }
+    case PTYPE_SOCKET_MYSQL:
+    {
+        connection = std::make_shared<mysql_connection>(serviceid, type, this, ioc_);
+        break;
+    }
+    case PTYPE_SOCKET_PG:
+    {
+        connection = std::make_shared<pg_connection>(serviceid, type, this, ioc_);
+        break;
+    }
+    case PTYPE_SOCKET_HTTP:
+    {
+        connection = std::make_shared<http_connection>(serviceid, type, this, ioc_);
+        break;
+    }
+    case PTYPE_SOCKET_CLUSTER:
+    {
+        connection = std::make_shared<cluster_connection>(serviceid, type, this, ioc_);
+        break;
+    }
     default:
         MOON_ASSERT(false, "Unknown socket protocol");
         break;
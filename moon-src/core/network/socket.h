@@ -65,6 +65,10 @@ namespace moon
 
         bool set_send_queue_limit(uint32_t fd, uint32_t warnsize, uint32_t errorsize);
 
+        bool set_http_head_limit(uint32_t fd, size_t limit);
+
+        size_t send_queue_size(uint32_t fd);
+
 		std::string getaddress(uint32_t fd);
     private:
         connection_ptr_t make_connection(uint32_t serviceid, uint8_t type);
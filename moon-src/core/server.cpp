@@ -1,6 +1,7 @@
 #include "server.h"
 #include "worker.h"
 #include "message.hpp"
+#include "common/affinity.hpp"
 
 namespace moon
 {
@@ -14,17 +15,35 @@ namespace moon
         wait();
     }
 
-    void server::init(uint32_t worker_num, const std::string& logfile)
+    void server::init(uint32_t worker_num, const std::string& logfile, const placement_conf& placement)
     {
         worker_num = (worker_num == 0) ? 1 : worker_num;
 
+        for (auto id : placement.dedicated)
+        {
+            //bootstrap is always the first service of worker 1
+            MOON_CHECK(id > 1 && id <= worker_num, moon::format("dedicated worker %u: must be in [2, %u]", id, worker_num));
+        }
+
         logger_.init(logfile);
 
+        if (placement.logger_cpu >= 0 && !logger_.bind_cpu(placement.logger_cpu))
+        {
+            CONSOLE_WARN(logger(), "log thread can not bind cpu %d", placement.logger_cpu);
+        }
+
+        timer_cpu_ = placement.timer_cpu;
+
         CONSOLE_INFO(logger(), "INIT with %d workers.", worker_num);
 
         for (uint32_t i = 0; i != worker_num; i++)
         {
-            workers_.emplace_back(std::make_unique<worker>(this,  i + 1));
+            auto& w = workers_.emplace_back(std::make_unique<worker>(this,  i + 1));
+            if (i < placement.worker_cpu.size())
+            {
+                w->cpu_ = placement.worker_cpu[i];
+            }
+            w->dedicated_ = std::find(placement.dedicated.begin(), placement.dedicated.end(), i + 1) != placement.dedicated.end();
         }
 
         for (auto& w : workers_)
@@ -42,6 +61,11 @@ namespace moon
         asio::error_code ignore;
         bool stop_once = false;
 
+        if (timer_cpu_ >= 0 && !bind_this_thread_cpu(timer_cpu_))
+        {
+            CONSOLE_WARN(logger(), "timer thread can not bind cpu %d", timer_cpu_);
+        }
+
         state_.store(state::ready, std::memory_order_release);
         while (true)
         {
@@ -149,7 +173,7 @@ namespace moon
         for (const auto& w : workers_)
         {
             auto n = w->count_.load(std::memory_order_acquire);
-            if (w->shared() && n < min_count)
+            if (!w->dedicated_ && w->shared() && n < min_count)
             {
                 min_count = n;
                 min_count_workerid = w->id();
@@ -162,7 +186,7 @@ namespace moon
             for (const auto& w : workers_)
             {
                 auto n = w->count_.load(std::memory_order_acquire);
-                if (n < min_count)
+                if (!w->dedicated_ && n < min_count)
                 {
                     min_count = n;
                     min_count_workerid = w->id();
@@ -258,6 +282,62 @@ namespace moon
          });
     }
 
+    void server::trace(bool enable)
+    {
+        if (enable && !trace_.load())
+        {
+            for (auto& w : workers_)
+            {
+                asio::post(w->io_context(), [w = w.get()] {
+                    w->clear_trace();
+                });
+            }
+        }
+        trace_.store(enable);
+    }
+
+    void server::trace_report(uint32_t sender, bool prometheus, int32_t sessionid)
+    {
+        collect_trace(0, sender, prometheus, sessionid, std::make_shared<std::array<std::string, 2>>());
+    }
+
+    void server::collect_trace(size_t index, uint32_t sender, bool prometheus, int32_t sessionid, std::shared_ptr<std::array<std::string, 2>> report)
+    {
+        //visit the workers one after another, each reads only its own services
+        if (index < workers_.size())
+        {
+            worker* w = workers_[index].get();
+            asio::post(w->io_context(), [this, w, index, sender, prometheus, sessionid, report = std::move(report)]() mutable {
+                w->trace_report(*report, prometheus);
+                collect_trace(index + 1, sender, prometheus, sessionid, std::move(report));
+            });
+            return;
+        }
+
+        auto& [first, second] = *report;
+        std::string content;
+        if (prometheus)
+        {
+            content.append("# HELP moon_queue_wait_us Time a message waited in the worker queue.\n");
+            content.append("# TYPE moon_queue_wait_us summary\n");
+            content.append(first);
+            content.append("# HELP moon_dispatch_us Time the service spent dispatching a message.\n");
+            content.append("# TYPE moon_dispatch_us summary\n");
+            content.append(second);
+        }
+        else
+        {
+            if (!first.empty())
+            {
+                first.pop_back();//trailing ','
+            }
+            content.append("[");
+            content.append(first);
+            content.append("]");
+        }
+        response(sender, std::string_view{}, content, sessionid);
+    }
+
     bool server::send_message(message_ptr_t&& m) const
     {
         worker* w = get_worker(0, m->receiver());
@@ -270,7 +350,7 @@ namespace moon
         return true;
     }
 
-    bool server::send(uint32_t sender, uint32_t receiver, buffer_ptr_t data, std::string_view header, int32_t sessionid, uint8_t type) const
+    bool server::send(uint32_t sender, uint32_t receiver, buffer_ptr_t data, std::string_view header, int32_t sessionid, uint8_t type, int64_t deadline) const
     {
         sessionid = -sessionid;
         message_ptr_t m = message::create(std::move(data));
@@ -282,6 +362,7 @@ namespace moon
         }
         m->set_type(type);
         m->set_sessionid(sessionid);
+        m->set_deadline(deadline);
         return send_message(std::move(m));
     }
 
@@ -298,6 +379,60 @@ namespace moon
         }
     }
 
+    channel_ptr_t server::new_channel(uint32_t producer, uint32_t consumer, size_t capacity)
+    {
+        uint32_t id = channel_seq_.fetch_add(1);
+        auto ch = std::make_shared<channel>(id, producer, consumer, capacity);
+        channels_.set(id, ch);
+        return ch;
+    }
+
+    channel_ptr_t server::get_channel(uint32_t id) const
+    {
+        channel_ptr_t ch;
+        channels_.try_get_value(id, ch);
+        return ch;
+    }
+
+    void server::close_channel(const channel_ptr_t& ch)
+    {
+        if (!ch->closed.exchange(true))
+        {
+            notify_channel(*ch, true);
+        }
+    }
+
+    void server::remove_channel(uint32_t id)
+    {
+        channels_.erase(id);
+    }
+
+    void server::remove_channels(uint32_t consumer)
+    {
+        channels_.erase_if([consumer](const channel_ptr_t& ch) {
+            if (ch->consumer != consumer)
+            {
+                return false;
+            }
+            ch->closed.store(true);
+            return true;
+        });
+    }
+
+    void server::notify_channel(channel& ch, bool force) const
+    {
+        //pairs with the fence of the consumer between clearing notified and reading the
+        //ring: either the consumer sees the new record or the producer sees the flag clear
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!force && (ch.notified.load(std::memory_order_relaxed) || ch.notified.exchange(true)))
+        {
+            return;
+        }
+        auto buf = message::create_buffer(sizeof(uint32_t));
+        buf->write_back(&ch.id, 1);
+        send(ch.producer, ch.consumer, std::move(buf), std::string_view{}, 0, PTYPE_CHANNEL);
+    }
+
     bool server::register_service(const std::string& type, register_func f)
     {
         auto ret = regservices_.emplace(type, f);
@@ -386,11 +521,15 @@ namespace moon
         for (auto& w : workers_)
         {
             req.append(",\n");
-            auto v = moon::format(R"({"id":%u, "cpu":%f, "mqsize":%u, "service":%u})",
+            auto v = moon::format(R"({"id":%u, "cpu":%f, "mqsize":%u, "service":%u, "expired":%u, "core":%d, "node":%d, "dedicated":%s})",
                 w->id(),
                 w->cpu_cost_,
                 w->mqsize_.load(),
-                w->count_.load(std::memory_order_acquire)
+                w->count_.load(std::memory_order_acquire),
+                w->expired_.load(),
+                w->cpu_,
+                cpu_numa_node(w->cpu_),
+                w->dedicated_ ? "true" : "false"
             );
             w->cpu_cost_ = 0;
             req.append(v);
@@ -4,6 +4,7 @@
 #include "common/timer.hpp"
 #include "common/concurrent_map.hpp"
 #include "worker.h"
+#include "channel.hpp"
 
 namespace moon
 {
@@ -45,7 +46,7 @@ namespace moon
 
         server(server&&) = delete;
 
-        void init(uint32_t worker_num, const std::string& logfile);
+        void init(uint32_t worker_num, const std::string& logfile, const placement_conf& placement = placement_conf{});
 
         void run();
 
@@ -73,12 +74,41 @@ namespace moon
 
         void scan_services(uint32_t sender, uint32_t workerid, int32_t sessionid);
 
+        //record queue wait and dispatch time of every message, enabling clears the previous records
+        void trace(bool enable);
+
+        bool trace() const
+        {
+            return trace_.load(std::memory_order_relaxed);
+        }
+
+        //responds with the latency histograms of all services, as JSON or Prometheus text
+        void trace_report(uint32_t sender, bool prometheus, int32_t sessionid);
+
         bool send_message(message_ptr_t&& msg) const;
 
-        bool send(uint32_t sender, uint32_t receiver, buffer_ptr_t buf, std::string_view header, int32_t sessionid, uint8_t type) const;
+        bool send(uint32_t sender, uint32_t receiver, buffer_ptr_t buf, std::string_view header, int32_t sessionid, uint8_t type, int64_t deadline = 0) const;
 
         void broadcast(uint32_t sender, const buffer_ptr_t& buf, std::string_view header, uint8_t type) const;
 
+        //a ring from producer to consumer, capacity in bytes
+        channel_ptr_t new_channel(uint32_t producer, uint32_t consumer, size_t capacity);
+
+        channel_ptr_t get_channel(uint32_t id) const;
+
+        //marks the channel closed and wakes the consumer to drain what is left.
+        //the consumer removes it once drained.
+        void close_channel(const channel_ptr_t& ch);
+
+        void remove_channel(uint32_t id);
+
+        //an exited service reads no more: its inbound channels are closed and removed,
+        //later writes of the producers fail
+        void remove_channels(uint32_t consumer);
+
+        //after writing: wakes the consumer unless a wake up is already pending
+        void notify_channel(channel& ch, bool force = false) const;
+
         bool register_service(const std::string& type, register_func func);
 
         service_ptr_t make_service(const std::string& type);
@@ -106,10 +136,15 @@ namespace moon
         void on_timer(uint32_t serviceid, uint32_t timerid);
 
         void wait();
+
+        void collect_trace(size_t index, uint32_t sender, bool prometheus, int32_t sessionid, std::shared_ptr<std::array<std::string, 2>> report);
     private:
         volatile int stopcode_ = 0;
+        std::atomic_bool trace_ = false;
         std::atomic<state> state_ = state::unknown;
         std::atomic<uint32_t> fd_seq_ = 1;
+        std::atomic<uint32_t> channel_seq_ = 1;
+        int timer_cpu_ = -1;
         std::time_t now_ = 0;
         mutable log logger_;
         mutable rwlock fd_lock_;
@@ -117,6 +152,7 @@ namespace moon
         std::unordered_map<std::string, register_func > regservices_;
         concurrent_map<std::string, std::string, rwlock> env_;
         concurrent_map<std::string, uint32_t, rwlock> unique_services_;
+        concurrent_map<uint32_t, channel_ptr_t, rwlock> channels_;
         std::unordered_set<uint32_t> fd_watcher_;
         std::vector<std::unique_ptr<worker>> workers_;
     };
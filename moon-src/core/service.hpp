@@ -1,6 +1,7 @@
 #pragma once
 #include "config.hpp"
 #include "common/log.hpp"
+#include "common/histogram.hpp"
 
 namespace moon
 {
@@ -8,6 +9,13 @@ namespace moon
     class worker;
     class server;
 
+    //latency of the messages of one PTYPE dispatched to a service, in microseconds
+    struct message_trace
+    {
+        histogram queue_wait;
+        histogram dispatch;
+    };
+
     class service
     {
     public:
@@ -88,6 +96,16 @@ namespace moon
 
         virtual void dispatch(message* msg) = 0;
 
+        //tasks queued with worker::defer, run after the current dispatch batch
+        virtual void run_deferred() {}
+
+        //a deadline registered with worker::add_deadline has passed
+        virtual void on_deadline(int32_t /*sessionid*/, int64_t /*deadline*/) {}
+
+        //services added with worker::add_gc step their collector between dispatch batches.
+        //true while a collection cycle is unfinished.
+        virtual bool gc_step(bool /*idle*/) { return false; }
+
     protected:
         void set_unique(bool v)
         {
@@ -112,6 +130,7 @@ namespace moon
         worker* worker_ = nullptr;
         double cpu_cost_ = 0.0;//
         std::string   name_;
+        std::unordered_map<uint8_t, std::unique_ptr<message_trace>> traces_;//by PTYPE, filled while server tracing is on
     };
 
     template<typename Service, typename Message>
@@ -5,6 +5,7 @@
 #include "message.hpp"
 #include "service.hpp"
 #include "server.h"
+#include "common/affinity.hpp"
 
 namespace moon
 {
@@ -13,6 +14,7 @@ namespace moon
         , server_(srv)
         , io_ctx_(1)
         , work_(asio::make_work_guard(io_ctx_))
+        , deadline_timer_(io_ctx_)
     {
     }
 
@@ -26,6 +28,19 @@ namespace moon
         socket_ = std::make_unique<moon::socket>(server_, this, io_ctx_);
 
         thread_ = std::thread([this]() {
+            //pinned before the services are created: their memory is first touched on this
+            //thread, so it comes from the numa node of the cpu
+            if (cpu_ >= 0)
+            {
+                if (bind_this_thread_cpu(cpu_))
+                {
+                    CONSOLE_INFO(server_->logger(), "WORKER-%u bind cpu %d, numa node %d%s", workerid_, cpu_, cpu_numa_node(cpu_), dedicated_ ? ", dedicated" : "");
+                }
+                else
+                {
+                    CONSOLE_WARN(server_->logger(), "WORKER-%u can not bind cpu %d", workerid_, cpu_);
+                }
+            }
             CONSOLE_INFO(server_->logger(), "WORKER-%u START", workerid_);
             io_ctx_.run();
             socket_->close_all();
@@ -137,6 +152,7 @@ namespace moon
                 auto content = moon::format(R"({"name":"%s","serviceid":%08X,"errmsg":"service destroy"})", s->name().data(), s->id());
                 server_->response(sender, "service destroy"sv, content, sessionid);
                 services_.erase(serviceid);
+                server_->remove_channels(serviceid);
                 if (services_.empty()) shared(true);
 
                 if (server_->get_state() == state::ready)
@@ -166,6 +182,10 @@ namespace moon
 
     void worker::send(message_ptr_t&& msg)
     {
+        if (server_->trace())
+        {
+            msg->set_enqueue_time(time::microsecond());
+        }
         ++mqsize_;
         if (mq_.push_back(std::move(msg)) == 1)
         {
@@ -177,20 +197,156 @@ namespace moon
 
                 service* ser = nullptr;
                 mq_.swap(swapmq_);
+                dispatching_ = true;
                 for (auto& msg : swapmq_)
                 {
                     handle_one(ser, std::move(msg));
                     --mqsize_;
                 }
+                dispatching_ = false;
                 swapmq_.clear();
                 if (!prefabs_.empty())
                 {
                     prefabs_.clear();
                 }
+                run_deferred();
+            });
+        }
+    }
+
+    void worker::defer(uint32_t serviceid)
+    {
+        deferred_.emplace_back(serviceid);
+        //inside a batch the tasks run when it ends, otherwise on the next loop turn
+        if (!dispatching_ && !deferred_posted_)
+        {
+            deferred_posted_ = true;
+            asio::post(io_ctx_, [this]() {
+                deferred_posted_ = false;
+                run_deferred();
+            });
+        }
+    }
+
+    void worker::run_deferred()
+    {
+        //tasks deferred while a round runs go to the next one. Rounds repeat
+        //while the mailbox is empty, bounded so io handlers are not starved.
+        dispatching_ = true;
+        for (int round = 0; round < MAX_DEFERRED_ROUNDS && !deferred_.empty(); ++round)
+        {
+            if (round > 0 && mqsize_ > 0)
+            {
+                break;
+            }
+            deferred_.swap(running_deferred_);
+            for (auto id : running_deferred_)
+            {
+                service* s = find_service(id);
+                if (nullptr == s || !s->ok())
+                {
+                    continue;
+                }
+                double start_time = moon::time::clock();
+                s->run_deferred();
+                double cost_time = moon::time::clock() - start_time;
+                s->add_cpu_cost(cost_time);
+                cpu_cost_ += cost_time;
+            }
+            running_deferred_.clear();
+        }
+        dispatching_ = false;
+
+        if (!deferred_.empty() && !deferred_posted_)
+        {
+            deferred_posted_ = true;
+            asio::post(io_ctx_, [this]() {
+                deferred_posted_ = false;
+                run_deferred();
+            });
+        }
+
+        //the batch is over, a good time for the adaptive collectors
+        run_gc();
+    }
+
+    void worker::add_gc(uint32_t serviceid)
+    {
+        gc_services_.emplace_back(serviceid);
+    }
+
+    void worker::run_gc()
+    {
+        if (gc_services_.empty())
+        {
+            return;
+        }
+
+        bool idle = (mqsize_ == 0);
+        bool pending = false;
+        for (size_t i = 0; i < gc_services_.size();)
+        {
+            service* s = find_service(gc_services_[i]);
+            if (nullptr == s)
+            {
+                gc_services_[i] = gc_services_.back();
+                gc_services_.pop_back();
+                continue;
+            }
+            ++i;
+            if (!s->ok())
+            {
+                continue;
+            }
+            double start_time = moon::time::clock();
+            pending = s->gc_step(idle) || pending;
+            double cost_time = moon::time::clock() - start_time;
+            s->add_cpu_cost(cost_time);
+            cpu_cost_ += cost_time;
+        }
+
+        //finish the cycles in idle time, one slice per loop turn so io is not starved
+        if (pending && idle && !gc_posted_)
+        {
+            gc_posted_ = true;
+            asio::post(io_ctx_, [this]() {
+                gc_posted_ = false;
+                run_gc();
             });
         }
     }
 
+    void worker::add_deadline(int64_t deadline, uint32_t serviceid, int32_t sessionid)
+    {
+        deadlines_.add(deadline, deadline_entry{ serviceid, sessionid, deadline });
+        arm_deadline_timer();
+    }
+
+    void worker::arm_deadline_timer()
+    {
+        //ticks only while deadlines are pending
+        if (deadline_armed_ || deadlines_.size() == 0)
+        {
+            return;
+        }
+        deadline_armed_ = true;
+        deadline_timer_.expires_after(std::chrono::milliseconds(decltype(deadlines_)::tick));
+        deadline_timer_.async_wait([this](const asio::error_code& e) {
+            deadline_armed_ = false;
+            if (e)
+            {
+                return;
+            }
+            deadlines_.update(server_->now(), [this](const deadline_entry& v) {
+                if (service* s = find_service(v.serviceid); nullptr != s && s->ok())
+                {
+                    s->on_deadline(v.sessionid, v.deadline);
+                }
+            });
+            arm_deadline_timer();
+        });
+    }
+
     uint32_t worker::id() const
     {
         return workerid_;
@@ -258,6 +414,13 @@ namespace moon
             return;
         }
 
+        //the caller has given up waiting, its own deadline already fails the call
+        if (int64_t deadline = msg->deadline(); deadline != 0 && deadline <= server_->now())
+        {
+            ++expired_;
+            return;
+        }
+
         if (nullptr == s || s->id() != receiver)
         {
             s = find_service(receiver);
@@ -278,15 +441,78 @@ namespace moon
             }
         }
 
+        int64_t enqueue_time = msg->enqueue_time();
+        int64_t trace_start = (enqueue_time != 0) ? time::microsecond() : 0;
+        uint8_t type = msg->type();
         double start_time = moon::time::clock();
         handle_message(s, std::move(msg));
         double cost_time = moon::time::clock() - start_time;
         s->add_cpu_cost(cost_time);
         cpu_cost_ += cost_time;
+        if (enqueue_time != 0)
+        {
+            trace(s, type, enqueue_time, trace_start, cost_time);
+        }
         if (cost_time > 0.1)
         {
             CONSOLE_WARN(server_->logger(),
                 "worker %u handle one message cost %f, from %08X to %08X", id(), cost_time, sender, receiver);
         }
     }
+
+    void worker::trace(service* s, uint8_t type, int64_t enqueue_time, int64_t start_time, double cost_time)
+    {
+        auto& t = s->traces_[type];
+        if (nullptr == t)
+        {
+            t = std::make_unique<message_trace>();
+        }
+        t->queue_wait.record(start_time - enqueue_time);
+        t->dispatch.record(static_cast<int64_t>(cost_time * 1000000));
+    }
+
+    void worker::clear_trace()
+    {
+        for (auto& it : services_)
+        {
+            it.second->traces_.clear();
+        }
+    }
+
+    void worker::trace_report(std::array<std::string, 2>& report, bool prometheus) const
+    {
+        static constexpr std::pair<const char*, double> quantiles[] = { {"0.5", 0.5}, {"0.9", 0.9}, {"0.99", 0.99}, {"0.999", 0.999} };
+
+        for (auto& it : services_)
+        {
+            const service* s = it.second.get();
+            for (auto& [type, t] : s->traces_)
+            {
+                if (prometheus)
+                {
+                    auto labels = moon::format(R"(service="%s",serviceid="%08X",ptype="%u")", s->name().data(), s->id(), type);
+                    auto append = [&labels](std::string& out, const char* metric, const histogram& h) {
+                        for (auto& [name, q] : quantiles)
+                        {
+                            out.append(moon::format("%s{%s,quantile=\"%s\"} %" PRIu64 "\n", metric, labels.data(), name, h.percentile(q)));
+                        }
+                        out.append(moon::format("%s_sum{%s} %" PRIu64 "\n", metric, labels.data(), h.sum()));
+                        out.append(moon::format("%s_count{%s} %" PRIu64 "\n", metric, labels.data(), h.count()));
+                    };
+                    append(report[0], "moon_queue_wait_us", t->queue_wait);
+                    append(report[1], "moon_dispatch_us", t->dispatch);
+                }
+                else
+                {
+                    auto summary = [](const histogram& h) {
+                        return moon::format(R"({"mean":%.1f,"p50":%)" PRIu64 R"(,"p90":%)" PRIu64 R"(,"p99":%)" PRIu64 R"(,"p999":%)" PRIu64 R"(,"max":%)" PRIu64 "}",
+                            h.mean(), h.percentile(0.5), h.percentile(0.9), h.percentile(0.99), h.percentile(0.999), h.max());
+                    };
+                    report[0].append(moon::format(R"({"name":"%s","serviceid":"%08X","ptype":%u,"count":%)" PRIu64 R"(,"queue_wait_us":%s,"dispatch_us":%s},)",
+                        s->name().data(), s->id(), type, t->dispatch.count(),
+                        summary(t->queue_wait).data(), summary(t->dispatch).data()));
+                }
+            }
+        }
+    }
 }
@@ -1,6 +1,7 @@
 #pragma once
 #include "config.hpp"
 #include "common/concurrent_queue.hpp"
+#include "common/timer_wheel.hpp"
 #include "network/socket.h"
 
 namespace moon
@@ -17,6 +18,8 @@ namespace moon
     public:
         static constexpr uint32_t MAX_SERVICE = 0xFFFFFF;
 
+        static constexpr int MAX_DEFERRED_ROUNDS = 64;
+
         friend class server;
 
         friend class socket;
@@ -39,6 +42,18 @@ namespace moon
 
         void send(message_ptr_t&& msg);
 
+        //run the deferred tasks of the service after the current dispatch batch.
+        //worker thread only.
+        void defer(uint32_t serviceid);
+
+        //calls service::on_deadline(sessionid, deadline) once the server time reaches deadline.
+        //worker thread only.
+        void add_deadline(int64_t deadline, uint32_t serviceid, int32_t sessionid);
+
+        //the service collects garbage in gc_step calls, made after each dispatch batch
+        //and repeated while the worker is idle. worker thread only.
+        void add_gc(uint32_t serviceid);
+
         void shared(bool v);
 
         bool shared() const;
@@ -48,6 +63,9 @@ namespace moon
         bool send_prefab(uint32_t sender, uint32_t receiver, intptr_t prefabid, std::string_view header, int32_t sessionid, uint8_t type) const;
 
         moon::socket& socket() { return *socket_; }
+
+        //appends the trace records of this worker's services, see server::trace_report
+        void trace_report(std::array<std::string, 2>& report, bool prometheus) const;
     private:
         void run();
 
@@ -57,20 +75,50 @@ namespace moon
     private:
         void handle_one(service*& ser, message_ptr_t&& msg);
 
+        void trace(service* s, uint8_t type, int64_t enqueue_time, int64_t start_time, double cost_time);
+
+        void clear_trace();
+
+        void run_deferred();
+
+        void run_gc();
+
+        void arm_deadline_timer();
+
         service* find_service(uint32_t serviceid) const;
     private:
+        bool dispatching_ = false;
+        bool deferred_posted_ = false;
+        bool gc_posted_ = false;
         std::atomic_bool shared_ = true;
         std::atomic_uint32_t count_ = 0;
         std::atomic_uint32_t mqsize_ = 0;
+        std::atomic_uint32_t expired_ = 0;
         uint32_t nextid_ = 0;
+        //pinned cpu, -1 unpinned
+        int cpu_ = -1;
+        //only runs services created with its threadid, see server::next_worker
+        bool dedicated_ = false;
         double cpu_cost_ = 0.0;
         uint32_t workerid_;
         server*  server_;
         asio::io_context io_ctx_;
         asio_work_type work_;
+        asio::steady_timer deadline_timer_;
+        bool deadline_armed_ = false;
         std::thread thread_;
         queue_type mq_;
         queue_type::container_type swapmq_;
+        std::vector<uint32_t> deferred_;
+        std::vector<uint32_t> running_deferred_;
+        std::vector<uint32_t> gc_services_;
+        struct deadline_entry
+        {
+            uint32_t serviceid;
+            int32_t sessionid;
+            int64_t deadline;
+        };
+        timer_wheel<deadline_entry> deadlines_;
         std::unique_ptr<moon::socket> socket_;
         std::unordered_map<uint32_t, service_ptr_t> services_;
         std::unordered_map<intptr_t, moon::buffer_ptr_t> prefabs_;
@@ -0,0 +1,523 @@
+#include <mutex>
+#include <memory>
+#include <cstddef>
+#include <filesystem>
+#include <unordered_map>
+#include "common/datatable.hpp"
+#include "common/mmap_file.hpp"
+#include "common/file.hpp"
+#include "lua.hpp"
+
+/*
+    read-only data tables, memory mapped and indexed in place.
+
+    local datatable = require("datatable")
+    datatable.save("item.dt", {[1001] = {name = "sword", attack = 10}})
+    local item = datatable.open("item.dt") --same mapping in every service of the process
+    print(item[1001].name, #item, item[1001].attack)
+
+    tables are userdata with __index, __len and __pairs. nothing is decoded on open;
+    a string is pushed to lua when it is read. the os page cache holds one copy of
+    the file for every process that opens it.
+*/
+
+#define METANAME "ldatatable"
+#define IMAGE_METANAME "ldatatable_image"
+
+namespace fs = std::filesystem;
+using namespace moon::datatable;
+
+static constexpr int MAX_DEPTH = 64;
+static constexpr uint64_t IN_PROGRESS = UINT64_MAX;
+
+struct mapped_image
+{
+    moon::mmap_file file;
+    fs::file_time_type mtime;
+    uintmax_t size = 0;
+};
+
+//one mapping per file and process, shared by the services of every worker.
+//a file replaced on disk(save renames over it) is mapped again by the next open.
+static std::mutex images_lock;
+static std::unordered_map<std::string, std::weak_ptr<mapped_image>> images;
+
+struct image_box
+{
+    std::shared_ptr<mapped_image> image;
+};
+
+struct table_proxy
+{
+    const char* data;
+    size_t size;
+    uint64_t offset;
+};
+
+static std::shared_ptr<mapped_image> open_image(const std::string& path, std::string& err)
+{
+    std::error_code ec;
+    std::string key = fs::absolute(path, ec).lexically_normal().string();
+    auto mtime = fs::last_write_time(key, ec);
+    auto size = ec ? 0 : fs::file_size(key, ec);
+    if (ec)
+    {
+        err = ec.message();
+        return nullptr;
+    }
+
+    std::unique_lock lock(images_lock);
+    if (auto it = images.find(key); it != images.end())
+    {
+        if (auto image = it->second.lock(); image && image->mtime == mtime && image->size == size)
+        {
+            return image;
+        }
+    }
+
+    auto image = std::make_shared<mapped_image>();
+    if (!image->file.open(key))
+    {
+        err = "can not map file";
+        return nullptr;
+    }
+    if (!reader{ image->file.data(), image->file.size() }.valid())
+    {
+        err = "not a datatable image";
+        return nullptr;
+    }
+    image->mtime = mtime;
+    image->size = size;
+
+    for (auto it = images.begin(); it != images.end();)
+    {
+        if (it->second.expired())
+            it = images.erase(it);
+        else
+            ++it;
+    }
+    images[key] = image;
+    return image;
+}
+
+static table_proxy* check_proxy(lua_State* L, int idx)
+{
+    return (table_proxy*)luaL_checkudata(L, idx, METANAME);
+}
+
+//a new userdata per read: caching proxies in a weak table costs more than it saves.
+//__eq compares records, so a table read twice is still equal to itself.
+static void push_table(lua_State* L, const table_proxy* from, int from_idx, uint64_t offset)
+{
+    if (!reader{ from->data, from->size }.check_table(offset))
+    {
+        luaL_error(L, "datatable: damaged table record at %I", (lua_Integer)offset);
+        return;
+    }
+    auto p = (table_proxy*)lua_newuserdatauv(L, sizeof(table_proxy), 1);
+    p->data = from->data;
+    p->size = from->size;
+    p->offset = offset;
+    luaL_setmetatable(L, METANAME);
+    lua_getiuservalue(L, from_idx, 1);//the image, kept alive by every proxy
+    lua_setiuservalue(L, -2, 1);
+}
+
+static void push_value(lua_State* L, const table_proxy* p, int idx, const value& v)
+{
+    switch (v.type)
+    {
+    case type_false:
+        lua_pushboolean(L, 0);
+        break;
+    case type_true:
+        lua_pushboolean(L, 1);
+        break;
+    case type_integer:
+        lua_pushinteger(L, (lua_Integer)v.i);
+        break;
+    case type_number:
+        lua_pushnumber(L, (lua_Number)v.n);
+        break;
+    case type_string:
+    {
+        reader r{ p->data, p->size };
+        if (!r.check_string(v))
+        {
+            luaL_error(L, "datatable: damaged string record");
+        }
+        auto s = r.string(v);
+        lua_pushlstring(L, s.data(), s.size());
+        break;
+    }
+    case type_table:
+        push_table(L, p, idx, v.offset);
+        break;
+    default:
+        lua_pushnil(L);
+        break;
+    }
+}
+
+static const value* find_key(lua_State* L, const table_proxy* p, int idx)
+{
+    reader r{ p->data, p->size };
+    switch (lua_type(L, idx))
+    {
+    case LUA_TNUMBER:
+    {
+        int isnum = 0;
+        lua_Integer i = lua_tointegerx(L, idx, &isnum);
+        if (isnum)
+            return r.find_integer(p->offset, (int64_t)i);
+        return r.find_number(p->offset, (double)lua_tonumber(L, idx));
+    }
+    case LUA_TSTRING:
+    {
+        size_t len = 0;
+        const char* s = lua_tolstring(L, idx, &len);
+        return r.find_string(p->offset, s, len);
+    }
+    case LUA_TBOOLEAN:
+        return r.find_boolean(p->offset, lua_toboolean(L, idx) != 0);
+    default:
+        return nullptr;
+    }
+}
+
+static int lindex(lua_State* L)
+{
+    table_proxy* p = check_proxy(L, 1);
+    const value* v = find_key(L, p, 2);
+    if (nullptr == v)
+    {
+        return 0;
+    }
+    push_value(L, p, 1, *v);
+    return 1;
+}
+
+static int llen(lua_State* L)
+{
+    table_proxy* p = check_proxy(L, 1);
+    lua_pushinteger(L, (lua_Integer)reader{ p->data, p->size }.head(p->offset)->narr);
+    return 1;
+}
+
+static int lnext(lua_State* L)
+{
+    table_proxy* p = check_proxy(L, 1);
+    reader r{ p->data, p->size };
+    auto t = r.head(p->offset);
+
+    //position: 0..narr-1 the array part, narr.. the slots
+    uint64_t pos = 0;
+    if (!lua_isnoneornil(L, 2))
+    {
+        int isnum = 0;
+        lua_Integer i = lua_tointegerx(L, 2, &isnum);
+        if (lua_type(L, 2) == LUA_TNUMBER && isnum && i >= 1 && (uint64_t)i <= t->narr)
+        {
+            pos = (uint64_t)i;
+        }
+        else
+        {
+            const value* v = find_key(L, p, 2);
+            if (nullptr == v)
+            {
+                return luaL_error(L, "invalid key to 'next'");
+            }
+            auto s = reinterpret_cast<const slot*>(reinterpret_cast<const char*>(v) - offsetof(slot, val));
+            pos = t->narr + (uint64_t)(s - r.hash(p->offset)) + 1;
+        }
+    }
+
+    if (pos < t->narr)
+    {
+        lua_pushinteger(L, (lua_Integer)(pos + 1));
+        push_value(L, p, 1, r.array(p->offset)[pos]);
+        return 2;
+    }
+
+    const slot* slots = r.hash(p->offset);
+    for (uint64_t i = pos - t->narr; i < t->nslots; ++i)
+    {
+        if (slots[i].key.type != type_nil)
+        {
+            push_value(L, p, 1, slots[i].key);
+            push_value(L, p, 1, slots[i].val);
+            return 2;
+        }
+    }
+    lua_pushnil(L);
+    return 1;
+}
+
+static int lpairs(lua_State* L)
+{
+    check_proxy(L, 1);
+    lua_pushcfunction(L, lnext);
+    lua_pushvalue(L, 1);
+    lua_pushnil(L);
+    return 3;
+}
+
+static int lnewindex(lua_State* L)
+{
+    return luaL_error(L, "datatable is read-only");
+}
+
+static int leq(lua_State* L)
+{
+    auto a = (table_proxy*)luaL_testudata(L, 1, METANAME);
+    auto b = (table_proxy*)luaL_testudata(L, 2, METANAME);
+    lua_pushboolean(L, a && b && a->data + a->offset == b->data + b->offset);
+    return 1;
+}
+
+static int ltostring(lua_State* L)
+{
+    table_proxy* p = check_proxy(L, 1);
+    lua_pushfstring(L, "datatable: %p", p->data + p->offset);
+    return 1;
+}
+
+static int lrelease_image(lua_State* L)
+{
+    auto box = (image_box*)lua_touserdata(L, 1);
+    box->~image_box();
+    return 0;
+}
+
+static int lopen(lua_State* L)
+{
+    std::string path = luaL_checkstring(L, 1);
+    std::string err;
+    auto image = open_image(path, err);
+    if (nullptr == image)
+    {
+        lua_pushnil(L);
+        lua_pushfstring(L, "datatable open '%s': %s", path.data(), err.data());
+        return 2;
+    }
+
+    auto box = (image_box*)lua_newuserdatauv(L, sizeof(image_box), 0);
+    new (box) image_box{ image };
+    if (luaL_newmetatable(L, IMAGE_METANAME))
+    {
+        lua_pushcfunction(L, lrelease_image);
+        lua_setfield(L, -2, "__gc");
+    }
+    lua_setmetatable(L, -2);
+
+    auto root = (table_proxy*)lua_newuserdatauv(L, sizeof(table_proxy), 1);
+    root->data = image->file.data();
+    root->size = image->file.size();
+    root->offset = reader{ root->data, root->size }.root();
+    luaL_setmetatable(L, METANAME);
+    lua_pushvalue(L, -2);
+    lua_setiuservalue(L, -2, 1);
+    return 1;
+}
+
+static value to_value(lua_State* L, int idx, writer& w, std::unordered_map<const void*, uint64_t>& tables, int depth);
+
+static uint64_t build_table(lua_State* L, int idx, writer& w, std::unordered_map<const void*, uint64_t>& tables, int depth)
+{
+    idx = lua_absindex(L, idx);
+    const void* key = lua_topointer(L, idx);
+    if (auto it = tables.find(key); it != tables.end())
+    {
+        if (it->second == IN_PROGRESS)
+        {
+            luaL_error(L, "datatable: table cycle");
+        }
+        return it->second;
+    }
+    if (depth > MAX_DEPTH)
+    {
+        luaL_error(L, "datatable: table too deep");
+    }
+    luaL_checkstack(L, 4, nullptr);
+    tables[key] = IN_PROGRESS;
+
+    lua_Unsigned narr = 0;
+    while (lua_rawgeti(L, idx, (lua_Integer)(narr + 1)) != LUA_TNIL)
+    {
+        lua_pop(L, 1);
+        ++narr;
+    }
+    lua_pop(L, 1);
+
+    uint32_t nhash = 0;
+    lua_pushnil(L);
+    while (lua_next(L, idx))
+    {
+        lua_pop(L, 1);
+        if (lua_isinteger(L, -1))
+        {
+            lua_Integer i = lua_tointeger(L, -1);
+            if (i >= 1 && (lua_Unsigned)i <= narr)
+            {
+                continue;
+            }
+        }
+        ++nhash;
+    }
+
+    uint64_t t = w.add_table((uint32_t)narr, nhash);
+    for (lua_Unsigned i = 0; i < narr; ++i)
+    {
+        lua_rawgeti(L, idx, (lua_Integer)(i + 1));
+        w.set_array(t, (uint32_t)i, to_value(L, -1, w, tables, depth + 1));
+        lua_pop(L, 1);
+    }
+
+    lua_pushnil(L);
+    while (lua_next(L, idx))
+    {
+        if (lua_isinteger(L, -2))
+        {
+            lua_Integer i = lua_tointeger(L, -2);
+            if (i >= 1 && (lua_Unsigned)i <= narr)
+            {
+                lua_pop(L, 1);
+                continue;
+            }
+        }
+        int kt = lua_type(L, -2);
+        if (kt != LUA_TNUMBER && kt != LUA_TSTRING && kt != LUA_TBOOLEAN)
+        {
+            luaL_error(L, "datatable: unsupported key type '%s'", lua_typename(L, kt));
+        }
+        value k = to_value(L, -2, w, tables, depth + 1);
+        value v = to_value(L, -1, w, tables, depth + 1);
+        w.set_hash(t, k, v);
+        lua_pop(L, 1);
+    }
+
+    tables[key] = t;
+    return t;
+}
+
+static value to_value(lua_State* L, int idx, writer& w, std::unordered_map<const void*, uint64_t>& tables, int depth)
+{
+    value v{};
+    int t = lua_type(L, idx);
+    switch (t)
+    {
+    case LUA_TBOOLEAN:
+        v.type = lua_toboolean(L, idx) ? type_true : type_false;
+        break;
+    case LUA_TNUMBER:
+    {
+        //integral floats are integers, as lua does for table keys
+        int isnum = 0;
+        lua_Integer i = lua_tointegerx(L, idx, &isnum);
+        if (isnum)
+        {
+            v.type = type_integer;
+            v.i = (int64_t)i;
+        }
+        else
+        {
+            v.type = type_number;
+            v.n = (double)lua_tonumber(L, idx);
+        }
+        break;
+    }
+    case LUA_TSTRING:
+    {
+        size_t len = 0;
+        const char* s = lua_tolstring(L, idx, &len);
+        if (len > UINT32_MAX)
+        {
+            luaL_error(L, "datatable: string too long");
+        }
+        v.type = type_string;
+        v.len = (uint32_t)len;
+        v.offset = w.add_string(std::string_view{ s, len });
+        break;
+    }
+    case LUA_TTABLE:
+        v.type = type_table;
+        v.offset = build_table(L, idx, w, tables, depth);
+        break;
+    default:
+        luaL_error(L, "datatable: unsupported value type '%s'", lua_typename(L, t));
+        break;
+    }
+    return v;
+}
+
+static std::string build(lua_State* L, int idx)
+{
+    luaL_checktype(L, idx, LUA_TTABLE);
+    writer w;
+    std::unordered_map<const void*, uint64_t> tables;
+    uint64_t root = build_table(L, idx, w, tables, 0);
+    return w.finish(root);
+}
+
+static int lbuild(lua_State* L)
+{
+    std::string data = build(L, 1);
+    lua_pushlstring(L, data.data(), data.size());
+    return 1;
+}
+
+//the image is written aside and renamed over path, services that mapped the old file keep it
+static int lsave(lua_State* L)
+{
+    std::string path = luaL_checkstring(L, 1);
+    std::string data = build(L, 2);
+    std::string tmp = path + ".tmp";
+    if (!moon::file::write(tmp, data, std::ios::out | std::ios::binary | std::ios::trunc))
+    {
+        lua_pushboolean(L, 0);
+        lua_pushfstring(L, "datatable save '%s': write failed", tmp.data());
+        return 2;
+    }
+    std::error_code ec;
+    fs::rename(tmp, path, ec);
+    if (ec)
+    {
+        lua_pushboolean(L, 0);
+        lua_pushfstring(L, "datatable save '%s': %s", path.data(), ec.message().data());
+        return 2;
+    }
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+extern "C"
+{
+    int LUAMOD_API luaopen_datatable(lua_State* L)
+    {
+        if (luaL_newmetatable(L, METANAME))
+        {
+            luaL_Reg m[] = {
+                { "__index", lindex },
+                { "__len", llen },
+                { "__pairs", lpairs },
+                { "__newindex", lnewindex },
+                { "__eq", leq },
+                { "__tostring", ltostring },
+                { NULL, NULL }
+            };
+            luaL_setfuncs(L, m, 0);
+        }
+        lua_pop(L, 1);
+
+        luaL_Reg l[] = {
+            { "open", lopen },
+            { "build", lbuild },
+            { "save", lsave },
+            { "next", lnext },
+            { NULL, NULL }
+        };
+        luaL_checkversion(L);
+        luaL_newlib(L, l);
+        return 1;
+    }
+}
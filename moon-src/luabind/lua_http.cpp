@@ -48,6 +48,104 @@ static int lhttp_parse_response(lua_State* L)
     return 4;
 }
 
+static void push_lower_header(lua_State* L, const http::case_insensitive_multimap_view& header)
+{
+    lua_createtable(L, 0, (int)header.size());
+    std::string key;
+    for (const auto& v : header)
+    {
+        key.assign(v.first.data(), v.first.size());
+        for (auto& c : key)
+        {
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        }
+        lua_pushlstring(L, key.data(), key.size());
+        lua_pushlstring(L, v.second.data(), v.second.size());
+        lua_rawset(L, -3);
+    }
+}
+
+static std::string_view get_message_data(lua_State* L, int index)
+{
+    if (lua_type(L, index) == LUA_TSTRING)
+    {
+        return luaL_check_stringview(L, index);
+    }
+    const char* data = (const char*)lua_touserdata(L, index);
+    size_t len = (size_t)luaL_checkinteger(L, index + 1);
+    if (nullptr == data)
+    {
+        luaL_error(L, "http: no data");
+    }
+    return std::string_view{ data, len };
+}
+
+// decode_response(sz, len | str) -> ok, version, status_code, header, content
+// PTYPE_SOCKET_HTTP message: head followed by the decoded body. header keys are lowercase.
+static int lhttp_decode_response(lua_State* L)
+{
+    std::string_view data = get_message_data(L, 1);
+    size_t head_len = data.find("\r\n\r\n");
+    if (head_len == std::string_view::npos)
+    {
+        lua_pushboolean(L, 0);
+        return 1;
+    }
+    head_len += 4;
+    std::string_view version;
+    std::string_view status_code;
+    http::case_insensitive_multimap_view header;
+    bool ok = http::response_parser::parse(data.substr(0, head_len), version, status_code, header);
+    lua_pushboolean(L, ok ? 1 : 0);
+    lua_pushlstring(L, version.data(), version.size());
+    lua_pushlstring(L, status_code.data(), status_code.size());
+    push_lower_header(L, header);
+    if (data.size() > head_len)
+    {
+        lua_pushlstring(L, data.data() + head_len, data.size() - head_len);
+    }
+    else
+    {
+        lua_pushnil(L);
+    }
+    return 5;
+}
+
+// decode_request(sz, len | str) -> ok, method, path, query_string, version, header, content
+// PTYPE_SOCKET_HTTP message of an accepted connection. header keys are lowercase.
+static int lhttp_decode_request(lua_State* L)
+{
+    std::string_view data = get_message_data(L, 1);
+    size_t head_len = data.find("\r\n\r\n");
+    if (head_len == std::string_view::npos)
+    {
+        lua_pushboolean(L, 0);
+        return 1;
+    }
+    head_len += 4;
+    std::string_view method;
+    std::string_view path;
+    std::string_view query_string;
+    std::string_view version;
+    http::case_insensitive_multimap_view header;
+    bool ok = http::request_parser::parse(data.substr(0, head_len), method, path, query_string, version, header);
+    lua_pushboolean(L, ok ? 1 : 0);
+    lua_pushlstring(L, method.data(), method.size());
+    lua_pushlstring(L, path.data(), path.size());
+    lua_pushlstring(L, query_string.data(), query_string.size());
+    lua_pushlstring(L, version.data(), version.size());
+    push_lower_header(L, header);
+    if (data.size() > head_len)
+    {
+        lua_pushlstring(L, data.data() + head_len, data.size() - head_len);
+    }
+    else
+    {
+        lua_pushnil(L);
+    }
+    return 7;
+}
+
 static int lhttp_parse_query_string(lua_State* L)
 {
     std::string_view data = luaL_check_stringview(L, 1);
@@ -104,6 +202,8 @@ extern "C"
         luaL_Reg l[] = {
                   { "parse_request", lhttp_parse_request},
                   { "parse_response", lhttp_parse_response },
+                  { "decode_response", lhttp_decode_response },
+                  { "decode_request", lhttp_decode_request },
                   { "create_query_string", lhttp_create_query_string },
                   { "parse_query_string", lhttp_parse_query_string},
                   { "urlencode", lhttp_urlencode },
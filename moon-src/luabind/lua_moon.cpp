@@ -224,8 +224,9 @@ static int lmoon_send(lua_State* L)
     buffer_ptr_t buf = moon_to_buffer(L, 2);
     std::string_view header = luaL_check_stringview(L, 3);
     int32_t sessionid = (int32_t)luaL_checkinteger(L, 4);
+    int64_t deadline = (int64_t)luaL_optinteger(L, 6, 0);
 
-    S->get_server()->send(S->id(), receiver, std::move(buf), header, sessionid, type);
+    S->get_server()->send(S->id(), receiver, std::move(buf), header, sessionid, type, deadline);
     return 0;
 }
 
@@ -298,6 +299,20 @@ static int lmoon_new_service(lua_State* L)
             conf.source = luaL_check_stringview(L, -1);
         else if (key == "memlimit")
             conf.memlimit = luaL_checkinteger(L, -1);
+        else if (key == "gcmode")
+            conf.gcmode = luaL_check_stringview(L, -1);
+        else if (key == "gcpause")
+            conf.gcpause = (int)luaL_checkinteger(L, -1);
+        else if (key == "gcstepmul")
+            conf.gcstepmul = (int)luaL_checkinteger(L, -1);
+        else if (key == "gcstepsize")
+            conf.gcstepsize = (int)luaL_checkinteger(L, -1);
+        else if (key == "gcminormul")
+            conf.gcminormul = (int)luaL_checkinteger(L, -1);
+        else if (key == "gcmajormul")
+            conf.gcmajormul = (int)luaL_checkinteger(L, -1);
+        else if (key == "gcbudget")
+            conf.gcbudget = luaL_checkinteger(L, -1);
         else if (key == "unique")
             conf.unique = lua_toboolean(L, -1);
         else if (key == "threadid")
@@ -334,6 +349,69 @@ static int lmoon_scan_services(lua_State* L)
     return 0;
 }
 
+static int lmoon_trace(lua_State* L)
+{
+    lua_service* S = (lua_service*)get_ptr(L, LMOON_GLOBAL);
+    S->get_server()->trace(lua_toboolean(L, 1));
+    return 0;
+}
+
+static int lmoon_trace_report(lua_State* L)
+{
+    lua_service* S = (lua_service*)get_ptr(L, LMOON_GLOBAL);
+    std::string_view format = luaL_check_stringview(L, 1);
+    int32_t sessionid = (int32_t)luaL_checkinteger(L, 2);
+    S->get_server()->trace_report(S->id(), format == "prometheus"sv, sessionid);
+    return 0;
+}
+
+static int lmoon_profile_start(lua_State* L)
+{
+    lua_service* S = (lua_service*)get_ptr(L, LMOON_GLOBAL);
+    int period = (int)luaL_optinteger(L, 1, 10000);
+    lua_pushboolean(L, S->profile_start(period));
+    return 1;
+}
+
+static int lmoon_profile_stop(lua_State* L)
+{
+    lua_service* S = (lua_service*)get_ptr(L, LMOON_GLOBAL);
+    std::string folded = S->profile_stop();
+    lua_pushlstring(L, folded.data(), folded.size());
+    return 1;
+}
+
+static int lmoon_memtrace_start(lua_State* L)
+{
+    lua_service* S = (lua_service*)get_ptr(L, LMOON_GLOBAL);
+    size_t rate = (size_t)luaL_optinteger(L, 1, 512 * 1024);
+    lua_pushboolean(L, S->memtrace_start(rate));
+    return 1;
+}
+
+static int lmoon_memtrace_report(lua_State* L)
+{
+    lua_service* S = (lua_service*)get_ptr(L, LMOON_GLOBAL);
+    std::string folded = S->memtrace_report((size_t)luaL_optinteger(L, 1, 0));
+    lua_pushlstring(L, folded.data(), folded.size());
+    return 1;
+}
+
+static int lmoon_memtrace_stop(lua_State* L)
+{
+    lua_service* S = (lua_service*)get_ptr(L, LMOON_GLOBAL);
+    std::string folded = S->memtrace_stop();
+    lua_pushlstring(L, folded.data(), folded.size());
+    return 1;
+}
+
+static int lmoon_gcstat(lua_State* L)
+{
+    lua_service* S = (lua_service*)get_ptr(L, LMOON_GLOBAL);
+    S->gc_stat(L);
+    return 1;
+}
+
 static int lmoon_queryservice(lua_State* L)
 {
     lua_service* S = (lua_service*)get_ptr(L, LMOON_GLOBAL);
@@ -408,11 +486,72 @@ static int lmoon_adjtime(lua_State* L)
 static int lmoon_callback(lua_State* L) {
     lua_service* S = (lua_service*)get_ptr(L, LMOON_GLOBAL);
     luaL_checktype(L, 1, LUA_TFUNCTION);
+    if (!lua_isnoneornil(L, 2))
+    {
+        luaL_checktype(L, 2, LUA_TFUNCTION);
+        lua_pushvalue(L, 2);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &lua_service::DEFERRED_KEY);
+    }
     lua_settop(L, 1);
     lua_rawsetp(L, LUA_REGISTRYINDEX, S);
     return 0;
 }
 
+static int lmoon_make_session(lua_State* L) {
+    lua_service* S = (lua_service*)get_ptr(L, LMOON_GLOBAL);
+    uint32_t watcher = (uint32_t)luaL_optinteger(L, 1, 0);
+    int64_t deadline = (int64_t)luaL_optinteger(L, 2, 0);
+    int32_t sessionid = S->make_session(L, watcher, deadline);
+    if (0 == sessionid)
+    {
+        return luaL_error(L, "too many sessions: %d", (int)S->sessions().size());
+    }
+    lua_pushinteger(L, sessionid);
+    return 1;
+}
+
+static int lmoon_take_session(lua_State* L) {
+    lua_service* S = (lua_service*)get_ptr(L, LMOON_GLOBAL);
+    S->take_session(L, (int32_t)luaL_checkinteger(L, 1));
+    return 1;
+}
+
+static int lmoon_cancel_session(lua_State* L) {
+    lua_service* S = (lua_service*)get_ptr(L, LMOON_GLOBAL);
+    S->cancel_session((int32_t)luaL_checkinteger(L, 1));
+    return 0;
+}
+
+//sessions waiting on service `watcher`, all parked sessions when watcher is 0
+static int lmoon_sessions(lua_State* L) {
+    lua_service* S = (lua_service*)get_ptr(L, LMOON_GLOBAL);
+    uint32_t watcher = (uint32_t)luaL_optinteger(L, 1, 0);
+    lua_createtable(L, 0, 0);
+    lua_Integer n = 0;
+    auto push = [L, &n](int32_t sessionid, const moon::session_table::slot& s) {
+        if (s.st != moon::session_table::state::cancelled)
+        {
+            lua_pushinteger(L, sessionid);
+            lua_rawseti(L, -2, ++n);
+        }
+    };
+    if (watcher != 0)
+    {
+        S->sessions().for_each_watching(watcher, push);
+    }
+    else
+    {
+        S->sessions().for_each(push);
+    }
+    return 1;
+}
+
+static int lmoon_defer(lua_State* L) {
+    lua_service* S = (lua_service*)get_ptr(L, LMOON_GLOBAL);
+    S->get_worker()->defer(S->id());
+    return 0;
+}
+
 static int message_decode(lua_State* L)
 {
     message* m = (message*)lua_touserdata(L, 1);
@@ -467,6 +606,11 @@ static int message_decode(lua_State* L)
             lua_pushinteger(L, m->size());
             break;
         }
+        case 'D':
+        {
+            lua_pushinteger(L, m->deadline());
+            break;
+        }
         case 'B':
         {
             lua_pushlightuserdata(L, m->get_buffer());
@@ -494,6 +638,208 @@ static int message_decode(lua_State* L)
     return lua_gettop(L) - top;
 }
 
+#define CHANNEL_METANAME "lmoon_channel"
+
+static constexpr lua_Integer CHANNEL_MIN_CAPACITY = 4 * 1024;
+static constexpr lua_Integer CHANNEL_MAX_CAPACITY = 1024 * 1024 * 1024;
+
+struct channel_box
+{
+    channel_ptr_t ch;
+    bool producer;
+};
+
+static channel_box* check_channel(lua_State* L)
+{
+    auto box = (channel_box*)luaL_checkudata(L, 1, CHANNEL_METANAME);
+    if (nullptr == box->ch)
+    {
+        luaL_error(L, "channel released");
+    }
+    return box;
+}
+
+static void push_channel(lua_State* L, channel_ptr_t ch, bool producer)
+{
+    auto box = (channel_box*)lua_newuserdatauv(L, sizeof(channel_box), 0);
+    new (box) channel_box{ std::move(ch), producer };
+    luaL_setmetatable(L, CHANNEL_METANAME);
+}
+
+static int lchannel_write(lua_State* L)
+{
+    channel_box* box = check_channel(L);
+    if (!box->producer)
+        return luaL_error(L, "channel write: not the producer");
+    channel& ch = *box->ch;
+    bool packed = (lua_type(L, 2) == LUA_TLIGHTUSERDATA);
+    std::string_view data = packed ? std::string_view{} : luaL_check_stringview(L, 2);
+    //a packed buffer is owned from here on, written or not
+    buffer_ptr_t buf(packed ? static_cast<buffer*>(lua_touserdata(L, 2)) : nullptr);
+    if (nullptr != buf)
+    {
+        data = std::string_view{ buf->data(), buf->size() };
+    }
+
+    if (ch.closed.load(std::memory_order_relaxed))
+    {
+        lua_pushboolean(L, 0);
+        return 1;
+    }
+
+    bool ok = (nullptr != data.data()) && ch.ring.try_write(data.data(), data.size());
+
+    if (ok)
+    {
+        ++ch.writes;
+        lua_service* S = (lua_service*)get_ptr(L, LMOON_GLOBAL);
+        S->get_server()->notify_channel(ch);
+    }
+    else
+    {
+        ++ch.full;
+    }
+    lua_pushboolean(L, ok ? 1 : 0);
+    return 1;
+}
+
+static int lchannel_read(lua_State* L)
+{
+    channel_box* box = check_channel(L);
+    if (box->producer)
+        return luaL_error(L, "channel read: not the consumer");
+    std::string_view record;
+    if (!box->ch->ring.peek(record))
+    {
+        return 0;
+    }
+    lua_pushlstring(L, record.data(), record.size());
+    box->ch->ring.pop(record);
+    ++box->ch->reads;
+    return 1;
+}
+
+//consumer, before draining: clears the pending wake up, later writes send a new one
+static int lchannel_rearm(lua_State* L)
+{
+    channel_box* box = check_channel(L);
+    box->ch->notified.store(false, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return 0;
+}
+
+static int lchannel_notify(lua_State* L)
+{
+    channel_box* box = check_channel(L);
+    lua_service* S = (lua_service*)get_ptr(L, LMOON_GLOBAL);
+    S->get_server()->notify_channel(*box->ch);
+    return 0;
+}
+
+static int lchannel_close(lua_State* L)
+{
+    channel_box* box = check_channel(L);
+    lua_service* S = (lua_service*)get_ptr(L, LMOON_GLOBAL);
+    S->get_server()->close_channel(box->ch);
+    return 0;
+}
+
+static int lchannel_closed(lua_State* L)
+{
+    channel_box* box = check_channel(L);
+    lua_pushboolean(L, box->ch->closed.load() ? 1 : 0);
+    return 1;
+}
+
+//consumer, once the channel is closed and drained
+static int lchannel_detach(lua_State* L)
+{
+    channel_box* box = check_channel(L);
+    lua_service* S = (lua_service*)get_ptr(L, LMOON_GLOBAL);
+    S->get_server()->remove_channel(box->ch->id);
+    box->ch.reset();
+    return 0;
+}
+
+static int lchannel_id(lua_State* L)
+{
+    channel_box* box = check_channel(L);
+    lua_pushinteger(L, box->ch->id);
+    return 1;
+}
+
+//counters of the own side only, the other side's are written by another thread
+static int lchannel_stats(lua_State* L)
+{
+    channel_box* box = check_channel(L);
+    channel& ch = *box->ch;
+    lua_createtable(L, 0, 5);
+    lua_pushinteger(L, (lua_Integer)ch.ring.capacity());
+    lua_setfield(L, -2, "capacity");
+    lua_pushinteger(L, (lua_Integer)ch.ring.size());
+    lua_setfield(L, -2, "used");
+    if (box->producer)
+    {
+        lua_pushinteger(L, (lua_Integer)ch.writes);
+        lua_setfield(L, -2, "writes");
+        lua_pushinteger(L, (lua_Integer)ch.full);
+        lua_setfield(L, -2, "full");
+    }
+    else
+    {
+        lua_pushinteger(L, (lua_Integer)ch.reads);
+        lua_setfield(L, -2, "reads");
+    }
+    return 1;
+}
+
+static int lchannel_gc(lua_State* L)
+{
+    auto box = (channel_box*)lua_touserdata(L, 1);
+    if (box->producer && nullptr != box->ch)
+    {
+        lua_service* S = (lua_service*)get_ptr(L, LMOON_GLOBAL);
+        S->get_server()->close_channel(box->ch);
+    }
+    box->~channel_box();
+    return 0;
+}
+
+static int lmoon_channel(lua_State* L)
+{
+    lua_service* S = (lua_service*)get_ptr(L, LMOON_GLOBAL);
+    uint32_t consumer = (uint32_t)luaL_checkinteger(L, 1);
+    lua_Integer capacity = luaL_optinteger(L, 2, 1024 * 1024);
+    luaL_argcheck(L, capacity >= CHANNEL_MIN_CAPACITY && capacity <= CHANNEL_MAX_CAPACITY, 2, "capacity out of range [4KB, 1GB]");
+    if (consumer == 0 || consumer == S->id())
+        return luaL_error(L, "moon.channel invalid consumer");
+    channel_ptr_t ch;
+    try
+    {
+        ch = S->get_server()->new_channel(S->id(), consumer, (size_t)capacity);
+    }
+    catch (const std::bad_alloc&)
+    {
+    }
+    //raised outside the catch, longjmp must not cross it
+    if (nullptr == ch)
+        return luaL_error(L, "moon.channel no memory for %I bytes", capacity);
+    push_channel(L, std::move(ch), true);
+    return 1;
+}
+
+static int lmoon_channel_attach(lua_State* L)
+{
+    lua_service* S = (lua_service*)get_ptr(L, LMOON_GLOBAL);
+    channel_ptr_t ch = S->get_server()->get_channel((uint32_t)luaL_checkinteger(L, 1));
+    if (nullptr == ch || ch->consumer != S->id())
+    {
+        return 0;
+    }
+    push_channel(L, std::move(ch), false);
+    return 1;
+}
+
 static int message_clone(lua_State* L)
 {
     message* m = (message*)lua_touserdata(L, 1);
@@ -508,6 +854,7 @@ static int message_clone(lua_State* L)
     nm->set_sender(m->sender());
     nm->set_sessionid(m->sessionid());
     nm->set_type(m->type());
+    nm->set_deadline(m->deadline());
     lua_pushlightuserdata(L, nm);
     return 1;
 }
@@ -584,6 +931,21 @@ extern "C"
             { "now", lmoon_now},
             { "adjtime", lmoon_adjtime},
             { "callback", lmoon_callback},
+            { "defer", lmoon_defer},
+            { "trace", lmoon_trace},
+            { "trace_report", lmoon_trace_report},
+            { "profile_start", lmoon_profile_start},
+            { "profile_stop", lmoon_profile_stop},
+            { "memtrace_start", lmoon_memtrace_start},
+            { "memtrace_report", lmoon_memtrace_report},
+            { "memtrace_stop", lmoon_memtrace_stop},
+            { "gcstat", lmoon_gcstat},
+            { "channel", lmoon_channel},
+            { "channel_attach", lmoon_channel_attach},
+            { "make_session", lmoon_make_session},
+            { "take_session", lmoon_take_session},
+            { "cancel_session", lmoon_cancel_session},
+            { "sessions", lmoon_sessions},
             { "decode", message_decode},
             { "clone", message_clone },
             { "release", message_release },
@@ -592,6 +954,27 @@ extern "C"
             {NULL,NULL}
         };
 
+        if (luaL_newmetatable(L, CHANNEL_METANAME))
+        {
+            luaL_Reg m[] = {
+                { "write", lchannel_write },
+                { "read", lchannel_read },
+                { "rearm", lchannel_rearm },
+                { "notify", lchannel_notify },
+                { "close", lchannel_close },
+                { "closed", lchannel_closed },
+                { "detach", lchannel_detach },
+                { "id", lchannel_id },
+                { "stats", lchannel_stats },
+                { NULL, NULL }
+            };
+            luaL_newlib(L, m);
+            lua_setfield(L, -2, "__index");
+            lua_pushcfunction(L, lchannel_gc);
+            lua_setfield(L, -2, "__gc");
+        }
+        lua_pop(L, 1);
+
         lua_createtable(L, 0, sizeof(l) / sizeof(l[0])  - 1);
         lua_service* S = (lua_service*)get_ptr(L, LMOON_GLOBAL);
         lua_pushstring(L, "id");
@@ -758,6 +1141,17 @@ static int lasio_set_send_queue_limit(lua_State* L)
     return 1;
 }
 
+static int lasio_set_http_head_limit(lua_State* L)
+{
+    lua_service* S = (lua_service*)get_ptr(L, LMOON_GLOBAL);
+    auto& sock = S->get_worker()->socket();
+    uint32_t fd = (uint32_t)luaL_checkinteger(L, 1);
+    size_t limit = (size_t)luaL_checkinteger(L, 2);
+    bool ok = sock.set_http_head_limit(fd, limit);
+    lua_pushboolean(L, ok ? 1 : 0);
+    return 1;
+}
+
 static int lasio_address(lua_State* L)
 {
     lua_service* S = (lua_service*)get_ptr(L, LMOON_GLOBAL);
@@ -786,6 +1180,7 @@ extern "C"
             { "setnodelay", lasio_setnodelay},
             { "set_enable_chunked", lasio_set_enable_chunked},
             { "set_send_queue_limit", lasio_set_send_queue_limit},
+            { "set_http_head_limit", lasio_set_http_head_limit},
             { "getaddress", lasio_address},
             {NULL,NULL}
         };
@@ -0,0 +1,947 @@
+#include "lua.hpp"
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Decode MySQL responses framed by mysql_connection.
+// Rows are built straight from the message buffer: no intermediate
+// strings for packet headers, length-encoded integers or numeric columns.
+
+#define MAX_PACKET_SIZE 0xFFFFFF
+#define SERVER_MORE_RESULTS_EXISTS 8
+#define UNSIGNED_FLAG 0x20
+
+enum field_type
+{
+    TYPE_DECIMAL = 0x00,
+    TYPE_TINY = 0x01,
+    TYPE_SHORT = 0x02,
+    TYPE_LONG = 0x03,
+    TYPE_FLOAT = 0x04,
+    TYPE_DOUBLE = 0x05,
+    TYPE_NULL = 0x06,
+    TYPE_TIMESTAMP = 0x07,
+    TYPE_LONGLONG = 0x08,
+    TYPE_INT24 = 0x09,
+    TYPE_DATE = 0x0a,
+    TYPE_TIME = 0x0b,
+    TYPE_DATETIME = 0x0c,
+    TYPE_YEAR = 0x0d,
+    TYPE_NEWDECIMAL = 0xf6,
+};
+
+struct column
+{
+    uint8_t type;
+    bool is_signed;
+};
+
+struct packet_reader
+{
+    const uint8_t* p;
+    const uint8_t* end;
+    std::string scratch;
+};
+
+struct packet
+{
+    const uint8_t* p;
+    const uint8_t* end;
+    uint8_t seq;
+
+    size_t size() const { return static_cast<size_t>(end - p); }
+};
+
+static void bad_packet(lua_State* L, const char* what)
+{
+    luaL_error(L, "mysql.core: malformed packet, %s", what);
+}
+
+//next logical packet, fragments of a packet larger than 16MB are joined
+static bool next_packet(lua_State* L, packet_reader* r, packet* pk)
+{
+    if (r->p >= r->end)
+    {
+        return false;
+    }
+    bool joined = false;
+    while (true)
+    {
+        if (r->end - r->p < 4)
+        {
+            bad_packet(L, "truncated header");
+        }
+        size_t len = static_cast<size_t>(r->p[0]) | (static_cast<size_t>(r->p[1]) << 8) | (static_cast<size_t>(r->p[2]) << 16);
+        uint8_t seq = r->p[3];
+        const uint8_t* payload = r->p + 4;
+        if (static_cast<size_t>(r->end - payload) < len)
+        {
+            bad_packet(L, "truncated payload");
+        }
+        r->p = payload + len;
+        if (!joined && len < MAX_PACKET_SIZE)
+        {
+            pk->p = payload;
+            pk->end = payload + len;
+            pk->seq = seq;
+            return true;
+        }
+        if (!joined)
+        {
+            r->scratch.clear();
+            joined = true;
+        }
+        r->scratch.append(reinterpret_cast<const char*>(payload), len);
+        pk->seq = seq;
+        if (len < MAX_PACKET_SIZE)
+        {
+            pk->p = reinterpret_cast<const uint8_t*>(r->scratch.data());
+            pk->end = pk->p + r->scratch.size();
+            return true;
+        }
+    }
+}
+
+static void need_packet(lua_State* L, packet_reader* r, packet* pk)
+{
+    if (!next_packet(L, r, pk))
+    {
+        bad_packet(L, "unexpected end");
+    }
+}
+
+static uint64_t read_fixed(lua_State* L, const uint8_t*& p, const uint8_t* end, size_t n)
+{
+    if (static_cast<size_t>(end - p) < n)
+    {
+        bad_packet(L, "truncated integer");
+    }
+    uint64_t v = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        v |= static_cast<uint64_t>(p[i]) << (8 * i);
+    }
+    p += n;
+    return v;
+}
+
+//length-encoded integer, returns false for NULL(0xFB)
+static bool read_lenenc(lua_State* L, const uint8_t*& p, const uint8_t* end, uint64_t& v)
+{
+    if (p >= end)
+    {
+        bad_packet(L, "truncated integer");
+    }
+    uint8_t c = *p++;
+    switch (c)
+    {
+    case 0xFB: return false;
+    case 0xFC: v = read_fixed(L, p, end, 2); return true;
+    case 0xFD: v = read_fixed(L, p, end, 3); return true;
+    case 0xFE: v = read_fixed(L, p, end, 8); return true;
+    case 0xFF: bad_packet(L, "bad length"); return false;
+    default: v = c; return true;
+    }
+}
+
+static bool read_lenenc_str(lua_State* L, const uint8_t*& p, const uint8_t* end, std::string_view& s)
+{
+    uint64_t len = 0;
+    if (!read_lenenc(L, p, end, len))
+    {
+        return false;
+    }
+    if (static_cast<uint64_t>(end - p) < len)
+    {
+        bad_packet(L, "truncated string");
+    }
+    s = std::string_view{ reinterpret_cast<const char*>(p), static_cast<size_t>(len) };
+    p += len;
+    return true;
+}
+
+static bool is_eof(const packet& pk)
+{
+    return pk.size() > 0 && pk.size() < 9 && pk.p[0] == 0xFE;
+}
+
+static bool is_err(const packet& pk)
+{
+    return pk.size() > 0 && pk.p[0] == 0xFF;
+}
+
+//ERR packet -> err, errno, sqlstate
+static void push_err(lua_State* L, const packet& pk)
+{
+    const uint8_t* p = pk.p + 1;
+    uint64_t errcode = read_fixed(L, p, pk.end, 2);
+    if (p < pk.end && *p == '#' && pk.end - p >= 6)
+    {
+        std::string_view state{ reinterpret_cast<const char*>(p + 1), 5 };
+        p += 6;
+        lua_pushlstring(L, reinterpret_cast<const char*>(p), pk.end - p);
+        lua_pushinteger(L, static_cast<lua_Integer>(errcode));
+        lua_pushlstring(L, state.data(), state.size());
+    }
+    else
+    {
+        lua_pushlstring(L, reinterpret_cast<const char*>(p), pk.end - p);
+        lua_pushinteger(L, static_cast<lua_Integer>(errcode));
+        lua_pushnil(L);
+    }
+}
+
+//OK packet -> {affected_rows, insert_id, server_status, warning_count, message}, returns server_status
+static uint16_t push_ok(lua_State* L, const packet& pk)
+{
+    const uint8_t* p = pk.p + 1;
+    uint64_t affected_rows = 0;
+    uint64_t insert_id = 0;
+    read_lenenc(L, p, pk.end, affected_rows);
+    read_lenenc(L, p, pk.end, insert_id);
+    uint16_t status = static_cast<uint16_t>(read_fixed(L, p, pk.end, 2));
+    uint16_t warning_count = static_cast<uint16_t>(read_fixed(L, p, pk.end, 2));
+
+    lua_createtable(L, 0, 5);
+    lua_pushinteger(L, static_cast<lua_Integer>(affected_rows));
+    lua_setfield(L, -2, "affected_rows");
+    lua_pushinteger(L, static_cast<lua_Integer>(insert_id));
+    lua_setfield(L, -2, "insert_id");
+    lua_pushinteger(L, status);
+    lua_setfield(L, -2, "server_status");
+    lua_pushinteger(L, warning_count);
+    lua_setfield(L, -2, "warning_count");
+    if (p < pk.end)
+    {
+        lua_pushlstring(L, reinterpret_cast<const char*>(p), pk.end - p);
+        lua_setfield(L, -2, "message");
+    }
+    return status;
+}
+
+//column definition, name is pushed when push_name
+static column read_column(lua_State* L, const packet& pk, bool push_name)
+{
+    const uint8_t* p = pk.p;
+    std::string_view s;
+    for (int i = 0; i < 4; ++i)
+    {
+        //catalog, schema, table, org_table
+        read_lenenc_str(L, p, pk.end, s);
+    }
+    std::string_view name;
+    read_lenenc_str(L, p, pk.end, name);
+    read_lenenc_str(L, p, pk.end, s);//org_name
+    uint64_t fixed_len = 0;
+    read_lenenc(L, p, pk.end, fixed_len);
+    if (fixed_len < 10 || static_cast<uint64_t>(pk.end - p) < fixed_len)
+    {
+        bad_packet(L, "column definition");
+    }
+    //charset(2), column_length(4), type(1), flags(2), decimals(1)
+    column c;
+    c.type = p[6];
+    uint16_t flags = static_cast<uint16_t>(p[7] | (p[8] << 8));
+    c.is_signed = (flags & UNSIGNED_FLAG) == 0;
+    if (push_name)
+    {
+        lua_pushlstring(L, name.data(), name.size());
+    }
+    return c;
+}
+
+//column definition -> {name, type, is_signed}
+static void push_column(lua_State* L, const packet& pk)
+{
+    lua_createtable(L, 0, 3);
+    column c = read_column(L, pk, true);
+    lua_setfield(L, -2, "name");
+    lua_pushinteger(L, c.type);
+    lua_setfield(L, -2, "type");
+    if (c.is_signed)
+    {
+        lua_pushboolean(L, 1);
+        lua_setfield(L, -2, "is_signed");
+    }
+}
+
+static bool is_integer_type(uint8_t type)
+{
+    switch (type)
+    {
+    case TYPE_TINY:
+    case TYPE_SHORT:
+    case TYPE_LONG:
+    case TYPE_LONGLONG:
+    case TYPE_INT24:
+    case TYPE_YEAR:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool is_number_type(uint8_t type)
+{
+    return is_integer_type(type) || type == TYPE_FLOAT || type == TYPE_DOUBLE || type == TYPE_NEWDECIMAL || type == TYPE_DECIMAL;
+}
+
+static void push_text_number(lua_State* L, std::string_view s, bool integer)
+{
+    if (integer && !s.empty() && s.size() <= 18)
+    {
+        size_t i = 0;
+        bool negative = false;
+        if (s[0] == '-')
+        {
+            negative = true;
+            i = 1;
+        }
+        int64_t v = 0;
+        bool ok = (i < s.size());
+        for (; ok && i < s.size(); ++i)
+        {
+            char c = s[i];
+            if (c < '0' || c > '9')
+            {
+                ok = false;
+                break;
+            }
+            v = v * 10 + (c - '0');
+        }
+        if (ok)
+        {
+            lua_pushinteger(L, negative ? -v : v);
+            return;
+        }
+    }
+
+    char buf[128];
+    if (s.size() < sizeof(buf))
+    {
+        memcpy(buf, s.data(), s.size());
+        buf[s.size()] = '\0';
+        if (lua_stringtonumber(L, buf) != 0)
+        {
+            return;
+        }
+    }
+    lua_pushlstring(L, s.data(), s.size());
+}
+
+static void push_text_row(lua_State* L, const packet& pk, const std::vector<column>& cols, bool compact, int names)
+{
+    int ncols = static_cast<int>(cols.size());
+    if (compact)
+    {
+        lua_createtable(L, ncols, 0);
+    }
+    else
+    {
+        lua_createtable(L, 0, ncols);
+    }
+
+    const uint8_t* p = pk.p;
+    std::string_view value;
+    for (int i = 0; i < ncols; ++i)
+    {
+        if (!read_lenenc_str(L, p, pk.end, value))
+        {
+            continue;
+        }
+        const column& c = cols[i];
+        if (is_number_type(c.type))
+        {
+            push_text_number(L, value, is_integer_type(c.type));
+        }
+        else
+        {
+            lua_pushlstring(L, value.data(), value.size());
+        }
+
+        if (compact)
+        {
+            lua_rawseti(L, -2, i + 1);
+        }
+        else
+        {
+            lua_rawgeti(L, names, i + 1);
+            lua_insert(L, -2);
+            lua_rawset(L, -3);
+        }
+    }
+}
+
+static void push_datetime(lua_State* L, const uint8_t*& p, const uint8_t* end, uint8_t type)
+{
+    uint64_t len = 0;
+    read_lenenc(L, p, end, len);
+    if (static_cast<uint64_t>(end - p) < len)
+    {
+        bad_packet(L, "truncated datetime");
+    }
+    unsigned year = 0, month = 0, day = 0, hour = 0, minute = 0, second = 0;
+    unsigned long micro = 0;
+    if (len >= 4)
+    {
+        year = static_cast<unsigned>(p[0] | (p[1] << 8));
+        month = p[2];
+        day = p[3];
+    }
+    if (len >= 7)
+    {
+        hour = p[4];
+        minute = p[5];
+        second = p[6];
+    }
+    if (len >= 11)
+    {
+        micro = static_cast<unsigned long>(p[7]) | (static_cast<unsigned long>(p[8]) << 8) | (static_cast<unsigned long>(p[9]) << 16) | (static_cast<unsigned long>(p[10]) << 24);
+    }
+    p += len;
+
+    char buf[64];
+    int n = 0;
+    if (type == TYPE_DATE)
+    {
+        n = snprintf(buf, sizeof(buf), "%04u-%02u-%02u", year, month, day);
+    }
+    else if (micro > 0)
+    {
+        n = snprintf(buf, sizeof(buf), "%04u-%02u-%02u %02u:%02u:%02u.%06lu", year, month, day, hour, minute, second, micro);
+    }
+    else
+    {
+        n = snprintf(buf, sizeof(buf), "%04u-%02u-%02u %02u:%02u:%02u", year, month, day, hour, minute, second);
+    }
+    lua_pushlstring(L, buf, static_cast<size_t>(n));
+}
+
+static void push_time(lua_State* L, const uint8_t*& p, const uint8_t* end)
+{
+    uint64_t len = 0;
+    read_lenenc(L, p, end, len);
+    if (static_cast<uint64_t>(end - p) < len)
+    {
+        bad_packet(L, "truncated time");
+    }
+    bool negative = false;
+    unsigned long days = 0, micro = 0;
+    unsigned hour = 0, minute = 0, second = 0;
+    if (len >= 8)
+    {
+        negative = p[0] != 0;
+        days = static_cast<unsigned long>(p[1]) | (static_cast<unsigned long>(p[2]) << 8) | (static_cast<unsigned long>(p[3]) << 16) | (static_cast<unsigned long>(p[4]) << 24);
+        hour = p[5];
+        minute = p[6];
+        second = p[7];
+    }
+    if (len >= 12)
+    {
+        micro = static_cast<unsigned long>(p[8]) | (static_cast<unsigned long>(p[9]) << 8) | (static_cast<unsigned long>(p[10]) << 16) | (static_cast<unsigned long>(p[11]) << 24);
+    }
+    p += len;
+
+    char buf[64];
+    unsigned long hours = days * 24 + hour;
+    int n = 0;
+    if (micro > 0)
+    {
+        n = snprintf(buf, sizeof(buf), "%s%02lu:%02u:%02u.%06lu", negative ? "-" : "", hours, minute, second, micro);
+    }
+    else
+    {
+        n = snprintf(buf, sizeof(buf), "%s%02lu:%02u:%02u", negative ? "-" : "", hours, minute, second);
+    }
+    lua_pushlstring(L, buf, static_cast<size_t>(n));
+}
+
+template<typename T>
+static T read_value(lua_State* L, const uint8_t*& p, const uint8_t* end)
+{
+    if (static_cast<size_t>(end - p) < sizeof(T))
+    {
+        bad_packet(L, "truncated value");
+    }
+    T v;
+    memcpy(&v, p, sizeof(T));
+    p += sizeof(T);
+    return v;
+}
+
+static void push_binary_value(lua_State* L, const uint8_t*& p, const uint8_t* end, const column& c)
+{
+    switch (c.type)
+    {
+    case TYPE_TINY:
+        if (c.is_signed)
+            lua_pushinteger(L, read_value<int8_t>(L, p, end));
+        else
+            lua_pushinteger(L, read_value<uint8_t>(L, p, end));
+        break;
+    case TYPE_SHORT:
+    case TYPE_YEAR:
+        if (c.is_signed && c.type == TYPE_SHORT)
+            lua_pushinteger(L, read_value<int16_t>(L, p, end));
+        else
+            lua_pushinteger(L, read_value<uint16_t>(L, p, end));
+        break;
+    case TYPE_LONG:
+    case TYPE_INT24:
+        if (c.is_signed)
+            lua_pushinteger(L, read_value<int32_t>(L, p, end));
+        else
+            lua_pushinteger(L, read_value<uint32_t>(L, p, end));
+        break;
+    case TYPE_LONGLONG:
+        lua_pushinteger(L, static_cast<lua_Integer>(read_value<int64_t>(L, p, end)));
+        break;
+    case TYPE_FLOAT:
+        lua_pushnumber(L, read_value<float>(L, p, end));
+        break;
+    case TYPE_DOUBLE:
+        lua_pushnumber(L, read_value<double>(L, p, end));
+        break;
+    case TYPE_DATE:
+    case TYPE_DATETIME:
+    case TYPE_TIMESTAMP:
+        push_datetime(L, p, end, c.type);
+        break;
+    case TYPE_TIME:
+        push_time(L, p, end);
+        break;
+    case TYPE_NULL:
+        lua_pushnil(L);
+        break;
+    default:
+    {
+        //decimal, strings, blobs, json, enum, set, bit, geometry
+        std::string_view s;
+        if (!read_lenenc_str(L, p, end, s))
+        {
+            lua_pushnil(L);
+        }
+        else if (c.type == TYPE_NEWDECIMAL || c.type == TYPE_DECIMAL)
+        {
+            push_text_number(L, s, false);
+        }
+        else
+        {
+            lua_pushlstring(L, s.data(), s.size());
+        }
+        break;
+    }
+    }
+}
+
+static void push_binary_row(lua_State* L, const packet& pk, const std::vector<column>& cols, bool compact, int names)
+{
+    int ncols = static_cast<int>(cols.size());
+    if (compact)
+    {
+        lua_createtable(L, ncols, 0);
+    }
+    else
+    {
+        lua_createtable(L, 0, ncols);
+    }
+
+    //0x00 header, then NULL bitmap with a 2 bits offset
+    size_t bitmap_size = (cols.size() + 7 + 2) / 8;
+    if (pk.size() < 1 + bitmap_size)
+    {
+        bad_packet(L, "binary row");
+    }
+    const uint8_t* bitmap = pk.p + 1;
+    const uint8_t* p = bitmap + bitmap_size;
+    for (int i = 0; i < ncols; ++i)
+    {
+        size_t bit = static_cast<size_t>(i) + 2;
+        if (bitmap[bit / 8] & (1 << (bit % 8)))
+        {
+            continue;
+        }
+        push_binary_value(L, p, pk.end, cols[i]);
+        if (lua_isnil(L, -1))
+        {
+            lua_pop(L, 1);
+            continue;
+        }
+        if (compact)
+        {
+            lua_rawseti(L, -2, i + 1);
+        }
+        else
+        {
+            lua_rawgeti(L, names, i + 1);
+            lua_insert(L, -2);
+            lua_rawset(L, -3);
+        }
+    }
+}
+
+static int count_rows(lua_State* L, packet_reader r)
+{
+    int n = 0;
+    packet pk;
+    while (next_packet(L, &r, &pk))
+    {
+        if (is_eof(pk) || is_err(pk))
+        {
+            break;
+        }
+        ++n;
+    }
+    return n;
+}
+
+static std::string_view get_data(lua_State* L, int index)
+{
+    size_t len = 0;
+    const char* data = nullptr;
+    if (lua_type(L, index) == LUA_TSTRING)
+    {
+        data = lua_tolstring(L, index, &len);
+    }
+    else
+    {
+        data = (const char*)lua_touserdata(L, index);
+        len = (size_t)luaL_checkinteger(L, index + 1);
+    }
+    if (nullptr == data)
+    {
+        luaL_error(L, "mysql.core: no data");
+    }
+    return std::string_view{ data, len };
+}
+
+// packet(sz, len | str) -> payload, seq
+static int lpacket(lua_State* L)
+{
+    std::string_view data = get_data(L, 1);
+    packet_reader r{ reinterpret_cast<const uint8_t*>(data.data()), reinterpret_cast<const uint8_t*>(data.data() + data.size()), {} };
+    packet pk;
+    need_packet(L, &r, &pk);
+    lua_pushlstring(L, reinterpret_cast<const char*>(pk.p), pk.size());
+    lua_pushinteger(L, pk.seq);
+    return 2;
+}
+
+// result(sz, len | str, compact, binary) -> results, [err, errno, sqlstate]
+// results is an array, one element per result set: rows array or OK table.
+// err is set when an ERR packet ends the response.
+static int lresult(lua_State* L)
+{
+    std::string_view data = get_data(L, 1);
+    int opt = (lua_type(L, 1) == LUA_TSTRING) ? 2 : 3;
+    bool compact = lua_toboolean(L, opt);
+    bool binary = lua_toboolean(L, opt + 1);
+
+    packet_reader r{ reinterpret_cast<const uint8_t*>(data.data()), reinterpret_cast<const uint8_t*>(data.data() + data.size()), {} };
+
+    lua_settop(L, opt + 1);
+    lua_newtable(L);
+    int results = lua_gettop(L);
+    lua_Integer nresult = 0;
+
+    std::vector<column> cols;
+    packet pk;
+    while (next_packet(L, &r, &pk))
+    {
+        if (pk.size() == 0)
+        {
+            bad_packet(L, "empty packet");
+        }
+
+        uint8_t first = pk.p[0];
+        if (first == 0x00)
+        {
+            push_ok(L, pk);
+            lua_rawseti(L, results, ++nresult);
+            continue;
+        }
+
+        if (first == 0xFF)
+        {
+            push_err(L, pk);
+            return 4;
+        }
+
+        if (first == 0xFB)
+        {
+            lua_pushliteral(L, "LOCAL INFILE request not supported");
+            lua_pushnil(L);
+            lua_pushnil(L);
+            return 4;
+        }
+
+        const uint8_t* p = pk.p;
+        uint64_t ncols = 0;
+        read_lenenc(L, p, pk.end, ncols);
+
+        cols.clear();
+        cols.reserve(static_cast<size_t>(ncols));
+        luaL_checkstack(L, 4, nullptr);
+        lua_createtable(L, static_cast<int>(ncols), 0);
+        int names = lua_gettop(L);
+        for (uint64_t i = 0; i < ncols; ++i)
+        {
+            need_packet(L, &r, &pk);
+            cols.push_back(read_column(L, pk, true));
+            lua_rawseti(L, names, static_cast<lua_Integer>(i + 1));
+        }
+
+        need_packet(L, &r, &pk);
+        if (!is_eof(pk))
+        {
+            bad_packet(L, "column definitions not terminated");
+        }
+
+        lua_createtable(L, count_rows(L, r), 0);
+        lua_Integer nrow = 0;
+        bool more = false;
+        while (true)
+        {
+            need_packet(L, &r, &pk);
+            if (is_eof(pk))
+            {
+                const uint8_t* q = pk.p + 3;
+                uint16_t status = static_cast<uint16_t>(read_fixed(L, q, pk.end, 2));
+                more = (status & SERVER_MORE_RESULTS_EXISTS) != 0;
+                break;
+            }
+            if (is_err(pk))
+            {
+                //error while sending rows, the rows so far are dropped
+                lua_pop(L, 2);
+                push_err(L, pk);
+                return 4;
+            }
+            if (binary)
+            {
+                push_binary_row(L, pk, cols, compact, names);
+            }
+            else
+            {
+                push_text_row(L, pk, cols, compact, names);
+            }
+            lua_rawseti(L, -2, ++nrow);
+        }
+        lua_rawseti(L, results, ++nresult);
+        lua_pop(L, 1);//names
+        if (!more)
+        {
+            break;
+        }
+    }
+    lua_settop(L, results);
+    return 1;
+}
+
+// prepare(sz, len | str) -> {prepare_id, field_count, param_count, warning_count, params, fields}
+// or nil, err, errno, sqlstate
+static int lprepare(lua_State* L)
+{
+    std::string_view data = get_data(L, 1);
+    packet_reader r{ reinterpret_cast<const uint8_t*>(data.data()), reinterpret_cast<const uint8_t*>(data.data() + data.size()), {} };
+    packet pk;
+    need_packet(L, &r, &pk);
+    if (is_err(pk))
+    {
+        lua_pushnil(L);
+        push_err(L, pk);
+        return 4;
+    }
+    if (pk.size() < 12 || pk.p[0] != 0x00)
+    {
+        bad_packet(L, "prepare response");
+    }
+    const uint8_t* p = pk.p + 1;
+    uint32_t prepare_id = static_cast<uint32_t>(read_fixed(L, p, pk.end, 4));
+    uint16_t field_count = static_cast<uint16_t>(read_fixed(L, p, pk.end, 2));
+    uint16_t param_count = static_cast<uint16_t>(read_fixed(L, p, pk.end, 2));
+    ++p;//filler
+    uint16_t warning_count = static_cast<uint16_t>(read_fixed(L, p, pk.end, 2));
+
+    lua_createtable(L, 0, 6);
+    lua_pushinteger(L, prepare_id);
+    lua_setfield(L, -2, "prepare_id");
+    lua_pushinteger(L, field_count);
+    lua_setfield(L, -2, "field_count");
+    lua_pushinteger(L, param_count);
+    lua_setfield(L, -2, "param_count");
+    lua_pushinteger(L, warning_count);
+    lua_setfield(L, -2, "warning_count");
+
+    const char* names[2] = { "params", "fields" };
+    uint16_t counts[2] = { param_count, field_count };
+    for (int k = 0; k < 2; ++k)
+    {
+        lua_createtable(L, counts[k], 0);
+        for (uint16_t i = 0; i < counts[k]; ++i)
+        {
+            need_packet(L, &r, &pk);
+            push_column(L, pk);
+            lua_rawseti(L, -2, i + 1);
+        }
+        if (counts[k] > 0)
+        {
+            need_packet(L, &r, &pk);
+            if (!is_eof(pk))
+            {
+                bad_packet(L, "definitions not terminated");
+            }
+        }
+        lua_setfield(L, -2, names[k]);
+    }
+    return 1;
+}
+
+static void append_fixed(std::string& out, uint64_t v, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        out.push_back(static_cast<char>((v >> (8 * i)) & 0xFF));
+    }
+}
+
+static void append_lenenc(std::string& out, uint64_t n)
+{
+    if (n < 251)
+    {
+        out.push_back(static_cast<char>(n));
+    }
+    else if (n < (1 << 16))
+    {
+        out.push_back(static_cast<char>(0xFC));
+        append_fixed(out, n, 2);
+    }
+    else if (n < (1 << 24))
+    {
+        out.push_back(static_cast<char>(0xFD));
+        append_fixed(out, n, 3);
+    }
+    else
+    {
+        out.push_back(static_cast<char>(0xFE));
+        append_fixed(out, n, 8);
+    }
+}
+
+// execute(prepare_id, bound_types, v1, v2, ...) -> packet, types
+// COM_STMT_EXECUTE packet with binary parameters: integer as LONGLONG, float as DOUBLE,
+// string as VAR_STRING, boolean as TINY, nil as NULL. The parameter types are only
+// sent when they differ from bound_types, the types returned by the previous call.
+static int lexecute(lua_State* L)
+{
+    uint32_t prepare_id = static_cast<uint32_t>(luaL_checkinteger(L, 1));
+    size_t bound_len = 0;
+    const char* bound = lua_tolstring(L, 2, &bound_len);
+    int nparams = lua_gettop(L) - 2;
+
+    std::string types;
+    types.reserve(static_cast<size_t>(nparams) * 2);
+    std::string values;
+    std::string nulls((static_cast<size_t>(nparams) + 7) / 8, '\0');
+    for (int i = 0; i < nparams; ++i)
+    {
+        int index = i + 3;
+        switch (lua_type(L, index))
+        {
+        case LUA_TNIL:
+            nulls[i / 8] = static_cast<char>(nulls[i / 8] | (1 << (i % 8)));
+            types.push_back(static_cast<char>(TYPE_NULL));
+            types.push_back('\0');
+            break;
+        case LUA_TBOOLEAN:
+            types.push_back(static_cast<char>(TYPE_TINY));
+            types.push_back('\0');
+            values.push_back(lua_toboolean(L, index) ? 1 : 0);
+            break;
+        case LUA_TNUMBER:
+            if (lua_isinteger(L, index))
+            {
+                int64_t v = lua_tointeger(L, index);
+                types.push_back(static_cast<char>(TYPE_LONGLONG));
+                types.push_back('\0');
+                append_fixed(values, static_cast<uint64_t>(v), 8);
+            }
+            else
+            {
+                double v = lua_tonumber(L, index);
+                uint64_t bits = 0;
+                memcpy(&bits, &v, sizeof(v));
+                types.push_back(static_cast<char>(TYPE_DOUBLE));
+                types.push_back('\0');
+                append_fixed(values, bits, 8);
+            }
+            break;
+        case LUA_TSTRING:
+        {
+            size_t len = 0;
+            const char* str = lua_tolstring(L, index, &len);
+            types.push_back(static_cast<char>(0xfd));
+            types.push_back('\0');
+            append_lenenc(values, len);
+            values.append(str, len);
+            break;
+        }
+        default:
+            return luaL_error(L, "mysql.core: invalid parameter #%d type %s", i + 1, luaL_typename(L, index));
+        }
+    }
+
+    bool rebind = (nullptr == bound || std::string_view{ bound, bound_len } != types);
+
+    std::string out;
+    out.reserve(4 + 10 + nulls.size() + 1 + (rebind ? types.size() : 0) + values.size());
+    out.append(4, '\0');
+    out.push_back(0x17);//COM_STMT_EXECUTE
+    append_fixed(out, prepare_id, 4);
+    out.push_back(0x00);//CURSOR_TYPE_NO_CURSOR
+    append_fixed(out, 1, 4);//iteration count
+    if (nparams > 0)
+    {
+        out.append(nulls);
+        out.push_back(rebind ? 1 : 0);
+        if (rebind)
+        {
+            out.append(types);
+        }
+        out.append(values);
+    }
+
+    size_t payload = out.size() - 4;
+    if (payload >= MAX_PACKET_SIZE)
+    {
+        return luaL_error(L, "mysql.core: execute packet too large");
+    }
+    //sequence id 0
+    out[0] = static_cast<char>(payload & 0xFF);
+    out[1] = static_cast<char>((payload >> 8) & 0xFF);
+    out[2] = static_cast<char>((payload >> 16) & 0xFF);
+
+    lua_pushlstring(L, out.data(), out.size());
+    lua_pushlstring(L, types.data(), types.size());
+    return 2;
+}
+
+extern "C"
+{
+    int LUAMOD_API luaopen_mysql_core(lua_State* L)
+    {
+        luaL_Reg l[] = {
+            { "packet", lpacket },
+            { "result", lresult },
+            { "prepare", lprepare },
+            { "execute", lexecute },
+            { NULL, NULL }
+        };
+        luaL_checkversion(L);
+        luaL_newlib(L, l);
+        return 1;
+    }
+}
@@ -0,0 +1,780 @@
+#include "lua.hpp"
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Decode PostgreSQL backend messages framed by pg_connection, and build the
+// extended query / COPY frontend messages. Rows are built straight from the
+// message buffer, numeric columns are converted without intermediate strings.
+
+#define PG_TYPE_BOOL 16
+#define PG_TYPE_INT8 20
+#define PG_TYPE_INT2 21
+#define PG_TYPE_INT4 23
+#define PG_TYPE_FLOAT4 700
+#define PG_TYPE_FLOAT8 701
+#define PG_TYPE_NUMERIC 1700
+
+struct field
+{
+    uint32_t type;
+    uint16_t format;
+};
+
+struct pg_message
+{
+    uint8_t type;
+    const uint8_t* p;
+    const uint8_t* end;
+
+    size_t size() const { return static_cast<size_t>(end - p); }
+};
+
+struct message_reader
+{
+    const uint8_t* p;
+    const uint8_t* end;
+};
+
+static void bad_message(lua_State* L, const char* what)
+{
+    luaL_error(L, "pg.core: malformed message, %s", what);
+}
+
+static uint32_t read_u32(const uint8_t* p)
+{
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) | (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+static uint16_t read_u16(const uint8_t* p)
+{
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+static bool next_message(lua_State* L, message_reader* r, pg_message* m)
+{
+    if (r->p >= r->end)
+    {
+        return false;
+    }
+    if (r->end - r->p < 5)
+    {
+        bad_message(L, "truncated header");
+    }
+    uint32_t len = read_u32(r->p + 1);
+    if (len < 4 || static_cast<size_t>(r->end - r->p - 1) < len)
+    {
+        bad_message(L, "truncated body");
+    }
+    m->type = r->p[0];
+    m->p = r->p + 5;
+    m->end = r->p + 1 + len;
+    r->p = m->end;
+    return true;
+}
+
+static std::string_view read_cstring(lua_State* L, const uint8_t*& p, const uint8_t* end)
+{
+    const uint8_t* s = static_cast<const uint8_t*>(memchr(p, 0, static_cast<size_t>(end - p)));
+    if (nullptr == s)
+    {
+        bad_message(L, "unterminated string");
+    }
+    std::string_view v{ reinterpret_cast<const char*>(p), static_cast<size_t>(s - p) };
+    p = s + 1;
+    return v;
+}
+
+//messages of one type following the current position, used to pre-size row tables
+static int count_messages(message_reader r, uint8_t type)
+{
+    int n = 0;
+    while (r.end - r.p >= 5 && r.p[0] == type)
+    {
+        uint32_t len = read_u32(r.p + 1);
+        if (len < 4 || static_cast<size_t>(r.end - r.p - 1) < len)
+        {
+            break;
+        }
+        r.p += 1 + len;
+        ++n;
+    }
+    return n;
+}
+
+static bool push_integer(lua_State* L, const char* s, size_t len)
+{
+    if (len == 0 || len > 20)
+    {
+        return false;
+    }
+    size_t i = 0;
+    bool neg = false;
+    if (s[0] == '-' || s[0] == '+')
+    {
+        neg = (s[0] == '-');
+        if (++i == len)
+        {
+            return false;
+        }
+    }
+    uint64_t v = 0;
+    for (; i < len; ++i)
+    {
+        unsigned d = static_cast<unsigned>(s[i] - '0');
+        if (d > 9)
+        {
+            return false;
+        }
+        v = v * 10 + d;
+    }
+    if (v > static_cast<uint64_t>(INT64_MAX))
+    {
+        return false;
+    }
+    int64_t n = static_cast<int64_t>(v);
+    lua_pushinteger(L, neg ? -n : n);
+    return true;
+}
+
+static bool push_number(lua_State* L, const char* s, size_t len)
+{
+    char tmp[64];
+    if (len == 0 || len >= sizeof(tmp))
+    {
+        return false;
+    }
+    memcpy(tmp, s, len);
+    tmp[len] = '\0';
+    return lua_stringtonumber(L, tmp) != 0;
+}
+
+//text format column value, same conversions moon.db.pg applied in Lua
+static void push_value(lua_State* L, const field& f, const char* s, size_t len)
+{
+    if (f.format == 0)
+    {
+        switch (f.type)
+        {
+        case PG_TYPE_BOOL:
+            lua_pushboolean(L, len == 1 && s[0] == 't');
+            return;
+        case PG_TYPE_INT2:
+        case PG_TYPE_INT4:
+        case PG_TYPE_INT8:
+            if (push_integer(L, s, len))
+            {
+                return;
+            }
+            break;
+        case PG_TYPE_FLOAT4:
+        case PG_TYPE_FLOAT8:
+        case PG_TYPE_NUMERIC:
+            if (push_number(L, s, len))
+            {
+                return;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    lua_pushlstring(L, s, len);
+}
+
+// RowDescription: column names into the table at names, field info into fields
+static void parse_row_desc(lua_State* L, const pg_message& m, int names, std::vector<field>& fields)
+{
+    if (m.size() < 2)
+    {
+        bad_message(L, "row description");
+    }
+    const uint8_t* p = m.p;
+    uint16_t n = read_u16(p);
+    p += 2;
+    fields.clear();
+    fields.reserve(n);
+    lua_createtable(L, n, 0);
+    lua_replace(L, names);
+    for (uint16_t i = 0; i < n; ++i)
+    {
+        std::string_view name = read_cstring(L, p, m.end);
+        if (m.end - p < 18)
+        {
+            bad_message(L, "row description");
+        }
+        field f;
+        f.type = read_u32(p + 6);
+        f.format = read_u16(p + 16);
+        p += 18;
+        fields.emplace_back(f);
+        lua_pushlstring(L, name.data(), name.size());
+        lua_rawseti(L, names, static_cast<lua_Integer>(i) + 1);
+    }
+}
+
+// DataRow: pushes one row table
+static void parse_row(lua_State* L, const pg_message& m, int names, const std::vector<field>& fields)
+{
+    if (m.size() < 2 || read_u16(m.p) != fields.size())
+    {
+        bad_message(L, "unexpected field count in 'D' message");
+    }
+    const uint8_t* p = m.p + 2;
+    lua_createtable(L, 0, static_cast<int>(fields.size()));
+    for (size_t i = 0; i < fields.size(); ++i)
+    {
+        if (m.end - p < 4)
+        {
+            bad_message(L, "data row");
+        }
+        int32_t len = static_cast<int32_t>(read_u32(p));
+        p += 4;
+        lua_rawgeti(L, names, static_cast<lua_Integer>(i) + 1);
+        if (len < 0)
+        {
+            lua_pushlstring(L, "\0", 1);
+        }
+        else
+        {
+            if (m.end - p < len)
+            {
+                bad_message(L, "data row");
+            }
+            push_value(L, fields[i], reinterpret_cast<const char*>(p), static_cast<size_t>(len));
+            p += len;
+        }
+        lua_rawset(L, -3);
+    }
+}
+
+static const char* error_field_name(uint8_t c)
+{
+    switch (c)
+    {
+    case 'S': return "severity";
+    case 'C': return "code";
+    case 'M': return "message";
+    case 'P': return "position";
+    case 'D': return "detail";
+    case 's': return "schema";
+    case 't': return "table";
+    case 'n': return "constraint";
+    default: return nullptr;
+    }
+}
+
+// ErrorResponse: pushes {severity=, code=, message=, ...}
+static void push_error(lua_State* L, const pg_message& m)
+{
+    lua_createtable(L, 0, 4);
+    const uint8_t* p = m.p;
+    while (p < m.end && *p != 0)
+    {
+        uint8_t c = *p++;
+        std::string_view v = read_cstring(L, p, m.end);
+        const char* name = error_field_name(c);
+        if (nullptr != name && !v.empty())
+        {
+            lua_pushlstring(L, v.data(), v.size());
+            lua_setfield(L, -2, name);
+        }
+    }
+}
+
+// NotificationResponse: appends {operation=, pid=, channel=, payload=} to the table at idx
+static void push_notification(lua_State* L, const pg_message& m, int idx)
+{
+    if (m.size() < 4)
+    {
+        bad_message(L, "notification");
+    }
+    const uint8_t* p = m.p + 4;
+    std::string_view channel = read_cstring(L, p, m.end);
+    std::string_view payload = read_cstring(L, p, m.end);
+    lua_createtable(L, 0, 4);
+    lua_pushliteral(L, "notification");
+    lua_setfield(L, -2, "operation");
+    lua_pushinteger(L, static_cast<int32_t>(read_u32(m.p)));
+    lua_setfield(L, -2, "pid");
+    lua_pushlstring(L, channel.data(), channel.size());
+    lua_setfield(L, -2, "channel");
+    lua_pushlstring(L, payload.data(), payload.size());
+    lua_setfield(L, -2, "payload");
+    lua_rawseti(L, idx, static_cast<lua_Integer>(lua_rawlen(L, idx)) + 1);
+}
+
+// CommandComplete tag: "INSERT 0 5", "SELECT 3", "CREATE TABLE"
+static bool affected_rows(std::string_view tag, lua_Integer& n, bool& select)
+{
+    select = (tag.substr(0, 6) == "SELECT");
+    size_t pos = tag.find_last_of(' ');
+    if (pos == std::string_view::npos || pos + 1 == tag.size())
+    {
+        return false;
+    }
+    lua_Integer v = 0;
+    for (size_t i = pos + 1; i < tag.size(); ++i)
+    {
+        unsigned d = static_cast<unsigned>(tag[i] - '0');
+        if (d > 9)
+        {
+            return false;
+        }
+        v = v * 10 + d;
+    }
+    n = v;
+    return true;
+}
+
+static std::string_view get_data(lua_State* L, int index)
+{
+    size_t len = 0;
+    const char* data = nullptr;
+    if (lua_type(L, index) == LUA_TSTRING)
+    {
+        data = lua_tolstring(L, index, &len);
+    }
+    else
+    {
+        data = (const char*)lua_touserdata(L, index);
+        len = (size_t)luaL_checkinteger(L, index + 1);
+    }
+    if (nullptr == data)
+    {
+        luaL_error(L, "pg.core: no data");
+    }
+    return std::string_view{ data, len };
+}
+
+// message(sz, len | str) -> type, payload
+static int lmessage(lua_State* L)
+{
+    std::string_view data = get_data(L, 1);
+    message_reader r{ reinterpret_cast<const uint8_t*>(data.data()), reinterpret_cast<const uint8_t*>(data.data() + data.size()) };
+    pg_message m;
+    if (!next_message(L, &r, &m))
+    {
+        bad_message(L, "empty");
+    }
+    lua_pushlstring(L, reinterpret_cast<const char*>(&m.type), 1);
+    lua_pushlstring(L, reinterpret_cast<const char*>(m.p), m.size());
+    return 2;
+}
+
+// result(sz, len | str) -> results, err, notifications, status, parsed
+// results is an array, one element per CommandComplete: rows array,
+// {affected_rows = n} or true. err is the ErrorResponse table if any.
+// status is the ReadyForQuery transaction status, or "G" when the server
+// waits for COPY data. parsed counts ParseComplete messages.
+static int lresult(lua_State* L)
+{
+    std::string_view data = get_data(L, 1);
+    message_reader r{ reinterpret_cast<const uint8_t*>(data.data()), reinterpret_cast<const uint8_t*>(data.data() + data.size()) };
+
+    //keep the arguments on the stack, data may point into a Lua string
+    const int results = lua_gettop(L) + 1;
+    const int err = results + 1;
+    const int notifications = results + 2;
+    const int status = results + 3;
+    const int names = results + 4;
+    const int rows = results + 5;
+    luaL_checkstack(L, 16, nullptr);
+    lua_createtable(L, 4, 0);
+    lua_pushnil(L);
+    lua_pushnil(L);
+    lua_pushnil(L);
+    lua_pushnil(L); //names of current row description
+    lua_pushnil(L); //rows of current row description
+
+    std::vector<field> fields;
+    bool has_desc = false;
+    lua_Integer nresult = 0;
+    lua_Integer parsed = 0;
+    lua_Integer nrow = 0;
+
+    pg_message m;
+    while (next_message(L, &r, &m))
+    {
+        switch (m.type)
+        {
+        case 'T':
+        {
+            parse_row_desc(L, m, names, fields);
+            has_desc = true;
+            nrow = 0;
+            lua_pushnil(L);
+            lua_replace(L, rows);
+            break;
+        }
+        case 'D':
+        {
+            if (!has_desc)
+            {
+                bad_message(L, "data row without row description");
+            }
+            if (lua_isnil(L, rows))
+            {
+                lua_createtable(L, count_messages(r, 'D') + 1, 0);
+                lua_replace(L, rows);
+            }
+            parse_row(L, m, names, fields);
+            lua_rawseti(L, rows, ++nrow);
+            break;
+        }
+        case 'C':
+        {
+            const uint8_t* p = m.p;
+            std::string_view tag = read_cstring(L, p, m.end);
+            lua_Integer n = 0;
+            bool select = false;
+            bool has_count = affected_rows(tag, n, select);
+            if (has_desc)
+            {
+                if (lua_isnil(L, rows))
+                {
+                    lua_newtable(L);
+                }
+                else
+                {
+                    lua_pushvalue(L, rows);
+                    if (has_count && !select)
+                    {
+                        lua_pushinteger(L, n);
+                        lua_setfield(L, -2, "affected_rows");
+                    }
+                }
+            }
+            else if (has_count)
+            {
+                lua_createtable(L, 0, 1);
+                lua_pushinteger(L, n);
+                lua_setfield(L, -2, "affected_rows");
+            }
+            else
+            {
+                lua_pushboolean(L, 1);
+            }
+            lua_rawseti(L, results, ++nresult);
+            has_desc = false;
+            lua_pushnil(L);
+            lua_replace(L, rows);
+            break;
+        }
+        case 'E':
+        {
+            push_error(L, m);
+            lua_replace(L, err);
+            break;
+        }
+        case 'A':
+        {
+            if (lua_isnil(L, notifications))
+            {
+                lua_newtable(L);
+                lua_replace(L, notifications);
+            }
+            push_notification(L, m, notifications);
+            break;
+        }
+        case 'Z':
+        {
+            if (m.size() < 1)
+            {
+                bad_message(L, "ready for query");
+            }
+            lua_pushlstring(L, reinterpret_cast<const char*>(m.p), 1);
+            lua_replace(L, status);
+            break;
+        }
+        case 'G':
+        {
+            lua_pushliteral(L, "G");
+            lua_replace(L, status);
+            break;
+        }
+        case '1':
+            ++parsed;
+            break;
+        default:
+            //BindComplete, CloseComplete, NoData, ParameterDescription, EmptyQueryResponse,
+            //NoticeResponse, ParameterStatus, BackendKeyData, CopyOutResponse
+            break;
+        }
+    }
+    lua_settop(L, status);
+    lua_pushinteger(L, parsed);
+    return 5;
+}
+
+// copy_data(sz, len | str) -> lines, status, err, affected_rows
+// COPY TO STDOUT chunk: CopyData payloads in order. status is set once
+// ReadyForQuery arrives.
+static int lcopy_data(lua_State* L)
+{
+    std::string_view data = get_data(L, 1);
+    message_reader r{ reinterpret_cast<const uint8_t*>(data.data()), reinterpret_cast<const uint8_t*>(data.data() + data.size()) };
+
+    const int lines = lua_gettop(L) + 1;
+    const int status = lines + 1;
+    const int err = lines + 2;
+    const int count = lines + 3;
+    luaL_checkstack(L, 8, nullptr);
+    lua_createtable(L, count_messages(r, 'd'), 0);
+    lua_pushnil(L);
+    lua_pushnil(L);
+    lua_pushnil(L);
+
+    lua_Integer n = 0;
+    pg_message m;
+    while (next_message(L, &r, &m))
+    {
+        switch (m.type)
+        {
+        case 'd':
+        {
+            lua_pushlstring(L, reinterpret_cast<const char*>(m.p), m.size());
+            lua_rawseti(L, lines, ++n);
+            break;
+        }
+        case 'C':
+        {
+            const uint8_t* p = m.p;
+            std::string_view tag = read_cstring(L, p, m.end);
+            lua_Integer v = 0;
+            bool select = false;
+            if (affected_rows(tag, v, select))
+            {
+                lua_pushinteger(L, v);
+                lua_replace(L, count);
+            }
+            break;
+        }
+        case 'E':
+        {
+            push_error(L, m);
+            lua_replace(L, err);
+            break;
+        }
+        case 'Z':
+        {
+            if (m.size() < 1)
+            {
+                bad_message(L, "ready for query");
+            }
+            lua_pushlstring(L, reinterpret_cast<const char*>(m.p), 1);
+            lua_replace(L, status);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    return 4;
+}
+
+static void append_u32(std::string& out, uint32_t v)
+{
+    out.push_back(static_cast<char>((v >> 24) & 0xFF));
+    out.push_back(static_cast<char>((v >> 16) & 0xFF));
+    out.push_back(static_cast<char>((v >> 8) & 0xFF));
+    out.push_back(static_cast<char>(v & 0xFF));
+}
+
+static void append_u16(std::string& out, uint16_t v)
+{
+    out.push_back(static_cast<char>((v >> 8) & 0xFF));
+    out.push_back(static_cast<char>(v & 0xFF));
+}
+
+static void patch_len(std::string& out, size_t start)
+{
+    uint32_t len = static_cast<uint32_t>(out.size() - start - 1);
+    out[start + 1] = static_cast<char>((len >> 24) & 0xFF);
+    out[start + 2] = static_cast<char>((len >> 16) & 0xFF);
+    out[start + 3] = static_cast<char>((len >> 8) & 0xFF);
+    out[start + 4] = static_cast<char>(len & 0xFF);
+}
+
+//text representation of a parameter, false for NULL
+static bool param_text(lua_State* L, int i, std::string_view& v, char* tmp, size_t tmpsz)
+{
+    switch (lua_type(L, i))
+    {
+    case LUA_TNIL:
+        return false;
+    case LUA_TBOOLEAN:
+        v = lua_toboolean(L, i) ? "t" : "f";
+        return true;
+    case LUA_TNUMBER:
+    {
+        int n = 0;
+        if (lua_isinteger(L, i))
+        {
+            n = snprintf(tmp, tmpsz, LUA_INTEGER_FMT, (LUAI_UACINT)lua_tointeger(L, i));
+        }
+        else
+        {
+            n = snprintf(tmp, tmpsz, "%.17g", static_cast<double>(lua_tonumber(L, i)));
+        }
+        v = std::string_view{ tmp, static_cast<size_t>(n) };
+        return true;
+    }
+    case LUA_TSTRING:
+    {
+        size_t len = 0;
+        const char* s = lua_tolstring(L, i, &len);
+        v = std::string_view{ s, len };
+        return true;
+    }
+    default:
+        luaL_error(L, "pg.core: unsupported parameter type '%s' at %d", luaL_typename(L, i), i - 1);
+        return false;
+    }
+}
+
+// execute(stmt_name, ...) -> Bind + Describe portal + Execute messages
+// parameters are sent in text format, nil as NULL
+static int lexecute(lua_State* L)
+{
+    size_t name_len = 0;
+    const char* name = luaL_checklstring(L, 1, &name_len);
+    int top = lua_gettop(L);
+    int nparams = top - 1;
+    if (nparams > 0xFFFF)
+    {
+        return luaL_error(L, "pg.core: too many parameters");
+    }
+
+    std::string out;
+    out.reserve(64 + name_len + static_cast<size_t>(nparams) * 16);
+
+    size_t start = out.size();
+    out.append("B\0\0\0\0", 5);
+    out.push_back('\0'); //unnamed portal
+    out.append(name, name_len);
+    out.push_back('\0');
+    append_u16(out, 0); //all parameters in text format
+    append_u16(out, static_cast<uint16_t>(nparams));
+    char tmp[64];
+    for (int i = 2; i <= top; ++i)
+    {
+        std::string_view v;
+        if (param_text(L, i, v, tmp, sizeof(tmp)))
+        {
+            append_u32(out, static_cast<uint32_t>(v.size()));
+            out.append(v.data(), v.size());
+        }
+        else
+        {
+            append_u32(out, 0xFFFFFFFF);
+        }
+    }
+    append_u16(out, 0); //all results in text format
+    patch_len(out, start);
+
+    out.append("D\0\0\0\6P\0", 7);
+    out.append("E\0\0\0\11\0\0\0\0\0", 10);
+
+    lua_pushlstring(L, out.data(), out.size());
+    return 1;
+}
+
+static void append_copy_text(std::string& out, const char* s, size_t len)
+{
+    for (size_t i = 0; i < len; ++i)
+    {
+        char c = s[i];
+        switch (c)
+        {
+        case '\\': out.append("\\\\", 2); break;
+        case '\t': out.append("\\t", 2); break;
+        case '\n': out.append("\\n", 2); break;
+        case '\r': out.append("\\r", 2); break;
+        default: out.push_back(c); break;
+        }
+    }
+}
+
+// copy_rows(rows [, ncols, i, j]) -> CopyData message holding rows[i..j] in text format.
+// each row is an array of column values(nil as NULL), or a preformatted line
+static int lcopy_rows(lua_State* L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_Integer ncols = luaL_optinteger(L, 2, 0);
+    lua_Integer first = luaL_optinteger(L, 3, 1);
+    lua_Integer last = luaL_optinteger(L, 4, static_cast<lua_Integer>(lua_rawlen(L, 1)));
+    lua_settop(L, 1);
+
+    std::string out;
+    out.reserve(static_cast<size_t>(last >= first ? last - first + 1 : 0) * 32 + 5);
+    out.append("d\0\0\0\0", 5);
+    char tmp[64];
+    for (lua_Integer r = first; r <= last; ++r)
+    {
+        int t = lua_rawgeti(L, 1, r);
+        if (t == LUA_TSTRING)
+        {
+            size_t len = 0;
+            const char* s = lua_tolstring(L, -1, &len);
+            out.append(s, len);
+            if (len == 0 || s[len - 1] != '\n')
+            {
+                out.push_back('\n');
+            }
+        }
+        else if (t == LUA_TTABLE)
+        {
+            lua_Integer n = ncols > 0 ? ncols : static_cast<lua_Integer>(lua_rawlen(L, -1));
+            int row = lua_gettop(L);
+            for (lua_Integer c = 1; c <= n; ++c)
+            {
+                if (c > 1)
+                {
+                    out.push_back('\t');
+                }
+                lua_rawgeti(L, row, c);
+                std::string_view v;
+                if (param_text(L, row + 1, v, tmp, sizeof(tmp)))
+                {
+                    append_copy_text(out, v.data(), v.size());
+                }
+                else
+                {
+                    out.append("\\N", 2);
+                }
+                lua_pop(L, 1);
+            }
+            out.push_back('\n');
+        }
+        else
+        {
+            return luaL_error(L, "pg.core: copy row %d must be a table or string", static_cast<int>(r));
+        }
+        lua_pop(L, 1);
+    }
+    patch_len(out, 0);
+    lua_pushlstring(L, out.data(), out.size());
+    return 1;
+}
+
+extern "C"
+{
+    int LUAMOD_API luaopen_pg_core(lua_State* L)
+    {
+        luaL_Reg l[] = {
+            { "message", lmessage },
+            { "result", lresult },
+            { "copy_data", lcopy_data },
+            { "execute", lexecute },
+            { "copy_rows", lcopy_rows },
+            { NULL, NULL }
+        };
+        luaL_checkversion(L);
+        luaL_newlib(L, l);
+        return 1;
+    }
+}
@@ -0,0 +1,243 @@
+#include "lua.hpp"
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+
+// Decode complete RESP2/RESP3 replies delivered by resp_connection.
+
+#define MAX_DEPTH 64
+
+struct resp_reader
+{
+    const char* p;
+    const char* end;
+};
+
+static void invalid_reply(lua_State* L, const char* what)
+{
+    luaL_error(L, "resp.decode: invalid reply, %s", what);
+}
+
+static std::string_view read_line(lua_State* L, resp_reader* r)
+{
+    const char* start = r->p;
+    while (r->p + 1 < r->end)
+    {
+        auto q = static_cast<const char*>(memchr(r->p, '\r', r->end - r->p - 1));
+        if (nullptr == q)
+        {
+            break;
+        }
+        if (q[1] == '\n')
+        {
+            r->p = q + 2;
+            return std::string_view{ start, static_cast<size_t>(q - start) };
+        }
+        r->p = q + 1;
+    }
+    invalid_reply(L, "line not terminated");
+    return std::string_view{};
+}
+
+static int64_t to_integer(lua_State* L, std::string_view s)
+{
+    size_t i = 0;
+    bool negative = false;
+    if (!s.empty() && (s[0] == '-' || s[0] == '+'))
+    {
+        negative = (s[0] == '-');
+        ++i;
+    }
+    if (i == s.size())
+    {
+        invalid_reply(L, "bad integer");
+    }
+    uint64_t v = 0;
+    for (; i < s.size(); ++i)
+    {
+        char c = s[i];
+        if (c < '0' || c > '9')
+        {
+            invalid_reply(L, "bad integer");
+        }
+        v = v * 10 + static_cast<uint64_t>(c - '0');
+    }
+    return negative ? static_cast<int64_t>(0 - v) : static_cast<int64_t>(v);
+}
+
+static bool push_reply(lua_State* L, resp_reader* r, int depth);
+
+static bool push_blob(lua_State* L, resp_reader* r, std::string_view line, size_t skip)
+{
+    int64_t len = to_integer(L, line);
+    if (len < 0)
+    {
+        lua_pushnil(L);
+        return true;
+    }
+    if (r->end - r->p < len + 2)
+    {
+        invalid_reply(L, "truncated bulk string");
+    }
+    size_t n = static_cast<size_t>(len);
+    skip = (skip <= n) ? skip : 0;
+    lua_pushlstring(L, r->p + skip, n - skip);
+    r->p += n + 2;
+    return true;
+}
+
+static bool push_aggregate(lua_State* L, resp_reader* r, std::string_view line, int depth, bool map)
+{
+    int64_t n = to_integer(L, line);
+    if (n < 0)
+    {
+        lua_pushnil(L);
+        return true;
+    }
+    if (depth >= MAX_DEPTH)
+    {
+        invalid_reply(L, "nested too deep");
+    }
+    luaL_checkstack(L, 4, nullptr);
+    bool ok = true;
+    if (map)
+    {
+        lua_createtable(L, 0, static_cast<int>(n));
+        for (int64_t i = 0; i < n; ++i)
+        {
+            ok = push_reply(L, r, depth + 1) && ok;
+            ok = push_reply(L, r, depth + 1) && ok;
+            if (lua_isnil(L, -2))
+            {
+                lua_pop(L, 2);
+                continue;
+            }
+            lua_rawset(L, -3);
+        }
+    }
+    else
+    {
+        lua_createtable(L, static_cast<int>(n), 0);
+        for (int64_t i = 1; i <= n; ++i)
+        {
+            ok = push_reply(L, r, depth + 1) && ok;
+            lua_rawseti(L, -2, i);
+        }
+    }
+    return ok;
+}
+
+//push one reply value, returns false if it is, or contains, an error reply
+static bool push_reply(lua_State* L, resp_reader* r, int depth)
+{
+    if (r->p >= r->end)
+    {
+        invalid_reply(L, "unexpected end");
+    }
+    char type = *r->p++;
+    std::string_view line = read_line(L, r);
+    switch (type)
+    {
+    case '+':
+    case '(':
+        lua_pushlstring(L, line.data(), line.size());
+        return true;
+    case '-':
+        lua_pushlstring(L, line.data(), line.size());
+        return false;
+    case ':':
+        lua_pushinteger(L, to_integer(L, line));
+        return true;
+    case '_':
+        lua_pushnil(L);
+        return true;
+    case '#':
+        lua_pushboolean(L, line.size() == 1 && line[0] == 't');
+        return true;
+    case ',':
+    {
+        std::string s{ line };
+        lua_pushnumber(L, strtod(s.data(), nullptr));
+        return true;
+    }
+    case '$':
+        return push_blob(L, r, line, 0);
+    case '!':
+        push_blob(L, r, line, 0);
+        return false;
+    case '=':
+        //verbatim string, skip the 'txt:' format prefix
+        return push_blob(L, r, line, 4);
+    case '*':
+    case '~':
+    case '>':
+        return push_aggregate(L, r, line, depth, false);
+    case '%':
+        return push_aggregate(L, r, line, depth, true);
+    case '|':
+    {
+        //attribute, not exposed: decode then discard, the real reply follows
+        push_aggregate(L, r, line, depth, true);
+        lua_pop(L, 1);
+        return push_reply(L, r, depth);
+    }
+    default:
+        invalid_reply(L, "unknown type");
+        return false;
+    }
+}
+
+// decode(sz, len | str) -> count, ok1, value1, ok2, value2, ...
+static int decode(lua_State* L)
+{
+    size_t len = 0;
+    const char* data = nullptr;
+    if (lua_type(L, 1) == LUA_TSTRING)
+    {
+        data = lua_tolstring(L, 1, &len);
+    }
+    else
+    {
+        data = (const char*)lua_touserdata(L, 1);
+        len = (size_t)luaL_checkinteger(L, 2);
+    }
+
+    int base = lua_gettop(L);
+    lua_pushinteger(L, 0);
+    if (nullptr == data || len == 0)
+    {
+        return 1;
+    }
+
+    resp_reader r{ data, data + len };
+    lua_Integer count = 0;
+    while (r.p < r.end)
+    {
+        luaL_checkstack(L, 3, "resp.decode: too many replies");
+        int idx = lua_gettop(L) + 1;
+        lua_pushboolean(L, 1);
+        bool ok = push_reply(L, &r, 0);
+        lua_pushboolean(L, ok ? 1 : 0);
+        lua_replace(L, idx);
+        ++count;
+    }
+    lua_pushinteger(L, count);
+    lua_replace(L, base + 1);
+    return lua_gettop(L) - base;
+}
+
+extern "C"
+{
+    int LUAMOD_API luaopen_resp(lua_State* L)
+    {
+        luaL_Reg l[] = {
+            { "decode", decode },
+            { NULL, NULL }
+        };
+        luaL_checkversion(L);
+        luaL_newlib(L, l);
+        return 1;
+    }
+}
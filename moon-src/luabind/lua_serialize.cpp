@@ -308,9 +308,64 @@ static void get_buffer(lua_State *L, buffer_view* buf, int len) {
     buf->skip(len);
 }
 
-static void unpack_one(lua_State *L, buffer_view* buf);
+/*
+    optional unpack behaviour used by unpack_intern:
+    short string keys are looked up in a per-service cache before creating lua strings.
+*/
+#define STRING_CACHE_SLOTS 512
 
-static void unpack_table(lua_State *L, buffer_view* buf, int array_size) {
+struct string_cache_slot
+{
+    uint8_t len;
+    char data[MAX_COOKIE - 1];
+};
+
+struct string_cache
+{
+    string_cache_slot slots[STRING_CACHE_SLOTS];
+};
+
+struct unpack_context
+{
+    string_cache* cache = nullptr;
+    int cache_strings = 0;
+};
+
+static void unpack_one(lua_State *L, buffer_view* buf, unpack_context* ctx = nullptr);
+
+static inline uint32_t string_cache_hash(const char* str, size_t len)
+{
+    uint32_t h = (uint32_t)len;
+    size_t step = (len >> 3) + 1;
+    for (size_t i = 0; i < len; i += step)
+        h ^= ((h << 5) + (h >> 2) + (uint8_t)str[i]);
+    return h;
+}
+
+static void get_key(lua_State* L, buffer_view* buf, int len, unpack_context* ctx) {
+    if (int(buf->size()) < len) {
+        invalid_stream(L, buf);
+    }
+    const char* str = buf->data();
+    string_cache_slot& slot = ctx->cache->slots[string_cache_hash(str, len) & (STRING_CACHE_SLOTS - 1)];
+    int idx = (int)(&slot - ctx->cache->slots) + 1;
+    //slot.len stores len + 1, so an unused slot never matches the empty string
+    if (slot.len == len + 1 && memcmp(slot.data, str, len) == 0) {
+        lua_rawgeti(L, ctx->cache_strings, idx);
+    }
+    else {
+        lua_pushlstring(L, str, len);
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, ctx->cache_strings, idx);
+        slot.len = (uint8_t)(len + 1);
+        memcpy(slot.data, str, len);
+    }
+    buf->skip(len);
+}
+
+static void unpack_key(lua_State* L, buffer_view* buf, unpack_context* ctx);
+
+static void unpack_table(lua_State *L, buffer_view* buf, int array_size, unpack_context* ctx) {
     if (array_size == MAX_COOKIE - 1) {
         uint8_t type{};
         if (!buf->read(&type))
@@ -325,21 +380,26 @@ static void unpack_table(lua_State *L, buffer_view* buf, int array_size) {
     lua_createtable(L, array_size, 0);
     int i;
     for (i = 1; i <= array_size; i++) {
-        unpack_one(L, buf);
+        unpack_one(L, buf, ctx);
         lua_rawseti(L, -2, i);
     }
     for (;;) {
-        unpack_one(L, buf);
+        if (ctx && ctx->cache) {
+            unpack_key(L, buf, ctx);
+        }
+        else {
+            unpack_one(L, buf, ctx);
+        }
         if (lua_isnil(L, -1)) {
             lua_pop(L, 1);
             return;
         }
-        unpack_one(L, buf);
+        unpack_one(L, buf, ctx);
         lua_rawset(L, -3);
     }
 }
 
-static void push_value(lua_State *L, buffer_view* buf, int type, int cookie)
+static void push_value(lua_State *L, buffer_view* buf, int type, int cookie, unpack_context* ctx = nullptr)
 {
     switch (type) {
     case TYPE_NIL:
@@ -381,7 +441,7 @@ static void push_value(lua_State *L, buffer_view* buf, int type, int cookie)
         break;
     }
     case TYPE_TABLE: {
-        unpack_table(L, buf, cookie);
+        unpack_table(L, buf, cookie, ctx);
         break;
     }
     default: {
@@ -391,11 +451,23 @@ static void push_value(lua_State *L, buffer_view* buf, int type, int cookie)
     }
 }
 
-static void unpack_one(lua_State *L, buffer_view* buf) {
+static void unpack_one(lua_State *L, buffer_view* buf, unpack_context* ctx) {
+    uint8_t type{};
+    if (!buf->read(&type))
+        invalid_stream(L, buf);
+    push_value(L, buf, type & 0x7, type >> 3, ctx);
+}
+
+static void unpack_key(lua_State* L, buffer_view* buf, unpack_context* ctx) {
     uint8_t type{};
     if (!buf->read(&type))
         invalid_stream(L, buf);
-    push_value(L, buf, type & 0x7, type >> 3);
+    if ((type & 0x7) == TYPE_SHORT_STRING) {
+        get_key(L, buf, type >> 3, ctx);
+    }
+    else {
+        push_value(L, buf, type & 0x7, type >> 3, ctx);
+    }
 }
 
 static int pack(lua_State* L)
@@ -475,6 +547,67 @@ static int unpack(lua_State* L)
     return lua_gettop(L) - 1;
 }
 
+static int unpack_with_context(lua_State* L, const char* data, size_t len, unpack_context* ctx)
+{
+    buffer_view br(data, len);
+    int top = lua_gettop(L);
+    for (int i = 0;; i++)
+    {
+        if (i % 8 == 7)
+        {
+            luaL_checkstack(L, LUA_MINSTACK, NULL);
+        }
+        uint8_t type = 0;
+        if (!br.read(&type))
+        {
+            break;
+        }
+        push_value(L, &br, type & 0x7, type >> 3, ctx);
+    }
+    return lua_gettop(L) - top;
+}
+
+static string_cache* upvalue_cache(lua_State* L, unpack_context& ctx)
+{
+    ctx.cache = (string_cache*)lua_touserdata(L, lua_upvalueindex(1));
+    lua_getiuservalue(L, lua_upvalueindex(1), 1);
+    ctx.cache_strings = lua_gettop(L);
+    return ctx.cache;
+}
+
+/*
+    same as unpack, but string keys are interned through the service's string cache.
+*/
+static int unpack_intern(lua_State* L)
+{
+    if (lua_isnoneornil(L, 1)) {
+        return 0;
+    }
+    const char* data;
+    size_t len;
+    if (lua_type(L, 1) == LUA_TSTRING) {
+        data = lua_tolstring(L, 1, &len);
+    }
+    else
+    {
+        data = (const char*)lua_touserdata(L, 1);
+        len = luaL_checkinteger(L, 2);
+    }
+
+    if (len == 0) {
+        return 0;
+    }
+
+    if (data == NULL) {
+        return luaL_error(L, "deserialize null pointer");
+    }
+
+    lua_settop(L, 2);
+    unpack_context ctx;
+    upvalue_cache(L, ctx);
+    return unpack_with_context(L, data, len, &ctx);
+}
+
 static int peek_one(lua_State* L)
 {
     if (lua_isnoneornil(L, 1)) {
@@ -666,6 +799,360 @@ static int sep_concatsafe(lua_State *L)
     return 1;
 }
 
+/*
+    schema mode: a registered message shape is packed as
+    [presence bitmap][fixed fields in declaration order][any fields, generic encoding]
+    keys are not written, fixed fields have no type byte, and the fixed part is
+    sized up front so the buffer is allocated once.
+*/
+#define SCHEMA_METANAME "lseri_schema"
+#define SCHEMA_MAX_FIELDS 255
+
+enum schema_type : uint8_t
+{
+    SCHEMA_INTEGER = 1,
+    SCHEMA_NUMBER,
+    SCHEMA_BOOLEAN,
+    SCHEMA_STRING,
+    SCHEMA_ANY,
+};
+
+struct seri_schema
+{
+    uint32_t nfield;
+    uint32_t nany;
+    uint8_t types[1];
+};
+
+static const char* schema_type_name(uint8_t t)
+{
+    switch (t)
+    {
+    case SCHEMA_INTEGER: return "integer";
+    case SCHEMA_NUMBER: return "number";
+    case SCHEMA_BOOLEAN: return "boolean";
+    case SCHEMA_STRING: return "string";
+    default: return "any";
+    }
+}
+
+static seri_schema* check_schema(lua_State* L, int index)
+{
+    return (seri_schema*)luaL_checkudata(L, index, SCHEMA_METANAME);
+}
+
+static inline size_t schema_bitmap_size(const seri_schema* s)
+{
+    return (s->nfield + 7) / 8;
+}
+
+//push t[key] of every field onto the stack, validate and return the fixed part size
+static size_t schema_prepare_values(lua_State* L, seri_schema* s, int tindex)
+{
+    luaL_checkstack(L, (int)s->nfield + LUA_MINSTACK, NULL);
+    lua_getiuservalue(L, 1, 1);
+    int keys = lua_gettop(L);
+    size_t size = schema_bitmap_size(s);
+    for (uint32_t i = 0; i < s->nfield; ++i)
+    {
+        lua_rawgeti(L, keys, i + 1);
+        int t = lua_rawget(L, tindex);
+        if (t == LUA_TNIL)
+        {
+            continue;
+        }
+        switch (s->types[i])
+        {
+        case SCHEMA_INTEGER:
+            if (!lua_isinteger(L, -1))
+                break;
+            size += sizeof(int64_t);
+            continue;
+        case SCHEMA_NUMBER:
+            if (t != LUA_TNUMBER)
+                break;
+            size += sizeof(double);
+            continue;
+        case SCHEMA_BOOLEAN:
+            if (t != LUA_TBOOLEAN)
+                break;
+            size += sizeof(uint8_t);
+            continue;
+        case SCHEMA_STRING:
+            if (t != LUA_TSTRING)
+                break;
+            size += sizeof(uint32_t) + lua_rawlen(L, -1);
+            continue;
+        default:
+            continue;
+        }
+        lua_rawgeti(L, keys, i + 1);
+        luaL_error(L, "seri.schema field '%s' expect %s, got %s", lua_tostring(L, -1), schema_type_name(s->types[i]), luaL_typename(L, -2));
+    }
+    return size;
+}
+
+//values are at [first, first + nfield)
+static void schema_write(lua_State* L, seri_schema* s, buffer* buf, int first, size_t fixed_size)
+{
+    buf->prepare(fixed_size);
+    char* p = std::addressof(*buf->end());
+    char* bitmap = p;
+    std::memset(bitmap, 0, schema_bitmap_size(s));
+    p += schema_bitmap_size(s);
+    for (uint32_t i = 0; i < s->nfield; ++i)
+    {
+        int index = first + (int)i;
+        if (lua_isnil(L, index))
+        {
+            continue;
+        }
+        bitmap[i >> 3] |= (char)(1 << (i & 7));
+        switch (s->types[i])
+        {
+        case SCHEMA_INTEGER:
+        {
+            int64_t v = lua_tointeger(L, index);
+            memcpy(p, &v, sizeof(v));
+            p += sizeof(v);
+            break;
+        }
+        case SCHEMA_NUMBER:
+        {
+            double v = lua_tonumber(L, index);
+            memcpy(p, &v, sizeof(v));
+            p += sizeof(v);
+            break;
+        }
+        case SCHEMA_BOOLEAN:
+            *p++ = (char)lua_toboolean(L, index);
+            break;
+        case SCHEMA_STRING:
+        {
+            size_t len = 0;
+            const char* str = lua_tolstring(L, index, &len);
+            uint32_t n = (uint32_t)len;
+            memcpy(p, &n, sizeof(n));
+            p += sizeof(n);
+            memcpy(p, str, len);
+            p += len;
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    buf->commit(fixed_size);
+
+    if (s->nany > 0)
+    {
+        for (uint32_t i = 0; i < s->nfield; ++i)
+        {
+            int index = first + (int)i;
+            if (s->types[i] == SCHEMA_ANY && !lua_isnil(L, index))
+            {
+                pack_one(L, buf, index, 0);
+            }
+        }
+    }
+}
+
+static int schema_pack(lua_State* L)
+{
+    seri_schema* s = check_schema(L, 1);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    lua_settop(L, 2);
+    size_t fixed_size = schema_prepare_values(L, s, 2);
+    auto buf = new buffer(fixed_size, BUFFER_HEAD_RESERVED);
+    buf->set_flag(HEAP_BUFFER);
+    schema_write(L, s, buf, 4, fixed_size);
+    buf->clear_flag(HEAP_BUFFER);
+    lua_pushlightuserdata(L, buf);
+    return 1;
+}
+
+static int schema_packsafe(lua_State* L)
+{
+    seri_schema* s = check_schema(L, 1);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    lua_settop(L, 2);
+    size_t fixed_size = schema_prepare_values(L, s, 2);
+    buffer buf(fixed_size);
+    schema_write(L, s, &buf, 4, fixed_size);
+    lua_pushlstring(L, buf.data(), buf.size());
+    return 1;
+}
+
+static int schema_unpack(lua_State* L)
+{
+    seri_schema* s = check_schema(L, 1);
+    const char* data;
+    size_t len;
+    if (lua_type(L, 2) == LUA_TSTRING) {
+        data = lua_tolstring(L, 2, &len);
+    }
+    else
+    {
+        data = (const char*)lua_touserdata(L, 2);
+        len = luaL_checkinteger(L, 3);
+    }
+
+    if (data == NULL) {
+        return luaL_error(L, "deserialize null pointer");
+    }
+
+    //the string at 2 stays on the stack, data points into it
+    lua_settop(L, 3);
+    lua_getiuservalue(L, 1, 1);
+    const int keys = 4;
+    buffer_view br(data, len);
+    const char* bitmap = br.data();
+    size_t nbitmap = schema_bitmap_size(s);
+    if (br.size() < nbitmap)
+        invalid_stream(L, &br);
+    br.skip(nbitmap);
+
+    lua_createtable(L, 0, (int)s->nfield);
+    for (uint32_t i = 0; i < s->nfield; ++i)
+    {
+        if (!(bitmap[i >> 3] & (1 << (i & 7))) || s->types[i] == SCHEMA_ANY)
+        {
+            continue;
+        }
+        lua_rawgeti(L, keys, i + 1);
+        switch (s->types[i])
+        {
+        case SCHEMA_INTEGER:
+        {
+            int64_t v{};
+            if (!br.read(&v))
+                invalid_stream(L, &br);
+            lua_pushinteger(L, v);
+            break;
+        }
+        case SCHEMA_NUMBER:
+        {
+            double v{};
+            if (!br.read(&v))
+                invalid_stream(L, &br);
+            lua_pushnumber(L, v);
+            break;
+        }
+        case SCHEMA_BOOLEAN:
+        {
+            uint8_t v{};
+            if (!br.read(&v))
+                invalid_stream(L, &br);
+            lua_pushboolean(L, v);
+            break;
+        }
+        default:
+        {
+            uint32_t n{};
+            if (!br.read(&n) || n > br.size() || n > (uint32_t)INT32_MAX)
+                invalid_stream(L, &br);
+            get_buffer(L, &br, (int)n);
+            break;
+        }
+        }
+        lua_rawset(L, -3);
+    }
+
+    for (uint32_t i = 0; s->nany > 0 && i < s->nfield; ++i)
+    {
+        if ((bitmap[i >> 3] & (1 << (i & 7))) && s->types[i] == SCHEMA_ANY)
+        {
+            lua_rawgeti(L, keys, i + 1);
+            unpack_one(L, &br);
+            lua_rawset(L, -3);
+        }
+    }
+    return 1;
+}
+
+static int schema_fields(lua_State* L)
+{
+    seri_schema* s = check_schema(L, 1);
+    lua_getiuservalue(L, 1, 1);
+    lua_createtable(L, (int)s->nfield, 0);
+    for (uint32_t i = 0; i < s->nfield; ++i)
+    {
+        lua_createtable(L, 2, 0);
+        lua_rawgeti(L, 2, i + 1);
+        lua_rawseti(L, -2, 1);
+        lua_pushstring(L, schema_type_name(s->types[i]));
+        lua_rawseti(L, -2, 2);
+        lua_rawseti(L, -2, i + 1);
+    }
+    return 1;
+}
+
+static uint8_t schema_parse_type(lua_State* L, const char* name)
+{
+    static const char* const names[] = { "integer", "number", "boolean", "string", "any", NULL };
+    for (int i = 0; names[i] != NULL; ++i)
+    {
+        if (strcmp(names[i], name) == 0)
+            return (uint8_t)(SCHEMA_INTEGER + i);
+    }
+    luaL_error(L, "seri.schema unknown field type '%s'", name);
+    return 0;
+}
+
+/*
+    seri.schema{ {"id","integer"}, {"name","string"}, {"pos","any"} }
+*/
+static int schema_new(lua_State* L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_Integer n = luaL_len(L, 1);
+    if (n <= 0 || n > SCHEMA_MAX_FIELDS)
+    {
+        return luaL_error(L, "seri.schema field count must be in [1, %d]", SCHEMA_MAX_FIELDS);
+    }
+
+    seri_schema* s = (seri_schema*)lua_newuserdatauv(L, sizeof(seri_schema) + (size_t)n, 1);
+    s->nfield = (uint32_t)n;
+    s->nany = 0;
+    lua_createtable(L, (int)n, 0);
+    for (lua_Integer i = 1; i <= n; ++i)
+    {
+        if (lua_rawgeti(L, 1, i) != LUA_TTABLE)
+        {
+            return luaL_error(L, "seri.schema field %d must be {name, type}", (int)i);
+        }
+        if (lua_rawgeti(L, -1, 1) != LUA_TSTRING)
+        {
+            return luaL_error(L, "seri.schema field %d name must be string", (int)i);
+        }
+        lua_rawseti(L, -3, i);
+        lua_rawgeti(L, -1, 2);
+        const char* tname = luaL_optstring(L, -1, "any");
+        s->types[i - 1] = schema_parse_type(L, tname);
+        if (s->types[i - 1] == SCHEMA_ANY)
+        {
+            ++s->nany;
+        }
+        lua_pop(L, 2);
+    }
+    lua_setiuservalue(L, -2, 1);
+
+    if (luaL_newmetatable(L, SCHEMA_METANAME))
+    {
+        luaL_Reg l[] = {
+            { "pack", schema_pack },
+            { "packs", schema_packsafe },
+            { "unpack", schema_unpack },
+            { "fields", schema_fields },
+            { NULL, NULL }
+        };
+        luaL_newlib(L, l);
+        lua_setfield(L, -2, "__index");
+    }
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
 extern "C"
 {
     int LUAMOD_API  luaopen_serialize(lua_State *L)
@@ -680,9 +1167,20 @@ extern "C"
             {"concats",concatsafe },
             {"sep_concat",sep_concat },
             {"sep_concats",sep_concatsafe },
+            {"schema",schema_new },
             {NULL,NULL},
         };
         luaL_newlib(L, l);
+
+        luaL_Reg lc[] = {
+            {"unpack_intern",unpack_intern },
+            {NULL,NULL},
+        };
+        string_cache* cache = (string_cache*)lua_newuserdatauv(L, sizeof(string_cache), 1);
+        memset(cache, 0, sizeof(string_cache));
+        lua_createtable(L, STRING_CACHE_SLOTS, 0);
+        lua_setiuservalue(L, -2, 1);
+        luaL_setfuncs(L, lc, 1);
         return 1;
     }
 }
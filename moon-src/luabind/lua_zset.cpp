@@ -1,5 +1,8 @@
 #include <algorithm>
+#include <vector>
 #include "common/zset.hpp"
+#include "common/file.hpp"
+#include "common/mmap_file.hpp"
 #include "lua.hpp"
 
 #define METANAME "lzet"
@@ -31,7 +34,6 @@ static int lprepare(lua_State* L)
     {
         return luaL_error(L, "invalid lua-zset pointer");
     }
-    proxy->zset->prepare();
     return 0;
 }
 
@@ -55,7 +57,6 @@ static int lkey(lua_State* L)
         return luaL_error(L, "invalid lua-zset pointer");
     }
     uint32_t rank = (uint32_t)luaL_checkinteger(L, 2);
-    proxy->zset->prepare();
     auto iter = proxy->zset->start(rank);
     if (iter == proxy->zset->end())
     {
@@ -138,7 +139,6 @@ static int lrange(lua_State* L)
     {
         return 0;
     }
-    proxy->zset->prepare();
     auto iter = proxy->zset->start(start);
     if (iter == proxy->zset->end())
     {
@@ -155,6 +155,117 @@ static int lrange(lua_State* L)
     return 1;
 };
 
+static const char* check_bytes(lua_State* L, int index, size_t& len)
+{
+    if (lua_type(L, index) == LUA_TSTRING)
+    {
+        return lua_tolstring(L, index, &len);
+    }
+    const char* data = (const char*)lua_touserdata(L, index);
+    if (nullptr == data)
+    {
+        luaL_error(L, "need string or lightuserdata(char*) and size");
+        return nullptr;
+    }
+    len = (size_t)luaL_checkinteger(L, index + 1);
+    return data;
+}
+
+//update_many(data [, len]): data is packed int64 triples {key, score, timestamp}, e.g. string.pack("<jjj", ...)
+static int lupdate_many(lua_State* L)
+{
+    zset_proxy* proxy = (zset_proxy*)lua_touserdata(L, 1);
+    if (nullptr == proxy || nullptr == proxy->zset)
+    {
+        return luaL_error(L, "invalid lua-zset pointer");
+    }
+    size_t len = 0;
+    const char* data = check_bytes(L, 2, len);
+    if (len % moon::zset::ENTRY_SIZE != 0)
+    {
+        return luaL_error(L, "zset.update_many data size must be a multiple of %d", (int)moon::zset::ENTRY_SIZE);
+    }
+    size_t count = len / moon::zset::ENTRY_SIZE;
+    if ((reinterpret_cast<uintptr_t>(data) % alignof(int64_t)) == 0)
+    {
+        proxy->zset->update_many(reinterpret_cast<const int64_t*>(data), count);
+    }
+    else
+    {
+        std::vector<int64_t> tmp(count * 3);
+        memcpy(tmp.data(), data, len);
+        proxy->zset->update_many(tmp.data(), count);
+    }
+    lua_pushinteger(L, proxy->zset->size());
+    return 1;
+}
+
+static int lsnapshot(lua_State* L)
+{
+    zset_proxy* proxy = (zset_proxy*)lua_touserdata(L, 1);
+    if (nullptr == proxy || nullptr == proxy->zset)
+    {
+        return luaL_error(L, "invalid lua-zset pointer");
+    }
+    std::string data = proxy->zset->snapshot();
+    lua_pushlstring(L, data.data(), data.size());
+    return 1;
+}
+
+static int lrestore(lua_State* L)
+{
+    zset_proxy* proxy = (zset_proxy*)lua_touserdata(L, 1);
+    if (nullptr == proxy || nullptr == proxy->zset)
+    {
+        return luaL_error(L, "invalid lua-zset pointer");
+    }
+    size_t len = 0;
+    const char* data = check_bytes(L, 2, len);
+    lua_pushboolean(L, proxy->zset->restore(data, len) ? 1 : 0);
+    return 1;
+}
+
+static int lsave(lua_State* L)
+{
+    zset_proxy* proxy = (zset_proxy*)lua_touserdata(L, 1);
+    if (nullptr == proxy || nullptr == proxy->zset)
+    {
+        return luaL_error(L, "invalid lua-zset pointer");
+    }
+    std::string path = luaL_checkstring(L, 2);
+    bool ok = moon::file::write(path, proxy->zset->snapshot(), std::ios::out | std::ios::binary | std::ios::trunc);
+    lua_pushboolean(L, ok ? 1 : 0);
+    return 1;
+}
+
+//load(path [, use_mmap]): restore from a file written by save
+static int lload(lua_State* L)
+{
+    zset_proxy* proxy = (zset_proxy*)lua_touserdata(L, 1);
+    if (nullptr == proxy || nullptr == proxy->zset)
+    {
+        return luaL_error(L, "invalid lua-zset pointer");
+    }
+    std::string path = luaL_checkstring(L, 2);
+    bool ok = false;
+    if (lua_toboolean(L, 3))
+    {
+        moon::mmap_file mf;
+        if (mf.open(path))
+        {
+            mf.sequential();
+            ok = proxy->zset->restore(mf.data(), mf.size());
+        }
+    }
+    else
+    {
+        std::string data = moon::file::read_all(path);
+        ok = proxy->zset->restore(data.data(), data.size());
+    }
+    lua_pushboolean(L, ok ? 1 : 0);
+    return 1;
+}
+
 static int lrelease(lua_State* L)
 {
     zset_proxy* proxy = (zset_proxy*)lua_touserdata(L, 1);
@@ -184,6 +295,11 @@ static int lcreate(lua_State* L)
             { "clear", lclear},
             { "size", lsize},
             { "erase", lerase},
+            { "update_many", lupdate_many},
+            { "snapshot", lsnapshot},
+            { "restore", lrestore},
+            { "save", lsave},
+            { "load", lload},
             { NULL,NULL }
         };
         luaL_newlib(L, l); //{}
@@ -6,6 +6,7 @@
 #include "common/lua_utility.hpp"
 #include "server.h"
 #include "services/lua_service.h"
+#include "services/cluster_service.h"
 
 extern "C" {
 #include "lstring.h"
@@ -114,6 +115,23 @@ static void usage(void) {
     std::cout << "        moon main.lua  hello\n";
 }
 
+//array of integers at the top of the stack, e.g. worker_cpu = {2, 3, 4, 5}
+template<typename T>
+static std::vector<T> read_integers(lua_State* L, const std::string& key)
+{
+    MOON_CHECK(lua_type(L, -1) == LUA_TTABLE, moon::format("init conf '%s' must be an array of integers", key.data()));
+    std::vector<T> res;
+    lua_Integer n = (lua_Integer)lua_rawlen(L, -1);
+    for (lua_Integer i = 1; i <= n; ++i)
+    {
+        lua_rawgeti(L, -1, i);
+        MOON_CHECK(lua_isinteger(L, -1), moon::format("init conf '%s' must be an array of integers", key.data()));
+        res.emplace_back(static_cast<T>(lua_tointeger(L, -1)));
+        lua_pop(L, 1);
+    }
+    return res;
+}
+
 int main(int argc, char* argv[])
 {
     using namespace moon;
@@ -132,6 +150,7 @@ int main(int argc, char* argv[])
         std::string logfile;
         std::string bootstrap;
         std::string loglevel;
+        placement_conf placement;
 
         int argn = 1;
         if (argc <= argn)
@@ -187,6 +206,14 @@ int main(int argc, char* argv[])
                     enable_console = lua_toboolean(L, -1);
                 else if (key == "loglevel")
                     loglevel = luaL_check_stringview(L, -1);
+                else if (key == "worker_cpu")
+                    placement.worker_cpu = read_integers<int>(L, key);
+                else if (key == "timer_cpu")
+                    placement.timer_cpu = (int)luaL_checkinteger(L, -1);
+                else if (key == "logger_cpu")
+                    placement.logger_cpu = (int)luaL_checkinteger(L, -1);
+                else if (key == "dedicated")
+                    placement.dedicated = read_integers<uint32_t>(L, key);
                 lua_pop(L, 1);
             }
         }
@@ -198,6 +225,10 @@ int main(int argc, char* argv[])
             return std::make_unique<lua_service>();
             });
 
+        server_->register_service("cluster", []()->service_ptr_t {
+            return std::make_unique<cluster_service>();
+            });
+
 #if TARGET_PLATFORM == PLATFORM_WINDOWS
         server_->set_env("LUA_CPATH_EXT", "/?.dll;");
 #else
@@ -226,7 +257,7 @@ int main(int argc, char* argv[])
         server_->logger()->set_enable_console(enable_console);
         server_->logger()->set_level(loglevel);
 
-        server_->init(thread_count, logfile);
+        server_->init(thread_count, logfile, placement);
 
         service_conf conf;
         conf.name = "bootstrap";
@@ -268,6 +299,10 @@ extern "C"
         REGISTER_CUSTOM_LIBRARY("buffer", luaopen_buffer);
         REGISTER_CUSTOM_LIBRARY("sharetable.core", luaopen_sharetable_core);
         REGISTER_CUSTOM_LIBRARY("socket.core", luaopen_socket_core);
+        REGISTER_CUSTOM_LIBRARY("resp", luaopen_resp);
+        REGISTER_CUSTOM_LIBRARY("mysql.core", luaopen_mysql_core);
+        REGISTER_CUSTOM_LIBRARY("pg.core", luaopen_pg_core);
+        REGISTER_CUSTOM_LIBRARY("datatable", luaopen_datatable);
 
         //custom
         REGISTER_CUSTOM_LIBRARY("pb", luaopen_pb);
@@ -0,0 +1,949 @@
+#include "cluster_service.h"
+#include "lua.hpp"
+#include "message.hpp"
+#include "server.h"
+#include "worker.h"
+#include "network/cluster_connection.hpp"
+#include "common/string.hpp"
+#include "common/lua_utility.hpp"
+#include "common/lz.hpp"
+#include "common/time.hpp"
+
+using namespace moon;
+
+static int64_t conf_integer(lua_State* L, const char* key, int64_t def)
+{
+    lua_getfield(L, -1, key);
+    int64_t v = lua_isinteger(L, -1) ? (int64_t)lua_tointeger(L, -1) : def;
+    lua_pop(L, 1);
+    return v;
+}
+
+static bool conf_boolean(lua_State* L, const char* key, bool def)
+{
+    lua_getfield(L, -1, key);
+    bool v = lua_isboolean(L, -1) ? (lua_toboolean(L, -1) != 0) : def;
+    lua_pop(L, 1);
+    return v;
+}
+
+//frame header and name, the payload is written after it
+static buffer_ptr_t make_head(uint8_t kind, uint8_t ptype, std::string_view name, uint32_t addr, int32_t session, size_t payload_size)
+{
+    cluster_frame f;
+    f.len = static_cast<uint32_t>(sizeof(f) - sizeof(f.len) + name.size() + payload_size);
+    f.kind = kind;
+    f.ptype = ptype;
+    f.name_len = static_cast<uint16_t>(name.size());
+    f.addr = addr;
+    f.session = session;
+    host2net(f.len);
+    host2net(f.name_len);
+    host2net(f.addr);
+    host2net(f.session);
+
+    auto head = message::create_buffer(sizeof(f) + name.size(), 0);
+    head->write_back(&f, 1);
+    if (!name.empty())
+    {
+        head->write_back(name.data(), name.size());
+    }
+    return head;
+}
+
+static uint64_t call_key(uint32_t caller, int32_t session)
+{
+    return (static_cast<uint64_t>(static_cast<uint32_t>(session)) << 32) | caller;
+}
+
+cluster_service::~cluster_service()
+{
+    auto& sock = worker_->socket();
+    if (listenfd_ != 0)
+    {
+        sock.close(listenfd_);
+    }
+    for (auto& it : peers_)
+    {
+        if (it.second.fd != 0)
+        {
+            sock.close(it.second.fd);
+        }
+    }
+    logger()->logstring(true, moon::LogLevel::Info, moon::format("[WORKER %u] destroy service [%s] ", worker_->id(), name().data()), id());
+}
+
+bool cluster_service::init(const moon::service_conf& conf)
+{
+    name_ = conf.name;
+
+    if (!conf.params.empty())
+    {
+        std::unique_ptr<lua_State, moon::state_deleter> L{ luaL_newstate() };
+        if (luaL_dostring(L.get(), conf.params.data()) != LUA_OK || !lua_istable(L.get(), -1))
+        {
+            CONSOLE_ERROR(logger(), "cluster_service::init params error: %s.", lua_tostring(L.get(), -1));
+            return false;
+        }
+        resolver_ = static_cast<uint32_t>(conf_integer(L.get(), "resolver", 0));
+        call_timeout_ = conf_integer(L.get(), "call_timeout", call_timeout_ / 1000) * 1000;
+        ping_interval_ = conf_integer(L.get(), "ping_interval", ping_interval_ / 1000) * 1000;
+        read_timeout_ = static_cast<uint32_t>(conf_integer(L.get(), "read_timeout", read_timeout_));
+        auto& opts = link_defaults_;
+        opts.batch_bytes = static_cast<uint32_t>(conf_integer(L.get(), "batch_bytes", opts.batch_bytes));
+        opts.delay_us = static_cast<uint32_t>(conf_integer(L.get(), "batch_delay_us", opts.delay_us));
+        opts.compress = conf_boolean(L.get(), "compress", opts.compress);
+        opts.dict_size = static_cast<uint32_t>(conf_integer(L.get(), "dict_size", opts.dict_size));
+        clamp(opts);
+    }
+
+    if (unique())
+    {
+        if (!server_->set_unique_service(name(), id()))
+        {
+            CONSOLE_ERROR(logger(), "cluster_service::init failed: unique service name %s repeated.", name().data());
+            return false;
+        }
+    }
+
+    timerid_ = server_->timeout(ping_interval_, id());
+
+    logger()->logstring(true, moon::LogLevel::Info, moon::format("[WORKER %u] new service [%s]", worker_->id(), name().data()), id());
+    ok_ = true;
+    return ok_;
+}
+
+void cluster_service::dispatch(message* msg)
+{
+    switch (msg->type())
+    {
+    case PTYPE_SOCKET_CLUSTER:
+        on_socket(msg);
+        break;
+    case PTYPE_LUA:
+    {
+        if (msg->sessionid() <= 0)
+        {
+            request(msg);
+            break;
+        }
+        //a local service answers an inbound call
+        auto it = inbound_calls_.find(msg->sessionid());
+        if (it != inbound_calls_.end())
+        {
+            auto c = it->second;
+            inbound_calls_.erase(it);
+            write_frame(c.fd, cluster_frame::response, msg->type(), std::string_view{}, c.addr, c.session, *msg);
+        }
+        break;
+    }
+    case PTYPE_ERROR:
+    {
+        if (auto it = connecting_.find(msg->sessionid()); it != connecting_.end())
+        {
+            uint32_t node = it->second;
+            connecting_.erase(it);
+            auto& p = peers_[node];
+            p.connecting = 0;
+            CONSOLE_WARN(logger(), "cluster node %u %s", node, std::string{ msg->bytes() }.data());
+            fail_pending(p, msg->bytes());
+        }
+        else if (auto iter = inbound_calls_.find(msg->sessionid()); iter != inbound_calls_.end())
+        {
+            auto c = iter->second;
+            inbound_calls_.erase(iter);
+            write_frame(c.fd, cluster_frame::error, PTYPE_ERROR, msg->header(), c.addr, c.session, *msg);
+        }
+        break;
+    }
+    case PTYPE_TEXT:
+    {
+        if (auto it = connecting_.find(msg->sessionid()); it != connecting_.end())
+        {
+            uint32_t node = it->second;
+            connecting_.erase(it);
+            auto& p = peers_[node];
+            p.connecting = 0;
+            p.fd = moon::string_convert<uint32_t>(msg->bytes());
+            if (auto opts = p.opts.value_or(link_defaults_); opts.batch_bytes > 0)
+            {
+                //announce the options, the peer mirrors them for its responses
+                open_link(p.fd, node, opts);
+                auto payload = message::create_buffer(sizeof(uint32_t), 0);
+                uint32_t dict_size = opts.dict_size;
+                host2net(dict_size);
+                payload->write_back(&dict_size, 1);
+                write_buffer(p.fd, make_head(cluster_frame::link, opts.compress ? 1 : 0, std::string_view{}, opts.batch_bytes, static_cast<int32_t>(opts.delay_us), payload->size()));
+                write_buffer(p.fd, std::move(payload));
+            }
+            auto queue = std::move(p.queue);
+            for (auto& m : queue)
+            {
+                forward(node, p, std::move(m));
+            }
+            break;
+        }
+        on_command(msg);
+        break;
+    }
+    case PTYPE_TIMER:
+    {
+        if (msg->sender() == timerid_)
+        {
+            on_timer();
+        }
+        break;
+    }
+    case PTYPE_SYSTEM:
+    {
+        if (msg->header() == "_service_exit")
+        {
+            for (auto it = services_.begin(); it != services_.end();)
+            {
+                if (it->second == msg->sender())
+                    it = services_.erase(it);
+                else
+                    ++it;
+            }
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void cluster_service::on_socket(message* msg)
+{
+    uint32_t fd = msg->sender();
+    switch (static_cast<socket_data_type>(msg->receiver()))
+    {
+    case socket_data_type::socket_recv:
+        on_frame(msg);
+        break;
+    case socket_data_type::socket_accept:
+        worker_->socket().settimeout(fd, read_timeout_);
+        CONSOLE_INFO(logger(), "cluster accept %u %s", fd, std::string{ msg->bytes() }.data());
+        break;
+    case socket_data_type::socket_connect:
+        CONSOLE_INFO(logger(), "cluster connect %u %s", fd, std::string{ msg->bytes() }.data());
+        break;
+    case socket_data_type::socket_error:
+        CONSOLE_WARN(logger(), "cluster socket error %u %s", fd, std::string{ msg->bytes() }.data());
+        break;
+    case socket_data_type::socket_close:
+        CONSOLE_INFO(logger(), "cluster close %u %s", fd, std::string{ msg->bytes() }.data());
+        on_closed(fd);
+        break;
+    default:
+        break;
+    }
+}
+
+void cluster_service::on_frame(message* msg, bool inner)
+{
+    uint32_t fd = msg->sender();
+    buffer* buf = msg->get_buffer();
+
+    cluster_frame f;
+    memcpy(&f, buf->data(), sizeof(f));
+    net2host(f.name_len);
+    net2host(f.addr);
+    net2host(f.session);
+
+    size_t head_len = sizeof(f) + f.name_len;
+    if (head_len > buf->size())
+    {
+        CONSOLE_WARN(logger(), "cluster bad frame from %u", fd);
+        worker_->socket().close(fd);
+        on_closed(fd);
+        return;
+    }
+
+    ++frames_in_;
+    if (!inner)
+    {
+        bytes_in_ += buf->size();
+        if (auto it = links_.find(fd); it != links_.end())
+        {
+            it->second.wire_in += buf->size();
+            it->second.raw_in += (f.kind == cluster_frame::batch) ? f.addr : buf->size();
+        }
+    }
+
+    std::string_view name{ buf->data() + sizeof(f), f.name_len };
+
+    switch (f.kind)
+    {
+    case cluster_frame::send:
+    case cluster_frame::call:
+    {
+        uint32_t to = find_service(name);
+        if (0 == to)
+        {
+            if (f.kind == cluster_frame::call)
+            {
+                auto err = message::create_buffer();
+                err->write_back("service not found: ", 19);
+                err->write_back(name.data(), name.size());
+                write_frame(fd, cluster_frame::error, PTYPE_ERROR, "cluster", f.addr, f.session, err);
+            }
+            else
+            {
+                CONSOLE_WARN(logger(), "cluster send to unknown service %s", std::string{ name }.data());
+            }
+            return;
+        }
+
+        int32_t sessionid = 0;
+        if (f.kind == cluster_frame::call)
+        {
+            sessionid = next_session();
+            inbound_calls_.emplace(sessionid, inbound_call{ fd, f.addr, f.session, server_->now() + 2 * call_timeout_ });
+        }
+
+        //redirect the frame buffer itself, only the header is skipped
+        buf->consume(head_len);
+        msg->set_sender(id());
+        msg->set_receiver(to);
+        msg->set_type(f.ptype);
+        msg->set_sessionid(-sessionid);
+        break;
+    }
+    case cluster_frame::response:
+    case cluster_frame::error:
+    {
+        auto it = outbound_calls_.find(fd);
+        if (it == outbound_calls_.end() || it->second.erase(call_key(f.addr, f.session)) == 0)
+        {
+            //already timed out
+            return;
+        }
+
+        buf->consume(head_len);
+        msg->set_sender(id());
+        msg->set_receiver(f.addr);
+        msg->set_sessionid(f.session);
+        if (f.kind == cluster_frame::error)
+        {
+            ++call_errors_;
+            msg->set_type(PTYPE_ERROR);
+            msg->set_header(name.empty() ? "cluster"sv : name);
+        }
+        else
+        {
+            msg->set_type(f.ptype);
+        }
+        break;
+    }
+    case cluster_frame::ping:
+        write_frame(fd, cluster_frame::pong, 0, std::string_view{}, 0, 0, nullptr);
+        break;
+    case cluster_frame::pong:
+        break;
+    case cluster_frame::batch:
+    {
+        if (inner)
+        {
+            CONSOLE_WARN(logger(), "cluster nested batch from %u", fd);
+            break;
+        }
+        auto& l = links_[fd];
+        on_batch(fd, l, f.ptype, f.addr, buf->data() + head_len, buf->size() - head_len);
+        break;
+    }
+    case cluster_frame::dict:
+    {
+        links_[fd].peer_dict.assign(buf->data() + head_len, buf->size() - head_len);
+        break;
+    }
+    case cluster_frame::link:
+    {
+        if (buf->size() - head_len < sizeof(uint32_t))
+        {
+            break;
+        }
+        link_options opts;
+        opts.batch_bytes = f.addr;
+        opts.delay_us = static_cast<uint32_t>(f.session);
+        opts.compress = (f.ptype != 0);
+        memcpy(&opts.dict_size, buf->data() + head_len, sizeof(opts.dict_size));
+        net2host(opts.dict_size);
+        clamp(opts);
+        open_link(fd, 0, opts);
+        break;
+    }
+    default:
+        CONSOLE_WARN(logger(), "cluster unknown frame kind %u from %u", (uint32_t)f.kind, fd);
+        break;
+    }
+}
+
+void cluster_service::on_batch(uint32_t fd, link& l, uint8_t flags, uint32_t rawsize, const char* data, size_t size)
+{
+    buffer_ptr_t raw;
+    if (flags & 1)
+    {
+        double start = moon::time::clock();
+        std::string_view dict = (flags & 2) ? std::string_view{ l.peer_dict } : std::string_view{};
+        if (rawsize <= cluster_connection::MAX_FRAME_SIZE)
+        {
+            raw = message::create_buffer(rawsize, 0);
+            raw->prepare(rawsize);
+        }
+        if (!raw || !lz::decompress(data, size, raw->data(), rawsize, dict))
+        {
+            CONSOLE_WARN(logger(), "cluster bad compressed batch from %u", fd);
+            worker_->socket().close(fd);
+            on_closed(fd);
+            return;
+        }
+        raw->commit(rawsize);
+        l.decompress_cost += moon::time::clock() - start;
+        data = raw->data();
+        size = rawsize;
+    }
+
+    //every packed frame is handled as if it was read alone
+    while (size >= sizeof(cluster_frame))
+    {
+        uint32_t len = 0;
+        memcpy(&len, data, sizeof(len));
+        net2host(len);
+        size_t total = sizeof(len) + static_cast<size_t>(len);
+        if (total < sizeof(cluster_frame) || total > size)
+        {
+            break;
+        }
+
+        auto fb = message::create_buffer(total);
+        fb->write_back(data, total);
+        auto m = message::create(std::move(fb));
+        m->set_sender(fd);
+        m->set_type(PTYPE_SOCKET_CLUSTER);
+        m->set_receiver(static_cast<uint8_t>(socket_data_type::socket_recv));
+        on_frame(m.get(), true);
+        if (m->receiver() != static_cast<uint8_t>(socket_data_type::socket_recv))
+        {
+            server_->send_message(std::move(m));
+        }
+        data += total;
+        size -= total;
+    }
+
+    if (size != 0)
+    {
+        CONSOLE_WARN(logger(), "cluster bad batch from %u", fd);
+    }
+}
+
+void cluster_service::request(message* msg)
+{
+    std::string_view header = msg->header();
+    size_t pos = header.find(':');
+    std::errc ec{};
+    uint32_t node = (pos == std::string_view::npos) ? 0 : moon::string_convert<uint32_t>(header.substr(0, pos), ec);
+    if (pos == std::string_view::npos || ec != std::errc() || pos + 1 == header.size())
+    {
+        if (msg->sessionid() < 0)
+        {
+            fail_call(msg->sender(), -msg->sessionid(), "invalid cluster header");
+        }
+        CONSOLE_WARN(logger(), "cluster invalid header '%s' from %08X", std::string{ header }.data(), msg->sender());
+        return;
+    }
+
+    auto& p = peers_[node];
+    std::string_view sname = header.substr(pos + 1);
+    if (p.fd != 0)
+    {
+        uint8_t kind = msg->sessionid() < 0 ? cluster_frame::call : cluster_frame::send;
+        if (write_frame(p.fd, kind, msg->type(), sname, msg->sender(), -msg->sessionid(), *msg))
+        {
+            if (kind == cluster_frame::call)
+            {
+                outbound_calls_[p.fd].emplace(call_key(msg->sender(), -msg->sessionid()), server_->now() + call_timeout_);
+            }
+            return;
+        }
+        p.fd = 0;
+    }
+
+    pending_message m;
+    m.sender = msg->sender();
+    m.sessionid = msg->sessionid();
+    m.type = msg->type();
+    m.name = sname;
+    m.data = *msg;
+    forward(node, p, std::move(m));
+}
+
+void cluster_service::forward(uint32_t node, peer& p, pending_message&& m)
+{
+    if (p.fd != 0)
+    {
+        uint8_t kind = m.sessionid < 0 ? cluster_frame::call : cluster_frame::send;
+        if (write_frame(p.fd, kind, m.type, m.name, m.sender, -m.sessionid, m.data))
+        {
+            if (kind == cluster_frame::call)
+            {
+                outbound_calls_[p.fd].emplace(call_key(m.sender, -m.sessionid), server_->now() + call_timeout_);
+            }
+            return;
+        }
+        p.fd = 0;
+    }
+
+    p.queue.emplace_back(std::move(m));
+
+    if (p.connecting != 0 || p.resolving)
+    {
+        return;
+    }
+
+    if (!p.host.empty())
+    {
+        connect(node, p);
+    }
+    else if (resolver_ != 0)
+    {
+        p.resolving = true;
+        auto req = message::create();
+        req->set_sender(id());
+        req->set_receiver(resolver_);
+        req->set_type(PTYPE_TEXT);
+        req->set_header("resolve"sv);
+        req->write_data(std::to_string(node));
+        server_->send_message(std::move(req));
+    }
+    else
+    {
+        fail_pending(p, moon::format("unknown node %u", node));
+    }
+}
+
+bool cluster_service::write_frame(uint32_t fd, uint8_t kind, uint8_t ptype, std::string_view name, uint32_t addr, int32_t session, const buffer_ptr_t& payload)
+{
+    size_t payload_size = payload ? payload->size() : 0;
+    size_t total = sizeof(cluster_frame) + name.size() + payload_size;
+    if (total > cluster_connection::MAX_FRAME_SIZE || name.size() > std::numeric_limits<uint16_t>::max())
+    {
+        CONSOLE_ERROR(logger(), "cluster frame too big: %zu", total);
+        return false;
+    }
+
+    auto it = links_.find(fd);
+    if (it != links_.end() && it->second.opts.batch_bytes > 0)
+    {
+        auto& l = it->second;
+        //big frames are not worth a copy unless they get compressed
+        if (l.opts.compress || total < l.opts.batch_bytes)
+        {
+            if (!l.batch)
+            {
+                l.batch = message::create_buffer(l.opts.batch_bytes, 0);
+            }
+            l.batch->write_back(make_head(kind, ptype, name, addr, session, payload_size)->data(), sizeof(cluster_frame) + name.size());
+            if (payload_size != 0)
+            {
+                l.batch->write_back(payload->data(), payload_size);
+            }
+            ++l.batch_frames;
+            ++frames_out_;
+            //only frames queued behind an in-flight write wait, a lone call is not delayed
+            if (l.batch->size() >= l.opts.batch_bytes || worker_->socket().send_queue_size(fd) == 0)
+            {
+                flush(fd);
+            }
+            else
+            {
+                flush_later(fd, l);
+            }
+            return true;
+        }
+        //keep frame order
+        flush(fd);
+    }
+
+    if (!write_buffer(fd, make_head(kind, ptype, name, addr, session, payload_size)))
+    {
+        return false;
+    }
+    //the payload follows in the same gathered write, never copied
+    if (payload_size != 0)
+    {
+        write_buffer(fd, payload);
+    }
+    ++frames_out_;
+    bytes_out_ += total;
+    return true;
+}
+
+bool cluster_service::write_buffer(uint32_t fd, buffer_ptr_t buf)
+{
+    return worker_->socket().write(fd, std::move(buf));
+}
+
+cluster_service::link& cluster_service::open_link(uint32_t fd, uint32_t node, const link_options& opts)
+{
+    auto& l = links_[fd];
+    l = link{};
+    l.opts = opts;
+    l.node = node;
+    return l;
+}
+
+void cluster_service::clamp(link_options& opts)
+{
+    opts.batch_bytes = std::min<uint32_t>(opts.batch_bytes, cluster_connection::MAX_FRAME_SIZE / 2);
+    opts.delay_us = std::min(opts.delay_us, MAX_DELAY_US);
+    //lz matches reach back MAX_OFFSET bytes, a bigger dictionary is never used
+    opts.dict_size = std::min<uint32_t>(opts.dict_size, static_cast<uint32_t>(lz::MAX_OFFSET));
+}
+
+void cluster_service::flush(uint32_t fd)
+{
+    auto it = links_.find(fd);
+    if (it == links_.end() || !it->second.batch || it->second.batch->size() == 0)
+    {
+        return;
+    }
+
+    auto& l = it->second;
+    auto raw = std::move(l.batch);
+    uint32_t frames = l.batch_frames;
+    l.batch_frames = 0;
+    ++l.batches;
+    l.frames += frames;
+    l.raw_out += raw->size();
+
+    if (l.opts.compress)
+    {
+        if (l.dict.empty() && l.opts.dict_size > 0)
+        {
+            //the first dict_size bytes of traffic become the dictionary of the link
+            l.samples.append(raw->data(), std::min<size_t>(raw->size(), l.opts.dict_size - l.samples.size()));
+            if (l.samples.size() >= l.opts.dict_size)
+            {
+                l.dict.reset(l.samples);
+                l.samples = std::string{};
+                auto content = l.dict.content();
+                auto d = message::create_buffer(content.size(), 0);
+                d->write_back(content.data(), content.size());
+                auto head = make_head(cluster_frame::dict, 0, std::string_view{}, 0, 0, d->size());
+                size_t n = head->size() + d->size();
+                write_buffer(fd, std::move(head));
+                write_buffer(fd, std::move(d));
+                l.wire_out += n;
+                bytes_out_ += n;
+            }
+        }
+
+        double start = moon::time::clock();
+        size_t bound = lz::compress_bound(raw->size());
+        auto out = message::create_buffer(sizeof(cluster_frame) + bound, 0);
+        out->prepare(sizeof(cluster_frame) + bound);
+        size_t n = l.dict.compress(raw->data(), raw->size(), out->data() + sizeof(cluster_frame), bound);
+        l.compress_cost += moon::time::clock() - start;
+        if (n != 0 && sizeof(cluster_frame) + n < raw->size() && sizeof(cluster_frame) + n <= cluster_connection::MAX_FRAME_SIZE)
+        {
+            uint8_t flags = l.dict.empty() ? 1 : 3;
+            auto head = make_head(cluster_frame::batch, flags, std::string_view{}, static_cast<uint32_t>(raw->size()), static_cast<int32_t>(frames), n);
+            memcpy(out->data(), head->data(), sizeof(cluster_frame));
+            out->commit(sizeof(cluster_frame) + n);
+            raw = std::move(out);
+        }
+    }
+
+    //uncompressed batches are the plain frames back to back
+    l.wire_out += raw->size();
+    bytes_out_ += raw->size();
+    write_buffer(fd, std::move(raw));
+}
+
+void cluster_service::flush_later(uint32_t fd, const link& l)
+{
+    if (std::find(dirty_.begin(), dirty_.end(), fd) == dirty_.end())
+    {
+        dirty_.push_back(fd);
+    }
+
+    if (flush_armed_)
+    {
+        return;
+    }
+
+    flush_armed_ = true;
+    if (!flush_timer_)
+    {
+        flush_timer_ = std::make_shared<asio::steady_timer>(worker_->io_context());
+    }
+    flush_timer_->expires_after(std::chrono::microseconds(l.opts.delay_us));
+    flush_timer_->async_wait([this, timer = std::weak_ptr<asio::steady_timer>(flush_timer_)](const asio::error_code& e)
+    {
+        //the timer dies with the service
+        if (e || timer.expired())
+        {
+            return;
+        }
+        flush_armed_ = false;
+        auto dirty = std::move(dirty_);
+        dirty_.clear();
+        for (auto fd : dirty)
+        {
+            flush(fd);
+        }
+    });
+}
+
+void cluster_service::connect(uint32_t node, peer& p)
+{
+    int32_t sessionid = next_session();
+    p.connecting = sessionid;
+    connecting_.emplace(sessionid, node);
+    worker_->socket().connect(p.host, p.port, id(), PTYPE_SOCKET_CLUSTER, sessionid, 1000);
+}
+
+void cluster_service::fail_pending(peer& p, std::string_view reason)
+{
+    auto queue = std::move(p.queue);
+    for (auto& m : queue)
+    {
+        if (m.sessionid < 0)
+        {
+            fail_call(m.sender, -m.sessionid, reason);
+        }
+        else
+        {
+            CONSOLE_WARN(logger(), "cluster drop message to %s: %s", m.name.data(), std::string{ reason }.data());
+        }
+    }
+}
+
+void cluster_service::fail_call(uint32_t caller, int32_t session, std::string_view reason)
+{
+    ++call_errors_;
+    server_->response(caller, "cluster"sv, reason, session, PTYPE_ERROR);
+}
+
+void cluster_service::on_closed(uint32_t fd)
+{
+    if (auto it = outbound_calls_.find(fd); it != outbound_calls_.end())
+    {
+        auto calls = std::move(it->second);
+        outbound_calls_.erase(it);
+        for (auto& c : calls)
+        {
+            fail_call(static_cast<uint32_t>(c.first & 0xFFFFFFFF), static_cast<int32_t>(c.first >> 32), "socket disconnect");
+        }
+    }
+
+    links_.erase(fd);
+
+    for (auto it = inbound_calls_.begin(); it != inbound_calls_.end();)
+    {
+        if (it->second.fd == fd)
+            it = inbound_calls_.erase(it);
+        else
+            ++it;
+    }
+
+    for (auto& it : peers_)
+    {
+        if (it.second.fd == fd)
+        {
+            it.second.fd = 0;
+            break;
+        }
+    }
+}
+
+void cluster_service::on_command(message* msg)
+{
+    std::string_view cmd = msg->header();
+    auto params = moon::split<std::string_view>(msg->bytes(), " ");
+    std::string res;
+    std::string err;
+
+    if (cmd == "listen" && params.size() == 2)
+    {
+        std::errc ec{};
+        auto port = moon::string_convert<uint16_t>(params[1], ec);
+        auto& sock = worker_->socket();
+        if (listenfd_ != 0)
+        {
+            err = "cluster already listening";
+        }
+        else if (ec != std::errc() || 0 == (listenfd_ = sock.listen(std::string{ params[0] }, port, id(), PTYPE_SOCKET_CLUSTER)))
+        {
+            err = moon::format("cluster listen %s failed", std::string{ msg->bytes() }.data());
+        }
+        else
+        {
+            sock.accept(listenfd_, 0, id());
+            CONSOLE_INFO(logger(), "cluster run at %s", std::string{ msg->bytes() }.data());
+            res = "true";
+        }
+    }
+    else if (cmd == "node" && (params.size() == 3 || params.size() == 7))
+    {
+        std::errc ec1{}, ec2{}, ec3{};
+        auto node = moon::string_convert<uint32_t>(params[0], ec1);
+        auto port = moon::string_convert<uint16_t>(params[2], ec2);
+        std::optional<link_options> opts;
+        if (params.size() == 7)
+        {
+            opts.emplace();
+            std::errc e1{}, e2{}, e3{};
+            opts->batch_bytes = moon::string_convert<uint32_t>(params[3], e1);
+            opts->delay_us = moon::string_convert<uint32_t>(params[4], e2);
+            opts->compress = (params[5] == "true" || params[5] == "1");
+            opts->dict_size = moon::string_convert<uint32_t>(params[6], e3);
+            clamp(*opts);
+            if (e1 != std::errc() || e2 != std::errc() || e3 != std::errc())
+            {
+                ec3 = std::errc::invalid_argument;
+            }
+        }
+
+        if (ec1 != std::errc() || ec2 != std::errc() || ec3 != std::errc())
+        {
+            err = "invalid node";
+        }
+        else
+        {
+            auto& p = peers_[node];
+            p.resolving = false;
+            p.host = params[1];
+            p.port = port;
+            if (opts)
+            {
+                p.opts = opts;
+            }
+            if (!p.queue.empty() && p.fd == 0 && p.connecting == 0)
+            {
+                connect(node, p);
+            }
+            res = "true";
+        }
+    }
+    else if (cmd == "node_error" && !params.empty())
+    {
+        std::errc ec{};
+        auto node = moon::string_convert<uint32_t>(params[0], ec);
+        if (auto it = peers_.find(node); ec == std::errc() && it != peers_.end())
+        {
+            it->second.resolving = false;
+            std::string_view reason = msg->bytes().substr(params[0].size());
+            fail_pending(it->second, moon::format("resolve node %u failed:%s", node, std::string{ reason }.data()));
+        }
+        res = "true";
+    }
+    else if (cmd == "stats")
+    {
+        size_t connected = 0;
+        size_t queued = 0;
+        size_t outbound = 0;
+        for (auto& it : peers_)
+        {
+            connected += (it.second.fd != 0) ? 1 : 0;
+            queued += it.second.queue.size();
+        }
+        for (auto& it : outbound_calls_)
+        {
+            outbound += it.second.size();
+        }
+        std::string links;
+        for (auto& it : links_)
+        {
+            auto& l = it.second;
+            if (!links.empty())
+            {
+                links.append(",");
+            }
+            links.append(moon::format(R"({"fd":%u,"node":%u,"compress":%s,"batches":%zu,"frames":%zu,"raw_out":%zu,"wire_out":%zu,"raw_in":%zu,"wire_in":%zu,"compress_ms":%.3f,"decompress_ms":%.3f})"
+                , it.first, l.node, l.opts.compress ? "true" : "false", l.batches, l.frames, l.raw_out, l.wire_out, l.raw_in, l.wire_in, l.compress_cost * 1000, l.decompress_cost * 1000));
+        }
+        res = moon::format(R"({"peers":%zu,"connected":%zu,"queued":%zu,"outbound_calls":%zu,"inbound_calls":%zu,"frames_in":%zu,"frames_out":%zu,"bytes_in":%zu,"bytes_out":%zu,"call_errors":%zu,"links":[%s]})"
+            , peers_.size(), connected, queued, outbound, inbound_calls_.size(), frames_in_, frames_out_, bytes_in_, bytes_out_, call_errors_, links.data());
+    }
+    else
+    {
+        err = moon::format("cluster unknown command '%s'", std::string{ cmd }.data());
+    }
+
+    if (msg->sessionid() < 0)
+    {
+        if (err.empty())
+            server_->response(msg->sender(), std::string_view{}, res, -msg->sessionid());
+        else
+            server_->response(msg->sender(), "cluster"sv, err, -msg->sessionid(), PTYPE_ERROR);
+    }
+    else if (!err.empty())
+    {
+        CONSOLE_WARN(logger(), "%s", err.data());
+    }
+}
+
+void cluster_service::on_timer()
+{
+    auto now = server_->now();
+    for (auto& it : outbound_calls_)
+    {
+        auto& calls = it.second;
+        for (auto c = calls.begin(); c != calls.end();)
+        {
+            if (now > c->second)
+            {
+                fail_call(static_cast<uint32_t>(c->first & 0xFFFFFFFF), static_cast<int32_t>(c->first >> 32), "socket read timeout");
+                c = calls.erase(c);
+            }
+            else
+            {
+                ++c;
+            }
+        }
+    }
+
+    for (auto it = inbound_calls_.begin(); it != inbound_calls_.end();)
+    {
+        if (now > it->second.deadline)
+            it = inbound_calls_.erase(it);
+        else
+            ++it;
+    }
+
+    for (auto& it : peers_)
+    {
+        if (it.second.fd != 0)
+        {
+            write_frame(it.second.fd, cluster_frame::ping, 0, std::string_view{}, 0, 0, nullptr);
+        }
+    }
+
+    timerid_ = server_->timeout(ping_interval_, id());
+}
+
+uint32_t cluster_service::find_service(std::string_view name)
+{
+    std::string key{ name };
+    if (auto it = services_.find(key); it != services_.end())
+    {
+        return it->second;
+    }
+    uint32_t addr = server_->get_unique_service(key);
+    if (addr != 0)
+    {
+        services_.emplace(std::move(key), addr);
+    }
+    return addr;
+}
+
+int32_t cluster_service::next_session()
+{
+    if (++session_seq_ == std::numeric_limits<int32_t>::max())
+    {
+        session_seq_ = 1;
+    }
+    return session_seq_;
+}
@@ -0,0 +1,163 @@
+#pragma once
+#include <optional>
+#include "config.hpp"
+#include "service.hpp"
+#include "asio.hpp"
+#include "common/lz.hpp"
+
+//native cluster router.
+//Local services send PTYPE_LUA messages with header "node:sname", a negative
+//sessionid makes it a call. Payload buffers are forwarded untouched: outbound
+//they are queued behind a small frame header on the peer connection, inbound
+//the frame header is consumed and the same buffer is redirected to the target.
+//Control commands are PTYPE_TEXT messages, the header is the command:
+//  listen "host port"          start accepting peers
+//  node "node host port [batch_bytes delay_us compress dict_size]"
+//                              set the address and link options of a node
+//  node_error "node errmsg"    resolve failed, pending messages of the node fail
+//  stats ""                    json counters
+//Unknown nodes are asked from the `resolver` service with a "resolve" text message.
+//Links with batch_bytes > 0 write a frame at once while the connection is idle,
+//frames that arrive while a write is in flight coalesce for up to delay_us
+//microseconds or batch_bytes bytes into one write. With compress the batch is
+//lz compressed against a dictionary made of the first dict_size bytes sent on
+//the link (a plain prefix of the traffic, not a trained dictionary).
+//delay_us is capped at MAX_DELAY_US and dict_size at lz::MAX_OFFSET, whoever sets them.
+//The connecting side announces its options, the accepting side mirrors them.
+class cluster_service :public moon::service
+{
+    struct pending_message
+    {
+        uint32_t sender = 0;
+        int32_t sessionid = 0;
+        uint8_t type = 0;
+        std::string name;
+        moon::buffer_ptr_t data;
+    };
+
+    struct link_options
+    {
+        uint32_t batch_bytes = 0;//0 no batching, frames are written zero copy
+        uint32_t delay_us = 200;
+        bool compress = false;
+        uint32_t dict_size = 16384;
+    };
+
+    //longest a batched frame may wait
+    static constexpr uint32_t MAX_DELAY_US = 100000;
+
+    struct peer
+    {
+        bool resolving = false;
+        int32_t connecting = 0;
+        uint32_t fd = 0;
+        uint16_t port = 0;
+        std::string host;
+        std::optional<link_options> opts;
+        std::vector<pending_message> queue;
+    };
+
+    //an inbound call waiting for the local service
+    struct inbound_call
+    {
+        uint32_t fd = 0;
+        uint32_t addr = 0;
+        int32_t session = 0;
+        int64_t deadline = 0;
+    };
+
+    //outbound calls waiting for the remote node, key (session<<32)|caller
+    using call_watch = std::unordered_map<uint64_t, int64_t>;
+
+    //batching and compression state of one peer connection
+    struct link
+    {
+        link_options opts;
+        uint32_t node = 0;
+        uint32_t batch_frames = 0;
+        moon::buffer_ptr_t batch;
+        std::string samples;
+        //hashed once when the samples are complete, reused by every batch
+        moon::lz::dictionary dict;
+        std::string peer_dict;
+        size_t batches = 0;
+        size_t frames = 0;
+        size_t raw_out = 0;
+        size_t wire_out = 0;
+        size_t raw_in = 0;
+        size_t wire_in = 0;
+        double compress_cost = 0.0;
+        double decompress_cost = 0.0;
+    };
+public:
+    cluster_service() = default;
+
+    ~cluster_service();
+
+private:
+    bool init(const moon::service_conf& conf) override;
+
+    void dispatch(moon::message* msg) override;
+
+    void on_socket(moon::message* msg);
+
+    void on_frame(moon::message* msg, bool inner = false);
+
+    void on_batch(uint32_t fd, link& l, uint8_t flags, uint32_t rawsize, const char* data, size_t size);
+
+    void on_command(moon::message* msg);
+
+    void on_timer();
+
+    void request(moon::message* msg);
+
+    void forward(uint32_t node, peer& p, pending_message&& m);
+
+    bool write_frame(uint32_t fd, uint8_t kind, uint8_t ptype, std::string_view name, uint32_t addr, int32_t session, const moon::buffer_ptr_t& payload);
+
+    bool write_buffer(uint32_t fd, moon::buffer_ptr_t buf);
+
+    link& open_link(uint32_t fd, uint32_t node, const link_options& opts);
+
+    //options come from the conf, the node command and the peer: keep them in range
+    static void clamp(link_options& opts);
+
+    void flush(uint32_t fd);
+
+    void flush_later(uint32_t fd, const link& l);
+
+    void connect(uint32_t node, peer& p);
+
+    void fail_pending(peer& p, std::string_view reason);
+
+    void fail_call(uint32_t caller, int32_t session, std::string_view reason);
+
+    void on_closed(uint32_t fd);
+
+    uint32_t find_service(std::string_view name);
+
+    int32_t next_session();
+private:
+    uint32_t listenfd_ = 0;
+    uint32_t resolver_ = 0;
+    uint32_t timerid_ = 0;
+    int32_t session_seq_ = 0;
+    int64_t call_timeout_ = 10000;
+    int64_t ping_interval_ = 5000;
+    uint32_t read_timeout_ = 180;
+    size_t frames_in_ = 0;
+    size_t frames_out_ = 0;
+    size_t bytes_in_ = 0;
+    size_t bytes_out_ = 0;
+    size_t call_errors_ = 0;
+    bool flush_armed_ = false;
+    link_options link_defaults_;
+    std::shared_ptr<asio::steady_timer> flush_timer_;
+    std::vector<uint32_t> dirty_;
+    std::unordered_map<uint32_t, link> links_;
+    std::unordered_map<uint32_t, peer> peers_;
+    std::unordered_map<int32_t, uint32_t> connecting_;
+    std::unordered_map<uint32_t, call_watch> outbound_calls_;
+    std::unordered_map<int32_t, inbound_call> inbound_calls_;
+    std::unordered_map<std::string, uint32_t> services_;
+};
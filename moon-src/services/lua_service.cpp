@@ -5,6 +5,12 @@
 #include "common/hash.hpp"
 #include "common/lua_utility.hpp"
 
+extern "C" {
+//the thread list to hook the coroutines, the running thread for memtrace
+#include "lstate.h"
+#include "lgc.h"
+}
+
 #ifdef MOON_ENABLE_MIMALLOC
 #include "mimalloc.h"
 #define free mi_free 
@@ -45,6 +51,18 @@ void *lua_service::lalloc(void *ud, void *ptr, size_t osize, size_t nsize)
                                moon::format("%s Memory warning %.2f M", l->name().data(), (float)l->mem / mb_memory), l->id());
     }
 
+    //adaptive gc backstop: a batch allocating faster than gc_step collects hands the
+    //collector back to lua, only two field writes, safe inside the allocator
+    if (l->gc_backstop_ != 0 && l->mem > l->gc_backstop_ && (ptr == nullptr || nsize > osize))
+    {
+        l->gc_backstop_ = 0;
+        ++l->gc_backstops_;
+        lua_gc(l->lua_.get(), LUA_GCRESTART);
+    }
+
+    if (nullptr != l->memtrace_ && nullptr != ptr)
+        l->memtrace_free(ptr);
+
     if (nsize == 0)
     {
         free(ptr);
@@ -52,7 +70,10 @@ void *lua_service::lalloc(void *ud, void *ptr, size_t osize, size_t nsize)
     }
     else
     {
-        return realloc(ptr, nsize);
+        void* nptr = realloc(ptr, nsize);
+        if (nullptr != l->memtrace_ && nullptr != nptr)
+            l->memtrace_alloc(nptr, nsize);
+        return nptr;
     }
 }
 
@@ -76,7 +97,26 @@ bool lua_service::init(const moon::service_conf& conf)
 
         lua_State* L = lua_.get();
         lua_gc(L, LUA_GCSTOP, 0);
-        lua_gc(L, LUA_GCGEN, 0, 0);
+        if (conf.gcmode.empty() || conf.gcmode == "gen")
+        {
+            lua_gc(L, LUA_GCGEN, conf.gcminormul, conf.gcmajormul);
+        }
+        else if (conf.gcmode == "inc" || conf.gcmode == "adaptive")
+        {
+            lua_gc(L, LUA_GCINC, conf.gcpause, conf.gcstepmul, conf.gcstepsize);
+            if (conf.gcmode == "adaptive")
+            {
+                gc_adaptive_ = true;
+                gc_pause_ = (conf.gcpause > 0) ? conf.gcpause : GC_DEFAULT_PAUSE;
+                gc_budget_ = (conf.gcbudget > 0) ? conf.gcbudget : GC_DEFAULT_BUDGET;
+            }
+        }
+        else
+        {
+            MOON_CHECK(false, moon::format("unknown gcmode '%s'", conf.gcmode.data()));
+        }
+        gc_mode_ = conf.gcmode.empty() ? "gen" : conf.gcmode;
+        G(L)->gcobserver = gc_observer;
 
         luaL_openlibs(L);
 
@@ -113,7 +153,17 @@ bool lua_service::init(const moon::service_conf& conf)
 
         logger()->logstring(true, moon::LogLevel::Info, moon::format("[WORKER %u] new service [%s]", worker_->id(), name().data()), id());
         ok_ = true;
-        lua_gc(L, LUA_GCRESTART, 0);
+        if (gc_adaptive_)
+        {
+            //stays stopped, gc_step runs the collector
+            gc_threshold_ = mem / 100 * gc_pause_;
+            gc_backstop_ = gc_threshold_ * GC_BACKSTOP;
+            worker_->add_gc(id());
+        }
+        else
+        {
+            lua_gc(L, LUA_GCRESTART, 0);
+        }
     }
     catch (const std::exception &e)
     {
@@ -122,10 +172,516 @@ bool lua_service::init(const moon::service_conf& conf)
     return ok_;
 }
 
+void lua_service::run_deferred()
+{
+    if (!ok())
+        return;
+    lua_State* L = lua_.get();
+    int top = lua_gettop(L);
+    if (top == 0)
+    {
+        lua_pushcfunction(L, traceback);
+        lua_rawgetp(L, LUA_REGISTRYINDEX, this);
+    }
+    else
+    {
+        assert(top == 2);
+    }
+
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, &DEFERRED_KEY) != LUA_TFUNCTION)
+    {
+        lua_pop(L, 1);
+        return;
+    }
+
+    if (lua_pcall(L, 0, 0, 1) != LUA_OK)
+    {
+        CONSOLE_ERROR(logger(), "run deferred %s error:\n%s", name().data(), lua_tostring(L, -1));
+        lua_pop(L, 1);
+    }
+}
+
+int32_t lua_service::make_session(lua_State* L, uint32_t watcher, int64_t deadline)
+{
+    int32_t sessionid = sessions_.make(watcher, deadline);
+    if (0 == sessionid)
+    {
+        return 0;
+    }
+
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, &SESSION_KEY) != LUA_TTABLE)
+    {
+        lua_pop(L, 1);
+        lua_createtable(L, 64, 0);
+        lua_pushvalue(L, -1);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &SESSION_KEY);
+    }
+    lua_pushthread(L);
+    lua_rawseti(L, -2, (lua_Integer)session_table::index(sessionid) + 1);
+    lua_pop(L, 1);
+
+    if (deadline != 0)
+    {
+        worker_->add_deadline(deadline, id(), sessionid);
+    }
+    return sessionid;
+}
+
+void lua_service::take_session(lua_State* L, int32_t sessionid)
+{
+    auto s = sessions_.find(sessionid);
+    if (nullptr == s)
+    {
+        lua_pushnil(L);
+        return;
+    }
+
+    if (s->st == session_table::state::cancelled)
+    {
+        sessions_.release(sessionid);
+        lua_pushboolean(L, 0);
+        return;
+    }
+
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &SESSION_KEY);
+    lua_Integer n = (lua_Integer)session_table::index(sessionid) + 1;
+    lua_rawgeti(L, -1, n);
+    lua_pushnil(L);
+    lua_rawseti(L, -3, n);
+    lua_remove(L, -2);
+
+    if (s->st == session_table::state::expired)
+    {
+        //either the response or the timeout error is still on its way
+        reap_session(sessionid);
+    }
+    else
+    {
+        sessions_.release(sessionid);
+    }
+}
+
+void lua_service::cancel_session(int32_t sessionid)
+{
+    auto s = sessions_.find(sessionid);
+    if (nullptr == s || s->st == session_table::state::cancelled)
+    {
+        return;
+    }
+
+    lua_State* L = lua_.get();
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, &SESSION_KEY) == LUA_TTABLE)
+    {
+        lua_pushnil(L);
+        lua_rawseti(L, -2, (lua_Integer)session_table::index(sessionid) + 1);
+    }
+    lua_pop(L, 1);
+
+    reap_session(sessionid);
+}
+
+void lua_service::reap_session(int32_t sessionid)
+{
+    int64_t reap_at = server_->now() + SESSION_REAP_MS;
+    sessions_.cancel(sessionid, reap_at);
+    worker_->add_deadline(reap_at, id(), sessionid);
+}
+
+void lua_service::on_deadline(int32_t sessionid, int64_t deadline)
+{
+    //wheel entries are never removed, skip the ones the session no longer waits for
+    auto s = sessions_.find(sessionid);
+    if (nullptr == s || s->deadline != deadline)
+    {
+        return;
+    }
+
+    if (s->st == session_table::state::parked)
+    {
+        s->st = session_table::state::expired;
+        s->deadline = 0;
+        server_->response(id(), "timeout"sv, std::string_view{}, sessionid, PTYPE_ERROR);
+    }
+    else if (s->st == session_table::state::cancelled)
+    {
+        sessions_.release(sessionid);
+    }
+}
+
+void lua_service::replace_hook(lua_State* L, lua_Hook from, lua_Hook hook, int mask, int count)
+{
+    //coroutines created later inherit the hook of the creating thread.
+    //threads hooked by someone else(debug.sethook) are left alone
+    global_State* g = G(L);
+    if (lua_gethook(g->mainthread) == from)
+    {
+        lua_sethook(g->mainthread, hook, mask, count);
+    }
+    for (GCObject* o = g->allgc; o != nullptr; o = o->next)
+    {
+        if (o->tt == LUA_VTHREAD && lua_gethook(gco2th(o)) == from)
+        {
+            lua_sethook(gco2th(o), hook, mask, count);
+        }
+    }
+}
+
+bool lua_service::has_hook(lua_State* L)
+{
+    global_State* g = G(L);
+    if (nullptr != lua_gethook(g->mainthread))
+    {
+        return true;
+    }
+    for (GCObject* o = g->allgc; o != nullptr; o = o->next)
+    {
+        if (o->tt == LUA_VTHREAD && nullptr != lua_gethook(gco2th(o)))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void lua_service::profile_hook(lua_State* L, lua_Debug*)
+{
+    lua_getfield(L, LUA_REGISTRYINDEX, LMOON_GLOBAL);
+    auto S = static_cast<lua_service*>(lua_touserdata(L, -1));
+    lua_pop(L, 1);
+    if (nullptr == S || nullptr == S->profiler_)
+    {
+        return;
+    }
+
+    auto& p = *S->profiler_;
+    lua_Debug ar;
+    int depth = 0;
+    for (; depth < profiler::MAX_DEPTH && lua_getstack(L, depth, &ar); ++depth)
+    {
+        lua_getinfo(L, "Sn", &ar);
+        auto& frame = p.frames[depth];
+        frame.clear();
+        if (ar.what[0] == 'C')
+        {
+            frame.append("[C]");
+        }
+        else
+        {
+            frame.append(ar.short_src);
+            frame.append(":");
+            frame.append(std::to_string(ar.linedefined));
+        }
+        if (nullptr != ar.name)
+        {
+            frame.append("(");
+            frame.append(ar.name);
+            frame.append(")");
+        }
+    }
+
+    //folded stacks list the outermost frame first
+    p.stack.clear();
+    if (depth == profiler::MAX_DEPTH)
+    {
+        p.stack.append("...;");
+    }
+    for (int i = depth - 1; i >= 0; --i)
+    {
+        p.stack.append(p.frames[i]);
+        if (i != 0)
+        {
+            p.stack.append(";");
+        }
+    }
+    ++p.stacks[p.stack];
+    ++p.samples;
+}
+
+bool lua_service::profile_start(int period)
+{
+    //one hook per thread, a debugger or tracer keeps its own
+    if (nullptr != profiler_ || has_hook(lua_.get()))
+    {
+        return false;
+    }
+    profiler_ = std::make_unique<profiler>();
+    replace_hook(lua_.get(), nullptr, profile_hook, LUA_MASKCOUNT, std::max(period, 1));
+    return true;
+}
+
+std::string lua_service::profile_stop()
+{
+    if (nullptr == profiler_)
+    {
+        return std::string{};
+    }
+    replace_hook(lua_.get(), profile_hook, nullptr, 0, 0);
+
+    std::vector<std::pair<const std::string*, uint64_t>> stacks;
+    stacks.reserve(profiler_->stacks.size());
+    for (auto& it : profiler_->stacks)
+    {
+        stacks.emplace_back(&it.first, it.second);
+    }
+    std::sort(stacks.begin(), stacks.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+
+    std::string res;
+    for (auto& [stack, count] : stacks)
+    {
+        res.append(*stack);
+        res.append(" ");
+        res.append(std::to_string(count));
+        res.append("\n");
+    }
+    profiler_.reset();
+    return res;
+}
+
+void lua_service::memtrace_free(void* ptr)
+{
+    auto& t = *memtrace_;
+    if (auto it = t.blocks.find(ptr); it != t.blocks.end())
+    {
+        auto& site = t.sites[it->second.site];
+        site.bytes -= it->second.weight;
+        --site.count;
+        t.blocks.erase(it);
+    }
+}
+
+void lua_service::memtrace_alloc(void* ptr, size_t nsize)
+{
+    auto& t = *memtrace_;
+    t.next_sample -= static_cast<int64_t>(nsize);
+    if (t.next_sample > 0)
+    {
+        return;
+    }
+    t.next_sample = static_cast<int64_t>(t.dist(t.rng) * t.rate) + 1;
+
+    //called from lalloc inside C frames, nothing may unwind from here:
+    //a sample that can not be recorded(bad_alloc) is dropped
+    try
+    {
+        //lalloc has no lua_State, the lua_resume patch tracks the running thread.
+        //5.4 keeps the old stack alive while growing it, so walking it here is safe.
+        lua_State* L = G(lua_.get())->running;
+        lua_Debug ar;
+        char srcs[memtrace::MAX_DEPTH][LUA_IDSIZE];
+        int lines[memtrace::MAX_DEPTH];
+        int depth = 0;
+        for (; depth < memtrace::MAX_DEPTH && lua_getstack(L, depth, &ar); ++depth)
+        {
+            lua_getinfo(L, "Sl", &ar);
+            if (ar.what[0] == 'C')
+                srcs[depth][0] = '\0';
+            else
+                memcpy(srcs[depth], ar.short_src, LUA_IDSIZE);
+            lines[depth] = ar.currentline;
+        }
+
+        t.stack.clear();
+        if (depth == memtrace::MAX_DEPTH)
+        {
+            t.stack.append("...;");
+        }
+        for (int i = depth - 1; i >= 0; --i)
+        {
+            if (srcs[i][0] == '\0')
+            {
+                t.stack.append("[C]");
+            }
+            else
+            {
+                t.stack.append(srcs[i]);
+                t.stack.append(":");
+                t.stack.append(std::to_string(lines[i]));
+            }
+            if (i != 0)
+            {
+                t.stack.append(";");
+            }
+        }
+        if (depth == 0)
+        {
+            t.stack.append("[no lua stack]");
+        }
+
+        auto [it, inserted] = t.site_index.try_emplace(t.stack, static_cast<uint32_t>(t.sites.size()));
+        uint32_t index = it->second;
+        if (inserted)
+        {
+            try
+            {
+                t.sites.emplace_back().stack = t.stack;
+            }
+            catch (...)
+            {
+                t.site_index.erase(it);
+                t.sites.resize(index);
+                throw;
+            }
+        }
+
+        //an allocation of nsize is sampled with probability 1-exp(-nsize/rate)
+        double p = 1.0 - std::exp(-static_cast<double>(nsize) / t.rate);
+        size_t weight = static_cast<size_t>(nsize / p);
+        t.blocks[ptr] = memtrace::block{ index, weight };
+        auto& site = t.sites[index];
+        site.bytes += weight;
+        ++site.count;
+    }
+    catch (...)
+    {
+    }
+}
+
+bool lua_service::memtrace_start(size_t rate)
+{
+    if (nullptr != memtrace_)
+    {
+        return false;
+    }
+    auto t = std::make_unique<memtrace>();
+    t->rate = std::max<size_t>(rate, 1);
+    t->rng.seed(static_cast<uint32_t>(id()));
+    t->next_sample = static_cast<int64_t>(t->dist(t->rng) * t->rate) + 1;
+    memtrace_ = std::move(t);
+    return true;
+}
+
+std::string lua_service::memtrace_report(size_t top) const
+{
+    if (nullptr == memtrace_)
+    {
+        return std::string{};
+    }
+
+    std::vector<const memtrace::site*> sites;
+    sites.reserve(memtrace_->sites.size());
+    for (auto& site : memtrace_->sites)
+    {
+        if (site.count > 0)
+        {
+            sites.emplace_back(&site);
+        }
+    }
+    std::sort(sites.begin(), sites.end(), [](const auto* a, const auto* b) { return a->bytes > b->bytes; });
+    if (top > 0 && sites.size() > top)
+    {
+        sites.resize(top);
+    }
+
+    std::string res;
+    for (auto* site : sites)
+    {
+        res.append(site->stack);
+        res.append(" ");
+        res.append(std::to_string(site->bytes));
+        res.append("\n");
+    }
+    return res;
+}
+
+std::string lua_service::memtrace_stop()
+{
+    std::string res = memtrace_report(0);
+    memtrace_.reset();
+    return res;
+}
+
+void lua_service::gc_observer(void* ud, int done)
+{
+    lua_service* S = static_cast<lua_service*>(ud);
+    if (S->gc_slice_)
+    {
+        return;
+    }
+    if (done == 0)
+    {
+        S->gc_start_ = time::microsecond();
+    }
+    else
+    {
+        S->gc_pauses_.record(time::microsecond() - S->gc_start_);
+    }
+}
+
+bool lua_service::gc_step(bool idle)
+{
+    lua_State* L = lua_.get();
+    if (lua_gc(L, LUA_GCISRUNNING))
+    {
+        //the backstop fired during the batch, take the collector back
+        lua_gc(L, LUA_GCSTOP);
+        gc_cycle_ = gc_cycle_ || G(L)->gcstate != GCSpause;
+        gc_backstop_ = std::max(mem, gc_threshold_) * GC_BACKSTOP;
+    }
+
+    if (!gc_cycle_ && mem < gc_threshold_)
+    {
+        return false;
+    }
+
+    //a busy worker only pays a quarter of the budget between batches
+    int64_t budget = idle ? gc_budget_ : gc_budget_ / 4;
+    gc_cycle_ = true;
+    gc_slice_ = true;
+    int64_t start = time::microsecond();
+    int64_t now = start;
+    do
+    {
+        if (lua_gc(L, LUA_GCSTEP, 0))
+        {
+            gc_cycle_ = false;
+            ++gc_cycles_;
+            gc_threshold_ = mem / 100 * gc_pause_;
+            gc_backstop_ = gc_threshold_ * GC_BACKSTOP;
+            now = time::microsecond();
+            break;
+        }
+        now = time::microsecond();
+    } while (now - start < budget);
+    gc_slice_ = false;
+    gc_pauses_.record(now - start);
+    return gc_cycle_;
+}
+
+void lua_service::gc_stat(lua_State* L) const
+{
+    lua_createtable(L, 0, 10);
+    lua_pushlstring(L, gc_mode_.data(), gc_mode_.size());
+    lua_setfield(L, -2, "mode");
+    lua_pushinteger(L, (lua_Integer)mem);
+    lua_setfield(L, -2, "mem");
+    lua_pushinteger(L, (lua_Integer)gc_pauses_.count());
+    lua_setfield(L, -2, "steps");
+    lua_pushinteger(L, (lua_Integer)gc_pauses_.sum());
+    lua_setfield(L, -2, "total_us");
+    lua_pushnumber(L, gc_pauses_.mean());
+    lua_setfield(L, -2, "mean_us");
+    lua_pushinteger(L, (lua_Integer)gc_pauses_.percentile(0.5));
+    lua_setfield(L, -2, "p50_us");
+    lua_pushinteger(L, (lua_Integer)gc_pauses_.percentile(0.99));
+    lua_setfield(L, -2, "p99_us");
+    lua_pushinteger(L, (lua_Integer)gc_pauses_.max());
+    lua_setfield(L, -2, "max_us");
+    if (gc_adaptive_)
+    {
+        lua_pushinteger(L, (lua_Integer)gc_cycles_);
+        lua_setfield(L, -2, "cycles");
+        lua_pushinteger(L, (lua_Integer)gc_threshold_);
+        lua_setfield(L, -2, "threshold");
+        lua_pushinteger(L, (lua_Integer)gc_backstops_);
+        lua_setfield(L, -2, "backstops");
+    }
+}
+
 void lua_service::dispatch(message *msg)
 {
     if (!ok())
         return;
+
     lua_State* L = lua_.get();
     try
     {
@@ -1,10 +1,13 @@
 #pragma  once
+#include <unordered_map>
+#include <random>
 #include "lua.hpp"
 #include "common/log.hpp"
 #include "common/buffer.hpp"
 #include "common/lua_utility.hpp"
 #include "config.hpp"
 #include "service.hpp"
+#include "session_table.hpp"
 
 #define LMOON_GLOBAL "LMOON_GLOBAL"
 
@@ -20,11 +23,137 @@ private:
 
     void dispatch(moon::message* msg) override;
 
+    void run_deferred() override;
+
     static void* lalloc(void * ud, void *ptr, size_t osize, size_t nsize);
+
+    void on_deadline(int32_t sessionid, int64_t deadline) override;
+
+    void reap_session(int32_t sessionid);
+
+    static void profile_hook(lua_State* L, lua_Debug* ar);
+
+    //sets hook on every thread whose current hook is `from`
+    static void replace_hook(lua_State* L, lua_Hook from, lua_Hook hook, int mask, int count);
+
+    static bool has_hook(lua_State* L);
+
+    void memtrace_alloc(void* ptr, size_t nsize);
+
+    void memtrace_free(void* ptr);
+
+    bool gc_step(bool idle) override;
+
+    static void gc_observer(void* ud, int done);
 public:
+    //park the running coroutine of L, returns the sessionid, 0 when all slots are in use.
+    //deadline in server time(milliseconds), 0 waits forever.
+    int32_t make_session(lua_State* L, uint32_t watcher, int64_t deadline);
+
+    //pushes the parked coroutine, false for a cancelled session, nil for an unknown one
+    void take_session(lua_State* L, int32_t sessionid);
+
+    void cancel_session(int32_t sessionid);
+
+    moon::session_table& sessions() { return sessions_; }
+
+    //sample the Lua stack of every coroutine each `period` VM instructions.
+    //false when already running or when a thread already has a debug hook.
+    bool profile_start(int period);
+
+    //stops sampling, returns folded stacks("frame;frame;frame count" lines) for flamegraph.pl
+    std::string profile_stop();
+
+    //sample one allocation per `rate` bytes(on average) with its Lua call stack.
+    //only blocks allocated after the start are tracked. false when already running.
+    bool memtrace_start(size_t rate);
+
+    //live bytes per call stack, estimated from the samples, as folded stacks
+    //("frame;frame;frame bytes" lines). the top `top` stacks, 0 for all.
+    std::string memtrace_report(size_t top) const;
+
+    //stops tracking, returns the final report
+    std::string memtrace_stop();
+
+    //pushes a table with the gc mode and the collector pause times(microseconds).
+    //a pause is one collector step inside the service, or one gc_step slice in adaptive mode.
+    void gc_stat(lua_State* L) const;
+
+    //adaptive gc: starts a cycle once mem reaches this percent of the mem left by the last one
+    static constexpr size_t GC_DEFAULT_PAUSE = 200;
+
+    //adaptive gc: lua's own collector takes over once mem reaches this multiple of
+    //the threshold, until the next gc_step
+    static constexpr size_t GC_BACKSTOP = 2;
+
+    //adaptive gc: microseconds of collector work per idle step
+    static constexpr int64_t GC_DEFAULT_BUDGET = 1000;
+
+    //a cancelled or timed out session drops late responses for this long
+    static constexpr int64_t SESSION_REAP_MS = 30000;
+
+    //registry key of the table holding the parked coroutines, by slot
+    inline static const char SESSION_KEY = 0;
+
+    //registry key of the lua function that runs the deferred tasks
+    inline static const char DEFERRED_KEY = 0;
+
     size_t mem = 0;
     size_t mem_limit = 0;
     size_t mem_report = 8 * 1024 * 1024;
 private:
+    struct memtrace
+    {
+        static constexpr int MAX_DEPTH = 32;
+
+        struct site
+        {
+            std::string stack;
+            size_t bytes = 0;
+            size_t count = 0;
+        };
+
+        struct block
+        {
+            uint32_t site;
+            size_t weight;
+        };
+
+        size_t rate = 0;
+        int64_t next_sample = 0;
+        std::minstd_rand rng;
+        std::exponential_distribution<double> dist;
+        std::string stack;
+        std::vector<site> sites;
+        std::unordered_map<std::string, uint32_t> site_index;
+        std::unordered_map<void*, block> blocks;
+    };
+    //declared before lua_: lua_close still frees through lalloc
+    std::unique_ptr<memtrace> memtrace_;
+
     std::unique_ptr<lua_State, moon::state_deleter> lua_;
+    moon::session_table sessions_;
+
+    struct profiler
+    {
+        static constexpr int MAX_DEPTH = 128;
+        uint64_t samples = 0;
+        std::string frames[MAX_DEPTH];
+        std::string stack;
+        std::unordered_map<std::string, uint64_t> stacks;
+    };
+    std::unique_ptr<profiler> profiler_;
+
+    bool gc_adaptive_ = false;
+    bool gc_cycle_ = false;
+    bool gc_slice_ = false;
+    size_t gc_pause_ = GC_DEFAULT_PAUSE;
+    size_t gc_threshold_ = 0;
+    size_t gc_backstop_ = 0;
+    uint64_t gc_backstops_ = 0;
+    int64_t gc_budget_ = GC_DEFAULT_BUDGET;
+    int64_t gc_start_ = 0;
+    uint64_t gc_cycles_ = 0;
+    std::string gc_mode_;
+    moon::histogram gc_pauses_;
 };
\ No newline at end of file
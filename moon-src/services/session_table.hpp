@@ -0,0 +1,209 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+
+namespace moon
+{
+    //sessions of the coroutines waiting for a response.
+    //A sessionid is (generation << SLOT_BITS) | slot: slots live in a dense array
+    //reused through a free list, the generation rejects responses to a slot's
+    //previous owner. Always positive, never 0.
+    //Sessions waiting on the same service are linked per watcher, so a service
+    //exit only visits its own callers.
+    class session_table
+    {
+    public:
+        static constexpr uint32_t SLOT_BITS = 20;
+        static constexpr uint32_t MAX_SLOTS = 1u << SLOT_BITS;
+        static constexpr uint32_t GEN_MASK = 0x7FF;
+        static constexpr uint32_t NIL = 0xFFFFFFFF;
+
+        enum class state : uint8_t
+        {
+            free,
+            parked,//a coroutine waits for the response
+            expired,//deadline passed, the timeout error is on its way
+            cancelled,//nobody waits, a late response is dropped quietly
+        };
+
+        struct slot
+        {
+            uint32_t gen = 1;
+            state st = state::free;
+            uint32_t watcher = 0;//service whose exit fails the call
+            uint32_t prev = NIL;//watcher list
+            uint32_t next = NIL;
+            int64_t deadline = 0;
+        };
+
+        //returns 0 when all slots are in use
+        int32_t make(uint32_t watcher, int64_t deadline)
+        {
+            uint32_t idx;
+            if (!free_.empty())
+            {
+                idx = free_.back();
+                free_.pop_back();
+            }
+            else if (slots_.size() < MAX_SLOTS)
+            {
+                idx = static_cast<uint32_t>(slots_.size());
+                slots_.emplace_back();
+            }
+            else
+            {
+                return 0;
+            }
+
+            auto& s = slots_[idx];
+            s.st = state::parked;
+            s.deadline = deadline;
+            link(idx, watcher);
+            ++size_;
+            return make_id(s.gen, idx);
+        }
+
+        static uint32_t index(int32_t sessionid)
+        {
+            return static_cast<uint32_t>(sessionid) & (MAX_SLOTS - 1);
+        }
+
+        slot* find(int32_t sessionid)
+        {
+            if (sessionid <= 0)
+            {
+                return nullptr;
+            }
+            uint32_t idx = index(sessionid);
+            if (idx >= slots_.size())
+            {
+                return nullptr;
+            }
+            auto& s = slots_[idx];
+            if (s.st == state::free || make_id(s.gen, idx) != sessionid)
+            {
+                return nullptr;
+            }
+            return &s;
+        }
+
+        //keep the slot, a late response is dropped until reap_at
+        void cancel(int32_t sessionid, int64_t reap_at)
+        {
+            if (auto s = find(sessionid); s != nullptr)
+            {
+                unlink(index(sessionid));
+                s->st = state::cancelled;
+                s->deadline = reap_at;
+            }
+        }
+
+        void release(int32_t sessionid)
+        {
+            uint32_t idx = index(sessionid);
+            unlink(idx);
+            auto& s = slots_[idx];
+            s.st = state::free;
+            s.deadline = 0;
+            s.gen = (s.gen % GEN_MASK) + 1;
+            free_.emplace_back(idx);
+            --size_;
+        }
+
+        template<typename Handler>
+        void for_each(Handler&& handler)
+        {
+            for (uint32_t idx = 0; idx < slots_.size(); ++idx)
+            {
+                auto& s = slots_[idx];
+                if (s.st != state::free)
+                {
+                    handler(make_id(s.gen, idx), s);
+                }
+            }
+        }
+
+        //sessions still waiting on the watcher, the handler must not modify the table
+        template<typename Handler>
+        void for_each_watching(uint32_t watcher, Handler&& handler)
+        {
+            auto iter = watchers_.find(watcher);
+            if (iter == watchers_.end())
+            {
+                return;
+            }
+            for (uint32_t idx = iter->second; idx != NIL; idx = slots_[idx].next)
+            {
+                handler(make_id(slots_[idx].gen, idx), slots_[idx]);
+            }
+        }
+
+        size_t size() const
+        {
+            return size_;
+        }
+
+        size_t capacity() const
+        {
+            return slots_.size();
+        }
+    private:
+        static int32_t make_id(uint32_t gen, uint32_t idx)
+        {
+            return static_cast<int32_t>((gen << SLOT_BITS) | idx);
+        }
+
+        void link(uint32_t idx, uint32_t watcher)
+        {
+            auto& s = slots_[idx];
+            s.watcher = watcher;
+            s.prev = NIL;
+            s.next = NIL;
+            if (watcher == 0)
+            {
+                return;
+            }
+            auto [iter, inserted] = watchers_.try_emplace(watcher, idx);
+            if (!inserted)
+            {
+                s.next = iter->second;
+                slots_[iter->second].prev = idx;
+                iter->second = idx;
+            }
+        }
+
+        void unlink(uint32_t idx)
+        {
+            auto& s = slots_[idx];
+            if (s.watcher == 0)
+            {
+                return;
+            }
+            if (s.prev != NIL)
+            {
+                slots_[s.prev].next = s.next;
+            }
+            else if (s.next != NIL)
+            {
+                watchers_[s.watcher] = s.next;
+            }
+            else
+            {
+                watchers_.erase(s.watcher);
+            }
+            if (s.next != NIL)
+            {
+                slots_[s.next].prev = s.prev;
+            }
+            s.watcher = 0;
+            s.prev = NIL;
+            s.next = NIL;
+        }
+    private:
+        size_t size_ = 0;
+        std::vector<slot> slots_;
+        std::vector<uint32_t> free_;
+        std::unordered_map<uint32_t, uint32_t> watchers_;//watcher -> first slot
+    };
+}
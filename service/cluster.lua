@@ -4,252 +4,76 @@ local seri = require("seri")
 local conf = ...
 
 local pack = seri.pack
-local packs = seri.packs
 local co_yield = coroutine.yield
+local make_response = moon.make_response
 
-local NODE = math.tointeger(moon.get_env("NODE"))
-
+---routing, framing and the peer connections live in the native "cluster" service
+---(cluster_router). This lua service starts it, resolves unknown nodes for it
+---and keeps the "Start" command.
 local function cluster_service()
 
     local json = require("json")
-    local buffer = require("buffer")
-    local socket = require("moon.socket")
     local httpc = require("moon.http.client")
 
-    local print = print
-    local assert = assert
-    local pairs = pairs
     local strfmt = string.format
 
     local unpack_one = seri.unpack_one
-    local queryservice = moon.queryservice
-    local wfront = buffer.write_front
-
-    local redirect = moon.redirect
-
-    local clusters = {}
+    local packs = seri.packs
+    local wfront = require("buffer").write_front
 
-    local close_watch = {}
-    local send_watch = {}
+    local router
 
-    local function add_send_watch( fd, sender, sessionid )
-        local senders = send_watch[fd]
-        if not senders then
-            senders = {}
-            send_watch[fd] = senders
-        end
-        local key = (sessionid<<32)|sender
-        --print("addkey", key, sessionid)
-        senders[key] = moon.time()
+    local function router_call(cmd, params)
+        local sessionid = make_response(router)
+        moon.raw_send("text", router, cmd, params, sessionid)
+        return co_yield()
     end
 
-    local function remove_send_watch( fd, sender, sessionid )
-        local senders = send_watch[fd]
-        if not senders then
-            assert(false)
+    local function resolve(node)
+        if not conf.etc_host then
+            moon.raw_send("text", router, "node_error", node.." no etc_host configured")
             return
         end
-
-        local key = (sessionid<<32)|sender
-        --print("remove key", key, sessionid)
-        senders[key] = nil
-        return true
-    end
-
-    local services_address = {}
-    local function get_service_address(sname)
-        local addr = services_address[sname]
-        if not addr then
-            addr = queryservice(sname)
-            assert(addr>0, tostring(sname))
-            services_address[sname] = addr
-        end
-        return addr
-    end
-
-    socket.on("connect",function(fd, msg)
-        print("connect", fd, moon.decode(msg, "Z"))
-        socket.set_enable_chunked(fd,"wr")
-    end)
-
-    socket.on("accept",function(fd, msg)
-        socket.settimeout(fd, 180)
-        socket.set_enable_chunked(fd,"wr")
-        print("accept", fd, moon.decode(msg, "Z"))
-    end)
-
-    socket.on("message", function(fd, msg)
-        local buf = moon.decode(msg, "B")
-        ---@type cluster_header
-        local header = unpack_one(buf, true)
-        if header.ping then
-            socket.write(fd, pack({pong = true}))
-            return
-        elseif header.pong then
+        local response, err = httpc.get(conf.etc_host,{
+            path = conf.etc_path.."?node="..node
+        })
+        if not response or response.status_code ~= "200 OK" then
+            local errstr = response and response.content or err
+            moon.error(errstr)
+            moon.raw_send("text", router, "node_error", strfmt("%s %s", node, errstr))
             return
         end
+        local c = json.decode(response.content)
+        moon.raw_send("text", router, "node", strfmt("%s %s %d", node, c.host, c.port))
+    end
 
-        if header.session < 0 then -- receive call message
-            moon.async(function ()
-                local address = get_service_address(header.to_sname)
-                assert(address>0, tostring(header.to_sname))
-                local session = moon.make_response(address)
-                redirect(msg, "", address, moon.PTYPE_LUA, moon.addr(), -session)
-                local res = {co_yield()}
-                header.session = -header.session
-                socket.write(fd, pack(header, table.unpack(res)))
+    moon.dispatch("text", function(msg)
+        local cmd, node = moon.decode(msg, "HZ")
+        if cmd == "resolve" then
+            moon.async(function()
+                resolve(node)
             end)
-        elseif header.session > 0 then --receive response message
-            if remove_send_watch(fd, header.from_addr, header.session) then
-                redirect(msg, "", header.from_addr, moon.PTYPE_LUA, moon.addr(), header.session)
-            end
-        else-- receive send message
-            local address = get_service_address(header.to_sname)
-            redirect(msg, "", address, moon.PTYPE_LUA)
         end
     end)
 
-    socket.on("close", function(fd, msg)
-        print("close", moon.decode(msg, "Z"))
-        for k, v in pairs(close_watch) do
-            if v == fd then
-                close_watch[k] = false
-            end
-        end
-
-        local senders = send_watch[fd]
-        if senders then
-            for key in pairs(senders) do
-                local sender = key&0xFFFFFFFF
-                local sessionid = (key>>32)
-                print("close response", sender, sessionid)
-                moon.response("lua", sender, -sessionid, false, "cluster:socket disconnect")
-            end
-        end
-        send_watch[fd] = nil
-
-        for _,v in pairs(clusters) do
-            if v.fd == fd then
-                v.fd = false
-                break
-            end
-        end
-    end)
-
-    socket.on("error", function(fd, msg)
-        print("socket error",fd, moon.decode(msg, "Z"))
-    end)
-
-
-    local function connect(node)
-        local c = clusters[node]
-        local fd, err = socket.connect(c.host, c.port, moon.PTYPE_SOCKET, 1000)
-        if not fd then
-            moon.error(err)
-            return
-        end
-        socket.set_enable_chunked(fd, "wr")
-        return fd
-    end
-
     local command = {}
 
-    local lock = require("moon.queue")()
-
     function command.Start()
+        while not router do
+            moon.sleep(10)
+        end
         if conf.host and conf.port then
-            local host, port = conf.host, conf.port
-            local listenfd = socket.listen(host, port,moon.PTYPE_SOCKET)
-            socket.start(listenfd)
-            print(strfmt("cluster run at %s %d", host, port))
-            setmetatable(clusters, {__gc=function()
-                socket.close(listenfd)
-            end})
+            local ok, err = router_call("listen", strfmt("%s %d", conf.host, conf.port))
+            assert(ok, err)
         end
         return true
     end
 
-    function command.Request(msg)
-        ---@type cluster_header
-        local header = unpack_one(moon.decode(msg, "B"))
-
-        local c = clusters[header.to_node]
-        if c and c.fd and socket.write_message(c.fd, msg) then
-            if header.session < 0 then
-                --记录mode-call消息，网络断开时，返回错误信息
-                add_send_watch(c.fd, header.from_addr, -header.session)
-            end
-            return
-        else
-            if c then
-                c.fd = false
-            end
-        end
-
-        local data = moon.decode(msg, "Z")
-
-        local scope<close> = lock()
-
-        c = clusters[header.to_node]
-        if not c then
-            local response, err = httpc.get(conf.etc_host,{
-                path = conf.etc_path.."?node="..tostring(header.to_node)
-            })
-            if not response or response.status_code ~= "200 OK" then
-                local errstr = response and response.content or err
-                moon.error(errstr)
-                moon.response("lua", header.from_addr, header.session, false, errstr)
-                return
-            end
-            c = json.decode(response.content)
-            c.fd = false
-            clusters[header.to_node] = c
-        end
-
-        if not c.fd then
-            c.fd = connect(header.to_node)
-        end
-
-        if c.fd and socket.write(c.fd, data) then
-            if header.session < 0 then
-                --记录mode-call消息，网络断开时，返回错误信息
-                add_send_watch(c.fd, header.from_addr, -header.session)
-            end
-            return
-        end
-
-        if header.session == 0 then
-            moon.error("not connected cluster")
-            return
-        else
-            --CASE1:connect failed, mode-call, 返回错误信息
-            moon.response("lua", header.from_addr, header.session, false, "connect failed:"..tostring(header.to_node))
-            return
-        end
+    ---@return table @ router counters
+    function command.Stats()
+        return json.decode(router_call("stats", ""))
     end
 
-    moon.async(function()
-        while true do
-            moon.sleep(5000)
-            for _,senders in pairs(send_watch) do
-                for key, t in pairs(senders) do
-                    if moon.time() - t > 10 then
-                        local sender = key&0xFFFFFFFF
-                        local sessionid = (key>>32)
-                        moon.response("lua", sender, -sessionid, false, "cluster:socket read timeout")
-                        senders[key] = nil
-                    end
-                end
-            end
-
-            for _, v in pairs(clusters) do
-                if v.fd then
-                    socket.write(v.fd, pack({ping = true}))
-                end
-            end
-        end
-    end)
-
     moon.dispatch("lua",function(msg)
         local sender, sessionid, buf = moon.decode(msg, "SEB")
         local cmd = unpack_one(buf, true)
@@ -272,8 +96,27 @@ local function cluster_service()
         end
     end)
 
+    moon.async(function()
+        router = moon.new_service("cluster", {
+            name = "cluster_router",
+            unique = true,
+            resolver = moon.addr(),
+            call_timeout = conf.call_timeout,
+            batch_bytes = conf.batch_bytes,
+            batch_delay_us = conf.batch_delay_us,
+            compress = conf.compress,
+            dict_size = conf.dict_size,
+        })
+        assert(router > 0, "create cluster_router failed")
+    end)
+
     moon.shutdown(function()
-        moon.quit()
+        moon.async(function()
+            if router then
+                moon.remove_service(router)
+            end
+            moon.quit()
+        end)
     end)
 end
 
@@ -283,51 +126,42 @@ end
 
 local cluster = {}
 
-local cluster_address
-
----@class cluster_header
----@field public to_node integer @ 接收者服务器ID
----@field public to_sname string @ 接收者服务name
----@field public from_node integer @ 发送者服务器ID
----@field public from_addr integer @ 发送者服务ID
----@field public session integer @ 协程session
+local router_address
 
-
-function cluster.send(receiver_node, receiver_sname, ...)
-    if not cluster_address then
-        cluster_address = moon.queryservice("cluster")
-        assert(cluster_address>0)
+local function router()
+    if not router_address then
+        router_address = moon.queryservice("cluster_router")
+        assert(router_address>0)
     end
+    return router_address
+end
 
-    local header = {
-        to_node = receiver_node,
-        to_sname = receiver_sname,
-        from_node = NODE,
-        from_addr = moon.addr(),
-        session = 0
-    }
+---message header of the router: "node:sname"
+local function target(receiver_node, receiver_sname)
+    return receiver_node..":"..receiver_sname
+end
 
-    moon.send("lua", cluster_address, "Request", header, ...)
+function cluster.send(receiver_node, receiver_sname, ...)
+    moon.raw_send("lua", router(), target(receiver_node, receiver_sname), pack(...))
 end
 
-function cluster.call(receiver_node, receiver_sname, ...)
-    if not cluster_address then
-        cluster_address = moon.queryservice("cluster")
-        assert(cluster_address>0)
+---set a node address directly, the router will not ask the etc server for it
+---@param opts? table @ link options {batch_bytes, delay_us(<=100000), compress, dict_size(<=65535)}, defaults from the cluster conf
+function cluster.set_node(node, host, port, opts)
+    local params = string.format("%d %s %d", node, host, port)
+    if opts then
+        params = string.format("%s %d %d %s %d", params, opts.batch_bytes or 0, opts.delay_us or 200,
+            opts.compress and "true" or "false", opts.dict_size or 16384)
     end
+    moon.raw_send("text", router(), "node", params)
+end
 
-    local sessionid = moon.make_response(cluster_address)
-
-    local header = {
-        to_node = receiver_node,
-        to_sname = receiver_sname,
-        from_node = NODE,
-        from_addr = moon.addr(),
-        session = -sessionid
-    }
-
-    moon.raw_send("lua", cluster_address, "", pack("Request", header, ...))
+---returns the values of the remote response, or false, errmsg
+function cluster.call(receiver_node, receiver_sname, ...)
+    local addr = router()
+    local sessionid = make_response(addr)
+    moon.raw_send("lua", addr, target(receiver_node, receiver_sname), pack(...), sessionid)
     return co_yield()
 end
 
-return cluster
\ No newline at end of file
+return cluster
@@ -9,135 +9,211 @@ local tbunpack = table.unpack
 local conf = ...
 
 if conf.name then
-    local function connect(db_conf, auto_reconnect)
-        local db, err
-        repeat
-            db, err = redis.connect(db_conf)
-            if not db then
-                moon.error(err)
+    local db_pool_size = conf.poolsize or 1
+
+    -- max replies read by one socket.read_reply
+    local PIPELINE_BATCH = 1024
+
+    -- request latency histogram upper bounds, milliseconds. last slot counts the rest
+    local LATENCY_BOUNDS = {1, 2, 5, 10, 20, 50, 100, 200, 500, 1000}
+
+    local make_queue = make_queue
+    local queue_push = queue_push
+    local queue_pop = queue_pop
+    local tbconcat = table.concat
+    local tbpack = table.pack
+    local clock = moon.clock
+    local read_reply = socket.read_reply
+
+    local pool = {}
+
+    for _=1,db_pool_size do
+        local histogram = {}
+        for i = 1, #LATENCY_BOUNDS + 1 do
+            histogram[i] = 0
+        end
+        tbinsert(pool, {
+            db = false,
+            connecting = false,
+            reading = false,
+            ---requests wait the next flush: {data, sender, sessionid, starttime}
+            waiting = make_queue(),
+            nwaiting = 0,
+            ---requests written, replies are matched in FIFO order
+            sent = make_queue(),
+            inflight = 0,
+            histogram = histogram,
+            total = 0,
+        })
+    end
+
+    local function record_latency(ctx, starttime)
+        local ms = (clock() - starttime) * 1000
+        local histogram = ctx.histogram
+        local n = #LATENCY_BOUNDS
+        local slot = n + 1
+        for i = 1, n do
+            if ms <= LATENCY_BOUNDS[i] then
+                slot = i
                 break
             end
+        end
+        histogram[slot] = histogram[slot] + 1
+        ctx.total = ctx.total + 1
+    end
 
-            if db == redis.socket_error then
-                db = nil
+    local function response(req, ok, res)
+        local sessionid = req[3]
+        if sessionid == 0 then
+            if not ok then
+                moon.error(res)
             end
+            return
+        end
+        if ok then
+            moon.response("lua", req[2], sessionid, res)
+        else
+            moon.response("lua", req[2], sessionid, false, res)
+        end
+    end
 
-            if not db and auto_reconnect then
-                moon.sleep(1000)
+    local flush
+
+    --- socket failed: everything already written gets the error, it may have run on the server.
+    --- requests not yet written stay queued for the next connection
+    local function on_socket_error(ctx, err)
+        moon.error(err)
+        if ctx.db then
+            ctx.db:disconnect()
+            ctx.db = false
+        end
+
+        while true do
+            local req = queue_pop(ctx.sent)
+            if not req then
+                break
             end
-        until(not auto_reconnect or db)
-        return db, err
+            response(req, false, err)
+        end
+        ctx.inflight = 0
     end
 
-    local function exec_one(db, msg , sender, sessionid, auto_reconnect)
-        local reconnect_times = 1
+    local function read_loop(ctx)
+        ctx.reading = true
+        while ctx.inflight > 0 and ctx.db do
+            local n = ctx.inflight < PIPELINE_BATCH and ctx.inflight or PIPELINE_BATCH
+            local res = tbpack(read_reply(ctx.db[1], n))
+            if not res[1] then
+                on_socket_error(ctx, res[2])
+                break
+            end
+            for i = 2, res.n, 2 do
+                local req = queue_pop(ctx.sent)
+                record_latency(ctx, req[4])
+                response(req, res[i], res[i+1])
+            end
+            ctx.inflight = ctx.inflight - n
+        end
+        ctx.reading = false
+        if ctx.nwaiting > 0 then
+            flush()
+        end
+    end
 
-        if auto_reconnect then
-            reconnect_times = -1
+    --- all requests queued since the last flush go out in one write
+    local function write_waiting(ctx)
+        local parts = {}
+        local n = 0
+        while true do
+            local req = queue_pop(ctx.waiting)
+            if not req then
+                break
+            end
+            n = n + 1
+            parts[n] = req[1]
+            queue_push(ctx.sent, req)
+        end
+        ctx.nwaiting = 0
+        if n == 0 then
+            return
         end
+        ctx.inflight = ctx.inflight + n
+        socket.write(ctx.db[1], tbconcat(parts))
+        if not ctx.reading then
+            moon.async(function()
+                read_loop(ctx)
+            end)
+        end
+    end
 
-        repeat
-            local err,res
-            if not db then
-                db, err = connect(conf, auto_reconnect)
-                if not db then
-                    if sessionid == 0 then
-                        moon.error(err)
-                    else
-                        moon.response("lua", sender, sessionid, false, err)
-                    end
-                    return
+    local function connect(ctx)
+        ctx.connecting = true
+        moon.async(function()
+            while ctx.nwaiting > 0 do
+                local db, err = redis.connect(conf)
+                if db then
+                    ctx.db = db
+                    break
                 end
-            end
-            res, err = redis.raw_send(db, msg)
-            if redis.socket_error == res then
-                db = nil
                 moon.error(err)
-                if reconnect_times == 0 then
-                    if sessionid ~= 0 then
-                        moon.response("lua", sender, sessionid, false, err)
+                -- fail the calls, keep the sends for the next try
+                local keep = make_queue()
+                local nkeep = 0
+                while true do
+                    local req = queue_pop(ctx.waiting)
+                    if not req then
+                        break
+                    end
+                    if req[3] == 0 then
+                        queue_push(keep, req)
+                        nkeep = nkeep + 1
+                    else
+                        response(req, false, err)
                     end
-                    return
                 end
-            else
-                if sessionid == 0 and not res then
-                    moon.error(err)
-                else
-                    moon.response("lua", sender, sessionid, res, err)
+                ctx.waiting = keep
+                ctx.nwaiting = nkeep
+                if nkeep > 0 then
+                    moon.sleep(1000)
                 end
-                return db, res
             end
-        until false
-    end
-
-    local db_pool_size = conf.poolsize or 1
-
-    local make_queue = make_queue
-    local queue_push = queue_push
-    local queue_pop = queue_pop
-    local queue_front = queue_front
-    local queue_size = queue_size
-    local traceback = debug.traceback
-    local xpcall = xpcall
-
-    local clone = moon.clone
-    local release = moon.release
-
-    local free_all = function(one)
-        for k, req in pairs(one.queue) do
-            if type(req[1])=="userdata" then
-                release(req[1])
+            ctx.connecting = false
+            if ctx.db and ctx.nwaiting > 0 then
+                write_waiting(ctx)
             end
-        end
-        one.queue = {}
+        end)
     end
 
-    local pool = {}
-
-    for _=1,db_pool_size do
-        local one = setmetatable({queue = make_queue(), running = false, db = false},{
-            __gc = free_all
-        }) 
-        tbinsert(pool,one)
-    end
+    local flush_pending = false
 
-    local function docmd(hash, sender, sessionid, msg)
-        hash = hash%db_pool_size + 1
-        --print(moon.name, "db hash", hash)
-        local ctx = pool[hash]
-        queue_push(ctx.queue, {clone(msg), sender, sessionid})
-        if ctx.running then
+    flush = function()
+        if flush_pending then
             return
         end
-        ctx.running = true
-        moon.async(function()
-            while true do
-                ---args - sender - sessionid
-                local req = queue_front(ctx.queue)
-                if not req then
-                    break
-                end
-                local iscall = req[3]~=0
-                local ok,db = xpcall(exec_one, traceback, ctx.db, req[1], req[2], req[3], not iscall)
-                if not ok then
+        flush_pending = true
+        -- runs after the messages already queued for this service, so they coalesce
+        moon.defer(function()
+            flush_pending = false
+            for _, ctx in ipairs(pool) do
+                if ctx.nwaiting > 0 then
                     if ctx.db then
-                        ctx.db:disconnect()
-                        ctx.db = nil
+                        write_waiting(ctx)
+                    elseif not ctx.connecting then
+                        connect(ctx)
                     end
-                    ---print lua error
-                    moon.error(db)
-                else
-                    ctx.db = db
-                end
-                if iscall or db then
-                    release(req[1])
-                    queue_pop(ctx.queue)
                 end
             end
-            ctx.running = false
         end)
     end
 
+    local function docmd(hash, sender, sessionid, data)
+        hash = hash%db_pool_size + 1
+        local ctx = pool[hash]
+        queue_push(ctx.waiting, {data, sender, sessionid, clock()})
+        ctx.nwaiting = ctx.nwaiting + 1
+        flush()
+    end
+
     local fd = socket.sync_connect(conf.host,conf.port,moon.PTYPE_TEXT)
     assert(fd, "connect db redis failed")
     socket.close(fd)
@@ -151,7 +227,27 @@ if conf.name then
     function command.len()
         local res = {}
         for _,v in ipairs(pool) do
-            res[#res+1] = queue_size(v.queue)
+            res[#res+1] = v.nwaiting + v.inflight
+        end
+        return res
+    end
+
+    --- per connection in-flight/queued counts and request latency histogram
+    function command.stats()
+        local res = {}
+        for i,v in ipairs(pool) do
+            local histogram = {}
+            for k, bound in ipairs(LATENCY_BOUNDS) do
+                histogram[k] = {bound, v.histogram[k]}
+            end
+            histogram[#LATENCY_BOUNDS + 1] = {"+inf", v.histogram[#LATENCY_BOUNDS + 1]}
+            res[i] = {
+                connected = v.db and true or false,
+                inflight = v.inflight,
+                queued = v.nwaiting,
+                total = v.total,
+                latency_ms = histogram,
+            }
         end
         return res
     end
@@ -161,7 +257,7 @@ if conf.name then
         local cmd, sz, len = seri.unpack_one(buf, true)
         if cmd == "Q" then
             local hash = seri.unpack_one(buf, true)
-            docmd(hash, sender, sessionid, msg)
+            docmd(hash, sender, sessionid, moon.decode(msg, "Z"))
             return
         end
 
@@ -190,9 +286,9 @@ if conf.name then
         while true do
             local all = true
             for _,v in ipairs(pool) do
-                if queue_front(v.queue) then
+                if v.nwaiting > 0 or v.inflight > 0 then
                     all = false
-                    print("wait_all_send", _, queue_size(v.queue))
+                    print("wait_all_send", _, v.nwaiting + v.inflight)
                     break
                 end
             end
@@ -254,6 +350,11 @@ else
         assert(wfront(buf, packstr("Q", hash)))
         raw_send("lua", db, "", buf, 0)
     end
+
+    --- per connection in-flight counts and latency histograms of the pool
+    function client.stats(db)
+        return moon.co_call("lua", db, "stats")
+    end
     return client
 end
 
@@ -44,6 +44,52 @@ local function sharetable_service()
 		moon.response("lua", source, sessionid)
 	end
 
+	---the patch chunk returns a list of {path = key or {k1, k2, ...}, value = v}.
+	---The new version copies only the tables along the patched paths and shares
+	---the rest with the current version, which therefore stays in memory until
+	---the new one is closed. Every version of a chain is retained that way, so
+	---after 16 patches the next one folds the chain into a full copy that has
+	---no base, and the superseded versions are released. A full loadfile also
+	---starts a fresh chain.
+	local function patch(source, sessionid, filename, datasource, ...)
+		local old = files[filename]
+		if old == nil then
+			moon.response("lua", source, sessionid, false, "sharetable not loaded: " .. filename)
+			return
+		end
+		local ok, m = pcall(core.patch, old, datasource, ...)
+		if not ok then
+			moon.response("lua", source, sessionid, false, m)
+			return
+		end
+		close_matrix(old)
+		files[filename] = m
+		moon.response("lua", source, sessionid, true)
+	end
+
+	function sharetable.patchfile(source, sessionid, filename, patchfile, ...)
+		if conf.dir then
+			filename = fs.join(conf.dir, filename)
+		end
+		patch(source, sessionid, filename, "@" .. patchfile, ...)
+	end
+
+	function sharetable.patchstring(source, sessionid, filename, datasource, ...)
+		if conf.dir then
+			filename = fs.join(conf.dir, filename)
+		end
+		patch(source, sessionid, filename, datasource, ...)
+	end
+
+	---memory of the current version of filename, a patched version counts only its own tables
+	function sharetable.size(source, sessionid, filename)
+		if conf.dir then
+			filename = fs.join(conf.dir, filename)
+		end
+		local m = files[filename]
+		moon.response("lua", source, sessionid, m and m:size() or 0)
+	end
+
 	local function query_file(source, filename)
 		local m = files[filename]
 		local ptr = m:getptr()
@@ -168,6 +214,19 @@ function sharetable.loadstring(filename, source, ...)
 	return moon.co_call( "lua", sharetable.address, "loadstring", filename, source, ...)
 end
 
+---apply the patch file to the loaded filename, clients switch with sharetable.update
+function sharetable.patchfile(filename, patchfile, ...)
+	return moon.co_call( "lua", sharetable.address, "patchfile", filename, patchfile, ...)
+end
+
+function sharetable.patchstring(filename, source, ...)
+	return moon.co_call( "lua", sharetable.address, "patchstring", filename, source, ...)
+end
+
+function sharetable.size(filename)
+	return moon.co_call( "lua", sharetable.address, "size", filename)
+end
+
 local RECORD = {}
 ---filename: xxx.lua
 function sharetable.query(filename)
@@ -218,8 +277,9 @@ local getinfo = debug.getinfo
 local NILOBJ = {}
 local function insert_replace(old_t, new_t, replace_map)
     for k, ov in pairs(old_t) do
-        if type(ov) == "table" then
-            local nv = new_t[k]
+        local nv = new_t[k]
+        -- a patched version shares unchanged subtables with the old one
+        if type(ov) == "table" and ov ~= nv then
             if nv == nil then
                 nv = NILOBJ
             end
@@ -1687,10 +1687,14 @@ void luaC_step (lua_State *L) {
   global_State *g = G(L);
   lua_assert(!g->gcemergency);
   if (g->gcrunning) {  /* running? */
+    if (g->gcobserver)
+      g->gcobserver(g->ud, 0);
     if(isdecGCmodegen(g))
       genstep(L, g);
     else
       incstep(L, g);
+    if (g->gcobserver)
+      g->gcobserver(g->ud, 1);
   }
 }
 
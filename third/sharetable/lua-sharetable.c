@@ -5,6 +5,7 @@
 #include <lualib.h>
 
 #include "lgc.h"
+#include "ltable.h"
 
 #ifdef makeshared
 
@@ -110,17 +111,35 @@ lco_stackvalues(lua_State* L) {
 }
 
 
+// patched versions chained on one full matrix, the next patch folds the chain
+#define MAX_PATCH_CHAIN 16
+
 struct state_ud {
 	lua_State *L;
+	struct state_ud *base;	// a patched matrix shares the tables of its base
+	int deps;	// patched matrices built on this one
+	int depth;	// patches between this matrix and its full load
+	int closing;
 };
 
-static int
-close_state(lua_State *L) {
-	struct state_ud *ud = (struct state_ud *)luaL_checkudata(L, 1, "BOXMATRIXSTATE");
-	if (ud->L) {
+static void
+release_state(struct state_ud *ud) {
+	while (ud && ud->L && ud->closing && ud->deps == 0) {
 		lua_close(ud->L);
 		ud->L = NULL;
+		ud = ud->base;
+		if (ud) {
+			--ud->deps;
+		}
 	}
+}
+
+// the state is closed once no patched matrix depends on it
+static int
+close_state(lua_State *L) {
+	struct state_ud *ud = (struct state_ud *)luaL_checkudata(L, 1, "BOXMATRIXSTATE");
+	ud->closing = 1;
+	release_state(ud);
 	return 0;
 }
 
@@ -151,9 +170,21 @@ get_size(lua_State *L) {
 
 
 static int
-box_state(lua_State *L, lua_State *mL) {
-	struct state_ud *ud = (struct state_ud *)lua_newuserdatauv(L, sizeof(*ud), 0);
+box_state(lua_State *L, lua_State *mL, int base) {
+	struct state_ud *ud = (struct state_ud *)lua_newuserdatauv(L, sizeof(*ud), 1);
 	ud->L = mL;
+	ud->base = NULL;
+	ud->deps = 0;
+	ud->depth = 0;
+	ud->closing = 0;
+	if (base) {
+		// keep the base box alive as long as this one
+		ud->base = (struct state_ud *)lua_touserdata(L, base);
+		++ud->base->deps;
+		ud->depth = ud->base->depth + 1;
+		lua_pushvalue(L, base);
+		lua_setiuservalue(L, -2, 1);
+	}
 	if (luaL_newmetatable(L, "BOXMATRIXSTATE")) {
 		lua_pushvalue(L, -1);
 		lua_setfield(L, -2, "__index");
@@ -190,22 +221,209 @@ load_matrixfile(lua_State *L) {
 	return 1;
 }
 
+// shared table at the top is replaced by an unshared shallow copy
+static void
+own_table(lua_State *L) {
+	Table *t = (Table *)lua_topointer(L, -1);
+	if (!isshared(t))
+		return;
+	luaL_checkstack(L, 4, NULL);
+	lua_createtable(L, (int)luaH_realasize(t), allocsizenode(t));
+	lua_pushnil(L);
+	while (lua_next(L, -3) != 0) {
+		lua_pushvalue(L, -2);
+		lua_insert(L, -2);
+		lua_rawset(L, -4);
+	}
+	lua_remove(L, -2);
+}
+
+// entry {path = key or {k1, k2, ...}, value = v}, a nil value removes the key.
+// tables along the path are copied, everything else stays shared with the base.
+static void
+apply_patch(lua_State *L, int root, int entry) {
+	int top = lua_gettop(L);
+	if (lua_type(L, entry) != LUA_TTABLE) {
+		luaL_error(L, "Invalid patch entry, it's a %s.", luaL_typename(L, entry));
+	}
+	lua_getfield(L, entry, "path");
+	int path = lua_gettop(L);
+	lua_pushvalue(L, root);
+	if (lua_type(L, path) == LUA_TTABLE) {
+		lua_Integer n = luaL_len(L, path);
+		lua_Integer i;
+		if (n < 1) {
+			luaL_error(L, "Empty patch path");
+		}
+		for (i=1;i<n;i++) {
+			lua_geti(L, path, i);
+			lua_pushvalue(L, -1);
+			int t = lua_rawget(L, -3);
+			if (t == LUA_TNIL) {
+				lua_pop(L, 1);
+				lua_newtable(L);
+			} else if (t == LUA_TTABLE) {
+				own_table(L);
+			} else {
+				luaL_error(L, "Patch path crosses a %s at %d", lua_typename(L, t), (int)i);
+			}
+			lua_pushvalue(L, -1);
+			lua_insert(L, -3);
+			lua_rawset(L, -4);
+			lua_remove(L, -2);
+		}
+		lua_geti(L, path, n);
+	} else {
+		lua_pushvalue(L, path);
+	}
+	if (lua_isnil(L, -1)) {
+		luaL_error(L, "Patch key is nil");
+	}
+	lua_getfield(L, entry, "value");
+	lua_rawset(L, -3);
+	lua_settop(L, top);
+}
+
+struct dump_state {
+	int init;
+	luaL_Buffer B;
+};
+
 static int
-matrix_from_file(lua_State *L) {
+dump_writer(lua_State *L, const void *p, size_t sz, void *ud) {
+	struct dump_state *state = (struct dump_state *)ud;
+	if (!state->init) {
+		state->init = 1;
+		luaL_buffinit(L, &state->B);
+	}
+	luaL_addlstring(&state->B, (const char *)p, sz);
+	return 0;
+}
+
+// value at the top is replaced by a deep copy owned by L, nothing of it stays in
+// another matrix. memo maps the tables and functions already copied.
+static void
+own_copy(lua_State *L, int memo) {
+	int t = lua_type(L, -1);
+	if (t == LUA_TSTRING) {
+		size_t sz;
+		const char *str = lua_tolstring(L, -1, &sz);
+		lua_pushlstring(L, str, sz);
+		lua_remove(L, -2);
+		return;
+	}
+	if (t != LUA_TTABLE && !(t == LUA_TFUNCTION && !lua_iscfunction(L, -1))) {
+		return;
+	}
+	luaL_checkstack(L, 6, NULL);
+	const void *p = lua_topointer(L, -1);
+	lua_pushlightuserdata(L, (void *)p);
+	if (lua_rawget(L, memo) != LUA_TNIL) {
+		lua_remove(L, -2);
+		return;
+	}
+	lua_pop(L, 1);
+	if (t == LUA_TFUNCTION) {
+		// shared functions have no upvalue, a dump and reload is a full copy
+		struct dump_state state;
+		state.init = 0;
+		if (lua_dump(L, dump_writer, &state, 0) != 0 || !state.init) {
+			luaL_error(L, "Can't copy function");
+		}
+		luaL_pushresult(&state.B);
+		size_t sz;
+		const char *code = lua_tolstring(L, -1, &sz);
+		if (luaL_loadbufferx(L, code, sz, "=sharetable", "b") != LUA_OK) {
+			lua_error(L);
+		}
+		lua_remove(L, -2);
+	} else {
+		lua_createtable(L, 0, 0);
+		lua_pushnil(L);
+		while (lua_next(L, -3) != 0) {
+			own_copy(L, memo);
+			lua_pushvalue(L, -2);
+			own_copy(L, memo);
+			lua_insert(L, -2);
+			lua_rawset(L, -4);
+		}
+	}
+	lua_pushlightuserdata(L, (void *)p);
+	lua_pushvalue(L, -2);
+	lua_rawset(L, memo);
+	lua_remove(L, -2);
+}
+
+static int
+load_matrixpatch(lua_State *L) {
+	luaL_openlibs(L);
+	const char * source = (const char *)lua_touserdata(L, 1);
+	const void * base = lua_touserdata(L, 2);
+	int fold = lua_toboolean(L, 3);
+	lua_rotate(L, 2, -2);
+	lua_pop(L, 2);
+	if (source[0] == '@') {
+		if (luaL_loadfilex_(L, source+1, NULL) != LUA_OK)
+			lua_error(L);
+	} else {
+		if (luaL_loadstring(L, source) != LUA_OK)
+			lua_error(L);
+	}
+	lua_replace(L, 1);
+	if (lua_pcall(L, lua_gettop(L) - 1, 1, 0) != LUA_OK)
+		lua_error(L);
+	luaL_checktype(L, -1, LUA_TTABLE);
+	int patch = lua_gettop(L);
+	lua_clonetable(L, base);
+	own_table(L);
+	int root = lua_gettop(L);
+	lua_Integer n = luaL_len(L, patch);
+	lua_Integer i;
+	for (i=1;i<=n;i++) {
+		lua_geti(L, patch, i);
+		apply_patch(L, root, lua_gettop(L));
+		lua_pop(L, 1);
+	}
+	lua_remove(L, patch);
+	if (fold) {
+		// the chain is folded: a full copy that no longer needs any base
+		lua_newtable(L);
+		lua_insert(L, -2);
+		own_copy(L, lua_gettop(L) - 1);
+		lua_remove(L, -2);
+	}
+	lua_gc(L, LUA_GCCOLLECT, 0);
+	// only the copied path and the new values get marked, the rest is shared already
+	lua_pushcfunction(L, make_matrix);
+	lua_insert(L, -2);
+	lua_call(L, 1, 1);
+	return 1;
+}
+
+static int
+new_matrix(lua_State *L, lua_CFunction loader, int base, int first) {
 	lua_State *mL = luaL_newstate();
 	if (mL == NULL) {
 		return luaL_error(L, "luaL_newstate failed");
 	}
-	const char * source = luaL_checkstring(L, 1);
+	const char * source = luaL_checkstring(L, first);
 	int top = lua_gettop(L);
-	lua_pushcfunction(mL, load_matrixfile);
+	lua_pushcfunction(mL, loader);
 	lua_pushlightuserdata(mL, (void *)source);
-	if (top > 1) {
-		if (!lua_checkstack(mL, top + 1)) {
+	int fold = 0;
+	if (base) {
+		struct state_ud *ud = (struct state_ud *)lua_touserdata(L, base);
+		fold = (ud->depth + 1 >= MAX_PATCH_CHAIN);
+		lua_pushlightuserdata(mL, (void *)lua_topointer(ud->L, 1));
+		lua_pushboolean(mL, fold);
+	}
+	if (top > first) {
+		if (!lua_checkstack(mL, top + 2)) {
+			lua_close(mL);
 			return luaL_error(L, "Too many argument %d", top);
 		}
 		int i;
-		for (i=2;i<=top;i++) {
+		for (i=first+1;i<=top;i++) {
 			switch(lua_type(L, i)) {
 			case LUA_TBOOLEAN:
 				lua_pushboolean(mL, lua_toboolean(L, i));
@@ -225,19 +443,36 @@ matrix_from_file(lua_State *L) {
 					lua_pushcfunction(mL, lua_tocfunction(L, i));
 					break;
 				}
+				lua_close(mL);
 				return luaL_argerror(L, i, "Only support light C function");
 			default:
+				lua_close(mL);
 				return luaL_argerror(L, i, "Type invalid");
 			}
 		}
 	}
-	int ok = lua_pcall(mL, top, 1, 0);
+	int ok = lua_pcall(mL, lua_gettop(mL) - 1, 1, 0);
 	if (ok != LUA_OK) {
 		lua_pushstring(L, lua_tostring(mL, -1));
 		lua_close(mL);
 		lua_error(L);
 	}
-	return box_state(L, mL);
+	return box_state(L, mL, fold ? 0 : base);
+}
+
+static int
+matrix_from_file(lua_State *L) {
+	return new_matrix(L, load_matrixfile, 0, 1);
+}
+
+// new matrix = base matrix + patch, unchanged subtables are shared with the base
+static int
+matrix_patch(lua_State *L) {
+	struct state_ud *ud = (struct state_ud *)luaL_checkudata(L, 1, "BOXMATRIXSTATE");
+	if (ud->L == NULL) {
+		return luaL_error(L, "Base matrix is closed");
+	}
+	return new_matrix(L, load_matrixpatch, 1, 2);
 }
 
 LUAMOD_API int
@@ -247,6 +482,7 @@ luaopen_sharetable_core(lua_State *L) {
 		{ "clone", clone_table },
 		{ "stackvalues", lco_stackvalues }, 
 		{ "matrix", matrix_from_file },
+		{ "patch", matrix_patch },
 		{ "is_sharedtable", lis_sharedtable },
 		{ NULL, NULL },
 	};